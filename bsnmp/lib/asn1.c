@@ -104,9 +104,8 @@ asn_get_header(struct asn_buf *b, u_char *type, asn_len_t *len)
 }
 
 /*
- * Write a length field (restricted to values < 2^32-1) and return the
- * number of bytes this field takes. If ptr is NULL, the length is computed
- * but nothing is written. If the length would be too large return 0.
+ * Write a length field and return the number of bytes this field takes.
+ * If ptr is NULL, the length is computed but nothing is written.
  */
 static u_int
 asn_put_len(u_char *ptr, asn_len_t len)
@@ -114,11 +113,6 @@ asn_put_len(u_char *ptr, asn_len_t len)
 	u_int lenlen, lenlen1;
 	asn_len_t tmp;
 
-	if (len > ASN_MAXLEN) {
-		asn_error(NULL, "encoding length too long: (%u)", len);
-		return (0);
-	}
-
 	if (len <= 127) {
 		if (ptr)
 			*ptr++ = (u_char)len;
@@ -143,7 +137,7 @@ asn_put_len(u_char *ptr, asn_len_t len)
 /*
  * Write a header (tag and length fields).
  * Tags are restricted to one byte tags (value <= 0x30) and the
- * lenght field to 16-bit. All errors stop the encoding.
+ * lenght field to 32-bit. All errors stop the encoding.
  */
 enum asn_err
 asn_put_header(struct asn_buf *b, u_char type, asn_len_t len)
@@ -163,8 +157,7 @@ asn_put_header(struct asn_buf *b, u_char type, asn_len_t len)
 	b->asn_len--;
 
 	/* length field */
-	if ((lenlen = asn_put_len(NULL, len)) == 0)
-		return (ASN_ERR_FAILED);
+	lenlen = asn_put_len(NULL, len);
 	if (b->asn_len < lenlen)
 		return (ASN_ERR_EOBUF);
 
@@ -177,48 +170,77 @@ asn_put_header(struct asn_buf *b, u_char type, asn_len_t len)
 
 /*
  * This constructs a temporary sequence header with space for the maximum
- * length field (three byte). Set the pointer that ptr points to to the
- * start of the encoded header. This is used for a later call to
- * asn_commit_header which will fix-up the length field and move the
- * value if needed. All errors should stop the encoding.
+ * length field the value may need. This is a two byte length field unless
+ * the remaining buffer is larger than 64k, then it is large enough to
+ * describe the whole buffer (up to four bytes). Set the pointer that ptr
+ * points to to the start of the encoded header. This is used for a later
+ * call to asn_commit_header which will fix-up the length field and move
+ * the value if needed. All errors should stop the encoding.
  */
-#define	TEMP_LEN (1 + ASN_MAXLENLEN + 1)
 enum asn_err
 asn_put_temp_header(struct asn_buf *b, u_char type, u_char **ptr)
 {
-	int ret;
+	asn_len_t maxlen;
+
+	if (b->asn_len > ASN_MAXLEN16)
+		maxlen = (b->asn_len > ASN_MAXLEN) ? ASN_MAXLEN : b->asn_len;
+	else
+		maxlen = ASN_MAXLEN16;
 
-	if (b->asn_len < TEMP_LEN)
+	if (b->asn_len < 1 + asn_put_len(NULL, maxlen))
 		return (ASN_ERR_EOBUF);
 	*ptr = b->asn_ptr;
-	if ((ret = asn_put_header(b, type, ASN_MAXLEN)) == ASN_ERR_OK)
-		assert(b->asn_ptr == *ptr + TEMP_LEN);
-	return (ret);
+	return (asn_put_header(b, type, maxlen));
 }
 enum asn_err
 asn_commit_header(struct asn_buf *b, u_char *ptr)
 {
 	asn_len_t len;
-	u_int lenlen, shift;
+	u_int lenlen, shift, templen;
+
+	/* size of the temporary header: tag, length of length, length */
+	templen = 2 + (ptr[1] & 0x7f);
 
 	/* compute length of encoded value without header */
-	len = b->asn_ptr - (ptr + TEMP_LEN);
+	len = b->asn_ptr - (ptr + templen);
 
 	/* insert length. may not fail. */
 	lenlen = asn_put_len(ptr + 1, len);
-	if (lenlen > TEMP_LEN - 1)
+	if (lenlen > templen - 1)
 		return (ASN_ERR_FAILED);
 
-	if (lenlen < TEMP_LEN - 1) {
+	if (lenlen < templen - 1) {
 		/* shift value down */
-		shift = (TEMP_LEN - 1) - lenlen;
-		memmove(ptr + 1 + lenlen, ptr + TEMP_LEN, len);
+		shift = (templen - 1) - lenlen;
+		memmove(ptr + 1 + lenlen, ptr + templen, len);
 		b->asn_ptr -= shift;
 		b->asn_len += shift;
 	}
 	return (ASN_ERR_OK);
 }
-#undef TEMP_LEN
+
+/*
+ * Fix a temporary header without moving the value. The value starts
+ * directly after the temporary header and has the given length. The final
+ * header is written to the end of the space of the temporary header;
+ * return where it starts or NULL if it does not fit.
+ */
+u_char *
+asn_commit_header_at(u_char *ptr, asn_len_t len)
+{
+	u_int lenlen, templen;
+	u_char *hdr;
+
+	templen = 2 + (ptr[1] & 0x7f);
+	lenlen = asn_put_len(NULL, len);
+	if (lenlen > templen - 1)
+		return (NULL);
+
+	hdr = ptr + templen - 1 - lenlen;
+	hdr[0] = ptr[0];
+	(void)asn_put_len(hdr + 1, len);
+	return (hdr);
+}
 
 /*
  * BER integer. This may be used to get a signed 64 bit integer at maximum.
@@ -912,6 +934,63 @@ asn_skip(struct asn_buf *b, asn_len_t len)
 	return (ASN_ERR_OK);
 }
 
+/*
+ * Find the index of the first sub-identifier in which the two arrays
+ * differ looking at most at the first len sub-identifiers. If they are
+ * equal up to len, len is returned. Short OIDs (and the common case of a
+ * difference right at the start) are handled by the plain loop; longer
+ * runs of equal sub-identifiers are skipped two at a time by comparing
+ * 64-bit words.
+ */
+#define	OID_WORD_MIN	4
+
+static __inline u_int
+oid_mismatch(const asn_subid_t *s1, const asn_subid_t *s2, u_int len)
+{
+	uint64_t w1, w2;
+	u_int i;
+
+	if (len < OID_WORD_MIN) {
+		for (i = 0; i < len; i++)
+			if (s1[i] != s2[i])
+				break;
+		return (i);
+	}
+	if (s1[0] != s2[0])
+		return (0);
+
+	for (i = 1; i + 2 <= len; i += 2) {
+		memcpy(&w1, &s1[i], sizeof(w1));
+		memcpy(&w2, &s2[i], sizeof(w2));
+		if (w1 != w2)
+			break;
+	}
+	for (; i < len; i++)
+		if (s1[i] != s2[i])
+			break;
+	return (i);
+}
+
+/*
+ * Compare two sub-identifier arrays.
+ */
+static int
+oid_compare(const asn_subid_t *s1, u_int len1, const asn_subid_t *s2,
+    u_int len2)
+{
+	u_int len, i;
+
+	len = (len1 < len2) ? len1 : len2;
+	if ((i = oid_mismatch(s1, s2, len)) < len)
+		return (s1[i] < s2[i] ? -1 : +1);
+
+	if (len1 < len2)
+		return (-1);
+	if (len1 > len2)
+		return (+1);
+	return (0);
+}
+
 /*
  * Compare two OIDs.
  *
@@ -922,33 +1001,78 @@ asn_skip(struct asn_buf *b, asn_len_t len)
 int
 asn_compare_oid(const struct asn_oid *o1, const struct asn_oid *o2)
 {
-	u_long i;
+	return (oid_compare(o1->subs, o1->len, o2->subs, o2->len));
+}
+
+/*
+ * Check whether an OID is a sub-string of another OID.
+ */
+int
+asn_is_suboid(const struct asn_oid *o1, const struct asn_oid *o2)
+{
+	if (o1->len > o2->len)
+		return (0);
+	return (oid_mismatch(o1->subs, o2->subs, o1->len) == o1->len);
+}
+
+/*
+ * Store an OID into a compact OID. The compact OID must either be
+ * all zeroes or hold a previous value. Returns -1 if the memory for
+ * a long OID cannot be allocated; the compact OID is empty then.
+ */
+int
+asn_coid_set(struct asn_coid *c, const struct asn_oid *oid)
+{
+	asn_subid_t *ext;
 
-	for (i = 0; i < o1->len && i < o2->len; i++) {
-		if (o1->subs[i] < o2->subs[i])
-			return (-1);
-		if (o1->subs[i] > o2->subs[i])
-			return (+1);
+	if (oid->len <= ASN_COIDINLINE) {
+		asn_coid_free(c);
+		memcpy(c->c_u.inl, oid->subs, oid->len * sizeof(oid->subs[0]));
+		c->len = oid->len;
+		return (0);
 	}
-	if (o1->len < o2->len)
+	if (c->len > ASN_COIDINLINE)
+		ext = realloc(c->c_u.ext, oid->len * sizeof(oid->subs[0]));
+	else
+		ext = malloc(oid->len * sizeof(oid->subs[0]));
+	if (ext == NULL) {
+		asn_coid_free(c);
 		return (-1);
-	if (o1->len > o2->len)
-		return (+1);
+	}
+	memcpy(ext, oid->subs, oid->len * sizeof(oid->subs[0]));
+	c->c_u.ext = ext;
+	c->len = oid->len;
 	return (0);
 }
 
 /*
- * Check whether an OID is a sub-string of another OID.
+ * Retrieve the OID from a compact OID.
  */
-int
-asn_is_suboid(const struct asn_oid *o1, const struct asn_oid *o2)
+void
+asn_coid_get(struct asn_oid *oid, const struct asn_coid *c)
 {
-	u_long i;
+	oid->len = c->len;
+	memcpy(oid->subs, asn_coid_subs(c), c->len * sizeof(oid->subs[0]));
+}
 
-	for (i = 0; i < o1->len; i++)
-		if (i >= o2->len || o1->subs[i] != o2->subs[i])
-			return (0);
-	return (1);
+/*
+ * Free the memory of a long compact OID. The OID is empty afterwards.
+ */
+void
+asn_coid_free(struct asn_coid *c)
+{
+	if (c->len > ASN_COIDINLINE)
+		free(c->c_u.ext);
+	c->len = 0;
+}
+
+/*
+ * Compare a compact OID to an OID. The result is as for asn_compare_oid.
+ */
+int
+asn_compare_coid(const struct asn_coid *c, const struct asn_oid *oid)
+{
+	return (oid_compare(asn_coid_subs(c), c->len, oid->subs, oid->len));
 }
 
 /*
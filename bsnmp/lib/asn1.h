@@ -64,6 +64,23 @@ struct asn_oid {
 	asn_subid_t subs[ASN_MAXOIDLEN];
 };
 
+/*
+ * Compact OID. OIDs of up to ASN_COIDINLINE sub-identifiers are stored
+ * in the structure itself, longer ones in a malloc'ed array. Use this
+ * for OIDs that are kept in large numbers (table indexes, mappings).
+ */
+#define ASN_COIDINLINE	14
+
+struct asn_coid {
+	u_int	len;
+	union {
+		asn_subid_t	inl[ASN_COIDINLINE];
+		asn_subid_t	*ext;
+	}	c_u;
+};
+#define asn_coid_subs(C)	\
+	((C)->len > ASN_COIDINLINE ? (C)->c_u.ext : (C)->c_u.inl)
+
 enum asn_err {
 	/* conversion was ok */
 	ASN_ERR_OK	= 0,
@@ -80,13 +97,16 @@ enum asn_err {
 };
 #define ASN_ERR_STOPPED(E) (((E) & 0x1000) != 0)
 
-/* type for the length field of encoded values. The length is restricted
- * to 65535, but using uint16_t would give conversion warnings on gcc */
-typedef uint32_t asn_len_t;	/* could be also uint16_t */
+/* type for the length field of encoded values. Lengths up to 65535 are
+ * enough for datagram transports, stream transports may use more. */
+typedef uint32_t asn_len_t;
 
 /* maximal length of a long length field without the length of the length */
-#define ASN_MAXLEN	65535
-#define ASN_MAXLENLEN	2	/* number of bytes in a length */
+#define ASN_MAXLEN	0xffffffffU
+#define ASN_MAXLENLEN	4	/* number of bytes in a length */
+
+/* maximal length for which the encoder reserves a two byte length field */
+#define ASN_MAXLEN16	65535
 
 /* maximum size of an octet string as per SMIv2 */
 #define ASN_MAXOCTETSTRING 65535
@@ -98,6 +118,7 @@ enum asn_err asn_put_header(struct asn_buf *, u_char, asn_len_t);
 
 enum asn_err asn_put_temp_header(struct asn_buf *, u_char, u_char **);
 enum asn_err asn_commit_header(struct asn_buf *, u_char *);
+u_char *asn_commit_header_at(u_char *, asn_len_t);
 
 enum asn_err asn_get_integer_raw(struct asn_buf *, asn_len_t, int32_t *);
 enum asn_err asn_get_integer(struct asn_buf *, int32_t *);
@@ -149,6 +170,14 @@ int asn_compare_oid(const struct asn_oid *, const struct asn_oid *);
 /* check whether the first is a suboid of the second one */
 int asn_is_suboid(const struct asn_oid *, const struct asn_oid *);
 
+/* convert between compact and normal OIDs */
+int asn_coid_set(struct asn_coid *, const struct asn_oid *);
+void asn_coid_get(struct asn_oid *, const struct asn_coid *);
+void asn_coid_free(struct asn_coid *);
+
+/* compare a compact OID with an OID */
+int asn_compare_coid(const struct asn_coid *, const struct asn_oid *);
+
 /* format an OID into a user buffer of size ASN_OIDSTRLEN */
 char *asn_oid2str_r(const struct asn_oid *, char *);
 
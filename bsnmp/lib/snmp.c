@@ -60,9 +60,10 @@ void (*snmp_printf)(const char *, ...) = snmp_printf_func;
 /*
  * Get the next variable binding from the list.
  * ASN errors on the sequence or the OID are always fatal.
+ * If novalue is set, the value is skipped and the binding gets NULL syntax.
  */
 static enum asn_err
-get_var_binding(struct asn_buf *b, struct snmp_value *binding)
+get_var_binding(struct asn_buf *b, struct snmp_value *binding, int novalue)
 {
 	u_char type;
 	asn_len_t len, trailer;
@@ -88,6 +89,16 @@ get_var_binding(struct asn_buf *b, struct snmp_value *binding)
 		return (ASN_ERR_FAILED);
 	}
 
+	if (novalue) {
+		binding->syntax = SNMP_SYNTAX_NULL;
+		if ((err = asn_skip(b, len)) != ASN_ERR_OK) {
+			snmp_error("cannot parse binding value");
+			return (err);
+		}
+		b->asn_len = trailer;
+		return (ASN_ERR_OK);
+	}
+
 	switch (type) {
 
 	  case ASN_TYPE_NULL:
@@ -108,6 +119,7 @@ get_var_binding(struct asn_buf *b, struct snmp_value *binding)
 			return (ASN_ERR_FAILED);
 		}
 		binding->v.octetstring.len = len;
+		binding->v.octetstring.borrowed = 0;
 		err = asn_get_octetstring_raw(b, len,
 		    binding->v.octetstring.octets,
 		    &binding->v.octetstring.len);
@@ -236,16 +248,22 @@ snmp_parse_pdus_hdr(struct asn_buf *b, struct snmp_pdu *pdu, asn_len_t *lenp)
 }
 
 static enum asn_err
-parse_pdus(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
+parse_pdus(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip, u_int flags)
 {
 	asn_len_t len, trailer;
 	struct snmp_value *v;
 	enum asn_err err, err1;
+	int novalue;
 
 	err = snmp_parse_pdus_hdr(b, pdu, &len);
 	if (ASN_ERR_STOPPED(err))
 		return (err);
 
+	/* the values of retrieval requests are ignored anyway */
+	novalue = (flags & SNMP_DECODE_NOVALUES) &&
+	    (pdu->type == SNMP_PDU_GET || pdu->type == SNMP_PDU_GETNEXT ||
+	    pdu->type == SNMP_PDU_GETBULK);
+
 	trailer = b->asn_len - len;
 
 	v = pdu->bindings;
@@ -256,7 +274,7 @@ parse_pdus(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
 			    SNMP_MAX_BINDINGS);
 			return (ASN_ERR_FAILED);
 		}
-		err1 = get_var_binding(b, v);
+		err1 = get_var_binding(b, v, novalue);
 		if (ASN_ERR_STOPPED(err1))
 			return (ASN_ERR_FAILED);
 		if (err1 != ASN_ERR_OK && err == ASN_ERR_OK) {
@@ -356,7 +374,8 @@ snmp_parse_message_hdr(struct asn_buf *b, struct snmp_pdu *pdu, asn_len_t *lenp)
 }
 
 static enum asn_err
-parse_message(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
+parse_message(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip,
+    u_int flags)
 {
 	enum asn_err err;
 	asn_len_t len, trailer;
@@ -368,7 +387,7 @@ parse_message(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
 	trailer = b->asn_len - len;
 	b->asn_len = len;
 
-	err = parse_pdus(b, pdu, ip);
+	err = parse_pdus(b, pdu, ip, flags);
 	if (ASN_ERR_STOPPED(err))
 		return (ASN_ERR_FAILED);
 
@@ -388,6 +407,17 @@ parse_message(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
  */
 enum snmp_code
 snmp_pdu_decode(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
+{
+	return (snmp_pdu_decode_flags(b, pdu, ip, 0));
+}
+
+/*
+ * Decode the PDU as above. With SNMP_DECODE_NOVALUES the values of
+ * GET, GETNEXT and GETBULK PDUs are skipped instead of decoded.
+ */
+enum snmp_code
+snmp_pdu_decode_flags(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip,
+    u_int flags)
 {
 	asn_len_t len;
 
@@ -406,7 +436,7 @@ snmp_pdu_decode(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *ip)
 		b->asn_len = len;
 	}
 
-	switch (parse_message(b, pdu, ip)) {
+	switch (parse_message(b, pdu, ip, flags)) {
 
 	  case ASN_ERR_OK:
 		return (SNMP_CODE_OK);
@@ -493,8 +523,8 @@ snmp_pdu_snoop(const struct asn_buf *b0)
 /*
  * Encode the SNMP PDU without the variable bindings field.
  * We do this the rather uneffective way by
- * moving things around and assuming that the length field will never
- * use more than 2 bytes.
+ * moving things around and reserving space for the largest length field
+ * that fits into the buffer.
  * We need a number of pointers to apply the fixes afterwards.
  */
 enum snmp_code
@@ -812,8 +842,11 @@ snmp_pdu_dump(const struct snmp_pdu *pdu)
 void
 snmp_value_free(struct snmp_value *value)
 {
-	if (value->syntax == SNMP_SYNTAX_OCTETSTRING)
-		free(value->v.octetstring.octets);
+	if (value->syntax == SNMP_SYNTAX_OCTETSTRING) {
+		if (!value->v.octetstring.borrowed)
+			free(value->v.octetstring.octets);
+		value->v.octetstring.borrowed = 0;
+	}
 	value->syntax = SNMP_SYNTAX_NULL;
 }
 
@@ -824,6 +857,7 @@ snmp_value_copy(struct snmp_value *to, const struct snmp_value *from)
 	to->syntax = from->syntax;
 
 	if (from->syntax == SNMP_SYNTAX_OCTETSTRING) {
+		to->v.octetstring.borrowed = 0;
 		if ((to->v.octetstring.len = from->v.octetstring.len) == 0)
 			to->v.octetstring.octets = NULL;
 		else {
@@ -985,6 +1019,7 @@ snmp_value_parse(const char *str, enum snmp_syntax syntax, union snmp_values *v)
 		}
 		v->octetstring.octets = octs;
 		v->octetstring.len = len;
+		v->octetstring.borrowed = 0;
 		return (0);
 # undef STUFFC
 	    }
@@ -67,6 +67,7 @@ struct snmp_value {
 	  struct {
 	    u_int		len;
 	    u_char		*octets;
+	    u_int		borrowed;	/* octets not owned */
 	  }			octetstring;
 	  struct asn_oid	oid;
 	  u_char		ipaddress[4];
@@ -160,8 +161,13 @@ void snmp_value_free(struct snmp_value *);
 int snmp_value_parse(const char *, enum snmp_syntax, union snmp_values *);
 int snmp_value_copy(struct snmp_value *, const struct snmp_value *);
 
+/* flags for snmp_pdu_decode_flags */
+#define SNMP_DECODE_NOVALUES	0x0001	/* skip values of retrieval PDUs */
+
 void snmp_pdu_free(struct snmp_pdu *);
 enum snmp_code snmp_pdu_decode(struct asn_buf *b, struct snmp_pdu *pdu, int32_t *);
+enum snmp_code snmp_pdu_decode_flags(struct asn_buf *b, struct snmp_pdu *pdu,
+    int32_t *, u_int);
 enum snmp_code snmp_pdu_encode(struct snmp_pdu *pdu, struct asn_buf *resp_b);
 
 int snmp_pdu_snoop(const struct asn_buf *);
@@ -32,6 +32,7 @@
  */
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -87,9 +88,22 @@ struct context {
 
 #define	TR(W)	(snmp_trace & SNMP_TRACE_##W)
 u_int snmp_trace = 0;
+int snmp_resp_iov = 0;
 
 static char oidbuf[ASN_OIDSTRLEN];
 
+/*
+ * Fix the lengths of an encoded response, unless the caller wants to do
+ * this with snmp_fix_encoding_iov().
+ */
+static enum snmp_code
+resp_fix_encoding(struct asn_buf *b, const struct snmp_pdu *resp)
+{
+	if (snmp_resp_iov)
+		return (SNMP_CODE_OK);
+	return (snmp_fix_encoding(b, resp));
+}
+
 /*
  * Allocate a context
  */
@@ -169,7 +183,10 @@ find_subnode(const struct snmp_value *value)
 /*
  * Execute a GET operation. The tree is rooted at the global 'root'.
  * Build the response PDU on the fly. If the return code is SNMP_RET_ERR
- * the pdu error status and index will be set.
+ * the pdu error status and index will be set. If some operations have
+ * started an asynchronous fetch, all other bindings are still executed
+ * and SNMP_RET_PENDING is returned. The error status and index are then
+ * set to a genErr for the first pending binding.
  */
 enum snmp_ret
 snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
@@ -181,6 +198,7 @@ snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 	enum snmp_syntax except;
 	struct context context;
 	enum asn_err err;
+	u_int pending = 0;
 
 	memset(&context, 0, sizeof(context));
 	context.ctx.data = data;
@@ -230,6 +248,10 @@ snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 					snmp_debug("get: exception noSuchInstance");
 				resp->bindings[i].syntax = SNMP_SYNTAX_NOSUCHINSTANCE;
 
+			} else if (ret == SNMP_ERR_PENDING) {
+				if (pending++ == 0)
+					pdu->error_index = i + 1;
+
 			} else if (ret != SNMP_ERR_NOERROR) {
 				pdu->error_status = SNMP_ERR_GENERR;
 				pdu->error_index = i + 1;
@@ -239,6 +261,10 @@ snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 		}
 		resp->nbindings++;
 
+		/* the response is built again when the fetches are done */
+		if (pending)
+			continue;
+
 		err = snmp_binding_encode(resp_b, &resp->bindings[i]);
 
 		if (err == ASN_ERR_EOBUF) {
@@ -257,7 +283,15 @@ snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 		}
 	}
 
-	return (snmp_fix_encoding(resp_b, resp));
+	if (pending) {
+		if (TR(GET))
+			snmp_debug("get: %u bindings pending", pending);
+		pdu->error_status = SNMP_ERR_GENERR;
+		snmp_pdu_free(resp);
+		return (SNMP_RET_PENDING);
+	}
+
+	return (resp_fix_encoding(resp_b, resp));
 }
 
 static struct snmp_node *
@@ -361,6 +395,10 @@ do_getnext(struct context *context, const struct snmp_value *inb,
 		}
 		outb->syntax = SNMP_SYNTAX_ENDOFMIBVIEW;
 
+	} else if (ret == SNMP_ERR_PENDING) {
+		pdu->error_status = SNMP_ERR_GENERR;
+		return (SNMP_RET_PENDING);
+
 	} else if (ret != SNMP_ERR_NOERROR) {
 		pdu->error_status = SNMP_ERR_GENERR;
 		return (SNMP_RET_ERR);
@@ -371,7 +409,7 @@ do_getnext(struct context *context, const struct snmp_value *inb,
 
 /*
  * Execute a GETNEXT operation. The tree is rooted at the global 'root'.
- * Build the response PDU on the fly. The return is:
+ * Build the response PDU on the fly. The return is as for snmp_get().
  */
 enum snmp_ret
 snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
@@ -381,6 +419,7 @@ snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 	u_int i;
 	enum asn_err err;
 	enum snmp_ret result;
+	u_int pending = 0;
 
 	memset(&context, 0, sizeof(context));
 	context.ctx.data = data;
@@ -398,6 +437,12 @@ snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 		result = do_getnext(&context, &pdu->bindings[i],
 		    &resp->bindings[i], pdu);
 
+		if (result == SNMP_RET_PENDING) {
+			if (pending++ == 0)
+				pdu->error_index = i + 1;
+			resp->nbindings++;
+			continue;
+		}
 		if (result != SNMP_RET_OK) {
 			pdu->error_index = i + 1;
 			snmp_pdu_free(resp);
@@ -406,6 +451,9 @@ snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 
 		resp->nbindings++;
 
+		if (pending)
+			continue;
+
 		err = snmp_binding_encode(resp_b, &resp->bindings[i]);
 
 		if (err == ASN_ERR_EOBUF) {
@@ -423,9 +471,22 @@ snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 			return (SNMP_RET_ERR);
 		}
 	}
-	return (snmp_fix_encoding(resp_b, resp));
+
+	if (pending) {
+		if (TR(GETNEXT))
+			snmp_debug("getnext: %u bindings pending", pending);
+		pdu->error_status = SNMP_ERR_GENERR;
+		snmp_pdu_free(resp);
+		return (SNMP_RET_PENDING);
+	}
+	return (resp_fix_encoding(resp_b, resp));
 }
 
+/*
+ * Execute a GETBULK operation. Because the repetitions depend on the
+ * results of the previous ones, the operation stops at the first
+ * binding that is pending.
+ */
 enum snmp_ret
 snmp_getbulk(struct snmp_pdu *pdu, struct asn_buf *resp_b,
     struct snmp_pdu *resp, void *data)
@@ -527,7 +588,7 @@ snmp_getbulk(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 	}
 
   done:
-	return (snmp_fix_encoding(resp_b, resp));
+	return (resp_fix_encoding(resp_b, resp));
 }
 
 /*
@@ -767,6 +828,10 @@ snmp_set(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 		if (TR(SET))
 			snmp_debug("set: action %s returns %d", np->name, ret);
 
+		/* a SET cannot wait for a fetch */
+		if (ret == SNMP_ERR_PENDING)
+			ret = SNMP_ERR_GENERR;
+
 		if (pdu->version == SNMP_V1) {
 			switch (ret) {
 			  case SNMP_ERR_NO_ACCESS:
@@ -874,7 +939,7 @@ snmp_set(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 			    asn_oid2str_r(&b->var, oidbuf), i);
 	}
 
-	if (snmp_fix_encoding(resp_b, resp) != SNMP_CODE_OK) {
+	if (resp_fix_encoding(resp_b, resp) != SNMP_CODE_OK) {
 		snmp_error("set: fix_encoding failed");
 		snmp_pdu_free(resp);
 		context.ctx.code = SNMP_RET_IGN;
@@ -996,6 +1061,45 @@ snmp_make_errresp(const struct snmp_pdu *pdu, struct asn_buf *pdu_b,
 	return (SNMP_RET_OK);
 }
 
+/*
+ * Fix the lengths of a response that was encoded with snmp_resp_iov set
+ * without moving the bindings. Each length is written directly in front
+ * of its value, so that the message consists of three fragments: the
+ * outer header with version and community, the PDU header and the
+ * bindings. These are returned in iov.
+ */
+enum snmp_code
+snmp_fix_encoding_iov(struct asn_buf *b, const struct snmp_pdu *resp,
+    struct iovec *iov)
+{
+	u_char *outer, *hdr, *vars;
+	size_t ofix, pfix, vlen;
+
+#define	TEMPLEN(P)	(2 + ((P)[1] & 0x7f))
+	/* octets between each temporary header and the next one */
+	ofix = resp->pdu_ptr - (resp->outer_ptr + TEMPLEN(resp->outer_ptr));
+	pfix = resp->vars_ptr - (resp->pdu_ptr + TEMPLEN(resp->pdu_ptr));
+	vlen = b->asn_ptr - (resp->vars_ptr + TEMPLEN(resp->vars_ptr));
+#undef TEMPLEN
+
+	if ((vars = asn_commit_header_at(resp->vars_ptr, vlen)) == NULL)
+		return (SNMP_CODE_FAILED);
+	vlen = b->asn_ptr - vars;
+	if ((hdr = asn_commit_header_at(resp->pdu_ptr, pfix + vlen)) == NULL)
+		return (SNMP_CODE_FAILED);
+	if ((outer = asn_commit_header_at(resp->outer_ptr,
+	    ofix + (resp->vars_ptr - hdr) + vlen)) == NULL)
+		return (SNMP_CODE_FAILED);
+
+	iov[0].iov_base = outer;
+	iov[0].iov_len = resp->pdu_ptr - outer;
+	iov[1].iov_base = hdr;
+	iov[1].iov_len = resp->vars_ptr - hdr;
+	iov[2].iov_base = vars;
+	iov[2].iov_len = vlen;
+	return (SNMP_CODE_OK);
+}
+
 static void
 snmp_debug_func(const char *fmt, ...)
 {
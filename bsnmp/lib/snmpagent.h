@@ -38,6 +38,7 @@ extern "C" {
 #endif
 
 struct snmp_dependency;
+struct iovec;
 
 enum snmp_ret {
 	/* OK, generate a response */
@@ -45,7 +46,9 @@ enum snmp_ret {
 	/* Error, ignore packet (no response) */
 	SNMP_RET_IGN	= 1,
 	/* Error, generate response from original packet */
-	SNMP_RET_ERR	= 2
+	SNMP_RET_ERR	= 2,
+	/* Some bindings wait for an asynchronous fetch */
+	SNMP_RET_PENDING = 3
 };
 
 /* Semi-Opaque object for SET operations */
@@ -97,6 +100,12 @@ enum snmp_op {
 typedef int (*snmp_op_t)(struct snmp_context *, struct snmp_value *,
     u_int, u_int, enum snmp_op);
 
+/*
+ * Returned by a GET or GETNEXT operation that has started an
+ * asynchronous fetch of the value. This is not an SNMP error code.
+ */
+#define SNMP_ERR_PENDING	(-2)
+
 struct snmp_node {
 	struct asn_oid oid;
 	const char	*name;		/* name of the leaf */
@@ -126,6 +135,12 @@ extern u_int snmp_trace;
 /* called to write the trace */
 extern void (*snmp_debug)(const char *fmt, ...);
 
+/* leave the lengths of responses to snmp_fix_encoding_iov() */
+extern int snmp_resp_iov;
+
+/* number of fragments of a response from snmp_fix_encoding_iov() */
+#define	SNMP_RESP_IOV	3
+
 enum snmp_ret snmp_get(struct snmp_pdu *pdu, struct asn_buf *resp_b,
     struct snmp_pdu *resp, void *);
 enum snmp_ret snmp_getnext(struct snmp_pdu *pdu, struct asn_buf *resp_b,
@@ -137,6 +152,8 @@ enum snmp_ret snmp_set(struct snmp_pdu *pdu, struct asn_buf *resp_b,
 
 enum snmp_ret snmp_make_errresp(const struct snmp_pdu *, struct asn_buf *,
     struct asn_buf *);
+enum snmp_code snmp_fix_encoding_iov(struct asn_buf *,
+    const struct snmp_pdu *, struct iovec *);
 
 struct snmp_dependency *snmp_dep_lookup(struct snmp_context *,
     const struct asn_oid *, const struct asn_oid *, size_t, snmp_depop_t);
@@ -35,14 +35,18 @@
  * Support functions for SNMP clients.
  */
 #include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #if defined(HAVE_STDINT_H)
 #include <stdint.h>
 #elif defined(HAVE_INTTYPES_H)
@@ -58,6 +62,7 @@
 #include "snmp.h"
 #include "snmpclient.h"
 #include "snmppriv.h"
+#include "snmpshm.h"
 
 /* List of all outstanding requests */
 struct sent_pdu {
@@ -928,7 +933,10 @@ open_client_udp(struct snmp_client *client, const char *host, const char *port)
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_flags = AI_CANONNAME;
 	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_DGRAM;
+	if (client->trans == SNMP_TRANS_TCP)
+		hints.ai_socktype = SOCK_STREAM;
+	else
+		hints.ai_socktype = SOCK_DGRAM;
 	hints.ai_protocol = 0;
 	error = getaddrinfo(client->chost, client->cport, &hints, &res0);
 	if (error != 0) {
@@ -949,6 +957,8 @@ open_client_udp(struct snmp_client *client, const char *host, const char *port)
 			}
 		} else if (connect(client->fd, (struct sockaddr *)addr, /* res->ai_addr, */
 		    res->ai_addrlen) == -1) {
+			(void)close(client->fd);
+			client->fd = -1;
 			if ((res = res->ai_next) == NULL) {
 				seterr(client, "%s", strerror(errno));
 				freeaddrinfo(res0);
@@ -1058,6 +1068,206 @@ open_client_local(struct snmp_client *client, const char *path)
 	return (0);
 }
 
+/*
+ * Receive the shared memory descriptor from the agent and map the rings.
+ * The socket is used only for wakeups after this.
+ */
+static int
+open_client_shm(struct snmp_client *client)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *hdr;
+	union {
+		struct cmsghdr	hdr;
+		u_char		buf[CMSG_SPACE(sizeof(int))];
+	} cmsg;
+	u_char byte;
+	void *ptr;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &cmsg;
+	msg.msg_controllen = sizeof(cmsg);
+
+	if (recvmsg(client->fd, &msg, 0) != 1 ||
+	    (hdr = CMSG_FIRSTHDR(&msg)) == NULL ||
+	    hdr->cmsg_level != SOL_SOCKET || hdr->cmsg_type != SCM_RIGHTS ||
+	    hdr->cmsg_len != CMSG_LEN(sizeof(int))) {
+		seterr(client, "no shared memory from agent");
+		return (-1);
+	}
+	memcpy(&fd, CMSG_DATA(hdr), sizeof(fd));
+
+	ptr = mmap(NULL, sizeof(struct snmp_shm), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (ptr == MAP_FAILED) {
+		seterr(client, "mmap: %s", strerror(errno));
+		return (-1);
+	}
+	client->shm = ptr;
+	return (0);
+}
+
+/*
+ * Put a request into the shared memory ring. Wake up the agent if it
+ * sleeps; if it is still busy with earlier requests it finds this one
+ * by itself.
+ */
+static ssize_t
+send_shm(struct snmp_client *client, const u_char *buf, size_t len)
+{
+	if (snmp_shm_put(&client->shm->req, buf, len) == -1) {
+		errno = ENOBUFS;
+		return (-1);
+	}
+	if (snmp_shm_notify(&client->shm->req) &&
+	    send(client->fd, "", 1, 0) == -1)
+		return (-1);
+	return ((ssize_t)len);
+}
+
+/*
+ * Get the next response from the shared memory ring. If there is none
+ * poll the ring for SNMP_SHM_SPIN microseconds (unless spin is 0) and
+ * then wait for the agent to wake us up. Timeouts and polling are
+ * handled by the socket options of the caller.
+ */
+static ssize_t
+recv_shm(struct snmp_client *client, u_char *buf, size_t buflen, int spin)
+{
+	struct snmp_shm_ring *r = &client->shm->resp;
+	struct timespec start, now;
+	u_char bell[64];
+	ssize_t ret;
+	int asleep = 0;
+
+	if (spin)
+		(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		if ((ret = snmp_shm_get(r, buf, buflen)) != 0) {
+			if (asleep)
+				snmp_shm_awake(r);
+			if (ret == -1) {
+				errno = EMSGSIZE;
+				return (-1);
+			}
+			/* the agent may wait for space for more responses */
+			if (snmp_shm_wakeup(r))
+				(void)send(client->fd, "", 1, 0);
+			return (ret);
+		}
+		if (asleep) {
+			if ((ret = recv(client->fd, bell, sizeof(bell), 0)) <= 0)
+				return (ret);
+			/* the agent has cleared the flag */
+			asleep = 0;
+			spin = 0;
+			continue;
+		}
+		if (spin) {
+			(void)clock_gettime(CLOCK_MONOTONIC, &now);
+			if ((now.tv_sec - start.tv_sec) * 1000000 +
+			    (now.tv_nsec - start.tv_nsec) / 1000 < SNMP_SHM_SPIN)
+				continue;
+			spin = 0;
+		}
+		/* look once more after setting the flag */
+		snmp_shm_sleep(r);
+		asleep = 1;
+	}
+}
+
+/*
+ * Read exactly len bytes from a stream socket. This is used for the rest
+ * of a message after its first byte has been received, so it waits even
+ * if the socket is non-blocking or has a receive timeout. Giving up here
+ * leaves the stream out of sync, so the timeout is reported as ETIMEDOUT.
+ */
+static int
+recv_exact(struct snmp_client *client, u_char *buf, size_t len)
+{
+	struct pollfd pfd;
+	ssize_t ret;
+	int ms;
+
+	ms = client->timeout.tv_sec * 1000 + client->timeout.tv_usec / 1000;
+	while (len > 0) {
+		if ((ret = recv(client->fd, buf, len, 0)) > 0) {
+			buf += ret;
+			len -= ret;
+			continue;
+		}
+		if (ret == 0) {
+			errno = EPIPE;
+			return (-1);
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return (-1);
+		pfd.fd = client->fd;
+		pfd.events = POLLIN;
+		if ((ret = poll(&pfd, 1, ms)) == 0) {
+			errno = ETIMEDOUT;
+			return (-1);
+		}
+		if (ret == -1 && errno != EINTR)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Receive the next message from a stream socket (local stream or TCP).
+ * The stream may contain several responses, so read exactly one message
+ * as given by the length in its header. Timeouts and polling apply only
+ * to the first byte.
+ */
+static ssize_t
+recv_stream(struct snmp_client *client, u_char *buf, size_t buflen)
+{
+	ssize_t ret;
+	size_t hdr, len;
+	u_int i;
+
+	if ((ret = recv(client->fd, buf, 1, 0)) <= 0)
+		return (ret);
+	if (buf[0] != (ASN_TYPE_SEQUENCE | ASN_TYPE_CONSTRUCTED)) {
+		errno = EPROTO;
+		return (-1);
+	}
+	if (recv_exact(client, buf + 1, 1) == -1)
+		return (-1);
+	if (buf[1] & 0x80) {
+		hdr = 2 + (buf[1] & 0x7f);
+		if (hdr == 2 || hdr > 2 + ASN_MAXLENLEN) {
+			errno = EPROTO;
+			return (-1);
+		}
+		if (recv_exact(client, buf + 2, hdr - 2) == -1)
+			return (-1);
+		len = 0;
+		for (i = 2; i < hdr; i++)
+			len = (len << 8) | buf[i];
+	} else {
+		hdr = 2;
+		len = buf[1];
+	}
+	if (len > buflen - hdr) {
+		errno = EMSGSIZE;
+		return (-1);
+	}
+	if (recv_exact(client, buf + hdr, len) == -1)
+		return (-1);
+	return ((ssize_t)(hdr + len));
+}
+
 /*
  * SNMP_OPEN
  */
@@ -1084,6 +1294,7 @@ snmp_open(struct snmp_client *client, const char *host, const char *port, const
 
 	switch (client->trans) {
 	case SNMP_TRANS_UDP:
+	case SNMP_TRANS_TCP:
 		if (open_client_udp(client, host, port))
 			return (-1);
 		break;
@@ -1093,6 +1304,17 @@ snmp_open(struct snmp_client *client, const char *host, const char *port, const
 			return (-1);
 		break;
 
+	case SNMP_TRANS_LOC_SHM:
+		if (open_client_local(client, host))
+			return (-1);
+		if (open_client_shm(client)) {
+			(void)close(client->fd);
+			client->fd = -1;
+			(void)remove(client->local_path);
+			return (-1);
+		}
+		break;
+
 	default:
 		seterr(client, "bad transport mapping");
 		return (-1);
@@ -1183,6 +1405,10 @@ snmp_close(struct snmp_client *client)
 		if (client->local_path[0] != '\0')
 			(void)remove(client->local_path);
 	}
+	if (client->shm != NULL) {
+		(void)munmap(client->shm, sizeof(struct snmp_shm));
+		client->shm = NULL;
+	}
 	while(!LIST_EMPTY(&sent_pdus)){
 		p1 = LIST_FIRST(&sent_pdus);
 		if (p1->timeout_id != NULL)
@@ -1283,7 +1509,11 @@ snmp_send_packet(struct snmp_client *client, struct snmp_pdu * pdu)
 	if (client->dump_pdus)
 		snmp_pdu_dump(pdu);
 
-	if ((ret = send(client->fd, buf, b.asn_ptr - buf, 0)) == -1) {
+	if (client->shm != NULL)
+		ret = send_shm(client, buf, b.asn_ptr - buf);
+	else
+		ret = send(client->fd, buf, b.asn_ptr - buf, 0);
+	if (ret == -1) {
 		seterr(client, "%s", strerror(errno));
 		free(buf);
 		return (-1);
@@ -1312,6 +1542,10 @@ snmp_timeout(struct snmp_client *client, void * listentry_ptr)
 		LIST_REMOVE(listentry, entries);
 		listentry->callback(client, listentry->pdu, NULL, listentry->arg);
 		free(listentry);
+	} else if (client->trans == SNMP_TRANS_TCP) {
+		/* TCP does not lose the request - just wait longer */
+		listentry->timeout_id =
+		    client->timeout_start(client, &client->timeout, snmp_timeout, listentry);
 	} else {
 		/* try again */
 		/* new request with new request ID */
@@ -1435,7 +1669,13 @@ snmp_receive_packet(struct snmp_client *client, struct snmp_pdu *pdu, struct tim
 			}
 		}
 	}
-	ret = recv(client->fd, buf, client->rxbuflen, 0);
+	if (client->shm != NULL)
+		ret = recv_shm(client, buf, client->rxbuflen, !dopoll);
+	else if (client->trans == SNMP_TRANS_TCP ||
+	    client->trans == SNMP_TRANS_LOC_STREAM)
+		ret = recv_stream(client, buf, client->rxbuflen);
+	else
+		ret = recv(client->fd, buf, client->rxbuflen, 0);
 	saved_errno = errno;
 	if (tv != NULL) {
 		if (dopoll) {
@@ -1452,9 +1692,10 @@ snmp_receive_packet(struct snmp_client *client, struct snmp_pdu *pdu, struct tim
 	}
 	if (ret == -1) {
 		free(buf);
-		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)
 			return (0);
 		seterr(client, "recv: %s", strerror(saved_errno));
+		errno = saved_errno;
 		return (-1);
 	}
 	if (ret == 0) {
@@ -1716,10 +1957,13 @@ snmp_dialog(struct snmp_client *client, struct snmp_v1_pdu *req, struct snmp_v1_
 			pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
 	}
 
+	reqid = -1;
 	for (i = 0; i <= client->retries; i++) {
 		(void)gettimeofday(&end, NULL);
 		timeradd(&end, &client->timeout, &end);
-		if ((reqid = snmp_send_packet(client, &pdu)) == -1)
+		/* a TCP connection does not lose requests - send only once */
+		if ((reqid == -1 || client->trans != SNMP_TRANS_TCP) &&
+		    (reqid = snmp_send_packet(client, &pdu)) == -1)
 			return (-1);
 		for (;;) {
 			(void)gettimeofday(&tv, NULL);
@@ -1736,8 +1980,9 @@ snmp_dialog(struct snmp_client *client, struct snmp_v1_pdu *req, struct snmp_v1_
 				/* not for us */
 				(void)snmp_deliver_packet(client, resp);
 			}
-			if (ret < 0 && errno == EPIPE)
-				/* stream closed */
+			if (ret < 0 && (errno == EPIPE ||
+			    client->trans == SNMP_TRANS_TCP))
+				/* stream closed or out of sync */
 				return (-1);
 		}
 	}
@@ -1813,6 +2058,10 @@ snmp_parse_server(struct snmp_client *client, const char *str)
 				client->trans = SNMP_TRANS_LOC_STREAM;
 			else if (p - s == 5 && strncmp(s, "dgram", 5) == 0)
 				client->trans = SNMP_TRANS_LOC_DGRAM;
+			else if (p - s == 3 && strncmp(s, "shm", 3) == 0)
+				client->trans = SNMP_TRANS_LOC_SHM;
+			else if (p - s == 3 && strncmp(s, "tcp", 3) == 0)
+				client->trans = SNMP_TRANS_TCP;
 			else {
 				seterr(client, "unknown SNMP transport '%.*s'",
 				    (int)(p - s), s);
@@ -55,6 +55,10 @@ extern "C" {
 #define	SNMP_TRANS_UDP		0
 #define	SNMP_TRANS_LOC_DGRAM	1
 #define	SNMP_TRANS_LOC_STREAM	2
+#define	SNMP_TRANS_LOC_SHM	3
+#define	SNMP_TRANS_TCP		4
+
+struct snmp_shm;
 
 struct snmp_client;
 
@@ -107,6 +111,8 @@ struct snmp_client {
 	snmp_timeout_stop_f timeout_stop;
 
 	char		local_path[sizeof(SNMP_LOCAL_PATH)];
+
+	struct snmp_shm	*shm;	/* rings of the shared memory transport */
 };
 
 void * snmp_client_malloc(struct snmp_client *client, size_t size);
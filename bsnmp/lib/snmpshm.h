@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Shared memory transport between a local client and the agent.
+ *
+ * The client connects to a UNIX domain stream socket of the agent. The
+ * agent answers with a single byte that carries a descriptor for a
+ * shared memory object holding a struct snmp_shm. Requests are put into
+ * the req ring by the client, responses into the resp ring by the agent.
+ * Each ring has exactly one producer and one consumer.
+ *
+ * A consumer that finds its ring empty may poll it for a while. Before
+ * it goes to sleep on the socket it sets the sleeping flag of the ring
+ * and looks into the ring once more. A producer writes one byte to the
+ * socket after putting messages into the ring only if it finds that
+ * flag set, and clears it. A consumer that keeps up with its producer
+ * therefore costs no system calls on that side. The agent sleeps in its
+ * event loop whenever it has emptied the request ring; a client polls
+ * for SNMP_SHM_SPIN microseconds before it sleeps.
+ *
+ * Messages are stored as a 32-bit length in host byte order followed by
+ * the message, padded to a multiple of 4 bytes. A message never wraps;
+ * if it does not fit at the end of the ring, a SNMP_SHM_PAD length is
+ * stored and the message starts at offset 0. A message is at most
+ * SNMP_SHM_MSGSIZE bytes, so that one always fits into a ring with
+ * SNMP_SHM_RESERVE free bytes.
+ *
+ * A producer that finds the ring too full sets its wait flag. The
+ * consumer clears the flag when it has taken a message out and then
+ * writes one byte to the socket to wake up the producer.
+ */
+#ifndef snmpshm_h_
+#define snmpshm_h_
+
+#define	SNMP_SHM_RINGSIZE	(64 * 1024)	/* must be a power of 2 */
+#define	SNMP_SHM_PAD		0xffffffffU
+#define	SNMP_SHM_MSGSIZE	(SNMP_SHM_RINGSIZE / 4 - 4)
+#define	SNMP_SHM_RESERVE	(SNMP_SHM_RINGSIZE / 2)
+#define	SNMP_SHM_SPIN		200	/* microseconds */
+
+#define	SNMP_SHM_LOAD(P)	__atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define	SNMP_SHM_STORE(P, V)	__atomic_store_n((P), (V), __ATOMIC_RELEASE)
+
+struct snmp_shm_ring {
+	uint32_t	head;		/* written by producer */
+	uint32_t	pad0[15];
+	uint32_t	tail;		/* written by consumer */
+	uint32_t	pad1[15];
+	uint32_t	wait;		/* producer waits for space */
+	uint32_t	pad2[15];
+	uint32_t	sleeping;	/* consumer waits for messages */
+	uint32_t	pad3[15];
+	u_char		data[SNMP_SHM_RINGSIZE];
+};
+
+struct snmp_shm {
+	struct snmp_shm_ring	req;	/* client to agent */
+	struct snmp_shm_ring	resp;	/* agent to client */
+};
+
+/*
+ * Put a message that is scattered over several buffers into a ring.
+ * Returns -1 if there is no space.
+ */
+static __inline int
+snmp_shm_putv(struct snmp_shm_ring *r, const struct iovec *iov, u_int iovcnt)
+{
+	uint32_t head, tail, off, need, pad, plen;
+	size_t len;
+	u_int i;
+
+	for (len = 0, i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len > SNMP_SHM_MSGSIZE)
+		return (-1);
+
+	head = r->head;
+	tail = SNMP_SHM_LOAD(&r->tail);
+	off = head & (SNMP_SHM_RINGSIZE - 1);
+	need = 4 + ((len + 3) & ~3U);
+	pad = (off + need > SNMP_SHM_RINGSIZE) ? SNMP_SHM_RINGSIZE - off : 0;
+
+	if (head - tail + pad + need > SNMP_SHM_RINGSIZE)
+		return (-1);
+
+	if (pad != 0) {
+		plen = SNMP_SHM_PAD;
+		memcpy(&r->data[off], &plen, 4);
+		head += pad;
+		off = 0;
+	}
+	plen = len;
+	memcpy(&r->data[off], &plen, 4);
+	for (off += 4, i = 0; i < iovcnt; off += iov[i].iov_len, i++)
+		memcpy(&r->data[off], iov[i].iov_base, iov[i].iov_len);
+
+	SNMP_SHM_STORE(&r->head, head + need);
+	return (0);
+}
+
+/*
+ * Put a message into a ring. Returns -1 if there is no space.
+ */
+static __inline int
+snmp_shm_put(struct snmp_shm_ring *r, const u_char *buf, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)(uintptr_t)buf;
+	iov.iov_len = len;
+	return (snmp_shm_putv(r, &iov, 1));
+}
+
+/*
+ * Get the next message from a ring. Returns 0 if the ring is empty, -1 if
+ * the ring is corrupt or the message is larger than buflen and the length
+ * of the message otherwise.
+ */
+static __inline ssize_t
+snmp_shm_get(struct snmp_shm_ring *r, u_char *buf, size_t buflen)
+{
+	uint32_t head, tail, off, plen;
+
+	tail = r->tail;
+	head = SNMP_SHM_LOAD(&r->head);
+
+	if (head == tail)
+		return (0);
+	if (head - tail > SNMP_SHM_RINGSIZE || (head - tail) % 4 != 0)
+		return (-1);
+
+	off = tail & (SNMP_SHM_RINGSIZE - 1);
+	memcpy(&plen, &r->data[off], 4);
+	if (plen == SNMP_SHM_PAD) {
+		if (head - tail <= SNMP_SHM_RINGSIZE - off)
+			return (-1);
+		tail += SNMP_SHM_RINGSIZE - off;
+		off = 0;
+		memcpy(&plen, &r->data[off], 4);
+	}
+	if (plen > buflen || plen > SNMP_SHM_RINGSIZE - off - 4 ||
+	    4 + plen > head - tail)
+		return (-1);
+	memcpy(buf, &r->data[off + 4], plen);
+
+	SNMP_SHM_STORE(&r->tail, tail + 4 + ((plen + 3) & ~3U));
+	return ((ssize_t)plen);
+}
+
+/*
+ * Return the number of free bytes in a ring (producer side).
+ */
+static __inline uint32_t
+snmp_shm_space(struct snmp_shm_ring *r)
+{
+	return (SNMP_SHM_RINGSIZE - (r->head - SNMP_SHM_LOAD(&r->tail)));
+}
+
+/*
+ * The producer is going to wait for space. The caller must check the
+ * space again afterwards, because the consumer may have taken all
+ * messages out before it saw the flag.
+ */
+static __inline void
+snmp_shm_wait(struct snmp_shm_ring *r)
+{
+	__atomic_store_n(&r->wait, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Called by the consumer after taking messages out. Returns 1 if the
+ * producer waits and must be woken up.
+ */
+static __inline int
+snmp_shm_wakeup(struct snmp_shm_ring *r)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (SNMP_SHM_LOAD(&r->wait) == 0)
+		return (0);
+	return (__atomic_exchange_n(&r->wait, 0, __ATOMIC_SEQ_CST) != 0);
+}
+
+/*
+ * The consumer is going to sleep on the socket. The caller must check
+ * the ring again afterwards, because the producer may have put a
+ * message in before it saw the flag.
+ */
+static __inline void
+snmp_shm_sleep(struct snmp_shm_ring *r)
+{
+	__atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * The consumer found a message after all and does not sleep.
+ */
+static __inline void
+snmp_shm_awake(struct snmp_shm_ring *r)
+{
+	__atomic_store_n(&r->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Called by the producer after putting messages in. Returns 1 if the
+ * consumer sleeps and must be woken up.
+ */
+static __inline int
+snmp_shm_notify(struct snmp_shm_ring *r)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (SNMP_SHM_LOAD(&r->sleeping) == 0)
+		return (0);
+	return (__atomic_exchange_n(&r->sleeping, 0, __ATOMIC_SEQ_CST) != 0);
+}
+
+#endif
@@ -32,7 +32,9 @@
  */
 #include "mibII.h"
 #include "mibII_oid.h"
+#if !defined(__linux__)
 #include <net/if_types.h>
+#endif
 
 
 /*****************************/
@@ -40,17 +42,15 @@
 /* our module */
 static struct lmodule *module;
 
+#if !defined(__linux__)
 /* routing socket */
 static int route;
 static void *route_fd;
+#endif
 
 /* if-index allocator */
 static uint32_t next_if_index = 1;
 
-/* re-fetch arp table */
-static int update_arp;
-static int in_update_arp;
-
 /* OR registrations */
 static u_int ifmib_reg;
 static u_int ipmib_reg;
@@ -72,15 +72,26 @@ struct mibdynif_list mibdynif_list = SLIST_HEAD_INITIALIZER(mibdynif_list);
 /* list of all interface index mappings */
 struct mibindexmap_list mibindexmap_list = STAILQ_HEAD_INITIALIZER(mibindexmap_list);
 
+/*
+ * Lookup indexes for the interfaces and the index mappings. Routers may
+ * have tens of thousands of interfaces, so the lists are not searched.
+ */
+#define	MIBIF_HASH	1024
+static LIST_HEAD(, mibif_private) mibif_hash_index[MIBIF_HASH];
+static LIST_HEAD(, mibif_private) mibif_hash_sys[MIBIF_HASH];
+static LIST_HEAD(, mibif_private) mibif_hash_name[MIBIF_HASH];
+static LIST_HEAD(, mibindexmap) mibindexmap_hash[MIBIF_HASH];
+
+static RB_HEAD(mibif_tree, mibif_private) mibif_tree =
+    RB_INITIALIZER(&mibif_tree);
+RB_PROTOTYPE(mibif_tree, mibif_private, tlink, mibif_compare);
+
 /* list of all stacking entries */
 struct mibifstack_list mibifstack_list = TAILQ_HEAD_INITIALIZER(mibifstack_list);
 
 /* list of all receive addresses */
 struct mibrcvaddr_list mibrcvaddr_list = TAILQ_HEAD_INITIALIZER(mibrcvaddr_list);
 
-/* list of all NetToMedia entries */
-struct mibarp_list mibarp_list = TAILQ_HEAD_INITIALIZER(mibarp_list);
-
 /* number of interfaces */
 int32_t mib_if_number;
 
@@ -96,9 +107,6 @@ int mib_iflist_bad;
 /* network socket */
 int mib_netsock;
 
-/* last time refreshed */
-uint64_t mibarpticks;
-
 /* info on system clocks */
 struct clockinfo clockinfo;
 
@@ -114,8 +122,10 @@ u_int mibif_force_hc_update_interval;
 /* current update interval */
 u_int mibif_hc_update_interval;
 
+#if !defined(__linux__)
 /* HC update timer handle */
 static void *hc_update_timer;
+#endif
 
 /*****************************/
 
@@ -130,42 +140,98 @@ static const struct asn_oid oid_ifIndex = OIDX_ifIndex;
 
 /*****************************/
 
+/*
+ * Order the interfaces by ifindex
+ */
+static int
+mibif_compare(struct mibif_private *p1, struct mibif_private *p2)
+{
+
+	if (p1->ifp->index < p2->ifp->index)
+		return (-1);
+	if (p1->ifp->index > p2->ifp->index)
+		return (+1);
+	return (0);
+}
+
+RB_GENERATE(mibif_tree, mibif_private, tlink, mibif_compare);
+
+static u_int
+mibif_hash_str(const char *name)
+{
+	u_int h = 0;
+
+	while (*name != '\0')
+		h = h * 31 + (u_char)*name++;
+	return (h % MIBIF_HASH);
+}
+
 /*
  * Find an interface
  */
 struct mibif *
 mib_find_if(u_int idx)
 {
-	struct mibif *ifp;
+	struct mibif_private *p;
 
-	TAILQ_FOREACH(ifp, &mibif_list, link)
-		if (ifp->index == idx)
-			return (ifp);
+	LIST_FOREACH(p, &mibif_hash_index[idx % MIBIF_HASH], ilink)
+		if (p->ifp->index == idx)
+			return (p->ifp);
 	return (NULL);
 }
 
 struct mibif *
 mib_find_if_sys(u_int sysindex)
 {
-	struct mibif *ifp;
+	struct mibif_private *p;
 
-	TAILQ_FOREACH(ifp, &mibif_list, link)
-		if (ifp->sysindex == sysindex)
-			return (ifp);
+	LIST_FOREACH(p, &mibif_hash_sys[sysindex % MIBIF_HASH], slink)
+		if (p->ifp->sysindex == sysindex)
+			return (p->ifp);
 	return (NULL);
 }
 
 struct mibif *
 mib_find_if_name(const char *name)
 {
-	struct mibif *ifp;
+	struct mibif_private *p;
 
-	TAILQ_FOREACH(ifp, &mibif_list, link)
-		if (strcmp(ifp->name, name) == 0)
-			return (ifp);
+	LIST_FOREACH(p, &mibif_hash_name[mibif_hash_str(name)], nlink)
+		if (strcmp(p->ifp->name, name) == 0)
+			return (p->ifp);
 	return (NULL);
 }
 
+/*
+ * Find the interface with the smallest ifindex larger than the one in
+ * the OID. During a walk the index usually exists and this is just the
+ * next one in the list.
+ */
+struct mibif *
+mibif_getnext(const struct asn_oid *oid, u_int sub)
+{
+	struct mibif *ifp;
+	struct mibif_private *p, *best;
+
+	if (oid->len == sub)
+		return (TAILQ_FIRST(&mibif_list));
+
+	if ((ifp = mib_find_if(oid->subs[sub])) != NULL)
+		return (TAILQ_NEXT(ifp, link));
+
+	best = NULL;
+	p = RB_ROOT(&mibif_tree);
+	while (p != NULL) {
+		if (p->ifp->index <= oid->subs[sub])
+			p = RB_RIGHT(p, tlink);
+		else {
+			best = p;
+			p = RB_LEFT(p, tlink);
+		}
+	}
+	return (best == NULL ? NULL : best->ifp);
+}
+
 /*
  * Check whether an interface is dynamic. The argument may include the
  * unit number. This assumes, that the name part does NOT contain digits.
@@ -278,8 +344,8 @@ mib_if_admin(struct mibif *ifp, int up)
 /*
  * Generate a link up/down trap
  */
-static void
-link_trap(struct mibif *ifp, int up)
+void
+mib_link_trap(struct mibif *ifp, int up)
 {
 	struct snmp_value ifindex;
 
@@ -292,6 +358,7 @@ link_trap(struct mibif *ifp, int up)
 	    (struct snmp_value *)NULL);
 }
 
+#if !defined(__linux__)
 /**
  * Fetch the GENERIC IFMIB and update the HC counters
  */
@@ -433,7 +500,7 @@ mib_fetch_ifmib(struct mibif *ifp)
 	    oldmib.ifmd_data.ifi_link_state &&
 	    (ifp->mib.ifmd_data.ifi_link_state == LINK_STATE_DOWN ||
 	    oldmib.ifmd_data.ifi_link_state == LINK_STATE_DOWN))
-		link_trap(ifp, ifp->mib.ifmd_data.ifi_link_state ==
+		mib_link_trap(ifp, ifp->mib.ifmd_data.ifi_link_state ==
 		    LINK_STATE_UP ? 1 : 0);
 
 	ifp->flags &= ~(MIBIF_HIGHSPEED | MIBIF_VERYHIGHSPEED);
@@ -494,6 +561,7 @@ mib_fetch_ifmib(struct mibif *ifp)
 	ifp->mibtick = get_ticks();
 	return (0);
 }
+#endif
 
 /* find first/next address for a given interface */
 struct mibifa *
@@ -522,8 +590,8 @@ mib_next_ififa(struct mibifa *ifa0)
 /*
  * Allocate a new IFA
  */
-static struct mibifa *
-alloc_ifa(u_int ifindex, struct in_addr addr)
+struct mibifa *
+mib_alloc_ifa(u_int ifindex, struct in_addr addr)
 {
 	struct mibifa *ifa;
 	uint32_t ha;
@@ -554,14 +622,15 @@ alloc_ifa(u_int ifindex, struct in_addr addr)
 /*
  * Delete an interface address
  */
-static void
-destroy_ifa(struct mibifa *ifa)
+void
+mib_free_ifa(struct mibifa *ifa)
 {
 	TAILQ_REMOVE(&mibifa_list, ifa, link);
 	free(ifa);
 }
 
 
+#if !defined(__linux__)
 /*
  * Helper routine to extract the sockaddr structures from a routing
  * socket message.
@@ -581,16 +650,18 @@ mib_extract_addrs(int addrs, u_char *info, struct sockaddr **out)
 	}
 }
 
+#endif
+
 /*
  * save the phys address of an interface. Handle receive address entries here.
  */
-static void
-get_physaddr(struct mibif *ifp, struct sockaddr_dl *sdl, u_char *ptr)
+void
+mib_set_physaddr(struct mibif *ifp, const u_char *ptr, u_int alen)
 {
 	u_char *np;
 	struct mibrcvaddr *rcv;
 
-	if (sdl->sdl_alen == 0) {
+	if (alen == 0) {
 		/* no address */
 		if (ifp->physaddrlen != 0) {
 			if ((rcv = mib_find_rcvaddr(ifp->index, ifp->physaddr,
@@ -603,7 +674,7 @@ get_physaddr(struct mibif *ifp, struct sockaddr_dl *sdl, u_char *ptr)
 		return;
 	}
 
-	if (ifp->physaddrlen != sdl->sdl_alen) {
+	if (ifp->physaddrlen != alen) {
 		/* length changed */
 		if (ifp->physaddrlen) {
 			/* delete olf receive address */
@@ -611,14 +682,14 @@ get_physaddr(struct mibif *ifp, struct sockaddr_dl *sdl, u_char *ptr)
 			    ifp->physaddrlen)) != NULL)
 				mib_rcvaddr_delete(rcv);
 		}
-		if ((np = realloc(ifp->physaddr, sdl->sdl_alen)) == NULL) {
+		if ((np = realloc(ifp->physaddr, alen)) == NULL) {
 			free(ifp->physaddr);
 			ifp->physaddr = NULL;
 			ifp->physaddrlen = 0;
 			return;
 		}
 		ifp->physaddr = np;
-		ifp->physaddrlen = sdl->sdl_alen;
+		ifp->physaddrlen = alen;
 
 	} else if (memcmp(ifp->physaddr, ptr, ifp->physaddrlen) == 0) {
 		/* no change */
@@ -643,14 +714,13 @@ get_physaddr(struct mibif *ifp, struct sockaddr_dl *sdl, u_char *ptr)
 /*
  * Free an interface
  */
-static void
+void
 mibif_free(struct mibif *ifp)
 {
 	struct mibif *ifp1;
-	struct mibindexmap *map;
+	struct mibif_private *priv = ifp->private;
 	struct mibifa *ifa, *ifa1;
 	struct mibrcvaddr *rcv, *rcv1;
-	struct mibarp *at, *at1;
 
 	if (ifp->xnotify != NULL)
 		(*ifp->xnotify)(ifp, MIBIF_NOTIFY_DESTROY, ifp->xnotify_data);
@@ -659,14 +729,24 @@ mibif_free(struct mibif *ifp)
 	(void)mib_ifstack_delete(NULL, ifp);
 
 	TAILQ_REMOVE(&mibif_list, ifp, link);
-
-	/* if this was the fastest interface - recompute this */
-	if (ifp->mib.ifmd_data.ifi_baudrate == mibif_maxspeed) {
-		mibif_maxspeed = ifp->mib.ifmd_data.ifi_baudrate;
-		TAILQ_FOREACH(ifp1, &mibif_list, link)
+	RB_REMOVE(mibif_tree, &mibif_tree, priv);
+	LIST_REMOVE(priv, ilink);
+	LIST_REMOVE(priv, slink);
+	LIST_REMOVE(priv, nlink);
+	priv->map->mibif = NULL;
+
+	/* if this was the fastest interface - recompute this. Stop as soon
+	 * as another one with the same speed turns up. */
+	if (ifp->mib.ifmd_data.ifi_baudrate == mibif_maxspeed &&
+	    mibif_maxspeed != 0) {
+		mibif_maxspeed = 0;
+		TAILQ_FOREACH(ifp1, &mibif_list, link) {
 			if (ifp1->mib.ifmd_data.ifi_baudrate > mibif_maxspeed)
 				mibif_maxspeed =
 				    ifp1->mib.ifmd_data.ifi_baudrate;
+			if (mibif_maxspeed == ifp->mib.ifmd_data.ifi_baudrate)
+				break;
+		}
 		mibif_reset_hc_timer();
 	}
 
@@ -676,18 +756,12 @@ mibif_free(struct mibif *ifp)
 	if (ifp->specmib != NULL)
 		free(ifp->specmib);
 
-	STAILQ_FOREACH(map, &mibindexmap_list, link)
-		if (map->mibif == ifp) {
-			map->mibif = NULL;
-			break;
-		}
-
 	/* purge interface addresses */
 	ifa = TAILQ_FIRST(&mibifa_list);
 	while (ifa != NULL) {
 		ifa1 = TAILQ_NEXT(ifa, link);
 		if (ifa->ifindex == ifp->index)
-			destroy_ifa(ifa);
+			mib_free_ifa(ifa);
 		ifa = ifa1;
 	}
 
@@ -701,13 +775,7 @@ mibif_free(struct mibif *ifp)
 	}
 
 	/* purge ARP entries */
-	at = TAILQ_FIRST(&mibarp_list);
-	while (at != NULL) {
-		at1 = TAILQ_NEXT(at, link);
-		if (at->index.subs[0] == ifp->index)
-			mib_arp_delete(at);
-		at = at1;
-	}
+	mib_arp_purge(ifp);
 
 
 	free(ifp);
@@ -718,10 +786,11 @@ mibif_free(struct mibif *ifp)
 /*
  * Create a new interface
  */
-static struct mibif *
+struct mibif *
 mibif_create(u_int sysindex, const char *name)
 {
 	struct mibif *ifp;
+	struct mibif_private *priv, *next;
 	struct mibindexmap *map;
 
 	if ((ifp = malloc(sizeof(*ifp))) == NULL) {
@@ -744,16 +813,17 @@ mibif_create(u_int sysindex, const char *name)
 	map = NULL;
 	if (!mib_if_is_dyn(ifp->name)) {
 		/* non-dynamic. look whether we know the interface */
-		STAILQ_FOREACH(map, &mibindexmap_list, link)
-			if (strcmp(map->name, ifp->name) == 0) {
-				ifp->index = map->ifindex;
-				map->mibif = ifp;
+		LIST_FOREACH(map, &mibindexmap_hash[mibif_hash_str(ifp->name)],
+		    hlink)
+			if (strcmp(map->name, ifp->name) == 0)
 				break;
-			}
 		/* assume it has a connector if it is not dynamic */
 		ifp->has_connector = 1;
 		ifp->trap_enable = 1;
 	}
+	if (map != NULL && map->mibif != NULL)
+		/* the old instance has gone away, but we have not noticed */
+		mibif_free(map->mibif);
 	if (map == NULL) {
 		/* new interface - get new index */
 		if (next_if_index > 0x7fffffff)
@@ -761,22 +831,39 @@ mibif_create(u_int sysindex, const char *name)
 
 		if ((map = malloc(sizeof(*map))) == NULL) {
 			syslog(LOG_ERR, "ifmap: %m");
+			free(ifp->private);
 			free(ifp);
 			return (NULL);
 		}
 		map->ifindex = next_if_index++;
 		map->sysindex = ifp->sysindex;
 		strcpy(map->name, ifp->name);
-		map->mibif = ifp;
 		STAILQ_INSERT_TAIL(&mibindexmap_list, map, link);
+		LIST_INSERT_HEAD(&mibindexmap_hash[mibif_hash_str(map->name)],
+		    map, hlink);
 	} else {
 		/* re-instantiate. Introduce a counter discontinuity */
 		ifp->counter_disc = get_ticks();
 	}
+	map->mibif = ifp;
 	ifp->index = map->ifindex;
 	ifp->mib.ifmd_data.ifi_link_state = LINK_STATE_UNKNOWN;
 
-	INSERT_OBJECT_INT(ifp, &mibif_list);
+	/* link into the indexes and the list, which is ordered by ifindex */
+	priv = ifp->private;
+	priv->ifp = ifp;
+	priv->map = map;
+	LIST_INSERT_HEAD(&mibif_hash_index[ifp->index % MIBIF_HASH], priv,
+	    ilink);
+	LIST_INSERT_HEAD(&mibif_hash_sys[ifp->sysindex % MIBIF_HASH], priv,
+	    slink);
+	LIST_INSERT_HEAD(&mibif_hash_name[mibif_hash_str(ifp->name)], priv,
+	    nlink);
+	RB_INSERT(mibif_tree, &mibif_tree, priv);
+	if ((next = RB_NEXT(mibif_tree, &mibif_tree, priv)) != NULL)
+		TAILQ_INSERT_BEFORE(next->ifp, ifp, link);
+	else
+		TAILQ_INSERT_TAIL(&mibif_list, ifp, link);
 	mib_if_number++;
 	mib_iftable_last_change = this_tick;
 
@@ -790,8 +877,8 @@ mibif_create(u_int sysindex, const char *name)
 /*
  * Inform all interested parties about a new interface
  */
-static void
-notify_newif(struct mibif *ifp)
+void
+mib_notify_newif(struct mibif *ifp)
 {
 	struct newifreg *reg;
 
@@ -805,8 +892,8 @@ notify_newif(struct mibif *ifp)
  * MIB. If this is a broadcast interface try to guess the broadcast address
  * depending on the interface type.
  */
-static void
-check_llbcast(struct mibif *ifp)
+void
+mib_check_llbcast(struct mibif *ifp)
 {
 	static u_char ether_bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 	static u_char arcnet_bcast = 0;
@@ -834,6 +921,7 @@ check_llbcast(struct mibif *ifp)
 }
 
 
+#if !defined(__linux__)
 /*
  * Retrieve the current interface list from the system.
  */
@@ -878,8 +966,8 @@ mib_refresh_iflist(void)
 		if ((ifp = mibif_create(idx, mib.ifmd_name)) != NULL) {
 			ifp->flags |= MIBIF_FOUND;
 			(void)mib_fetch_ifmib(ifp);
-			check_llbcast(ifp);
-			notify_newif(ifp);
+			mib_check_llbcast(ifp);
+			mib_notify_newif(ifp);
 		}
 	}
 
@@ -895,6 +983,8 @@ mib_refresh_iflist(void)
 	}
 }
 
+#endif
+
 /*
  * Find an interface address
  */
@@ -909,8 +999,11 @@ mib_find_ifa(struct in_addr addr)
 	return (NULL);
 }
 
+#if !defined(__linux__)
+
 /*
- * Process a new ARP entry
+ * Process an ARP entry. An entry that is deleted or not resolved (any
+ * more) is removed.
  */
 static void
 process_arp(const struct rt_msghdr *rtm, const struct sockaddr_dl *sdl,
@@ -919,18 +1012,27 @@ process_arp(const struct rt_msghdr *rtm, const struct sockaddr_dl *sdl,
 	struct mibif *ifp;
 	struct mibarp *at;
 
-	/* IP arp table entry */
-	if (sdl->sdl_alen == 0) {
-		update_arp = 1;
-		return;
-	}
 	if ((ifp = mib_find_if_sys(sdl->sdl_index)) == NULL)
 		return;
-	/* have a valid entry */
-	if ((at = mib_find_arp(ifp, sa->sin_addr)) == NULL &&
-	    (at = mib_arp_create(ifp, sa->sin_addr,
-	    sdl->sdl_data + sdl->sdl_nlen, sdl->sdl_alen)) == NULL)
+	at = mib_find_arp(ifp, sa->sin_addr);
+
+	if (rtm->rtm_type == RTM_DELETE || sdl->sdl_alen == 0) {
+		if (at != NULL)
+			mib_arp_delete(at);
 		return;
+	}
+
+	/* have a valid entry */
+	if (at == NULL) {
+		if ((at = mib_arp_create(ifp, sa->sin_addr,
+		    sdl->sdl_data + sdl->sdl_nlen, sdl->sdl_alen)) == NULL)
+			return;
+	} else {
+		/* the hardware address may change */
+		if ((at->physlen = sdl->sdl_alen) > sizeof(at->phys))
+			at->physlen = sizeof(at->phys);
+		memcpy(at->phys, sdl->sdl_data + sdl->sdl_nlen, at->physlen);
+	}
 
 	if (rtm->rtm_rmx.rmx_expire == 0)
 		at->flags |= MIBARP_PERM;
@@ -980,7 +1082,7 @@ handle_rtmsg(struct rt_msghdr *rtm)
 				    "interface %u", ifam->ifam_index);
 				break;
 			}
-		     	if ((ifa = alloc_ifa(ifp->index, sa->sin_addr)) == NULL)
+		     	if ((ifa = mib_alloc_ifa(ifp->index, sa->sin_addr)) == NULL)
 				break;
 		}
 		sa = (struct sockaddr_in *)(void *)addrs[RTAX_NETMASK];
@@ -1003,7 +1105,7 @@ handle_rtmsg(struct rt_msghdr *rtm)
 		if ((ifa = mib_find_ifa(sa->sin_addr)) != NULL) {
 			ifa->flags |= MIBIFA_FOUND;
 			if (!(ifa->flags & MIBIFA_DESTROYED))
-				destroy_ifa(ifa);
+				mib_free_ifa(ifa);
 		}
 		break;
 
@@ -1051,7 +1153,7 @@ handle_rtmsg(struct rt_msghdr *rtm)
 		    addrs[RTAX_IFP]->sa_family == AF_LINK) {
 			sdl = (struct sockaddr_dl *)(void *)addrs[RTAX_IFP];
 			ptr = sdl->sdl_data + sdl->sdl_nlen;
-			get_physaddr(ifp, sdl, ptr);
+			mib_set_physaddr(ifp, ptr, sdl->sdl_alen);
 		}
 		(void)mib_fetch_ifmib(ifp);
 		break;
@@ -1067,8 +1169,8 @@ handle_rtmsg(struct rt_msghdr *rtm)
 			if (ifp == NULL && (ifp = mibif_create(ifan->ifan_index,
 			    ifan->ifan_name)) != NULL) {
 				(void)mib_fetch_ifmib(ifp);
-				check_llbcast(ifp);
-				notify_newif(ifp);
+				mib_check_llbcast(ifp);
+				mib_notify_newif(ifp);
 			}
 			break;
 
@@ -1118,7 +1220,16 @@ handle_rtmsg(struct rt_msghdr *rtm)
 
 	  case RTM_DELETE:
 		mib_extract_addrs(rtm->rtm_addrs, (u_char *)(rtm + 1), addrs);
-		if (rtm->rtm_errno == 0 && !(rtm->rtm_flags & RTF_LLINFO))
+		if (rtm->rtm_flags & RTF_LLINFO) {
+			if (addrs[RTAX_DST] == NULL ||
+			    addrs[RTAX_GATEWAY] == NULL ||
+			    addrs[RTAX_DST]->sa_family != AF_INET ||
+			    addrs[RTAX_GATEWAY]->sa_family != AF_LINK)
+				break;
+			process_arp(rtm,
+			    (struct sockaddr_dl *)(void *)addrs[RTAX_GATEWAY],
+			    (struct sockaddr_in *)(void *)addrs[RTAX_DST]);
+		} else if (rtm->rtm_errno == 0)
 			mib_sroute_process(rtm, addrs[RTAX_GATEWAY],
 			    addrs[RTAX_DST], addrs[RTAX_NETMASK]);
 		break;
@@ -1228,8 +1339,8 @@ mib_fetch_rtab(int af, int info, int arg, size_t *lenp)
  * receive addresses, arp-table.
  * This does not change the interface list itself.
  */
-static void
-update_ifa_info(void)
+void
+mib_update_ifa_info(void)
 {
 	u_char *buf, *next;
 	struct rt_msghdr *rtm;
@@ -1272,7 +1383,7 @@ update_ifa_info(void)
 	while (ifa != NULL) {
 		ifa1 = TAILQ_NEXT(ifa, link);
 		if (!(ifa->flags & MIBIFA_FOUND))
-			destroy_ifa(ifa);
+			mib_free_ifa(ifa);
 		ifa = ifa1;
 	}
 
@@ -1287,28 +1398,24 @@ update_ifa_info(void)
 }
 
 /*
- * Update arp table
+ * Update arp table. The routing messages keep it current; this catches
+ * entries that have changed without a message.
  */
-void
+int
 mib_arp_update(void)
 {
-	struct mibarp *at, *at1;
+	struct mibarp *at;
 	size_t needed;
 	u_char *buf, *next;
 	struct rt_msghdr *rtm;
 
-	if (in_update_arp)
-		return;		/* Aaargh */
-	in_update_arp = 1;
+	if ((buf = mib_fetch_rtab(AF_INET, NET_RT_FLAGS, RTF_LLINFO,
+	    &needed)) == NULL)
+		return (-1);
 
-	TAILQ_FOREACH(at, &mibarp_list, link)
+	for (at = mib_first_arp(); at != NULL; at = mib_next_arp(at))
 		at->flags &= ~MIBARP_FOUND;
 
-	if ((buf = mib_fetch_rtab(AF_INET, NET_RT_FLAGS, RTF_LLINFO, &needed)) == NULL) {
-		in_update_arp = 0;
-		return;
-	}
-
 	next = buf;
 	while (next < buf + needed) {
 		rtm = (struct rt_msghdr *)(void *)next;
@@ -1317,16 +1424,8 @@ mib_arp_update(void)
 	}
 	free(buf);
 
-	at = TAILQ_FIRST(&mibarp_list);
-	while (at != NULL) {
-		at1 = TAILQ_NEXT(at, link);
-		if (!(at->flags & MIBARP_FOUND))
-			mib_arp_delete(at);
-		at = at1;
-	}
-	mibarpticks = get_ticks();
-	update_arp = 0;
-	in_update_arp = 0;
+	mib_arp_sweep();
+	return (0);
 }
 
 
@@ -1356,15 +1455,15 @@ route_input(int fd, void *udata __unused)
 /*
  * execute and SIOCAIFADDR
  */
-static int
-siocaifaddr(char *ifname, struct in_addr addr, struct in_addr mask,
-    struct in_addr bcast)
+int
+mib_sys_addifa(const struct mibif *ifp, struct in_addr addr,
+    struct in_addr mask, struct in_addr bcast)
 {
 	struct ifaliasreq addreq;
 	struct sockaddr_in *sa;
 
 	memset(&addreq, 0, sizeof(addreq));
-	strncpy(addreq.ifra_name, ifname, sizeof(addreq.ifra_name));
+	strncpy(addreq.ifra_name, ifp->name, sizeof(addreq.ifra_name));
 
 	sa = (struct sockaddr_in *)(void *)&addreq.ifra_addr;
 	sa->sin_family = AF_INET;
@@ -1387,14 +1486,14 @@ siocaifaddr(char *ifname, struct in_addr addr, struct in_addr mask,
 /*
  * Exececute a SIOCDIFADDR
  */
-static int
-siocdifaddr(const char *ifname, struct in_addr addr)
+int
+mib_sys_delifa(const struct mibif *ifp, struct in_addr addr)
 {
 	struct ifreq delreq;
 	struct sockaddr_in *sa;
 
 	memset(&delreq, 0, sizeof(delreq));
-	strncpy(delreq.ifr_name, ifname, sizeof(delreq.ifr_name));
+	strncpy(delreq.ifr_name, ifp->name, sizeof(delreq.ifr_name));
 	sa = (struct sockaddr_in *)(void *)&delreq.ifr_addr;
 	sa->sin_family = AF_INET;
 	sa->sin_len = sizeof(*sa);
@@ -1406,14 +1505,14 @@ siocdifaddr(const char *ifname, struct in_addr addr)
 /*
  * Verify an interface address without fetching the entire list
  */
-static int
-verify_ifa(const char *name, struct mibifa *ifa)
+int
+mib_sys_verifyifa(const struct mibif *ifp, const struct mibifa *ifa)
 {
 	struct ifreq req;
 	struct sockaddr_in *sa;
 
 	memset(&req, 0, sizeof(req));
-	strncpy(req.ifr_name, name, sizeof(req.ifr_name));
+	strncpy(req.ifr_name, ifp->name, sizeof(req.ifr_name));
 	sa = (struct sockaddr_in *)(void *)&req.ifr_addr;
 	sa->sin_family = AF_INET;
 	sa->sin_len = sizeof(*sa);
@@ -1434,6 +1533,7 @@ verify_ifa(const char *name, struct mibifa *ifa)
 	}
 	return (0);
 }
+#endif
 
 /*
  * Restore a deleted interface address. Don't wait for the routing socket
@@ -1448,7 +1548,7 @@ mib_undestroy_ifa(struct mibifa *ifa)
 		/* keep it destroyed */
 		return;
 
-	if (siocaifaddr(ifp->name, ifa->inaddr, ifa->inmask, ifa->inbcast))
+	if (mib_sys_addifa(ifp, ifa->inaddr, ifa->inmask, ifa->inbcast))
 		/* keep it destroyed */
 		return;
 
@@ -1468,7 +1568,7 @@ mib_destroy_ifa(struct mibifa *ifa)
 		mib_iflist_bad = 1;
 		return (-1);
 	}
-	if (siocdifaddr(ifp->name, ifa->inaddr)) {
+	if (mib_sys_delifa(ifp, ifa->inaddr)) {
 		/* ups. */
 		syslog(LOG_ERR, "SIOCDIFADDR: %m");
 		mib_iflist_bad = 1;
@@ -1493,7 +1593,7 @@ mib_unmodify_ifa(struct mibifa *ifa)
 		return;
 	}
 
-	if (siocaifaddr(ifp->name, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
+	if (mib_sys_addifa(ifp, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
 		/* ups. */
 		mib_iflist_bad = 1;
 		return;
@@ -1514,13 +1614,13 @@ mib_modify_ifa(struct mibifa *ifa)
 		return (-1);
 	}
 
-	if (siocaifaddr(ifp->name, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
+	if (mib_sys_addifa(ifp, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
 		/* ups. */
 		mib_iflist_bad = 1;
 		return (-1);
 	}
 
-	if (verify_ifa(ifp->name, ifa)) {
+	if (mib_sys_verifyifa(ifp, ifa)) {
 		/* ups. */
 		mib_iflist_bad = 1;
 		return (-1);
@@ -1543,13 +1643,13 @@ mib_uncreate_ifa(struct mibifa *ifa)
 		mib_iflist_bad = 1;
 		return;
 	}
-	if (siocdifaddr(ifp->name, ifa->inaddr)) {
+	if (mib_sys_delifa(ifp, ifa->inaddr)) {
 		/* ups. */
 		mib_iflist_bad = 1;
 		return;
 	}
 
-	destroy_ifa(ifa);
+	mib_free_ifa(ifa);
 }
 
 /*
@@ -1564,29 +1664,30 @@ mib_create_ifa(u_int ifindex, struct in_addr addr, struct in_addr mask,
 
 	if ((ifp = mib_find_if(ifindex)) == NULL)
 		return (NULL);
-	if ((ifa = alloc_ifa(ifindex, addr)) == NULL)
+	if ((ifa = mib_alloc_ifa(ifindex, addr)) == NULL)
 		return (NULL);
 	ifa->inmask = mask;
 	ifa->inbcast = bcast;
 
-	if (siocaifaddr(ifp->name, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
+	if (mib_sys_addifa(ifp, ifa->inaddr, ifa->inmask, ifa->inbcast)) {
 		syslog(LOG_ERR, "%s: %m", __func__);
-		destroy_ifa(ifa);
+		mib_free_ifa(ifa);
 		return (NULL);
 	}
-	if (verify_ifa(ifp->name, ifa)) {
-		destroy_ifa(ifa);
+	if (mib_sys_verifyifa(ifp, ifa)) {
+		mib_free_ifa(ifa);
 		return (NULL);
 	}
 	return (ifa);
 }
 
+#if !defined(__linux__)
 /*
  * Get all cloning interfaces and make them dynamic.
  * Hah! Whe should probably do this on a periodic basis (XXX).
  */
-static void
-get_cloners(void)
+void
+mib_get_cloners(void)
 {
 	struct if_clonereq req;
 	char *buf, *cp;
@@ -1613,6 +1714,63 @@ get_cloners(void)
 	free(buf);
 }
 
+/*
+ * Open the routing socket.
+ */
+int
+mib_sys_init(struct lmodule *mod __unused)
+{
+	size_t len;
+
+	len = sizeof(clockinfo);
+	if (sysctlbyname("kern.clockrate", &clockinfo, &len, NULL, 0) == -1) {
+		syslog(LOG_ERR, "kern.clockrate: %m");
+		return (-1);
+	}
+	if (len != sizeof(clockinfo)) {
+		syslog(LOG_ERR, "kern.clockrate: wrong size");
+		return (-1);
+	}
+
+	if ((route = socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC)) == -1) {
+		syslog(LOG_ERR, "PF_ROUTE: %m");
+		return (-1);
+	}
+
+	/* assume, that all cloning interfaces are dynamic */
+	mib_get_cloners();
+
+	return (0);
+}
+
+int
+mib_sys_start(void)
+{
+	if ((route_fd = fd_select(route, route_input, NULL, module)) == NULL) {
+		syslog(LOG_ERR, "fd_select(route): %m");
+		return (-1);
+	}
+	return (0);
+}
+
+void
+mib_sys_fini(void)
+{
+	if (route_fd != NULL)
+		fd_deselect(route_fd);
+	if (route != -1)
+		(void)close(route);
+}
+
+/*
+ * Nothing to do - the routing socket keeps the lists up to date.
+ */
+void
+mib_sys_idle(void)
+{
+}
+#endif
+
 /*
  * Idle function
  */
@@ -1626,15 +1784,14 @@ mibII_idle(void)
 			ifa->flags &= ~MIBIFA_DESTROYED;
 
 		/* assume, that all cloning interfaces are dynamic */
-		get_cloners();
+		mib_get_cloners();
 
 		mib_refresh_iflist();
-		update_ifa_info();
-		mib_arp_update();
+		mib_update_ifa_info();
+		(void)mib_arp_update();
 		mib_iflist_bad = 0;
 	}
-	if (update_arp)
-		mib_arp_update();
+	mib_sys_idle();
 }
 
 
@@ -1644,13 +1801,11 @@ mibII_idle(void)
 static void
 mibII_start(void)
 {
-	if ((route_fd = fd_select(route, route_input, NULL, module)) == NULL) {
-		syslog(LOG_ERR, "fd_select(route): %m");
+	if (mib_sys_start() == -1)
 		return;
-	}
 	mib_refresh_iflist();
-	update_ifa_info();
-	mib_arp_update();
+	mib_update_ifa_info();
+	(void)mib_fetch_arp();
 	(void)mib_fetch_route();
 	mib_iftable_last_change = 0;
 	mib_ifstack_last_change = 0;
@@ -1680,34 +1835,31 @@ mibII_start(void)
 static int
 mibII_init(struct lmodule *mod, int argc __unused, char *argv[] __unused)
 {
-	size_t len;
-
 	module = mod;
 
-	len = sizeof(clockinfo);
-	if (sysctlbyname("kern.clockrate", &clockinfo, &len, NULL, 0) == -1) {
-		syslog(LOG_ERR, "kern.clockrate: %m");
-		return (-1);
-	}
-	if (len != sizeof(clockinfo)) {
-		syslog(LOG_ERR, "kern.clockrate: wrong size");
+	if ((mib_netsock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+		syslog(LOG_ERR, "PF_INET: %m");
 		return (-1);
 	}
+	(void)shutdown(mib_netsock, SHUT_RDWR);
 
-	if ((route = socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC)) == -1) {
-		syslog(LOG_ERR, "PF_ROUTE: %m");
+	if (mib_sys_init(mod) == -1) {
+		(void)close(mib_netsock);
 		return (-1);
 	}
 
-	if ((mib_netsock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
-		syslog(LOG_ERR, "PF_INET: %m");
-		(void)close(route);
+	if (mib_ip_init(mod) == -1 || mib_tcp_init(mod) == -1 ||
+	    mib_udp_init(mod) == -1 || mib_route_init(mod) == -1 ||
+	    mib_arp_init(mod) == -1) {
+		mib_arp_fini();
+		mib_route_fini();
+		mib_udp_fini();
+		mib_tcp_fini();
+		mib_ip_fini();
+		mib_sys_fini();
+		(void)close(mib_netsock);
 		return (-1);
 	}
-	(void)shutdown(mib_netsock, SHUT_RDWR);
-
-	/* assume, that all cloning interfaces are dynamic */
-	get_cloners();
 
 	return (0);
 }
@@ -1715,10 +1867,12 @@ mibII_init(struct lmodule *mod, int argc __unused, char *argv[] __unused)
 static int
 mibII_fini(void)
 {
-	if (route_fd != NULL)
-		fd_deselect(route_fd);
-	if (route != -1)
-		(void)close(route);
+	mib_arp_fini();
+	mib_route_fini();
+	mib_udp_fini();
+	mib_tcp_fini();
+	mib_ip_fini();
+	mib_sys_fini();
 	if (mib_netsock != -1)
 		(void)close(mib_netsock);
 	/* XXX free memory */
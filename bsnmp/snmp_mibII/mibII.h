@@ -31,9 +31,21 @@
  * Implementation of the interfaces and IP groups of MIB-II.
  */
 #include <sys/param.h>
+#include <sys/queue.h>
+#if defined(HAVE_SYS_TREE_H)
+#include <sys/tree.h>
+#else
+#include "tree.h"
+#endif
+#if !defined(__linux__)
 #include <sys/sysctl.h>
+#endif
 #include <sys/socket.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#else
 #include <sys/sockio.h>
+#endif
 #include <sys/syslog.h>
 #include <sys/time.h>
 #include <stdio.h>
@@ -43,9 +55,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <net/if.h>
+#if !defined(__linux__)
 #include <net/if_dl.h>
 #include <net/if_mib.h>
 #include <net/route.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -66,7 +80,10 @@ enum {
 };
 
 /*
- * Private mibif data - hang off from the mibif.
+ * Private mibif data - hang off from the mibif. This also links the
+ * interface into the lookup indexes, which are maintained by mibif_create()
+ * and mibif_free(): hashes by ifindex, sysindex and name and a tree ordered
+ * by ifindex to find the successor of an index that does not exist.
  */
 struct mibif_private {
 	uint64_t	hc_inoctets;
@@ -75,6 +92,13 @@ struct mibif_private {
 	uint64_t	hc_opackets;
 	uint64_t	hc_imcasts;
 	uint64_t	hc_ipackets;
+
+	struct mibif	*ifp;		/* back pointer */
+	struct mibindexmap *map;
+	RB_ENTRY(mibif_private) tlink;
+	LIST_ENTRY(mibif_private) ilink;
+	LIST_ENTRY(mibif_private) slink;
+	LIST_ENTRY(mibif_private) nlink;
 };
 #define	MIBIF_PRIV(IFP) ((struct mibif_private *)((IFP)->private))
 
@@ -114,6 +138,7 @@ SLIST_HEAD(mibdynif_list, mibdynif);
 
 struct mibindexmap {
 	STAILQ_ENTRY(mibindexmap) link;
+	LIST_ENTRY(mibindexmap) hlink;	/* hashed by name */
 	u_short		sysindex;
 	u_int		ifindex;
 	struct mibif	*mibif;		/* may be NULL */
@@ -137,13 +162,13 @@ TAILQ_HEAD(mibifstack_list, mibifstack);
  * NetToMediaTable (ArpTable)
  */
 struct mibarp {
-	TAILQ_ENTRY(mibarp) link;
-	struct asn_oid	index;		/* contains both the ifindex and addr */
+	RB_ENTRY(mibarp) link;
+	u_int		ifindex;	/* the index is ifindex and addr */
+	uint32_t	addr;		/* in host byte order */
 	u_char		phys[128];	/* the physical address */
 	u_int		physlen;	/* and its length */
 	u_int		flags;
 };
-TAILQ_HEAD(mibarp_list, mibarp);
 enum {
 	MIBARP_FOUND	= 0x00010000,
 	MIBARP_PERM	= 0x00000001,
@@ -177,9 +202,6 @@ extern struct mibifstack_list mibifstack_list;
 /* list of all receive addresses */
 extern struct mibrcvaddr_list mibrcvaddr_list;
 
-/* list of all NetToMedia entries */
-extern struct mibarp_list mibarp_list;
-
 /* number of interfaces */
 extern int32_t mib_if_number;
 
@@ -192,8 +214,30 @@ extern uint64_t mib_ifstack_last_change;
 /* if this is set, one of our lists may be bad. refresh them when idle */
 extern int mib_iflist_bad;
 
-/* last time refreshed */
-extern uint64_t mibarpticks;
+#if defined(__linux__)
+struct clockinfo {
+	int	hz;		/* clock frequency */
+	int	tick;		/* micro-seconds per hz tick */
+	int	spare;
+	int	stathz;		/* statistics clock frequency */
+	int	profhz;		/* profiling clock frequency */
+};
+
+/* IANA ifType values for the ARPHRD types we map */
+#define	IFT_OTHER	0x01
+#define	IFT_ETHER	0x06
+#define	IFT_ISO88025	0x09
+#define	IFT_FDDI	0x0f
+#define	IFT_PPP		0x17
+#define	IFT_LOOP	0x18
+#define	IFT_SLIP	0x1c
+#define	IFT_ARCNET	0x23
+#define	IFT_ATM		0x25
+#define	IFT_IEEE80211	0x47
+#define	IFT_TUNNEL	0x83
+#define	IFT_IEEE1394	0x90
+#define	IFT_INFINIBAND	0xc7
+#endif
 
 /* info on system clocks */
 extern struct clockinfo clockinfo;
@@ -228,6 +272,9 @@ int mib_modify_ifa(struct mibifa *);
 /* undo if address modification */
 void mib_unmodify_ifa(struct mibifa *);
 
+/* find the interface following an ifTable index */
+struct mibif *mibif_getnext(const struct asn_oid *, u_int);
+
 /* create an interface address */
 struct mibifa * mib_create_ifa(u_int ifindex, struct in_addr addr, struct in_addr mask, struct in_addr bcast);
 
@@ -238,12 +285,77 @@ void mib_uncreate_ifa(struct mibifa *);
 struct mibarp *mib_arp_create(const struct mibif *, struct in_addr, const u_char *, size_t);
 void mib_arp_delete(struct mibarp *);
 
+/* delete all arp entries of an interface */
+void mib_arp_purge(const struct mibif *);
+
 /* find arp entry */
 struct mibarp *mib_find_arp(const struct mibif *, struct in_addr);
 
-/* update arp table */
-void mib_arp_update(void);
+/* iterate over the arp entries in index order */
+struct mibarp *mib_first_arp(void);
+struct mibarp *mib_next_arp(struct mibarp *);
+
+/* delete the arp entries that have not been found by a dump */
+void mib_arp_sweep(void);
+
+/* dump the arp table from the system */
+int mib_arp_update(void);
+
+/* dump the arp table if it is older than its maximum age */
+int mib_fetch_arp(void);
+
+/*
+ * Interface to the system. This is implemented with the routing socket
+ * in mibII.c and with rtnetlink in mibII_netlink.c.
+ */
+int mib_sys_init(struct lmodule *);
+int mib_sys_start(void);
+void mib_sys_fini(void);
+void mib_sys_idle(void);
+
+/* get all cloning interfaces and make them dynamic */
+void mib_get_cloners(void);
 
+/* update addresses and receive addresses of all interfaces */
+void mib_update_ifa_info(void);
+
+/* add, delete and check an interface address in the kernel */
+int mib_sys_addifa(const struct mibif *, struct in_addr, struct in_addr,
+    struct in_addr);
+int mib_sys_delifa(const struct mibif *, struct in_addr);
+int mib_sys_verifyifa(const struct mibif *, const struct mibifa *);
+
+/* create/free interfaces for the system interface code */
+struct mibif *mibif_create(u_int sysindex, const char *name);
+void mibif_free(struct mibif *);
+
+/* inform all interested parties about a new interface */
+void mib_notify_newif(struct mibif *);
+
+/* guess the link level broadcast receive address */
+void mib_check_llbcast(struct mibif *);
+
+/* set the physical address and its receive address entry */
+void mib_set_physaddr(struct mibif *, const u_char *, u_int);
+
+/* generate a link up/down trap */
+void mib_link_trap(struct mibif *, int up);
+
+/* allocate/free an interface address entry */
+struct mibifa *mib_alloc_ifa(u_int ifindex, struct in_addr);
+void mib_free_ifa(struct mibifa *);
+
+#if defined(__linux__)
+/* read the counters of a protocol from /proc/net/snmp */
+int mib_proc_snmp(const char *, const char *const *, u_int, uint32_t *);
+
+/* read and write an integer in /proc/sys */
+int mib_proc_getint(const char *, int *);
+int mib_proc_setint(const char *, int);
+
+/* dump the routing table */
+int mib_route_dump(void);
+#else
 /* fetch routing table */
 u_char *mib_fetch_rtab(int af, int info, int arg, size_t *lenp);
 
@@ -257,6 +369,24 @@ void mib_send_rtmsg(struct rt_msghdr *, struct sockaddr *,
 
 /* extract addresses from routing message */
 void mib_extract_addrs(int, u_char *, struct sockaddr **);
+#endif
 
-/* fetch routing table */
+/* fetch routing table if it is older than its maximum age */
 int mib_fetch_route(void);
+
+/* add or update and delete a route (addresses in host byte order) */
+void mib_sroute_add(uint32_t dst, u_int plen, uint32_t gw,
+    const struct mibif *, u_int type, u_int proto);
+void mib_sroute_del(uint32_t dst, u_int plen, uint32_t gw);
+
+/* register and unregister the refresh caches of the groups */
+int mib_ip_init(struct lmodule *);
+void mib_ip_fini(void);
+int mib_tcp_init(struct lmodule *);
+void mib_tcp_fini(void);
+int mib_udp_init(struct lmodule *);
+void mib_udp_fini(void);
+int mib_route_init(struct lmodule *);
+void mib_route_fini(void);
+int mib_arp_init(struct lmodule *);
+void mib_arp_fini(void);
@@ -199,7 +199,7 @@ op_ifentry(struct snmp_context *ctx, struct snmp_value *value,
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
-		if ((ifp = NEXT_OBJECT_INT(&mibif_list, &value->var, sub)) == NULL)
+		if ((ifp = mibif_getnext(&value->var, sub)) == NULL)
 			return (SNMP_ERR_NOSUCHNAME);
 		value->var.len = sub + 1;
 		value->var.subs[sub] = ifp->index;
@@ -380,7 +380,7 @@ op_ifxtable(struct snmp_context *ctx, struct snmp_value *value,
 		/* FALLTHROUGH */
 
 	  case SNMP_OP_GETNEXT:
-		if ((ifp = NEXT_OBJECT_INT(&mibif_list, &value->var, sub)) == NULL)
+		if ((ifp = mibif_getnext(&value->var, sub)) == NULL)
 			return (SNMP_ERR_NOSUCHNAME);
 		value->var.len = sub + 1;
 		value->var.subs[sub] = ifp->index;
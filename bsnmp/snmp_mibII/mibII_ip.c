@@ -32,33 +32,127 @@
  */
 #include "mibII.h"
 #include "mibII_oid.h"
+#if !defined(__linux__)
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <netinet/ip_var.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp_var.h>
+#endif
 
-static struct ipstat ipstat;
-static u_int	ip_idrop;
-static struct icmpstat icmpstat;
+/* the statistics, indexed by the leaf number */
+static uint32_t ipstat[LEAF_ipFragCreates + 1];
+static uint32_t icmpstat[LEAF_icmpOutAddrMaskReps + 1];
 
 static int	ip_forwarding;
 static int	ip_defttl;
-static uint64_t ip_tick;
+static struct snmp_refresh *ip_refresh;
+static struct snmp_refresh *ipstat_refresh;
+
+#if defined(__linux__)
+
+#define	IP_FORWARDING	"/proc/sys/net/ipv4/ip_forward"
+#define	IP_DEFTTL	"/proc/sys/net/ipv4/ip_default_ttl"
+
+/* the names of the counters in /proc/net/snmp */
+static const char *const ip_names[LEAF_ipFragCreates + 1] = {
+	[LEAF_ipInReceives] =		"InReceives",
+	[LEAF_ipInHdrErrors] =		"InHdrErrors",
+	[LEAF_ipInAddrErrors] =		"InAddrErrors",
+	[LEAF_ipForwDatagrams] =	"ForwDatagrams",
+	[LEAF_ipInUnknownProtos] =	"InUnknownProtos",
+	[LEAF_ipInDiscards] =		"InDiscards",
+	[LEAF_ipInDelivers] =		"InDelivers",
+	[LEAF_ipOutRequests] =		"OutRequests",
+	[LEAF_ipOutDiscards] =		"OutDiscards",
+	[LEAF_ipOutNoRoutes] =		"OutNoRoutes",
+	[LEAF_ipReasmTimeout] =		"ReasmTimeout",
+	[LEAF_ipReasmReqds] =		"ReasmReqds",
+	[LEAF_ipReasmOKs] =		"ReasmOKs",
+	[LEAF_ipReasmFails] =		"ReasmFails",
+	[LEAF_ipFragOKs] =		"FragOKs",
+	[LEAF_ipFragFails] =		"FragFails",
+	[LEAF_ipFragCreates] =		"FragCreates",
+};
+
+static const char *const icmp_names[LEAF_icmpOutAddrMaskReps + 1] = {
+	[LEAF_icmpInMsgs] =		"InMsgs",
+	[LEAF_icmpInErrors] =		"InErrors",
+	[LEAF_icmpInDestUnreachs] =	"InDestUnreachs",
+	[LEAF_icmpInTimeExcds] =	"InTimeExcds",
+	[LEAF_icmpInParmProbs] =	"InParmProbs",
+	[LEAF_icmpInSrcQuenchs] =	"InSrcQuenchs",
+	[LEAF_icmpInRedirects] =	"InRedirects",
+	[LEAF_icmpInEchos] =		"InEchos",
+	[LEAF_icmpInEchoReps] =		"InEchoReps",
+	[LEAF_icmpInTimestamps] =	"InTimestamps",
+	[LEAF_icmpInTimestampReps] =	"InTimestampReps",
+	[LEAF_icmpInAddrMasks] =	"InAddrMasks",
+	[LEAF_icmpInAddrMaskReps] =	"InAddrMaskReps",
+	[LEAF_icmpOutMsgs] =		"OutMsgs",
+	[LEAF_icmpOutErrors] =		"OutErrors",
+	[LEAF_icmpOutDestUnreachs] =	"OutDestUnreachs",
+	[LEAF_icmpOutTimeExcds] =	"OutTimeExcds",
+	[LEAF_icmpOutParmProbs] =	"OutParmProbs",
+	[LEAF_icmpOutSrcQuenchs] =	"OutSrcQuenchs",
+	[LEAF_icmpOutRedirects] =	"OutRedirects",
+	[LEAF_icmpOutEchos] =		"OutEchos",
+	[LEAF_icmpOutEchoReps] =	"OutEchoReps",
+	[LEAF_icmpOutTimestamps] =	"OutTimestamps",
+	[LEAF_icmpOutTimestampReps] =	"OutTimestampReps",
+	[LEAF_icmpOutAddrMasks] =	"OutAddrMasks",
+	[LEAF_icmpOutAddrMaskReps] =	"OutAddrMaskReps",
+};
 
-static uint64_t ipstat_tick;
+/*
+ * Linux keeps the counters as defined by the MIB.
+ */
+static int
+fetch_ipstat(void *arg __unused)
+{
+	if (mib_proc_snmp("Ip", ip_names, LEAF_ipFragCreates + 1,
+	    ipstat) == -1)
+		return (-1);
+	if (mib_proc_snmp("Icmp", icmp_names, LEAF_icmpOutAddrMaskReps + 1,
+	    icmpstat) == -1)
+		return (-1);
+	return (0);
+}
+
+static int
+ip_getvar(const char *name, int *val)
+{
+	return (mib_proc_getint(name, val));
+}
+
+static int
+ip_setvar(const char *name, int val, int *old)
+{
+	if (old != NULL && mib_proc_getint(name, old) == -1)
+		return (-1);
+	return (mib_proc_setint(name, val));
+}
+
+#else /* !__linux__ */
+
+#define	IP_FORWARDING	"net.inet.ip.forwarding"
+#define	IP_DEFTTL	"net.inet.ip.ttl"
 
 static int
-fetch_ipstat(void)
+fetch_ipstat(void *arg __unused)
 {
+	struct ipstat ips;
+	struct icmpstat icps;
+	u_int ip_idrop;
 	size_t len;
+	u_int i;
 
-	len = sizeof(ipstat);
-	if (sysctlbyname("net.inet.ip.stats", &ipstat, &len, NULL, 0) == -1) {
+	len = sizeof(ips);
+	if (sysctlbyname("net.inet.ip.stats", &ips, &len, NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.ip.stats: %m");
 		return (-1);
 	}
-	if (len != sizeof(ipstat)) {
+	if (len != sizeof(ips)) {
 		syslog(LOG_ERR, "net.inet.ip.stats: wrong size");
 		return (-1);
 	}
@@ -69,62 +163,131 @@ fetch_ipstat(void)
 		syslog(LOG_WARNING, "net.inet.ip.intr_queue_drops: wrong size");
 		ip_idrop = 0;
 	}
-	len = sizeof(icmpstat);
-	if (sysctlbyname("net.inet.icmp.stats", &icmpstat, &len, NULL, 0) == -1) {
+	len = sizeof(icps);
+	if (sysctlbyname("net.inet.icmp.stats", &icps, &len, NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.icmp.stats: %m");
 		return (-1);
 	}
-	if (len != sizeof(icmpstat)) {
+	if (len != sizeof(icps)) {
 		syslog(LOG_ERR, "net.inet.icmp.stats: wrong size");
 		return (-1);
 	}
 
-	ipstat_tick = get_ticks();
+	ipstat[LEAF_ipInReceives] = ips.ips_total;
+	ipstat[LEAF_ipInHdrErrors] = ips.ips_badsum + ips.ips_tooshort
+	    + ips.ips_toosmall + ips.ips_badhlen
+	    + ips.ips_badlen + ips.ips_badvers +
+	    + ips.ips_toolong;
+	ipstat[LEAF_ipInAddrErrors] = ips.ips_cantforward;
+	ipstat[LEAF_ipForwDatagrams] = ips.ips_forward;
+	ipstat[LEAF_ipInUnknownProtos] = ips.ips_noproto;
+	ipstat[LEAF_ipInDiscards] = ip_idrop;
+	ipstat[LEAF_ipInDelivers] = ips.ips_delivered;
+	ipstat[LEAF_ipOutRequests] = ips.ips_localout;
+	ipstat[LEAF_ipOutDiscards] = ips.ips_odropped;
+	ipstat[LEAF_ipOutNoRoutes] = ips.ips_noroute;
+	ipstat[LEAF_ipReasmTimeout] = IPFRAGTTL;
+	ipstat[LEAF_ipReasmReqds] = ips.ips_fragments;
+	ipstat[LEAF_ipReasmOKs] = ips.ips_reassembled;
+	ipstat[LEAF_ipReasmFails] = ips.ips_fragdropped
+	    + ips.ips_fragtimeout;
+	ipstat[LEAF_ipFragOKs] = ips.ips_fragmented;
+	ipstat[LEAF_ipFragFails] = ips.ips_cantfrag;
+	ipstat[LEAF_ipFragCreates] = ips.ips_ofragments;
+
+	/* missing: bad type and packets on faith */
+	icmpstat[LEAF_icmpInMsgs] = icps.icps_tooshort + icps.icps_checksum;
+	for (i = 0; i <= ICMP_MAXTYPE; i++)
+		icmpstat[LEAF_icmpInMsgs] += icps.icps_inhist[i];
+	icmpstat[LEAF_icmpInErrors] = icps.icps_tooshort +
+	    icps.icps_checksum +
+	    icps.icps_badlen +
+	    icps.icps_badcode +
+	    icps.icps_bmcastecho +
+	    icps.icps_bmcasttstamp;
+	icmpstat[LEAF_icmpInDestUnreachs] = icps.icps_inhist[ICMP_UNREACH];
+	icmpstat[LEAF_icmpInTimeExcds] = icps.icps_inhist[ICMP_TIMXCEED];
+	icmpstat[LEAF_icmpInParmProbs] = icps.icps_inhist[ICMP_PARAMPROB];
+	icmpstat[LEAF_icmpInSrcQuenchs] = icps.icps_inhist[ICMP_SOURCEQUENCH];
+	icmpstat[LEAF_icmpInRedirects] = icps.icps_inhist[ICMP_REDIRECT];
+	icmpstat[LEAF_icmpInEchos] = icps.icps_inhist[ICMP_ECHO];
+	icmpstat[LEAF_icmpInEchoReps] = icps.icps_inhist[ICMP_ECHOREPLY];
+	icmpstat[LEAF_icmpInTimestamps] = icps.icps_inhist[ICMP_TSTAMP];
+	icmpstat[LEAF_icmpInTimestampReps] =
+	    icps.icps_inhist[ICMP_TSTAMPREPLY];
+	icmpstat[LEAF_icmpInAddrMasks] = icps.icps_inhist[ICMP_MASKREQ];
+	icmpstat[LEAF_icmpInAddrMaskReps] = icps.icps_inhist[ICMP_MASKREPLY];
+
+	icmpstat[LEAF_icmpOutMsgs] = icps.icps_badaddr + icps.icps_noroute;
+	for (i = 0; i <= ICMP_MAXTYPE; i++)
+		icmpstat[LEAF_icmpOutMsgs] += icps.icps_outhist[i];
+	icmpstat[LEAF_icmpOutErrors] = icps.icps_badaddr +
+	    icps.icps_noroute;
+	icmpstat[LEAF_icmpOutDestUnreachs] = icps.icps_outhist[ICMP_UNREACH];
+	icmpstat[LEAF_icmpOutTimeExcds] = icps.icps_outhist[ICMP_TIMXCEED];
+	icmpstat[LEAF_icmpOutParmProbs] = icps.icps_outhist[ICMP_PARAMPROB];
+	icmpstat[LEAF_icmpOutSrcQuenchs] =
+	    icps.icps_outhist[ICMP_SOURCEQUENCH];
+	icmpstat[LEAF_icmpOutRedirects] = icps.icps_outhist[ICMP_REDIRECT];
+	icmpstat[LEAF_icmpOutEchos] = icps.icps_outhist[ICMP_ECHO];
+	icmpstat[LEAF_icmpOutEchoReps] = icps.icps_outhist[ICMP_ECHOREPLY];
+	icmpstat[LEAF_icmpOutTimestamps] = icps.icps_outhist[ICMP_TSTAMP];
+	icmpstat[LEAF_icmpOutTimestampReps] =
+	    icps.icps_outhist[ICMP_TSTAMPREPLY];
+	icmpstat[LEAF_icmpOutAddrMasks] = icps.icps_outhist[ICMP_MASKREQ];
+	icmpstat[LEAF_icmpOutAddrMaskReps] =
+	    icps.icps_outhist[ICMP_MASKREPLY];
+
 	return (0);
 }
 
 static int
-fetch_ip(void)
+ip_getvar(const char *name, int *val)
 {
 	size_t len;
 
-	len = sizeof(ip_forwarding);
-	if (sysctlbyname("net.inet.ip.forwarding", &ip_forwarding, &len,
-	    NULL, 0) == -1) {
-		syslog(LOG_ERR, "net.inet.ip.forwarding: %m");
+	len = sizeof(*val);
+	if (sysctlbyname(name, val, &len, NULL, 0) == -1) {
+		syslog(LOG_ERR, "%s: %m", name);
 		return (-1);
 	}
-	if (len != sizeof(ip_forwarding)) {
-		syslog(LOG_ERR, "net.inet.ip.forwarding: wrong size");
+	if (len != sizeof(*val)) {
+		syslog(LOG_ERR, "%s: wrong size", name);
 		return (-1);
 	}
+	return (0);
+}
 
-	len = sizeof(ip_defttl);
-	if (sysctlbyname("net.inet.ip.ttl", &ip_defttl, &len,
-	    NULL, 0) == -1) {
-		syslog(LOG_ERR, "net.inet.ip.ttl: %m");
-		return (-1);
-	}
-	if (len != sizeof(ip_defttl)) {
-		syslog(LOG_ERR, "net.inet.ip.ttl: wrong size");
+static int
+ip_setvar(const char *name, int val, int *old)
+{
+	size_t olen;
+
+	olen = sizeof(*old);
+	if (sysctlbyname(name, old, old ? &olen : NULL,
+	    &val, sizeof(val)) == -1) {
+		syslog(LOG_ERR, "set %s: %m", name);
 		return (-1);
 	}
+	return (0);
+}
 
-	ip_tick = get_ticks();
+#endif /* !__linux__ */
+
+static int
+fetch_ip(void *arg __unused)
+{
+	if (ip_getvar(IP_FORWARDING, &ip_forwarding) == -1 ||
+	    ip_getvar(IP_DEFTTL, &ip_defttl) == -1)
+		return (-1);
 	return (0);
 }
 
 static int
 ip_forward(int forw, int *old)
 {
-	size_t olen;
-
-	olen = sizeof(*old);
-	if (sysctlbyname("net.inet.ip.forwarding", old, old ? &olen : NULL,
-	    &forw, sizeof(forw)) == -1) {
-		syslog(LOG_ERR, "set net.inet.ip.forwarding: %m");
+	if (ip_setvar(IP_FORWARDING, forw, old) == -1)
 		return (-1);
-	}
 	ip_forwarding = forw;
 	return (0);
 }
@@ -132,14 +295,8 @@ ip_forward(int forw, int *old)
 static int
 ip_setttl(int ttl, int *old)
 {
-	size_t olen;
-
-	olen = sizeof(*old);
-	if (sysctlbyname("net.inet.ip.ttl", old, old ? &olen : NULL,
-	    &ttl, sizeof(ttl)) == -1) {
-		syslog(LOG_ERR, "set net.inet.ip.ttl: %m");
+	if (ip_setvar(IP_DEFTTL, ttl, old) == -1)
 		return (-1);
-	}
 	ip_defttl = ttl;
 	return (0);
 }
@@ -147,6 +304,33 @@ ip_setttl(int ttl, int *old)
 /*
  * READ/WRITE ip group.
  */
+/*
+ * The forwarding flag and the TTL are fetched for each PDU so that a SET
+ * sees the current values. The statistics are cheap enough to do the same.
+ */
+int
+mib_ip_init(struct lmodule *mod)
+{
+	if ((ip_refresh = refresh_register("mibII.ip", 0, fetch_ip, NULL,
+	    mod)) == NULL)
+		return (-1);
+	if ((ipstat_refresh = refresh_register("mibII.ipstat", 0,
+	    fetch_ipstat, NULL, mod)) == NULL) {
+		refresh_unregister(ip_refresh);
+		ip_refresh = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+void
+mib_ip_fini(void)
+{
+	refresh_unregister(ipstat_refresh);
+	refresh_unregister(ip_refresh);
+	ipstat_refresh = ip_refresh = NULL;
+}
+
 int
 op_ip(struct snmp_context *ctx, struct snmp_value *value,
     u_int sub, u_int idx __unused, enum snmp_op op)
@@ -162,9 +346,8 @@ op_ip(struct snmp_context *ctx, struct snmp_value *value,
 		break;
 
 	  case SNMP_OP_SET:
-		if (ip_tick < this_tick)
-			if (fetch_ip() == -1)
-				return (SNMP_ERR_GENERR);
+		if (refresh_check(ip_refresh) == -1)
+			return (SNMP_ERR_GENERR);
 
 		switch (value->var.subs[sub - 1]) {
 
@@ -220,9 +403,8 @@ op_ip(struct snmp_context *ctx, struct snmp_value *value,
 		return (SNMP_ERR_NOERROR);
 	}
 
-	if (ip_tick < this_tick)
-		if (fetch_ip() == -1)
-			return (SNMP_ERR_GENERR);
+	if (refresh_check(ip_refresh) == -1)
+		return (SNMP_ERR_GENERR);
 
 	switch (value->var.subs[sub - 1]) {
 
@@ -260,83 +442,12 @@ op_ipstat(struct snmp_context *ctx __unused, struct snmp_value *value,
 		abort();
 	}
 
-	if (ipstat_tick < this_tick)
-		fetch_ipstat();
-
-	switch (value->var.subs[sub - 1]) {
-
-	  case LEAF_ipInReceives:
-		value->v.uint32 = ipstat.ips_total;
-		break;
-
-	  case LEAF_ipInHdrErrors:
-		value->v.uint32 = ipstat.ips_badsum + ipstat.ips_tooshort
-		    + ipstat.ips_toosmall + ipstat.ips_badhlen
-		    + ipstat.ips_badlen + ipstat.ips_badvers +
-		    + ipstat.ips_toolong;
-		break;
-
-	  case LEAF_ipInAddrErrors:
-		value->v.uint32 = ipstat.ips_cantforward;
-		break;
-
-	  case LEAF_ipForwDatagrams:
-		value->v.uint32 = ipstat.ips_forward;
-		break;
-
-	  case LEAF_ipInUnknownProtos:
-		value->v.uint32 = ipstat.ips_noproto;
-		break;
-
-	  case LEAF_ipInDiscards:
-		value->v.uint32 = ip_idrop;
-		break;
-
-	  case LEAF_ipInDelivers:
-		value->v.uint32 = ipstat.ips_delivered;
-		break;
-
-	  case LEAF_ipOutRequests:
-		value->v.uint32 = ipstat.ips_localout;
-		break;
-
-	  case LEAF_ipOutDiscards:
-		value->v.uint32 = ipstat.ips_odropped;
-		break;
-
-	  case LEAF_ipOutNoRoutes:
-		value->v.uint32 = ipstat.ips_noroute;
-		break;
-
-	  case LEAF_ipReasmTimeout:
-		value->v.integer = IPFRAGTTL;
-		break;
-
-	  case LEAF_ipReasmReqds:
-		value->v.uint32 = ipstat.ips_fragments;
-		break;
+	(void)refresh_check(ipstat_refresh);
 
-	  case LEAF_ipReasmOKs:
-		value->v.uint32 = ipstat.ips_reassembled;
-		break;
-
-	  case LEAF_ipReasmFails:
-		value->v.uint32 = ipstat.ips_fragdropped
-		    + ipstat.ips_fragtimeout;
-		break;
-
-	  case LEAF_ipFragOKs:
-		value->v.uint32 = ipstat.ips_fragmented;
-		break;
-
-	  case LEAF_ipFragFails:
-		value->v.uint32 = ipstat.ips_cantfrag;
-		break;
-
-	  case LEAF_ipFragCreates:
-		value->v.uint32 = ipstat.ips_ofragments;
-		break;
-	}
+	if (value->var.subs[sub - 1] == LEAF_ipReasmTimeout)
+		value->v.integer = ipstat[LEAF_ipReasmTimeout];
+	else
+		value->v.uint32 = ipstat[value->var.subs[sub - 1]];
 	return (SNMP_ERR_NOERROR);
 }
 
@@ -347,8 +458,6 @@ int
 op_icmpstat(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int idx __unused, enum snmp_op op)
 {
-	u_int i;
-
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
@@ -365,129 +474,8 @@ op_icmpstat(struct snmp_context *ctx __unused, struct snmp_value *value,
 		abort();
 	}
 
-	if (ipstat_tick < this_tick)
-		fetch_ipstat();
-
-	switch (value->var.subs[sub - 1]) {
-
-	  case LEAF_icmpInMsgs:
-		value->v.integer = 0;
-		for (i = 0; i <= ICMP_MAXTYPE; i++)
-			value->v.integer += icmpstat.icps_inhist[i];
-		value->v.integer += icmpstat.icps_tooshort +
-		    icmpstat.icps_checksum;
-		/* missing: bad type and packets on faith */
-		break;
-
-	  case LEAF_icmpInErrors:
-		value->v.integer = icmpstat.icps_tooshort +
-		    icmpstat.icps_checksum +
-		    icmpstat.icps_badlen +
-		    icmpstat.icps_badcode +
-		    icmpstat.icps_bmcastecho +
-		    icmpstat.icps_bmcasttstamp;
-		break;
-
-	  case LEAF_icmpInDestUnreachs:
-		value->v.integer = icmpstat.icps_inhist[ICMP_UNREACH];
-		break;
-
-	  case LEAF_icmpInTimeExcds:
-		value->v.integer = icmpstat.icps_inhist[ICMP_TIMXCEED];
-		break;
-
-	  case LEAF_icmpInParmProbs:
-		value->v.integer = icmpstat.icps_inhist[ICMP_PARAMPROB];
-		break;
-
-	  case LEAF_icmpInSrcQuenchs:
-		value->v.integer = icmpstat.icps_inhist[ICMP_SOURCEQUENCH];
-		break;
-
-	  case LEAF_icmpInRedirects:
-		value->v.integer = icmpstat.icps_inhist[ICMP_REDIRECT];
-		break;
-
-	  case LEAF_icmpInEchos:
-		value->v.integer = icmpstat.icps_inhist[ICMP_ECHO];
-		break;
-
-	  case LEAF_icmpInEchoReps:
-		value->v.integer = icmpstat.icps_inhist[ICMP_ECHOREPLY];
-		break;
-
-	  case LEAF_icmpInTimestamps:
-		value->v.integer = icmpstat.icps_inhist[ICMP_TSTAMP];
-		break;
-
-	  case LEAF_icmpInTimestampReps:
-		value->v.integer = icmpstat.icps_inhist[ICMP_TSTAMPREPLY];
-		break;
-
-	  case LEAF_icmpInAddrMasks:
-		value->v.integer = icmpstat.icps_inhist[ICMP_MASKREQ];
-		break;
-
-	  case LEAF_icmpInAddrMaskReps:
-		value->v.integer = icmpstat.icps_inhist[ICMP_MASKREPLY];
-		break;
-
-	  case LEAF_icmpOutMsgs:
-		value->v.integer = 0;
-		for (i = 0; i <= ICMP_MAXTYPE; i++)
-			value->v.integer += icmpstat.icps_outhist[i];
-		value->v.integer += icmpstat.icps_badaddr +
-		    icmpstat.icps_noroute;
-		break;
-
-	  case LEAF_icmpOutErrors:
-		value->v.integer = icmpstat.icps_badaddr +
-		    icmpstat.icps_noroute;
-		break;
-
-	  case LEAF_icmpOutDestUnreachs:
-		value->v.integer = icmpstat.icps_outhist[ICMP_UNREACH];
-		break;
-
-	  case LEAF_icmpOutTimeExcds:
-		value->v.integer = icmpstat.icps_outhist[ICMP_TIMXCEED];
-		break;
-
-	  case LEAF_icmpOutParmProbs:
-		value->v.integer = icmpstat.icps_outhist[ICMP_PARAMPROB];
-		break;
-
-	  case LEAF_icmpOutSrcQuenchs:
-		value->v.integer = icmpstat.icps_outhist[ICMP_SOURCEQUENCH];
-		break;
+	(void)refresh_check(ipstat_refresh);
 
-	  case LEAF_icmpOutRedirects:
-		value->v.integer = icmpstat.icps_outhist[ICMP_REDIRECT];
-		break;
-
-	  case LEAF_icmpOutEchos:
-		value->v.integer = icmpstat.icps_outhist[ICMP_ECHO];
-		break;
-
-	  case LEAF_icmpOutEchoReps:
-		value->v.integer = icmpstat.icps_outhist[ICMP_ECHOREPLY];
-		break;
-
-	  case LEAF_icmpOutTimestamps:
-		value->v.integer = icmpstat.icps_outhist[ICMP_TSTAMP];
-		break;
-
-	  case LEAF_icmpOutTimestampReps:
-		value->v.integer = icmpstat.icps_outhist[ICMP_TSTAMPREPLY];
-		break;
-
-	  case LEAF_icmpOutAddrMasks:
-		value->v.integer = icmpstat.icps_outhist[ICMP_MASKREQ];
-		break;
-
-	  case LEAF_icmpOutAddrMaskReps:
-		value->v.integer = icmpstat.icps_outhist[ICMP_MASKREPLY];
-		break;
-	}
+	value->v.uint32 = icmpstat[value->var.subs[sub - 1]];
 	return (SNMP_ERR_NOERROR);
 }
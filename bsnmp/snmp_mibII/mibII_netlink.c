@@ -0,0 +1,1266 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Linux system interface for the interfaces and ip groups.
+ *
+ * The interface, address and ARP lists are filled from rtnetlink dumps.
+ * A second netlink socket is joined to the link, IPv4 address and
+ * neighbour groups; its messages update the lists in place. If the kernel
+ * drops events because the socket overflows, the lists are marked bad and
+ * rebuilt from scratch when the daemon is idle.
+ *
+ * The kernel keeps 64-bit interface counters. They are read from
+ * IFLA_STATS64 with a single link dump for all interfaces at most once
+ * per PDU, so there is no need for a polling timer.
+ *
+ * The IPv4 routes of the main table are dumped and updated from the
+ * events in the same way. The protocol statistics and the tcp and udp
+ * tables come from /proc.
+ */
+#if defined(__linux__)
+
+#include "mibII.h"
+
+#include <limits.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/if_addr.h>
+#include <linux/neighbour.h>
+#include <net/if_arp.h>
+
+/* these are in <linux/if.h>, which clashes with <net/if.h> */
+#ifndef IFF_LOWER_UP
+#define	IFF_LOWER_UP	0x10000
+#endif
+#ifndef IF_OPER_UP
+#define	IF_OPER_UNKNOWN		0
+#define	IF_OPER_NOTPRESENT	1
+#define	IF_OPER_DOWN		2
+#define	IF_OPER_LOWERLAYERDOWN	3
+#define	IF_OPER_UP		6
+#endif
+
+#ifndef NDA_RTA
+#define	NDA_RTA(r) ((struct rtattr *)(void *)(((char *)(r)) +		\
+	NLMSG_ALIGN(sizeof(struct ndmsg))))
+#define	NDA_PAYLOAD(n)	NLMSG_PAYLOAD(n, sizeof(struct ndmsg))
+#endif
+
+/* size of the receive buffers */
+#define	NL_BUFSIZE	(64 * 1024)
+
+/* our module */
+static struct lmodule *module;
+
+/* event socket */
+static int nl_event = -1;
+static void *nl_event_fd;
+
+/* socket for dumps and requests */
+static int nl_req = -1;
+static uint32_t nl_seq;
+
+/* set while we are reading the answer to a request */
+static int nl_busy;
+
+/* tick of the last link dump */
+static uint64_t link_dump_tick;
+
+static void nl_msg(struct nlmsghdr *);
+static void route_msg(struct nlmsghdr *);
+
+/*
+ * Open a netlink route socket and join the given groups.
+ */
+static int
+nl_open(uint32_t groups, int rcvbuf)
+{
+	struct sockaddr_nl sa;
+	int s;
+
+	if ((s = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1) {
+		syslog(LOG_ERR, "netlink socket: %m");
+		return (-1);
+	}
+	if (rcvbuf != 0 && setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+	    sizeof(rcvbuf)) == -1)
+		syslog(LOG_WARNING, "netlink SO_RCVBUF: %m");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		syslog(LOG_ERR, "netlink bind: %m");
+		(void)close(s);
+		return (-1);
+	}
+	return (s);
+}
+
+/*
+ * Split the attributes of a message.
+ */
+static void
+nl_parse(struct rtattr **tb, u_int max, struct rtattr *rta, int len)
+{
+	memset(tb, 0, sizeof(*tb) * (max + 1));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type <= max)
+			tb[rta->rta_type] = rta;
+}
+
+/*
+ * Append an attribute to a request.
+ */
+static void
+nl_addattr(struct nlmsghdr *nlh, u_short type, const void *data, size_t len)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *)(void *)((char *)nlh +
+	    NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/*
+ * Send a request and process the answer. All data messages are handed
+ * to func. Returns 0 when a dump is complete or the request was
+ * acknowledged and -1 with errno set otherwise. Requests cannot be nested;
+ * this may happen, if a new interface found during a dump is handed to
+ * another module which asks for fresh data.
+ */
+static int
+nl_request(struct nlmsghdr *nlh, void (*func)(struct nlmsghdr *))
+{
+	static u_char buf[NL_BUFSIZE];
+	struct sockaddr_nl sa;
+	struct nlmsghdr *m;
+	struct nlmsgerr *e;
+	ssize_t n;
+	int len, ret;
+
+	if (nl_busy) {
+		errno = EBUSY;
+		return (-1);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	nlh->nlmsg_seq = ++nl_seq;
+	if (sendto(nl_req, nlh, nlh->nlmsg_len, 0, (struct sockaddr *)&sa,
+	    sizeof(sa)) == -1) {
+		syslog(LOG_ERR, "netlink send: %m");
+		return (-1);
+	}
+
+	nl_busy = 1;
+	ret = -1;
+	for (;;) {
+		if ((n = recv(nl_req, buf, sizeof(buf), 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "netlink recv: %m");
+			goto out;
+		}
+		len = n;
+		for (m = (struct nlmsghdr *)(void *)buf; NLMSG_OK(m, len);
+		    m = NLMSG_NEXT(m, len)) {
+			if (m->nlmsg_seq != nl_seq)
+				/* answer to an earlier request */
+				continue;
+			if (m->nlmsg_type == NLMSG_DONE) {
+				ret = 0;
+				goto out;
+			}
+			if (m->nlmsg_type == NLMSG_ERROR) {
+				e = NLMSG_DATA(m);
+				if (e->error == 0)
+					ret = 0;
+				else
+					errno = -e->error;
+				goto out;
+			}
+			(*func)(m);
+			if (!(m->nlmsg_flags & NLM_F_MULTI)) {
+				ret = 0;
+				goto out;
+			}
+		}
+	}
+  out:
+	nl_busy = 0;
+	return (ret);
+}
+
+/*
+ * Dump a table. All the request headers start with the family.
+ */
+static int
+nl_dump(u_short type, size_t hdrlen, u_char family,
+    void (*func)(struct nlmsghdr *))
+{
+	struct {
+		struct nlmsghdr	hdr;
+		u_char		body[sizeof(struct ifinfomsg)];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(hdrlen);
+	req.hdr.nlmsg_type = type;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.body[0] = family;
+
+	return (nl_request(&req.hdr, func));
+}
+
+/*
+ * Map the hardware type to ifType.
+ */
+static u_char
+link_type(u_short type)
+{
+	switch (type) {
+
+	  case ARPHRD_ETHER:
+		return (IFT_ETHER);
+
+	  case ARPHRD_LOOPBACK:
+		return (IFT_LOOP);
+
+	  case ARPHRD_PPP:
+		return (IFT_PPP);
+
+	  case ARPHRD_SLIP:
+	  case ARPHRD_CSLIP:
+		return (IFT_SLIP);
+
+	  case ARPHRD_IEEE802_TR:
+		return (IFT_ISO88025);
+
+	  case ARPHRD_FDDI:
+		return (IFT_FDDI);
+
+	  case ARPHRD_ARCNET:
+		return (IFT_ARCNET);
+
+	  case ARPHRD_ATM:
+		return (IFT_ATM);
+
+	  case ARPHRD_IEEE80211:
+	  case ARPHRD_IEEE80211_PRISM:
+	  case ARPHRD_IEEE80211_RADIOTAP:
+		return (IFT_IEEE80211);
+
+	  case ARPHRD_IEEE1394:
+		return (IFT_IEEE1394);
+
+	  case ARPHRD_INFINIBAND:
+		return (IFT_INFINIBAND);
+
+	  case ARPHRD_TUNNEL:
+	  case ARPHRD_TUNNEL6:
+	  case ARPHRD_SIT:
+	  case ARPHRD_IPGRE:
+		return (IFT_TUNNEL);
+	}
+	return (IFT_OTHER);
+}
+
+/*
+ * Read the link speed. The kernel has it only from the driver via sysfs.
+ */
+static u_long
+link_speed(const struct mibif *ifp)
+{
+	char path[sizeof("/sys/class/net//speed") + IFNAMSIZ];
+	FILE *fp;
+	long mbps;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/speed", ifp->name);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (0);
+	if (fscanf(fp, "%ld", &mbps) != 1 || mbps <= 0)
+		mbps = 0;
+	(void)fclose(fp);
+
+	if ((u_long)mbps > ULONG_MAX / 1000000)
+		return (ULONG_MAX);
+	return ((u_long)mbps * 1000000);
+}
+
+/*
+ * Virtual interfaces (those with a link kind) come and go like cloned
+ * interfaces on BSD. Make their name prefix dynamic.
+ */
+static void
+link_set_dyn(const char *name)
+{
+	char prefix[IFNAMSIZ];
+	size_t len;
+
+	for (len = 0; name[len] != '\0' && isalpha(name[len]); len++)
+		prefix[len] = name[len];
+	if (len == 0)
+		return;
+	prefix[len] = '\0';
+	mib_if_set_dyn(prefix);
+}
+
+/*
+ * Update an interface from a link message.
+ */
+static void
+link_update(struct mibif *ifp, const struct ifinfomsg *ifi,
+    struct rtattr **tb)
+{
+	struct mibif_private *p = ifp->private;
+	struct if_data *d = &ifp->mib.ifmd_data;
+	struct rtnl_link_stats64 st;
+	struct rtnl_link_stats st32;
+	u_char old_state = d->ifi_link_state;
+	int old_flags = ifp->mib.ifmd_flags;
+	int have_stats;
+
+	ifp->mib.ifmd_flags = ifi->ifi_flags;
+	d->ifi_type = link_type(ifi->ifi_type);
+
+	if (tb[IFLA_MTU] != NULL && RTA_PAYLOAD(tb[IFLA_MTU]) >= sizeof(uint32_t))
+		d->ifi_mtu = *(uint32_t *)RTA_DATA(tb[IFLA_MTU]);
+
+	/* the loopback has an all-zero address, BSD shows none */
+	if (tb[IFLA_ADDRESS] != NULL && ifi->ifi_type != ARPHRD_LOOPBACK)
+		mib_set_physaddr(ifp, RTA_DATA(tb[IFLA_ADDRESS]),
+		    RTA_PAYLOAD(tb[IFLA_ADDRESS]));
+
+	d->ifi_link_state = LINK_STATE_UNKNOWN;
+	if (tb[IFLA_OPERSTATE] != NULL) {
+		switch (*(u_char *)RTA_DATA(tb[IFLA_OPERSTATE])) {
+
+		  case IF_OPER_UP:
+			d->ifi_link_state = LINK_STATE_UP;
+			break;
+
+		  case IF_OPER_DOWN:
+		  case IF_OPER_LOWERLAYERDOWN:
+		  case IF_OPER_NOTPRESENT:
+			d->ifi_link_state = LINK_STATE_DOWN;
+			break;
+
+		  case IF_OPER_UNKNOWN:
+			/* loopback and many virtual drivers */
+			if (ifi->ifi_flags & IFF_LOWER_UP)
+				d->ifi_link_state = LINK_STATE_UP;
+			break;
+		}
+	}
+
+	/* older kernels may send a shorter structure */
+	have_stats = 0;
+	if (tb[IFLA_STATS64] != NULL) {
+		memset(&st, 0, sizeof(st));
+		memcpy(&st, RTA_DATA(tb[IFLA_STATS64]),
+		    MIN(RTA_PAYLOAD(tb[IFLA_STATS64]), sizeof(st)));
+		have_stats = 1;
+	} else if (tb[IFLA_STATS] != NULL) {
+		memset(&st32, 0, sizeof(st32));
+		memcpy(&st32, RTA_DATA(tb[IFLA_STATS]),
+		    MIN(RTA_PAYLOAD(tb[IFLA_STATS]), sizeof(st32)));
+		memset(&st, 0, sizeof(st));
+		st.rx_packets = st32.rx_packets;
+		st.tx_packets = st32.tx_packets;
+		st.rx_bytes = st32.rx_bytes;
+		st.tx_bytes = st32.tx_bytes;
+		st.rx_errors = st32.rx_errors;
+		st.tx_errors = st32.tx_errors;
+		st.rx_dropped = st32.rx_dropped;
+		st.tx_dropped = st32.tx_dropped;
+		st.multicast = st32.multicast;
+		st.rx_nohandler = st32.rx_nohandler;
+		have_stats = 1;
+	}
+	if (have_stats) {
+		p->hc_inoctets = st.rx_bytes;
+		p->hc_outoctets = st.tx_bytes;
+		p->hc_ipackets = st.rx_packets;
+		p->hc_opackets = st.tx_packets;
+		p->hc_imcasts = st.multicast;
+		p->hc_omcasts = 0;
+
+		d->ifi_ibytes = st.rx_bytes;
+		d->ifi_obytes = st.tx_bytes;
+		d->ifi_ipackets = st.rx_packets;
+		d->ifi_opackets = st.tx_packets;
+		d->ifi_imcasts = st.multicast;
+		d->ifi_omcasts = 0;
+		d->ifi_ierrors = st.rx_errors;
+		d->ifi_oerrors = st.tx_errors;
+		d->ifi_iqdrops = st.rx_dropped;
+		d->ifi_noproto = st.rx_nohandler;
+		ifp->mib.ifmd_snd_drops = st.tx_dropped;
+	}
+
+	if (d->ifi_link_state != old_state ||
+	    ((ifi->ifi_flags ^ old_flags) & (IFF_UP | IFF_RUNNING))) {
+		(void)gettimeofday(&d->ifi_lastchange, NULL);
+		d->ifi_baudrate = link_speed(ifp);
+	}
+
+	/*
+	 * Quoting RFC2863, 3.1.15: "... LinkUp and linkDown traps are
+	 * generated just after ifOperStatus leaves, or just before it
+	 * enters, the down state, respectively;"
+	 */
+	if (ifp->trap_enable && d->ifi_link_state != old_state &&
+	    (d->ifi_link_state == LINK_STATE_DOWN ||
+	    old_state == LINK_STATE_DOWN))
+		mib_link_trap(ifp, d->ifi_link_state == LINK_STATE_UP ? 1 : 0);
+
+	ifp->flags &= ~(MIBIF_HIGHSPEED | MIBIF_VERYHIGHSPEED);
+	if (d->ifi_baudrate > 20000000) {
+		ifp->flags |= MIBIF_HIGHSPEED;
+		if (d->ifi_baudrate > 650000000)
+			ifp->flags |= MIBIF_VERYHIGHSPEED;
+	}
+	if (d->ifi_baudrate > mibif_maxspeed)
+		mibif_maxspeed = d->ifi_baudrate;
+
+	ifp->mibtick = get_ticks();
+}
+
+/*
+ * RTM_NEWLINK or RTM_DELLINK
+ */
+static void
+link_msg(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct mibif *ifp;
+	const char *name;
+	int created;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return;
+	nl_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+
+	ifp = mib_find_if_sys(ifi->ifi_index);
+
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		if (ifp != NULL)
+			mibif_free(ifp);
+		return;
+	}
+
+	created = 0;
+	if (ifp == NULL) {
+		if (tb[IFLA_IFNAME] == NULL)
+			return;
+		name = RTA_DATA(tb[IFLA_IFNAME]);
+		if (strnlen(name, RTA_PAYLOAD(tb[IFLA_IFNAME])) >= IFNAMSIZ)
+			return;
+		if (tb[IFLA_LINKINFO] != NULL)
+			link_set_dyn(name);
+		if ((ifp = mibif_create(ifi->ifi_index, name)) == NULL)
+			return;
+		created = 1;
+	}
+	ifp->flags |= MIBIF_FOUND;
+	link_update(ifp, ifi, tb);
+
+	if (created) {
+		mib_check_llbcast(ifp);
+		mib_notify_newif(ifp);
+	}
+}
+
+/*
+ * RTM_NEWADDR or RTM_DELADDR
+ */
+static void
+addr_msg(struct nlmsghdr *nlh)
+{
+	struct ifaddrmsg *ifam = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFA_MAX + 1];
+	struct rtattr *a;
+	struct in_addr addr;
+	struct mibif *ifp;
+	struct mibifa *ifa;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifam)) ||
+	    ifam->ifa_family != AF_INET)
+		return;
+	nl_parse(tb, IFA_MAX, IFA_RTA(ifam), IFA_PAYLOAD(nlh));
+
+	/* on point-to-point links IFA_ADDRESS is the peer */
+	if ((a = tb[IFA_LOCAL]) == NULL && (a = tb[IFA_ADDRESS]) == NULL)
+		return;
+	if (RTA_PAYLOAD(a) != sizeof(addr))
+		return;
+	memcpy(&addr, RTA_DATA(a), sizeof(addr));
+
+	if (nlh->nlmsg_type == RTM_DELADDR) {
+		if ((ifa = mib_find_ifa(addr)) != NULL) {
+			ifa->flags |= MIBIFA_FOUND;
+			if (!(ifa->flags & MIBIFA_DESTROYED))
+				mib_free_ifa(ifa);
+		}
+		return;
+	}
+
+	if ((ifa = mib_find_ifa(addr)) == NULL) {
+		/* unknown address */
+		if ((ifp = mib_find_if_sys(ifam->ifa_index)) == NULL) {
+			syslog(LOG_WARNING, "RTM_NEWADDR for unknown "
+			    "interface %u", ifam->ifa_index);
+			return;
+		}
+		if ((ifa = mib_alloc_ifa(ifp->index, addr)) == NULL)
+			return;
+	}
+	if (ifam->ifa_prefixlen == 0)
+		ifa->inmask.s_addr = 0;
+	else
+		ifa->inmask.s_addr = htonl(0xffffffffU <<
+		    (32 - MIN(ifam->ifa_prefixlen, 32)));
+
+	if ((a = tb[IFA_BROADCAST]) != NULL && RTA_PAYLOAD(a) == sizeof(addr))
+		memcpy(&ifa->inbcast, RTA_DATA(a), sizeof(addr));
+
+	ifa->flags |= MIBIFA_FOUND;
+}
+
+/*
+ * RTM_NEWNEIGH or RTM_DELNEIGH
+ */
+static void
+neigh_msg(struct nlmsghdr *nlh)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct rtattr *tb[NDA_MAX + 1];
+	struct rtattr *ll;
+	struct in_addr addr;
+	struct mibif *ifp;
+	struct mibarp *at;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm)) ||
+	    ndm->ndm_family != AF_INET)
+		return;
+	nl_parse(tb, NDA_MAX, NDA_RTA(ndm), NDA_PAYLOAD(nlh));
+
+	if (tb[NDA_DST] == NULL || RTA_PAYLOAD(tb[NDA_DST]) != sizeof(addr))
+		return;
+	memcpy(&addr, RTA_DATA(tb[NDA_DST]), sizeof(addr));
+
+	if ((ifp = mib_find_if_sys(ndm->ndm_ifindex)) == NULL)
+		return;
+	at = mib_find_arp(ifp, addr);
+
+	ll = tb[NDA_LLADDR];
+	if (nlh->nlmsg_type == RTM_DELNEIGH || ll == NULL ||
+	    RTA_PAYLOAD(ll) == 0 || RTA_PAYLOAD(ll) > sizeof(at->phys) ||
+	    (ndm->ndm_state & (NUD_INCOMPLETE | NUD_FAILED | NUD_NOARP))) {
+		if (at != NULL)
+			mib_arp_delete(at);
+		return;
+	}
+
+	if (at == NULL) {
+		if ((at = mib_arp_create(ifp, addr, RTA_DATA(ll),
+		    RTA_PAYLOAD(ll))) == NULL)
+			return;
+	} else {
+		/* the hardware address may change */
+		at->physlen = RTA_PAYLOAD(ll);
+		memcpy(at->phys, RTA_DATA(ll), at->physlen);
+	}
+
+	if (ndm->ndm_state & NUD_PERMANENT)
+		at->flags |= MIBARP_PERM;
+	else
+		at->flags &= ~MIBARP_PERM;
+	at->flags |= MIBARP_FOUND;
+}
+
+/*
+ * Add or delete one next hop of a route.
+ */
+static void
+route_nexthop(int add, const struct rtmsg *rtm, uint32_t dst,
+    const struct rtattr *gwattr, int oif)
+{
+	const struct mibif *ifp;
+	uint32_t gw;
+	u_int type, proto;
+
+	gw = 0;
+	if (gwattr != NULL && RTA_PAYLOAD(gwattr) == sizeof(struct in_addr))
+		gw = ntohl(((const struct in_addr *)RTA_DATA(gwattr))->s_addr);
+
+	if (!add) {
+		mib_sroute_del(dst, rtm->rtm_dst_len, gw);
+		return;
+	}
+
+	if ((ifp = mib_find_if_sys(oif)) == NULL && oif != 0)
+		mib_iflist_bad = 1;
+
+	if (rtm->rtm_type != RTN_UNICAST)
+		type = 2;		/* reject */
+	else if (gw == 0)
+		type = 3;		/* local */
+	else
+		type = 4;		/* remote */
+
+	switch (rtm->rtm_protocol) {
+
+	  case RTPROT_KERNEL:
+		proto = 2;		/* local */
+		break;
+	  case RTPROT_BOOT:
+	  case RTPROT_STATIC:
+		proto = 3;		/* netmgmt */
+		break;
+	  case RTPROT_REDIRECT:
+		proto = 4;		/* icmp */
+		break;
+	  default:
+		proto = 1;		/* other */
+		break;
+	}
+	mib_sroute_add(dst, rtm->rtm_dst_len, gw, ifp, type, proto);
+}
+
+/*
+ * Route message. Only the IPv4 routes of the main table are used. Each
+ * next hop of a multipath route is a row in the table.
+ */
+static void
+route_msg(struct nlmsghdr *nlh)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct rtattr *tb[RTA_MAX + 1];
+	struct rtattr *nhtb[RTA_MAX + 1];
+	struct rtnexthop *nh;
+	uint32_t dst, table;
+	int len, oif;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm)) ||
+	    rtm->rtm_family != AF_INET)
+		return;
+	nl_parse(tb, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+
+	table = rtm->rtm_table;
+	if (tb[RTA_TABLE] != NULL)
+		table = *(uint32_t *)RTA_DATA(tb[RTA_TABLE]);
+	if (table != RT_TABLE_MAIN)
+		return;
+	switch (rtm->rtm_type) {
+
+	  case RTN_UNICAST:
+	  case RTN_UNREACHABLE:
+	  case RTN_PROHIBIT:
+	  case RTN_BLACKHOLE:
+		break;
+	  default:
+		return;
+	}
+
+	dst = 0;
+	if (tb[RTA_DST] != NULL)
+		dst = ntohl(((struct in_addr *)RTA_DATA(tb[RTA_DST]))->s_addr);
+
+	if (tb[RTA_MULTIPATH] == NULL) {
+		oif = 0;
+		if (tb[RTA_OIF] != NULL)
+			oif = *(int *)RTA_DATA(tb[RTA_OIF]);
+		route_nexthop(nlh->nlmsg_type == RTM_NEWROUTE, rtm, dst,
+		    tb[RTA_GATEWAY], oif);
+		return;
+	}
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	while (len >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+	    nh->rtnh_len <= len) {
+		nl_parse(nhtb, RTA_MAX, RTNH_DATA(nh),
+		    nh->rtnh_len - RTNH_LENGTH(0));
+		route_nexthop(nlh->nlmsg_type == RTM_NEWROUTE, rtm, dst,
+		    nhtb[RTA_GATEWAY], nh->rtnh_ifindex);
+		len -= RTNH_ALIGN(nh->rtnh_len);
+		nh = RTNH_NEXT(nh);
+	}
+}
+
+/*
+ * Handle a message from a dump or an event.
+ */
+static void
+nl_msg(struct nlmsghdr *nlh)
+{
+	switch (nlh->nlmsg_type) {
+
+	  case RTM_NEWLINK:
+	  case RTM_DELLINK:
+		link_msg(nlh);
+		break;
+
+	  case RTM_NEWADDR:
+	  case RTM_DELADDR:
+		addr_msg(nlh);
+		break;
+
+	  case RTM_NEWNEIGH:
+	  case RTM_DELNEIGH:
+		neigh_msg(nlh);
+		break;
+
+	  case RTM_NEWROUTE:
+	  case RTM_DELROUTE:
+		route_msg(nlh);
+		break;
+	}
+}
+
+/*
+ * Input on the event socket.
+ */
+static void
+nl_input(int fd, void *udata __unused)
+{
+	static u_char buf[NL_BUFSIZE];
+	struct nlmsghdr *nlh;
+	ssize_t n;
+	int len;
+
+	if ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) == -1) {
+		if (errno == ENOBUFS) {
+			/* we have lost events */
+			mib_iflist_bad = 1;
+			return;
+		}
+		if (errno != EAGAIN && errno != EINTR)
+			syslog(LOG_ERR, "netlink events: %m");
+		return;
+	}
+
+	len = n;
+	for (nlh = (struct nlmsghdr *)(void *)buf; NLMSG_OK(nlh, len);
+	    nlh = NLMSG_NEXT(nlh, len))
+		nl_msg(nlh);
+}
+
+/*
+ * Fetch all interfaces and their counters with one dump.
+ */
+static int
+link_dump(void)
+{
+	if (nl_dump(RTM_GETLINK, sizeof(struct ifinfomsg), AF_UNSPEC,
+	    nl_msg) == -1)
+		return (-1);
+	link_dump_tick = get_ticks();
+	return (0);
+}
+
+/*
+ * Fetch new MIB data. All interfaces are updated with the first call for
+ * a PDU; later calls (for example after changing the admin status) ask
+ * only for the given interface.
+ */
+int
+mib_fetch_ifmib(struct mibif *ifp)
+{
+	struct {
+		struct nlmsghdr	hdr;
+		struct ifinfomsg ifi;
+	} req;
+
+	if (link_dump_tick < this_tick)
+		return (link_dump());
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.hdr.nlmsg_type = RTM_GETLINK;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifp->sysindex;
+
+	return (nl_request(&req.hdr, nl_msg));
+}
+
+/*
+ * The kernel counters are 64 bits wide and are read with each link dump,
+ * so there is nothing to poll.
+ */
+void
+mibif_reset_hc_timer(void)
+{
+	mibif_hc_update_interval = 0;
+}
+
+/*
+ * Retrieve the current interface list from the system.
+ */
+void
+mib_refresh_iflist(void)
+{
+	struct mibif *ifp, *ifp1;
+
+	TAILQ_FOREACH(ifp, &mibif_list, link)
+		ifp->flags &= ~MIBIF_FOUND;
+
+	if (link_dump() == -1)
+		return;
+
+	/*
+	 * Purge interfaces that disappeared
+	 */
+	ifp = TAILQ_FIRST(&mibif_list);
+	while (ifp != NULL) {
+		ifp1 = TAILQ_NEXT(ifp, link);
+		if (!(ifp->flags & MIBIF_FOUND))
+			mibif_free(ifp);
+		ifp = ifp1;
+	}
+}
+
+/*
+ * Link level multicast addresses are not available via rtnetlink.
+ */
+static void
+mcast_update(void)
+{
+	FILE *fp;
+	char line[512], name[IFNAMSIZ + 1], hex[2 * ASN_MAXOIDLEN + 1];
+	u_char addr[ASN_MAXOIDLEN];
+	u_int sysindex, refs, global;
+	size_t len, i;
+	struct mibif *ifp;
+	struct mibrcvaddr *rcv;
+
+	if ((fp = fopen("/proc/net/dev_mcast", "r")) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%u %16s %u %u %256s", &sysindex, name, &refs,
+		    &global, hex) != 5)
+			continue;
+		if ((len = strlen(hex) / 2) == 0)
+			continue;
+		for (i = 0; i < len; i++)
+			if (sscanf(hex + 2 * i, "%2hhx", &addr[i]) != 1)
+				break;
+		if (i != len)
+			continue;
+
+		if ((ifp = mib_find_if_sys(sysindex)) == NULL)
+			continue;
+		if ((rcv = mib_find_rcvaddr(ifp->index, addr, len)) == NULL) {
+			if ((rcv = mib_rcvaddr_create(ifp, addr, len)) == NULL)
+				continue;
+			rcv->flags |= MIBRCVADDR_VOLATILE;
+		}
+		rcv->flags |= MIBRCVADDR_FOUND;
+	}
+	(void)fclose(fp);
+}
+
+/*
+ * Update the interface addresses and the receive addresses.
+ */
+void
+mib_update_ifa_info(void)
+{
+	struct mibifa *ifa, *ifa1;
+	struct mibrcvaddr *rcv, *rcv1;
+
+	TAILQ_FOREACH(ifa, &mibifa_list, link)
+		ifa->flags &= ~MIBIFA_FOUND;
+	TAILQ_FOREACH(rcv, &mibrcvaddr_list, link)
+		rcv->flags &= ~MIBRCVADDR_FOUND;
+
+	if (nl_dump(RTM_GETADDR, sizeof(struct ifaddrmsg), AF_INET, nl_msg) == -1)
+		return;
+	mcast_update();
+
+	ifa = TAILQ_FIRST(&mibifa_list);
+	while (ifa != NULL) {
+		ifa1 = TAILQ_NEXT(ifa, link);
+		if (!(ifa->flags & MIBIFA_FOUND))
+			mib_free_ifa(ifa);
+		ifa = ifa1;
+	}
+
+	rcv = TAILQ_FIRST(&mibrcvaddr_list);
+	while (rcv != NULL) {
+		rcv1 = TAILQ_NEXT(rcv, link);
+		if (!(rcv->flags & (MIBRCVADDR_FOUND | MIBRCVADDR_BCAST |
+		    MIBRCVADDR_HW)))
+			mib_rcvaddr_delete(rcv);
+		rcv = rcv1;
+	}
+}
+
+/*
+ * Update arp table. The events keep it current; this only catches
+ * entries that have silently expired.
+ */
+int
+mib_arp_update(void)
+{
+	struct mibarp *at;
+
+	if (nl_busy)
+		/* a dump is already running */
+		return (-1);
+
+	for (at = mib_first_arp(); at != NULL; at = mib_next_arp(at))
+		at->flags &= ~MIBARP_FOUND;
+
+	if (nl_dump(RTM_GETNEIGH, sizeof(struct ndmsg), AF_INET, nl_msg) == -1)
+		return (-1);
+
+	mib_arp_sweep();
+	return (0);
+}
+
+/*
+ * Dump the routing table. The routes are handed to mib_sroute_add().
+ */
+int
+mib_route_dump(void)
+{
+	return (nl_dump(RTM_GETROUTE, sizeof(struct rtmsg), AF_INET, nl_msg));
+}
+
+/*
+ * Read the counters of a protocol from /proc/net/snmp. For each protocol
+ * the file has a line with the names of the counters and a line with the
+ * values; both start with the protocol name. The value of each counter
+ * whose name is in the table is stored at the same index in vals, all
+ * other entries are set to 0.
+ */
+int
+mib_proc_snmp(const char *proto, const char *const *names, u_int n,
+    uint32_t *vals)
+{
+	FILE *fp;
+	char hdr[2048], line[2048];
+	char *hp, *vp, *h, *v;
+	size_t plen = strlen(proto);
+	u_int i;
+	int ret = -1;
+
+	if ((fp = fopen("/proc/net/snmp", "r")) == NULL) {
+		syslog(LOG_ERR, "/proc/net/snmp: %m");
+		return (-1);
+	}
+	while (fgets(hdr, sizeof(hdr), fp) != NULL &&
+	    fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(hdr, proto, plen) != 0 || hdr[plen] != ':' ||
+		    strncmp(line, hdr, plen + 1) != 0)
+			continue;
+
+		memset(vals, 0, n * sizeof(vals[0]));
+		h = strtok_r(hdr + plen + 1, " \n", &hp);
+		v = strtok_r(line + plen + 1, " \n", &vp);
+		while (h != NULL && v != NULL) {
+			for (i = 0; i < n; i++)
+				if (names[i] != NULL &&
+				    strcmp(names[i], h) == 0) {
+					/* Counter32 wraps, -1 stays -1 */
+					vals[i] = (uint32_t)strtoll(v, NULL, 10);
+					break;
+				}
+			h = strtok_r(NULL, " \n", &hp);
+			v = strtok_r(NULL, " \n", &vp);
+		}
+		ret = 0;
+		break;
+	}
+	(void)fclose(fp);
+
+	if (ret == -1)
+		syslog(LOG_ERR, "/proc/net/snmp: no %s counters", proto);
+	return (ret);
+}
+
+/*
+ * Read an integer from a file in /proc/sys.
+ */
+int
+mib_proc_getint(const char *path, int *val)
+{
+	FILE *fp;
+	int ret;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		syslog(LOG_ERR, "%s: %m", path);
+		return (-1);
+	}
+	ret = (fscanf(fp, "%d", val) == 1) ? 0 : -1;
+	(void)fclose(fp);
+
+	if (ret == -1)
+		syslog(LOG_ERR, "%s: bad contents", path);
+	return (ret);
+}
+
+/*
+ * Write an integer to a file in /proc/sys.
+ */
+int
+mib_proc_setint(const char *path, int val)
+{
+	FILE *fp;
+	int ret;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		syslog(LOG_ERR, "set %s: %m", path);
+		return (-1);
+	}
+	ret = (fprintf(fp, "%d\n", val) < 0) ? -1 : 0;
+	if (fclose(fp) == EOF)
+		ret = -1;
+
+	if (ret == -1)
+		syslog(LOG_ERR, "set %s: %m", path);
+	return (ret);
+}
+
+/*
+ * Add or delete an IPv4 address. A prefix length of -1 deletes the address
+ * with any prefix length.
+ */
+static int
+addr_request(u_short type, u_short flags, const struct mibif *ifp,
+    struct in_addr addr, int plen, const struct in_addr *bcast)
+{
+	struct {
+		struct nlmsghdr	hdr;
+		struct ifaddrmsg ifa;
+		u_char		attrs[3 * RTA_SPACE(sizeof(struct in_addr))];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.hdr.nlmsg_type = type;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = (plen == -1) ? 0 : plen;
+	req.ifa.ifa_index = ifp->sysindex;
+
+	nl_addattr(&req.hdr, IFA_LOCAL, &addr, sizeof(addr));
+	if (plen != -1)
+		nl_addattr(&req.hdr, IFA_ADDRESS, &addr, sizeof(addr));
+	if (bcast != NULL && bcast->s_addr != INADDR_ANY)
+		nl_addattr(&req.hdr, IFA_BROADCAST, bcast, sizeof(*bcast));
+	return (nl_request(&req.hdr, nl_msg));
+}
+
+/* the address addr_find() looks for and what it has found */
+static struct {
+	u_int		sysindex;
+	struct in_addr	addr;
+	int		plen;		/* -1 if not found */
+	struct in_addr	bcast;
+} addr_found;
+
+static void
+addr_find_msg(struct nlmsghdr *nlh)
+{
+	struct ifaddrmsg *ifam = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFA_MAX + 1];
+	struct rtattr *a;
+
+	if (nlh->nlmsg_type != RTM_NEWADDR ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifam)) ||
+	    ifam->ifa_family != AF_INET ||
+	    ifam->ifa_index != addr_found.sysindex)
+		return;
+	nl_parse(tb, IFA_MAX, IFA_RTA(ifam), IFA_PAYLOAD(nlh));
+
+	if ((a = tb[IFA_LOCAL]) == NULL || RTA_PAYLOAD(a) !=
+	    sizeof(struct in_addr) || memcmp(RTA_DATA(a), &addr_found.addr,
+	    sizeof(struct in_addr)) != 0)
+		return;
+
+	addr_found.plen = ifam->ifa_prefixlen;
+	addr_found.bcast.s_addr = INADDR_ANY;
+	if ((a = tb[IFA_BROADCAST]) != NULL &&
+	    RTA_PAYLOAD(a) == sizeof(struct in_addr))
+		memcpy(&addr_found.bcast, RTA_DATA(a), sizeof(struct in_addr));
+}
+
+/*
+ * Find the prefix length and broadcast address the kernel has for an
+ * address of an interface. The lists are not touched.
+ */
+static int
+addr_find(const struct mibif *ifp, struct in_addr addr)
+{
+	addr_found.sysindex = ifp->sysindex;
+	addr_found.addr = addr;
+	addr_found.plen = -1;
+
+	return (nl_dump(RTM_GETADDR, sizeof(struct ifaddrmsg), AF_INET,
+	    addr_find_msg));
+}
+
+/*
+ * Set an interface address. Linux identifies addresses by address and
+ * prefix length. If only the broadcast address changes, the address is
+ * replaced in place. If the prefix length changes, the old address must
+ * be removed first, because the kernel may otherwise take the new one for
+ * a secondary of the old one and remove both. If the new address cannot
+ * be set then, the old one is restored.
+ */
+int
+mib_sys_addifa(const struct mibif *ifp, struct in_addr addr,
+    struct in_addr mask, struct in_addr bcast)
+{
+	uint32_t m = ntohl(mask.s_addr);
+	u_int plen;
+	int err;
+
+	for (plen = 0; plen < 32 && (m & (0x80000000U >> plen)); plen++)
+		;
+	if (plen < 32 && (m << plen) != 0) {
+		/* non-contiguous masks are not supported */
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (addr_find(ifp, addr) == -1)
+		return (-1);
+
+	if (addr_found.plen == -1 || (u_int)addr_found.plen == plen)
+		return (addr_request(RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+		    ifp, addr, plen, &bcast));
+
+	if (addr_request(RTM_DELADDR, 0, ifp, addr, addr_found.plen,
+	    NULL) == -1)
+		return (-1);
+	if (addr_request(RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, ifp,
+	    addr, plen, &bcast) == -1) {
+		err = errno;
+		if (addr_request(RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, ifp,
+		    addr, addr_found.plen, &addr_found.bcast) == -1) {
+			syslog(LOG_ERR, "cannot restore address %s: %m",
+			    inet_ntoa(addr));
+			mib_iflist_bad = 1;
+		}
+		errno = err;
+		return (-1);
+	}
+	return (0);
+}
+
+int
+mib_sys_delifa(const struct mibif *ifp, struct in_addr addr)
+{
+	return (addr_request(RTM_DELADDR, 0, ifp, addr, -1, NULL));
+}
+
+/*
+ * The kernel has acknowledged the change.
+ */
+int
+mib_sys_verifyifa(const struct mibif *ifp __unused,
+    const struct mibifa *ifa __unused)
+{
+	return (0);
+}
+
+/*
+ * There are no cloners. Virtual interfaces are detected by their link
+ * kind in link_msg().
+ */
+void
+mib_get_cloners(void)
+{
+}
+
+/*
+ * Open the netlink sockets.
+ */
+int
+mib_sys_init(struct lmodule *mod)
+{
+	module = mod;
+
+	clockinfo.hz = sysconf(_SC_CLK_TCK);
+	clockinfo.tick = 1000000 / clockinfo.hz;
+	clockinfo.stathz = clockinfo.hz;
+	clockinfo.profhz = clockinfo.hz;
+
+	if ((nl_req = nl_open(0, 0)) == -1)
+		return (-1);
+	if ((nl_event = nl_open(RTMGRP_LINK | RTMGRP_IPV4_IFADDR |
+	    RTMGRP_IPV4_ROUTE | RTMGRP_NEIGH, 1024 * 1024)) == -1) {
+		(void)close(nl_req);
+		nl_req = -1;
+		return (-1);
+	}
+	return (0);
+}
+
+int
+mib_sys_start(void)
+{
+	if ((nl_event_fd = fd_select(nl_event, nl_input, NULL,
+	    module)) == NULL) {
+		syslog(LOG_ERR, "fd_select(netlink): %m");
+		return (-1);
+	}
+	return (0);
+}
+
+void
+mib_sys_fini(void)
+{
+	if (nl_event_fd != NULL)
+		fd_deselect(nl_event_fd);
+	if (nl_event != -1)
+		(void)close(nl_event);
+	if (nl_req != -1)
+		(void)close(nl_req);
+}
+
+/*
+ * Nothing to do - the events keep the lists up to date.
+ */
+void
+mib_sys_idle(void)
+{
+}
+
+#endif /* __linux__ */
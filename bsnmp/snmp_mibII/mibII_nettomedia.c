@@ -30,33 +30,93 @@
  *
  * Read-only implementation of the Arp table (ipNetToMediaTable)
  *
- * The problem with the table is, that we don't receive routing message
- * when a) an arp table entry is resolved and b) when an arp table entry is
- * deleted automatically. Therefor we need to poll the table from time to
- * time.
+ * The entries are kept in a tree ordered by ifindex and address, which
+ * is the table's index. The routing socket or netlink messages add and
+ * remove single entries. Older kernels do not send messages when an entry
+ * is resolved or expires, so the whole table is still dumped from time to
+ * time through the "mibII.arp" refresh cache to catch these.
  */
 #include "mibII.h"
 #include "mibII_oid.h"
 
-#define ARPREFRESH	30
+#define	ARP_UPDATE_INTERVAL	(100 * 60)	/* 1 min */
+static struct snmp_refresh *arp_refresh;
+
+/* the key of an entry */
+#define	ARP_KEY(AT)	(((uint64_t)(AT)->ifindex << 32) | (AT)->addr)
+
+static RB_HEAD(mibarp_tree, mibarp) mibarp_tree =
+    RB_INITIALIZER(&mibarp_tree);
+
+static int
+mibarp_compare(struct mibarp *a1, struct mibarp *a2)
+{
+
+	if (ARP_KEY(a1) < ARP_KEY(a2))
+		return (-1);
+	if (ARP_KEY(a1) > ARP_KEY(a2))
+		return (+1);
+	return (0);
+}
+
+RB_PROTOTYPE(mibarp_tree, mibarp, link, mibarp_compare);
+RB_GENERATE(mibarp_tree, mibarp, link, mibarp_compare);
+
+/*
+ * Find the first entry with a key larger than (or equal to, if strict is
+ * not set) the given one. There is no RB_ macro for this.
+ */
+static struct mibarp *
+arp_bound(uint64_t key, int strict)
+{
+	struct mibarp *at, *best;
+
+	best = NULL;
+	at = RB_ROOT(&mibarp_tree);
+	while (at != NULL) {
+		if (ARP_KEY(at) > key || (!strict && ARP_KEY(at) == key)) {
+			best = at;
+			at = RB_LEFT(at, link);
+		} else
+			at = RB_RIGHT(at, link);
+	}
+	return (best);
+}
+
+/*
+ * Find the entry following the given index. Address parts larger than
+ * 255 are handled by skipping all entries with the preceding parts.
+ */
+static struct mibarp *
+arp_getnext(const struct asn_oid *oid, u_int sub)
+{
+	uint64_t key;
+	u_int i;
+
+	if (oid->len == sub)
+		return (RB_MIN(mibarp_tree, &mibarp_tree));
+
+	key = (uint64_t)oid->subs[sub] << 32;
+	for (i = 1; i < 5; i++) {
+		if (sub + i >= oid->len)
+			return (arp_bound(key, 0));
+		if (oid->subs[sub + i] > 0xff) {
+			key |= 0xffffffffU >> (8 * (i - 1));
+			return (arp_bound(key, 1));
+		}
+		key |= (uint64_t)oid->subs[sub + i] << (8 * (4 - i));
+	}
+	return (arp_bound(key, 1));
+}
 
 struct mibarp *
 mib_find_arp(const struct mibif *ifp, struct in_addr in)
 {
-	struct mibarp *at;
-	uint32_t a = ntohl(in.s_addr);
-
-	if (get_ticks() >= mibarpticks + ARPREFRESH)
-		mib_arp_update();
-
-	TAILQ_FOREACH(at, &mibarp_list, link)
-		if (at->index.subs[0] == ifp->index &&
-		    (at->index.subs[1] == ((a >> 24) & 0xff)) &&
-		    (at->index.subs[2] == ((a >> 16) & 0xff)) &&
-		    (at->index.subs[3] == ((a >>  8) & 0xff)) &&
-		    (at->index.subs[4] == ((a >>  0) & 0xff)))
-			return (at);
-	return (NULL);
+	struct mibarp key;
+
+	key.ifindex = ifp->index;
+	key.addr = ntohl(in.s_addr);
+	return (RB_FIND(mibarp_tree, &mibarp_tree, &key));
 }
 
 struct mibarp *
@@ -64,23 +124,21 @@ mib_arp_create(const struct mibif *ifp, struct in_addr in, const u_char *phys,
     size_t physlen)
 {
 	struct mibarp *at;
-	uint32_t a = ntohl(in.s_addr);
 
 	if ((at = malloc(sizeof(*at))) == NULL)
 		return (NULL);
 	at->flags = 0;
 
-	at->index.len = 5;
-	at->index.subs[0] = ifp->index;
-	at->index.subs[1] = (a >> 24) & 0xff;
-	at->index.subs[2] = (a >> 16) & 0xff;
-	at->index.subs[3] = (a >>  8) & 0xff;
-	at->index.subs[4] = (a >>  0) & 0xff;
+	at->ifindex = ifp->index;
+	at->addr = ntohl(in.s_addr);
 	if ((at->physlen = physlen) > sizeof(at->phys))
 		at->physlen = sizeof(at->phys);
 	memcpy(at->phys, phys, at->physlen);
 
-	INSERT_OBJECT_OID(at, &mibarp_list);
+	if (RB_INSERT(mibarp_tree, &mibarp_tree, at) != NULL) {
+		free(at);
+		return (NULL);
+	}
 
 	return (at);
 }
@@ -88,38 +146,129 @@ mib_arp_create(const struct mibif *ifp, struct in_addr in, const u_char *phys,
 void
 mib_arp_delete(struct mibarp *at)
 {
-	TAILQ_REMOVE(&mibarp_list, at, link);
+	RB_REMOVE(mibarp_tree, &mibarp_tree, at);
 	free(at);
 }
 
+/*
+ * Delete all entries of an interface
+ */
+void
+mib_arp_purge(const struct mibif *ifp)
+{
+	struct mibarp *at, *at1;
+
+	at = arp_bound((uint64_t)ifp->index << 32, 0);
+	while (at != NULL && at->ifindex == ifp->index) {
+		at1 = RB_NEXT(mibarp_tree, &mibarp_tree, at);
+		mib_arp_delete(at);
+		at = at1;
+	}
+}
+
+/*
+ * Iterate over all entries
+ */
+struct mibarp *
+mib_first_arp(void)
+{
+	return (RB_MIN(mibarp_tree, &mibarp_tree));
+}
+
+struct mibarp *
+mib_next_arp(struct mibarp *at)
+{
+	return (RB_NEXT(mibarp_tree, &mibarp_tree, at));
+}
+
+/*
+ * Delete all entries that were not seen by a dump
+ */
+void
+mib_arp_sweep(void)
+{
+	struct mibarp *at, *at1;
+
+	at = RB_MIN(mibarp_tree, &mibarp_tree);
+	while (at != NULL) {
+		at1 = RB_NEXT(mibarp_tree, &mibarp_tree, at);
+		if (!(at->flags & MIBARP_FOUND))
+			mib_arp_delete(at);
+		at = at1;
+	}
+}
+
+static int
+fetch_arp(void *arg __unused)
+{
+	return (mib_arp_update());
+}
+
+int
+mib_arp_init(struct lmodule *mod)
+{
+	arp_refresh = refresh_register("mibII.arp", ARP_UPDATE_INTERVAL,
+	    fetch_arp, NULL, mod);
+	return (arp_refresh == NULL ? -1 : 0);
+}
+
+void
+mib_arp_fini(void)
+{
+	refresh_unregister(arp_refresh);
+	arp_refresh = NULL;
+}
+
+int
+mib_fetch_arp(void)
+{
+	return (refresh_check(arp_refresh));
+}
+
 int
 op_nettomedia(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int iidx __unused, enum snmp_op op)
 {
 	struct mibarp *at;
+	struct mibarp key;
+	u_int i;
 
 	at = NULL;	/* gcc */
 
-	if (get_ticks() >= mibarpticks + ARPREFRESH)
-		mib_arp_update();
+	if (mib_fetch_arp() == -1)
+		return (SNMP_ERR_GENERR);
 
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
-		if ((at = NEXT_OBJECT_OID(&mibarp_list, &value->var, sub)) == NULL)
+		if ((at = arp_getnext(&value->var, sub)) == NULL)
 			return (SNMP_ERR_NOSUCHNAME);
-		index_append(&value->var, sub, &at->index);
+		value->var.len = sub + 5;
+		value->var.subs[sub] = at->ifindex;
+		for (i = 1; i < 5; i++)
+			value->var.subs[sub + i] =
+			    (at->addr >> (8 * (4 - i))) & 0xff;
 		break;
 
 	  case SNMP_OP_GET:
-		if ((at = FIND_OBJECT_OID(&mibarp_list, &value->var, sub)) == NULL)
-			return (SNMP_ERR_NOSUCHNAME);
-		break;
-
 	  case SNMP_OP_SET:
-		if ((at = FIND_OBJECT_OID(&mibarp_list, &value->var, sub)) == NULL)
-			return (SNMP_ERR_NO_CREATION);
-		return (SNMP_ERR_NOT_WRITEABLE);
+		if (value->var.len - sub != 5)
+			return (op == SNMP_OP_GET ? SNMP_ERR_NOSUCHNAME :
+			    SNMP_ERR_NO_CREATION);
+		key.ifindex = value->var.subs[sub];
+		key.addr = 0;
+		for (i = 1; i < 5; i++) {
+			if (value->var.subs[sub + i] > 0xff)
+				break;
+			key.addr |= value->var.subs[sub + i] << (8 * (4 - i));
+		}
+		if (i < 5 ||
+		    (at = RB_FIND(mibarp_tree, &mibarp_tree, &key)) == NULL)
+			return (op == SNMP_OP_GET ? SNMP_ERR_NOSUCHNAME :
+			    SNMP_ERR_NO_CREATION);
+		if (op == SNMP_OP_SET)
+			return (SNMP_ERR_NOT_WRITEABLE);
+		break;
 
 	  case SNMP_OP_ROLLBACK:
 	  case SNMP_OP_COMMIT:
@@ -129,17 +278,17 @@ op_nettomedia(struct snmp_context *ctx __unused, struct snmp_value *value,
 	switch (value->var.subs[sub - 1]) {
 
 	  case LEAF_ipNetToMediaIfIndex:
-		value->v.integer = at->index.subs[0];
+		value->v.integer = at->ifindex;
 		break;
 
 	  case LEAF_ipNetToMediaPhysAddress:
 		return (string_get(value, at->phys, at->physlen));
 
 	  case LEAF_ipNetToMediaNetAddress:
-		value->v.ipaddress[0] = at->index.subs[1];
-		value->v.ipaddress[1] = at->index.subs[2];
-		value->v.ipaddress[2] = at->index.subs[3];
-		value->v.ipaddress[3] = at->index.subs[4];
+		value->v.ipaddress[0] = at->addr >> 24;
+		value->v.ipaddress[1] = at->addr >> 16;
+		value->v.ipaddress[2] = at->addr >> 8;
+		value->v.ipaddress[3] = at->addr >> 0;
 		break;
 
 	  case LEAF_ipNetToMediaType:
@@ -41,53 +41,208 @@
 #include "mibII.h"
 #include "mibII_oid.h"
 
+/*
+ * A route. The ipCidrRouteTable index (dest, mask, tos, next hop) is
+ * built from the fields when needed. The ToS is always 0 and the mask
+ * is kept as a prefix length, which keeps the entry at 48 bytes on LP64.
+ */
 struct sroute {
 	RB_ENTRY(sroute) link;
+	uint32_t	dst;		/* host order */
+	uint32_t	gw;		/* host order */
 	uint32_t	ifindex;
-	uint8_t		index[13];
+	uint8_t		plen;
 	uint8_t		type;
 	uint8_t		proto;
+	uint8_t		flags;
 };
+#define	SROUTE_FOUND	0x01
+
 RB_HEAD(sroutes, sroute) sroutes = RB_INITIALIZER(&sroutes);
 
 RB_PROTOTYPE(sroutes, sroute, link, sroute_compare);
 
+/*
+ * Routes are allocated in chunks to save the per allocation overhead
+ * of malloc. Free routes are linked through their left pointer.
+ */
+#define	SROUTE_CHUNK	1024
+
+struct sroute_chunk {
+	SLIST_ENTRY(sroute_chunk) link;
+	struct sroute	routes[SROUTE_CHUNK];
+};
+static SLIST_HEAD(, sroute_chunk) sroute_chunks =
+    SLIST_HEAD_INITIALIZER(sroute_chunks);
+static struct sroute *sroute_free;
+
 #define	ROUTE_UPDATE_INTERVAL	(100 * 60 * 10)	/* 10 min */
-static uint64_t route_tick;
+static struct snmp_refresh *route_refresh;
 static u_int route_total;
 
+#define	PLEN2MASK(P)	((P) == 0 ? 0 : 0xffffffffU << (32 - (P)))
+
 /*
- * Compare two routes
+ * Compare two routes. This is the order of the table index.
  */
 static int
 sroute_compare(struct sroute *s1, struct sroute *s2)
 {
 
-	return (memcmp(s1->index, s2->index, 13));
+	if (s1->dst != s2->dst)
+		return (s1->dst < s2->dst ? -1 : +1);
+	if (s1->plen != s2->plen)
+		return (s1->plen < s2->plen ? -1 : +1);
+	if (s1->gw != s2->gw)
+		return (s1->gw < s2->gw ? -1 : +1);
+	return (0);
+}
+
+/*
+ * Convert a netmask to a prefix length. Return -1 if the mask is not
+ * contiguous.
+ */
+static int
+sroute_plen(uint32_t mask, uint8_t *plen)
+{
+	u_int p;
+
+	for (p = 0; p < 32; p++)
+		if (!(mask & (0x80000000U >> p)))
+			break;
+	if (mask != PLEN2MASK(p))
+		return (-1);
+	*plen = p;
+	return (0);
 }
 
 static void
 sroute_index_append(struct asn_oid *oid, u_int sub, const struct sroute *s)
 {
+	uint32_t mask = PLEN2MASK(s->plen);
 	int i;
 
 	oid->len = sub + 13;
-	for (i = 0; i < 13; i++)
-		oid->subs[sub + i] = s->index[i];
+	for (i = 0; i < 4; i++) {
+		oid->subs[sub + i] = (s->dst >> (24 - 8 * i)) & 0xff;
+		oid->subs[sub + 4 + i] = (mask >> (24 - 8 * i)) & 0xff;
+		oid->subs[sub + 9 + i] = (s->gw >> (24 - 8 * i)) & 0xff;
+	}
+	oid->subs[sub + 8] = 0;
 }
 
-#if 0
 static void
-sroute_print(const struct sroute *r)
+sroute_ipaddress(u_char *ip, uint32_t addr)
 {
+	ip[0] = (addr >> 24) & 0xff;
+	ip[1] = (addr >> 16) & 0xff;
+	ip[2] = (addr >>  8) & 0xff;
+	ip[3] = (addr >>  0) & 0xff;
+}
+
+static struct sroute *
+sroute_alloc(void)
+{
+	struct sroute_chunk *c;
+	struct sroute *r;
 	u_int i;
 
-	for (i = 0; i < 13 - 1; i++)
-		printf("%u.", r->index[i]);
-	printf("%u proto=%u type=%u", r->index[i], r->proto, r->type);
+	if (sroute_free == NULL) {
+		if ((c = malloc(sizeof(*c))) == NULL)
+			return (NULL);
+		SLIST_INSERT_HEAD(&sroute_chunks, c, link);
+		for (i = 0; i < SROUTE_CHUNK; i++) {
+			RB_LEFT(&c->routes[i], link) = sroute_free;
+			sroute_free = &c->routes[i];
+		}
+	}
+	r = sroute_free;
+	sroute_free = RB_LEFT(r, link);
+	return (r);
+}
+
+static void
+sroute_delete(struct sroute *r)
+{
+	RB_REMOVE(sroutes, &sroutes, r);
+	RB_LEFT(r, link) = sroute_free;
+	sroute_free = r;
+	route_total--;
+}
+
+#if defined(DEBUG_ROUTE)
+static void
+sroute_print(const char *what, const struct sroute *r)
+{
+	printf("%s: %u.%u.%u.%u/%u %u.%u.%u.%u proto=%u type=%u\n", what,
+	    r->dst >> 24, (r->dst >> 16) & 0xff, (r->dst >> 8) & 0xff,
+	    r->dst & 0xff, r->plen, r->gw >> 24, (r->gw >> 16) & 0xff,
+	    (r->gw >> 8) & 0xff, r->gw & 0xff, r->proto, r->type);
 }
 #endif
 
+/*
+ * Add a route or update an existing one.
+ */
+void
+mib_sroute_add(uint32_t dst, u_int plen, uint32_t gw, const struct mibif *ifp,
+    u_int type, u_int proto)
+{
+	struct sroute key;
+	struct sroute *r;
+
+	key.dst = dst;
+	key.plen = plen;
+	key.gw = gw;
+	if ((r = RB_FIND(sroutes, &sroutes, &key)) == NULL) {
+		if ((r = sroute_alloc()) == NULL) {
+			syslog(LOG_ERR, "%m");
+			return;
+		}
+		r->dst = dst;
+		r->plen = plen;
+		r->gw = gw;
+		r->flags = 0;
+		RB_INSERT(sroutes, &sroutes, r);
+		route_total++;
+	}
+
+	r->ifindex = (ifp == NULL) ? 0 : ifp->index;
+	r->type = type;
+	r->proto = proto;
+
+	r->flags |= SROUTE_FOUND;
+#if defined(DEBUG_ROUTE)
+	sroute_print("ADD/GET", r);
+#endif
+}
+
+/*
+ * Delete a route.
+ */
+void
+mib_sroute_del(uint32_t dst, u_int plen, uint32_t gw)
+{
+	struct sroute key;
+	struct sroute *r;
+
+	key.dst = dst;
+	key.plen = plen;
+	key.gw = gw;
+	key.type = key.proto = key.flags = 0;
+	if ((r = RB_FIND(sroutes, &sroutes, &key)) == NULL) {
+#if defined(DEBUG_ROUTE)
+		sroute_print("DELETE not found", &key);
+#endif
+		return;
+	}
+#if defined(DEBUG_ROUTE)
+	sroute_print("DELETE", r);
+#endif
+	sroute_delete(r);
+}
+
+#if !defined(__linux__)
 /*
  * process routing message
  */
@@ -98,9 +253,7 @@ mib_sroute_process(struct rt_msghdr *rtm, struct sockaddr *gw,
 	struct sockaddr_in *in_dst, *in_gw;
 	struct in_addr in_mask;
 	struct mibif *ifp;
-	struct sroute key;
-	struct sroute *r, *r1;
-	in_addr_t ha;
+	uint8_t plen;
 
 	if (dst == NULL || gw == NULL || dst->sa_family != AF_INET ||
 	    gw->sa_family != AF_INET)
@@ -116,54 +269,15 @@ mib_sroute_process(struct rt_msghdr *rtm, struct sockaddr *gw,
 	else
 		in_mask = ((struct sockaddr_in *)(void *)mask)->sin_addr;
 
-	/* build the index */
-	ha = ntohl(in_dst->sin_addr.s_addr);
-	key.index[0] = (ha >> 24) & 0xff;
-	key.index[1] = (ha >> 16) & 0xff;
-	key.index[2] = (ha >>  8) & 0xff;
-	key.index[3] = (ha >>  0) & 0xff;
-
-	ha = ntohl(in_mask.s_addr);
-	key.index[4] = (ha >> 24) & 0xff;
-	key.index[5] = (ha >> 16) & 0xff;
-	key.index[6] = (ha >>  8) & 0xff;
-	key.index[7] = (ha >>  0) & 0xff;
-
-	/* ToS */
-	key.index[8] = 0;
-
-	ha = ntohl(in_gw->sin_addr.s_addr);
-	key.index[9] = (ha >> 24) & 0xff;
-	key.index[10] = (ha >> 16) & 0xff;
-	key.index[11] = (ha >>  8) & 0xff;
-	key.index[12] = (ha >>  0) & 0xff;
+	if (sroute_plen(ntohl(in_mask.s_addr), &plen) == -1) {
+		syslog(LOG_WARNING, "%s: non-contiguous netmask %s ignored",
+		    __func__, inet_ntoa(in_mask));
+		return;
+	}
 
 	if (rtm->rtm_type == RTM_DELETE) {
-		r = RB_FIND(sroutes, &sroutes, &key);
-		if (r == 0) {
-#if defined(DEBUG_ROUTE)
-			syslog(LOG_WARNING, "%s: DELETE: %u.%u.%u.%u "
-			    "%u.%u.%u.%u %u %u.%u.%u.%u not found", __func__,
-			    key.index[0], key.index[1], key.index[2],
-			    key.index[3], key.index[4], key.index[5],
-			    key.index[6], key.index[7], key.index[8],
-			    key.index[9], key.index[10], key.index[11],
-			    key.index[12]);
-#endif
-			return;
-		}
-		RB_REMOVE(sroutes, &sroutes, r);
-		free(r);
-		route_total--;
-#if defined(DEBUG_ROUTE)
-		printf("%s: DELETE: %u.%u.%u.%u "
-		    "%u.%u.%u.%u %u %u.%u.%u.%u\n", __func__,
-		    key.index[0], key.index[1], key.index[2],
-		    key.index[3], key.index[4], key.index[5],
-		    key.index[6], key.index[7], key.index[8],
-		    key.index[9], key.index[10], key.index[11],
-		    key.index[12]);
-#endif
+		mib_sroute_del(ntohl(in_dst->sin_addr.s_addr), plen,
+		    ntohl(in_gw->sin_addr.s_addr));
 		return;
 	}
 
@@ -178,80 +292,46 @@ mib_sroute_process(struct rt_msghdr *rtm, struct sockaddr *gw,
 		mib_iflist_bad = 1;
 	}
 
-	if ((r = malloc(sizeof(*r))) == NULL) {
-		syslog(LOG_ERR, "%m");
-		return;
-	}
-
-	memcpy(r->index, key.index, sizeof(r->index));
-	r->ifindex = (ifp == NULL) ? 0 : ifp->index;
-
-	r->type = (rtm->rtm_flags & RTF_LLINFO) ? 3 :
-	    (rtm->rtm_flags & RTF_REJECT) ? 2 : 4;
-
 	/* cannot really know, what protocol it runs */
-	r->proto = (rtm->rtm_flags & RTF_LOCAL) ? 2 :
+	mib_sroute_add(ntohl(in_dst->sin_addr.s_addr), plen,
+	    ntohl(in_gw->sin_addr.s_addr), ifp,
+	    (rtm->rtm_flags & RTF_LLINFO) ? 3 :
+	    (rtm->rtm_flags & RTF_REJECT) ? 2 : 4,
+	    (rtm->rtm_flags & RTF_LOCAL) ? 2 :
 	    (rtm->rtm_flags & RTF_STATIC) ? 3 :
-	    (rtm->rtm_flags & RTF_DYNAMIC) ? 4 : 10;
-
-	r1 = RB_INSERT(sroutes, &sroutes, r);
-	if (r1 != NULL) {
-#if defined(DEBUG_ROUTE)
-		syslog(LOG_WARNING, "%s: %u.%u.%u.%u "
-		    "%u.%u.%u.%u %u %u.%u.%u.%u duplicate route", __func__,
-		    key.index[0], key.index[1], key.index[2],
-		    key.index[3], key.index[4], key.index[5],
-		    key.index[6], key.index[7], key.index[8],
-		    key.index[9], key.index[10], key.index[11],
-		    key.index[12]);
-#endif
-		r1->ifindex = r->ifindex;
-		r1->type = r->type;
-		r1->proto = r->proto;
-		free(r);
-		return;
-	}
-
-	route_total++;
-#if defined(DEBUG_ROUTE)
-	printf("%s: ADD/GET: %u.%u.%u.%u "
-	    "%u.%u.%u.%u %u %u.%u.%u.%u\n", __func__,
-	    key.index[0], key.index[1], key.index[2],
-	    key.index[3], key.index[4], key.index[5],
-	    key.index[6], key.index[7], key.index[8],
-	    key.index[9], key.index[10], key.index[11],
-	    key.index[12]);
-#endif
+	    (rtm->rtm_flags & RTF_DYNAMIC) ? 4 : 10);
 }
+#endif
 
-int
-mib_fetch_route(void)
+/*
+ * Load the routing table. The dump is merged into the table: existing
+ * routes are updated in place and only the routes that have gone are
+ * deleted afterwards, so the table is not rebuilt from scratch each time
+ * and stays intact if the dump fails.
+ */
+static int
+fetch_route(void *arg __unused)
 {
+	struct sroute *r, *r1;
+#if defined(__linux__)
+
+	RB_FOREACH(r, sroutes, &sroutes)
+		r->flags &= ~SROUTE_FOUND;
+
+	if (mib_route_dump() == -1)
+		return (-1);
+#else
 	u_char *rtab, *next;
 	size_t len;
-	struct sroute *r, *r1;
 	struct rt_msghdr *rtm;
 	struct sockaddr *addrs[RTAX_MAX];
 
-	if (route_tick != 0 && route_tick + ROUTE_UPDATE_INTERVAL > this_tick)
-		return (0);
-
-	/*
-	 * Remove all routes
-	 */
-	r = RB_MIN(sroutes, &sroutes);
-	while (r != NULL) {
-		r1 = RB_NEXT(sroutes, &sroutes, r);
-		RB_REMOVE(sroutes, &sroutes, r);
-		free(r);
-		r = r1;
-	}
-	route_total = 0;
-
 	if ((rtab = mib_fetch_rtab(AF_INET, NET_RT_DUMP, 0, &len)) == NULL)
 		return (-1);
 
-	next = rtab;
+	RB_FOREACH(r, sroutes, &sroutes)
+		r->flags &= ~SROUTE_FOUND;
+
 	for (next = rtab; next < rtab + len; next += rtm->rtm_msglen) {
 		rtm = (struct rt_msghdr *)(void *)next;
 		if (rtm->rtm_type != RTM_GET ||
@@ -259,27 +339,58 @@ mib_fetch_route(void)
 			continue;
 		mib_extract_addrs(rtm->rtm_addrs, (u_char *)(rtm + 1), addrs);
 
-		
 		mib_sroute_process(rtm, addrs[RTAX_GATEWAY], addrs[RTAX_DST],
 		    addrs[RTAX_NETMASK]);
 	}
+	free(rtab);
+#endif
 
-#if 0
-	u_int n = 0;
 	r = RB_MIN(sroutes, &sroutes);
 	while (r != NULL) {
-		printf("%u: ", n++);
-		sroute_print(r);
-		printf("\n");
-		r = RB_NEXT(sroutes, &sroutes, r);
+		r1 = RB_NEXT(sroutes, &sroutes, r);
+		if (!(r->flags & SROUTE_FOUND))
+			sroute_delete(r);
+		r = r1;
 	}
-#endif
-	free(rtab);
-	route_tick = get_ticks();
 
 	return (0);
 }
 
+/*
+ * The routing socket (netlink on Linux) keeps the table current. Dump
+ * it again only from time to time to catch lost messages.
+ */
+int
+mib_route_init(struct lmodule *mod)
+{
+	route_refresh = refresh_register("mibII.route", ROUTE_UPDATE_INTERVAL,
+	    fetch_route, NULL, mod);
+	return (route_refresh == NULL ? -1 : 0);
+}
+
+void
+mib_route_fini(void)
+{
+	struct sroute_chunk *c;
+
+	refresh_unregister(route_refresh);
+	route_refresh = NULL;
+
+	while ((c = SLIST_FIRST(&sroute_chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&sroute_chunks, link);
+		free(c);
+	}
+	RB_INIT(&sroutes);
+	sroute_free = NULL;
+	route_total = 0;
+}
+
+int
+mib_fetch_route(void)
+{
+	return (refresh_check(route_refresh));
+}
+
 /**
  * Find a route in the table.
  */
@@ -287,90 +398,100 @@ static struct sroute *
 sroute_get(const struct asn_oid *oid, u_int sub)
 {
 	struct sroute key;
-	int i;
+	uint32_t mask;
+	u_int i;
 
 	if (oid->len - sub != 13)
 		return (NULL);
 	for (i = 0; i < 13; i++)
-		key.index[i] = oid->subs[sub + i];
+		if (oid->subs[sub + i] > 0xff)
+			return (NULL);
+	if (oid->subs[sub + 8] != 0)
+		return (NULL);
+
+	key.dst = key.gw = mask = 0;
+	for (i = 0; i < 4; i++) {
+		key.dst = (key.dst << 8) | oid->subs[sub + i];
+		mask = (mask << 8) | oid->subs[sub + 4 + i];
+		key.gw = (key.gw << 8) | oid->subs[sub + 9 + i];
+	}
+	if (sroute_plen(mask, &key.plen) == -1)
+		return (NULL);
 	return (RB_FIND(sroutes, &sroutes, &key));
 }
 
 /**
- * Find next route in the table. There is no such RB_ macro, so must
- * dig into the innards of the RB stuff.
+ * Find the first route with an index larger than (or equal to, if strict
+ * is not set) the given one. There is no such RB_ macro, so must dig
+ * into the innards of the RB stuff. The mask is compared as a number,
+ * which for contiguous masks is the same as comparing the prefix lengths.
  */
 static struct sroute *
-sroute_getnext(struct asn_oid *oid, u_int sub)
+sroute_bound(const uint32_t key[3], int strict)
 {
-	u_int i;
-	int comp;
-	struct sroute key;
-	struct sroute *best;
-	struct sroute *s;
-
-	/*
-	 * We now, that the OID is at least the tableEntry OID. If it is,
-	 * the user wants the first route.
-	 */
-	if (oid->len == sub)
-		return (RB_MIN(sroutes, &sroutes));
-
-	/*
-	 * This is also true for any index that consists of zeros and is
-	 * shorter than the full index.
-	 */
-	if (oid->len < sub + 13) {
-		for (i = sub; i < oid->len; i++)
-			if (oid->subs[i] != 0)
-				break;
-		if (i == oid->len)
-			return (RB_MIN(sroutes, &sroutes));
-
-		/*
-		 * Now if the index is too short, we fill it with zeros and then
-		 * subtract one from the index. We can do this, because we now,
-		 * that there is at least one index element that is not zero.
-		 */
-		for (i = oid->len; i < sub + 13; i++)
-			oid->subs[i] = 0;
-
-		for (i = sub + 13 - 1; i >= sub; i--) {
-			if (oid->subs[i] != 0) {
-				oid->subs[i]--;
-				break;
-			}
-			oid->subs[i] = ASN_MAXID;
-		}
-		oid->len = sub + 13;
-	}
-
-	/* build the index */
-	for (i = sub; i < sub + 13; i++)
-		key.index[i - sub] = oid->subs[i];
+	struct sroute *best, *s;
+	uint32_t k[3];
+	int comp, i;
 
-	/* now find the element */
 	best = NULL;
 	s = RB_ROOT(&sroutes);
-
 	while (s != NULL) {
-		comp = sroute_compare(&key, s);
-		if (comp >= 0) {
-			/* The current element is smaller than what we search.
-			 * Forget about it and move to the right subtree. */
+		k[0] = s->dst;
+		k[1] = PLEN2MASK(s->plen);
+		k[2] = s->gw;
+		for (comp = 0, i = 0; i < 3 && comp == 0; i++)
+			if (k[i] != key[i])
+				comp = k[i] < key[i] ? -1 : +1;
+
+		if (comp > 0 || (comp == 0 && !strict)) {
+			/* the current element may be what we need, but
+			 * a better one can only be in the left subtree. */
+			best = s;
+			s = RB_LEFT(s, link);
+		} else
 			s = RB_RIGHT(s, link);
+	}
+	return (best);
+}
+
+/**
+ * Find next route in the table. The index is read in parts of one byte
+ * (dest, mask, next hop) except for the ToS, which is always 0 in the
+ * table. A part that is out of range sets all following bits, so that
+ * the search skips everything starting with the preceding parts.
+ */
+static struct sroute *
+sroute_getnext(const struct asn_oid *oid, u_int sub)
+{
+	uint32_t key[3];
+	u_int i, part, byte;
+	asn_subid_t v;
+
+	key[0] = key[1] = key[2] = 0;
+	for (i = 0; i < 13; i++) {
+		if (sub + i >= oid->len)
+			return (sroute_bound(key, 0));
+		v = oid->subs[sub + i];
+
+		if (i == 8) {
+			/* ToS */
+			if (v != 0) {
+				key[2] = 0xffffffff;
+				return (sroute_bound(key, 1));
+			}
 			continue;
 		}
-		/* the current element is larger than what we search.
-		 * forget about the right subtree (its even larger), but
-		 * the current element may be what we need. */
-		if (best == NULL || sroute_compare(s, best) < 0)
-			/* this one's better */
-			best = s;
-
-		s = RB_LEFT(s, link);
+		part = (i < 8) ? i / 4 : 2;
+		byte = (i < 8) ? i % 4 : i - 9;
+		if (v > 0xff) {
+			key[part] |= 0xffffffffU >> (8 * byte);
+			while (++part < 3)
+				key[part] = 0xffffffff;
+			return (sroute_bound(key, 1));
+		}
+		key[part] |= v << (8 * (3 - byte));
 	}
-	return (best);
+	return (sroute_bound(key, 1));
 }
 
 /*
@@ -414,28 +535,19 @@ op_route_table(struct snmp_context *ctx __unused, struct snmp_value *value,
 	switch (value->var.subs[sub - 1]) {
 
 	  case LEAF_ipCidrRouteDest:
-		value->v.ipaddress[0] = r->index[0];
-		value->v.ipaddress[1] = r->index[1];
-		value->v.ipaddress[2] = r->index[2];
-		value->v.ipaddress[3] = r->index[3];
+		sroute_ipaddress(value->v.ipaddress, r->dst);
 		break;
 
 	  case LEAF_ipCidrRouteMask:
-		value->v.ipaddress[0] = r->index[4];
-		value->v.ipaddress[1] = r->index[5];
-		value->v.ipaddress[2] = r->index[6];
-		value->v.ipaddress[3] = r->index[7];
+		sroute_ipaddress(value->v.ipaddress, PLEN2MASK(r->plen));
 		break;
 
 	  case LEAF_ipCidrRouteTos:
-		value->v.integer = r->index[8];
+		value->v.integer = 0;
 		break;
 
 	  case LEAF_ipCidrRouteNextHop:
-		value->v.ipaddress[0] = r->index[9];
-		value->v.ipaddress[1] = r->index[10];
-		value->v.ipaddress[2] = r->index[11];
-		value->v.ipaddress[3] = r->index[12];
+		sroute_ipaddress(value->v.ipaddress, r->gw);
 		break;
 
 	  case LEAF_ipCidrRouteIfIndex:
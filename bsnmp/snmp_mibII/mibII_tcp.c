@@ -32,52 +32,251 @@
  */
 #include "mibII.h"
 #include "mibII_oid.h"
+#if !defined(__linux__)
 #include <sys/socketvar.h>
 #include <netinet/in_pcb.h>
 #include <netinet/tcp.h>
 #include <netinet/tcp_var.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_fsm.h>
+#endif
+
+/* default maximum age of the connection table (1 second) */
+#define	TCP_MAXAGE	100
 
 struct tcp_index {
-	struct asn_oid	index;
-	struct xtcpcb	*tp;
+	struct asn_coid	index;
+	u_int		state;		/* tcpConnState */
+};
+
+struct tcp_snap {
+	uint32_t	stat[LEAF_tcpInErrs + 1];	/* by leaf */
+#if !defined(__linux__)
+	struct xinpgen	*xinpgen;
+	size_t		xinpgen_len;
+#endif
+	u_int		total;		/* valid entries in oids */
+	u_int		oidnum;		/* allocated entries in oids */
+	struct tcp_index *oids;
 };
 
-static uint64_t tcp_tick;
-static struct tcpstat tcpstat;
-static struct xinpgen *xinpgen;
-static size_t xinpgen_len;
-static u_int tcp_count;
-static u_int tcp_total;
+/*
+ * fetch_tcp builds the next snapshot, on the refresh thread if there is
+ * one, while the operations read the current one.
+ */
+static struct tcp_snap tcp_snap[2];
+static struct tcp_snap *tcp_cur = &tcp_snap[0];
+static struct tcp_snap *tcp_next = &tcp_snap[1];
 
-static u_int oidnum;
-static struct tcp_index *tcpoids;
+static struct snmp_refresh *tcp_refresh;
 
 static int
 tcp_compare(const void *p1, const void *p2)
 {
 	const struct tcp_index *t1 = p1;
 	const struct tcp_index *t2 = p2;
+	struct asn_oid idx;
+
+	asn_coid_get(&idx, &t2->index);
+	return (asn_compare_coid(&t1->index, &idx));
+}
+
+/*
+ * Binary search the sorted index array. Return the first entry whose index
+ * is greater than (next) or not less than (!next) the index part of var.
+ */
+static u_int
+tcp_find(const struct asn_oid *var, u_int sub, int next)
+{
+	struct asn_oid key;
+	u_int lo, hi, mid;
+	int c;
+
+	key.len = var->len - sub;
+	memcpy(key.subs, &var->subs[sub], key.len * sizeof(key.subs[0]));
+
+	lo = 0;
+	hi = tcp_cur->total;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = -asn_compare_coid(&tcp_cur->oids[mid].index, &key);
+		if (c > 0 || (next && c == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Set the index of a connection from the addresses and ports in host
+ * byte order.
+ */
+static void
+tcp_index_set(struct tcp_index *oid, in_addr_t laddr, u_int lport,
+    in_addr_t faddr, u_int fport)
+{
+	struct asn_oid idx;
+
+	idx.len = 10;
+	idx.subs[0] = (laddr >> 24) & 0xff;
+	idx.subs[1] = (laddr >> 16) & 0xff;
+	idx.subs[2] = (laddr >>  8) & 0xff;
+	idx.subs[3] = (laddr >>  0) & 0xff;
+	idx.subs[4] = lport;
+	idx.subs[5] = (faddr >> 24) & 0xff;
+	idx.subs[6] = (faddr >> 16) & 0xff;
+	idx.subs[7] = (faddr >>  8) & 0xff;
+	idx.subs[8] = (faddr >>  0) & 0xff;
+	idx.subs[9] = fport;
+
+	/* always fits inline, so this cannot fail */
+	(void)asn_coid_set(&oid->index, &idx);
+}
+
+#if defined(__linux__)
+
+/* the names of the counters in /proc/net/snmp */
+static const char *const tcp_names[LEAF_tcpInErrs + 1] = {
+	[LEAF_tcpRtoAlgorithm] =	"RtoAlgorithm",
+	[LEAF_tcpRtoMin] =		"RtoMin",
+	[LEAF_tcpRtoMax] =		"RtoMax",
+	[LEAF_tcpMaxConn] =		"MaxConn",
+	[LEAF_tcpActiveOpens] =		"ActiveOpens",
+	[LEAF_tcpPassiveOpens] =	"PassiveOpens",
+	[LEAF_tcpAttemptFails] =	"AttemptFails",
+	[LEAF_tcpEstabResets] =		"EstabResets",
+	[LEAF_tcpCurrEstab] =		"CurrEstab",
+	[LEAF_tcpInSegs] =		"InSegs",
+	[LEAF_tcpOutSegs] =		"OutSegs",
+	[LEAF_tcpRetransSegs] =		"RetransSegs",
+	[LEAF_tcpInErrs] =		"InErrs",
+};
+
+/* tcpConnState for the states in /proc/net/tcp */
+static const u_int tcp_states[] = {
+	0,
+	5,	/* ESTABLISHED */
+	3,	/* SYN_SENT */
+	4,	/* SYN_RECV */
+	6,	/* FIN_WAIT1 */
+	7,	/* FIN_WAIT2 */
+	11,	/* TIME_WAIT */
+	1,	/* CLOSE */
+	8,	/* CLOSE_WAIT */
+	9,	/* LAST_ACK */
+	2,	/* LISTEN */
+	10,	/* CLOSING */
+	4,	/* NEW_SYN_RECV */
+};
+
+/*
+ * The lines of /proc/net/tcp start with the slot number, the local and
+ * remote address and port and the state, all but the slot in hex. The
+ * addresses are printed as the 32-bit value in network byte order.
+ */
+static int
+fetch_tcp(void *arg __unused)
+{
+	struct tcp_snap *s = tcp_next;
+	FILE *fp;
+	char line[256];
+	u_int laddr, lport, faddr, fport, state, n;
+	struct tcp_index *oid;
+
+	if (mib_proc_snmp("Tcp", tcp_names, LEAF_tcpInErrs + 1,
+	    s->stat) == -1)
+		return (-1);
 
-	return (asn_compare_oid(&t1->index, &t2->index));
+	if ((fp = fopen("/proc/net/tcp", "r")) == NULL) {
+		syslog(LOG_ERR, "/proc/net/tcp: %m");
+		return (-1);
+	}
+	s->total = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%*u: %x:%x %x:%x %x", &laddr, &lport,
+		    &faddr, &fport, &state) != 5)
+			continue;
+		if (s->total == s->oidnum) {
+			n = (s->oidnum == 0) ? 64 : 2 * s->oidnum;
+			if ((oid = realloc(s->oids,
+			    n * sizeof(s->oids[0]))) == NULL) {
+				syslog(LOG_ERR, "%m");
+				(void)fclose(fp);
+				return (-1);
+			}
+			/* asn_coid_set needs zeroed entries */
+			memset(&oid[s->oidnum], 0,
+			    (n - s->oidnum) * sizeof(oid[0]));
+			s->oids = oid;
+			s->oidnum = n;
+		}
+		oid = &s->oids[s->total++];
+		tcp_index_set(oid, ntohl(laddr), lport, ntohl(faddr), fport);
+		oid->state = (state < sizeof(tcp_states) /
+		    sizeof(tcp_states[0])) ? tcp_states[state] : 0;
+	}
+	(void)fclose(fp);
+
+	qsort(s->oids, s->total, sizeof(s->oids[0]), tcp_compare);
+
+	return (0);
+}
+
+#else /* !__linux__ */
+
+/*
+ * Map the kernel state to tcpConnState.
+ */
+static u_int
+tcp_state(int t_state)
+{
+	switch (t_state) {
+
+	  case TCPS_CLOSED:
+		return (1);
+	  case TCPS_LISTEN:
+		return (2);
+	  case TCPS_SYN_SENT:
+		return (3);
+	  case TCPS_SYN_RECEIVED:
+		return (4);
+	  case TCPS_ESTABLISHED:
+		return (5);
+	  case TCPS_CLOSE_WAIT:
+		return (8);
+	  case TCPS_FIN_WAIT_1:
+		return (6);
+	  case TCPS_CLOSING:
+		return (10);
+	  case TCPS_LAST_ACK:
+		return (9);
+	  case TCPS_FIN_WAIT_2:
+		return (7);
+	  case TCPS_TIME_WAIT:
+		return (11);
+	  default:
+		return (0);
+	}
 }
 
 static int
-fetch_tcp(void)
+fetch_tcp(void *arg __unused)
 {
+	struct tcp_snap *s = tcp_next;
+	struct tcpstat tcps;
 	size_t len;
 	struct xinpgen *ptr;
 	struct xtcpcb *tp;
 	struct tcp_index *oid;
-	in_addr_t inaddr;
+	u_int count;
 
-	len = sizeof(tcpstat);
-	if (sysctlbyname("net.inet.tcp.stats", &tcpstat, &len, NULL, 0) == -1) {
+	len = sizeof(tcps);
+	if (sysctlbyname("net.inet.tcp.stats", &tcps, &len, NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.tcp.stats: %m");
 		return (-1);
 	}
-	if (len != sizeof(tcpstat)) {
+	if (len != sizeof(tcps)) {
 		syslog(LOG_ERR, "net.inet.tcp.stats: wrong size");
 		return (-1);
 	}
@@ -87,78 +286,123 @@ fetch_tcp(void)
 		syslog(LOG_ERR, "net.inet.tcp.pcblist: %m");
 		return (-1);
 	}
-	if (len > xinpgen_len) {
-		if ((ptr = realloc(xinpgen, len)) == NULL) {
+	if (len > s->xinpgen_len) {
+		if ((ptr = realloc(s->xinpgen, len)) == NULL) {
 			syslog(LOG_ERR, "%zu: %m", len);
 			return (-1);
 		}
-		xinpgen = ptr;
-		xinpgen_len = len;
+		s->xinpgen = ptr;
+		s->xinpgen_len = len;
 	}
-	if (sysctlbyname("net.inet.tcp.pcblist", xinpgen, &len, NULL, 0) == -1) {
+	if (sysctlbyname("net.inet.tcp.pcblist", s->xinpgen, &len,
+	    NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.tcp.pcblist: %m");
 		return (-1);
 	}
 
-	tcp_tick = get_ticks();
-
-	tcp_count = 0;
-	tcp_total = 0;
-	for (ptr = (struct xinpgen *)(void *)((char *)xinpgen + xinpgen->xig_len);
+	count = 0;
+	s->total = 0;
+	for (ptr = (struct xinpgen *)(void *)((char *)s->xinpgen +
+	    s->xinpgen->xig_len);
 	     ptr->xig_len > sizeof(struct xinpgen);
              ptr = (struct xinpgen *)(void *)((char *)ptr + ptr->xig_len)) {
 		tp = (struct xtcpcb *)ptr;
-		if (tp->xt_inp.inp_gencnt > xinpgen->xig_gen ||
+		if (tp->xt_inp.inp_gencnt > s->xinpgen->xig_gen ||
 		    (tp->xt_inp.inp_vflag & INP_IPV4) == 0)
 			continue;
 
-		tcp_total++;
+		s->total++;
 		if (tp->xt_tp.t_state == TCPS_ESTABLISHED ||
 		    tp->xt_tp.t_state == TCPS_CLOSE_WAIT)
-			tcp_count++;
+			count++;
 	}
 
-	if (oidnum < tcp_total) {
-		oid = realloc(tcpoids, tcp_total * sizeof(tcpoids[0]));
+#define hz clockinfo.hz
+	s->stat[LEAF_tcpRtoAlgorithm] = 4;	/* Van Jacobson */
+	s->stat[LEAF_tcpRtoMin] = 1000 * TCPTV_MIN / hz;
+	s->stat[LEAF_tcpRtoMax] = 1000 * TCPTV_REXMTMAX / hz;
+#undef hz
+	s->stat[LEAF_tcpMaxConn] = (uint32_t)-1;
+	s->stat[LEAF_tcpActiveOpens] = tcps.tcps_connattempt;
+	s->stat[LEAF_tcpPassiveOpens] = tcps.tcps_accepts;
+	s->stat[LEAF_tcpAttemptFails] = tcps.tcps_conndrops;
+	s->stat[LEAF_tcpEstabResets] = tcps.tcps_drops;
+	s->stat[LEAF_tcpCurrEstab] = count;
+	s->stat[LEAF_tcpInSegs] = tcps.tcps_rcvtotal;
+	s->stat[LEAF_tcpOutSegs] = tcps.tcps_sndtotal -
+	    tcps.tcps_sndrexmitpack;
+	s->stat[LEAF_tcpRetransSegs] = tcps.tcps_sndrexmitpack;
+	s->stat[LEAF_tcpInErrs] = tcps.tcps_rcvbadsum +
+	    tcps.tcps_rcvbadoff +
+	    tcps.tcps_rcvshort;
+
+	if (s->oidnum < s->total) {
+		oid = realloc(s->oids, s->total * sizeof(s->oids[0]));
 		if (oid == NULL) {
-			free(tcpoids);
-			oidnum = 0;
+			free(s->oids);
+			s->oids = NULL;
+			s->oidnum = 0;
+			s->total = 0;
 			return (0);
 		}
-		tcpoids = oid;
-		oidnum = tcp_total;
+		/* asn_coid_set needs zeroed entries */
+		memset(&oid[s->oidnum], 0,
+		    (s->total - s->oidnum) * sizeof(oid[0]));
+		s->oids = oid;
+		s->oidnum = s->total;
 	}
 
-	oid = tcpoids;
-	for (ptr = (struct xinpgen *)(void *)((char *)xinpgen + xinpgen->xig_len);
+	oid = s->oids;
+	for (ptr = (struct xinpgen *)(void *)((char *)s->xinpgen +
+	    s->xinpgen->xig_len);
 	     ptr->xig_len > sizeof(struct xinpgen);
              ptr = (struct xinpgen *)(void *)((char *)ptr + ptr->xig_len)) {
 		tp = (struct xtcpcb *)ptr;
-		if (tp->xt_inp.inp_gencnt > xinpgen->xig_gen ||
+		if (tp->xt_inp.inp_gencnt > s->xinpgen->xig_gen ||
 		    (tp->xt_inp.inp_vflag & INP_IPV4) == 0)
 			continue;
-		oid->tp = tp;
-		oid->index.len = 10;
-		inaddr = ntohl(tp->xt_inp.inp_laddr.s_addr);
-		oid->index.subs[0] = (inaddr >> 24) & 0xff;
-		oid->index.subs[1] = (inaddr >> 16) & 0xff;
-		oid->index.subs[2] = (inaddr >>  8) & 0xff;
-		oid->index.subs[3] = (inaddr >>  0) & 0xff;
-		oid->index.subs[4] = ntohs(tp->xt_inp.inp_lport);
-		inaddr = ntohl(tp->xt_inp.inp_faddr.s_addr);
-		oid->index.subs[5] = (inaddr >> 24) & 0xff;
-		oid->index.subs[6] = (inaddr >> 16) & 0xff;
-		oid->index.subs[7] = (inaddr >>  8) & 0xff;
-		oid->index.subs[8] = (inaddr >>  0) & 0xff;
-		oid->index.subs[9] = ntohs(tp->xt_inp.inp_fport);
+		tcp_index_set(oid, ntohl(tp->xt_inp.inp_laddr.s_addr),
+		    ntohs(tp->xt_inp.inp_lport),
+		    ntohl(tp->xt_inp.inp_faddr.s_addr),
+		    ntohs(tp->xt_inp.inp_fport));
+		oid->state = tcp_state(tp->xt_tp.t_state);
 		oid++;
 	}
 
-	qsort(tcpoids, tcp_total, sizeof(tcpoids[0]), tcp_compare);
+	qsort(s->oids, s->total, sizeof(s->oids[0]), tcp_compare);
 
 	return (0);
 }
 
+#endif /* !__linux__ */
+
+static void
+swap_tcp(void *arg __unused)
+{
+	struct tcp_snap *s = tcp_cur;
+
+	tcp_cur = tcp_next;
+	tcp_next = s;
+}
+
+/*
+ * Register the refresh cache for the statistics and the connection table.
+ */
+int
+mib_tcp_init(struct lmodule *mod)
+{
+	tcp_refresh = refresh_register_bg("mibII.tcp", TCP_MAXAGE, fetch_tcp,
+	    swap_tcp, NULL, mod);
+	return (tcp_refresh == NULL ? -1 : 0);
+}
+
+void
+mib_tcp_fini(void)
+{
+	refresh_unregister(tcp_refresh);
+	tcp_refresh = NULL;
+}
+
 /*
  * Scalars
  */
@@ -182,68 +426,21 @@ op_tcp(struct snmp_context *ctx __unused, struct snmp_value *value,
 		abort();
 	}
 
-	if (tcp_tick < this_tick)
-		if (fetch_tcp() == -1)
-			return (SNMP_ERR_GENERR);
+	if (refresh_check(tcp_refresh) == -1)
+		return (SNMP_ERR_GENERR);
 
 	switch (value->var.subs[sub - 1]) {
 
 	  case LEAF_tcpRtoAlgorithm:
-		value->v.integer = 4;	/* Van Jacobson */
-		break;
-
-#define hz clockinfo.hz
-
 	  case LEAF_tcpRtoMin:
-		value->v.integer = 1000 * TCPTV_MIN / hz;
-		break;
-
 	  case LEAF_tcpRtoMax:
-		value->v.integer = 1000 * TCPTV_REXMTMAX / hz;
-		break;
-#undef hz
-
 	  case LEAF_tcpMaxConn:
-		value->v.integer = -1;
-		break;
-
-	  case LEAF_tcpActiveOpens:
-		value->v.uint32 = tcpstat.tcps_connattempt;
-		break;
-
-	  case LEAF_tcpPassiveOpens:
-		value->v.uint32 = tcpstat.tcps_accepts;
-		break;
-
-	  case LEAF_tcpAttemptFails:
-		value->v.uint32 = tcpstat.tcps_conndrops;
-		break;
-
-	  case LEAF_tcpEstabResets:
-		value->v.uint32 = tcpstat.tcps_drops;
+		value->v.integer =
+		    (int32_t)tcp_cur->stat[value->var.subs[sub - 1]];
 		break;
 
-	  case LEAF_tcpCurrEstab:
-		value->v.uint32 = tcp_count;
-		break;
-
-	  case LEAF_tcpInSegs:
-		value->v.uint32 = tcpstat.tcps_rcvtotal;
-		break;
-
-	  case LEAF_tcpOutSegs:
-		value->v.uint32 = tcpstat.tcps_sndtotal -
-		    tcpstat.tcps_sndrexmitpack;
-		break;
-
-	  case LEAF_tcpRetransSegs:
-		value->v.uint32 = tcpstat.tcps_sndrexmitpack;
-		break;
-
-	  case LEAF_tcpInErrs:
-		value->v.uint32 = tcpstat.tcps_rcvbadsum +
-		    tcpstat.tcps_rcvbadoff +
-		    tcpstat.tcps_rcvshort;
+	  default:
+		value->v.uint32 = tcp_cur->stat[value->var.subs[sub - 1]];
 		break;
 	}
 	return (SNMP_ERR_NOERROR);
@@ -254,27 +451,26 @@ op_tcpconn(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int iidx __unused, enum snmp_op op)
 {
 	u_int i;
+	struct asn_oid idx;
+	const asn_subid_t *subs;
 
-	if (tcp_tick < this_tick)
-		if (fetch_tcp() == -1)
-			return (SNMP_ERR_GENERR);
+	if (refresh_check(tcp_refresh) == -1)
+		return (SNMP_ERR_GENERR);
 
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
-		for (i = 0; i < tcp_total; i++)
-			if (index_compare(&value->var, sub, &tcpoids[i].index) < 0)
-				break;
-		if (i == tcp_total)
+		if ((i = tcp_find(&value->var, sub, 1)) == tcp_cur->total)
 			return (SNMP_ERR_NOSUCHNAME);
-		index_append(&value->var, sub, &tcpoids[i].index);
+		asn_coid_get(&idx, &tcp_cur->oids[i].index);
+		index_append(&value->var, sub, &idx);
 		break;
 
 	  case SNMP_OP_GET:
-		for (i = 0; i < tcp_total; i++)
-			if (index_compare(&value->var, sub, &tcpoids[i].index) == 0)
-				break;
-		if (i == tcp_total)
+		if ((i = tcp_find(&value->var, sub, 0)) == tcp_cur->total)
+			return (SNMP_ERR_NOSUCHNAME);
+		asn_coid_get(&idx, &tcp_cur->oids[i].index);
+		if (index_compare(&value->var, sub, &idx) != 0)
 			return (SNMP_ERR_NOSUCHNAME);
 		break;
 
@@ -286,71 +482,34 @@ op_tcpconn(struct snmp_context *ctx __unused, struct snmp_value *value,
 	  default:
 		abort();
 	}
+	subs = asn_coid_subs(&tcp_cur->oids[i].index);
 
 	switch (value->var.subs[sub - 1]) {
 
 	  case LEAF_tcpConnState:
-		switch (tcpoids[i].tp->xt_tp.t_state) {
-
-		  case TCPS_CLOSED:
-			value->v.integer = 1;
-			break;
-		  case TCPS_LISTEN:
-			value->v.integer = 2;
-			break;
-		  case TCPS_SYN_SENT:
-			value->v.integer = 3;
-			break;
-		  case TCPS_SYN_RECEIVED:
-			value->v.integer = 4;
-			break;
-		  case TCPS_ESTABLISHED:
-			value->v.integer = 5;
-			break;
-		  case TCPS_CLOSE_WAIT:
-			value->v.integer = 8;
-			break;
-		  case TCPS_FIN_WAIT_1:
-			value->v.integer = 6;
-			break;
-		  case TCPS_CLOSING:
-			value->v.integer = 10;
-			break;
-		  case TCPS_LAST_ACK:
-			value->v.integer = 9;
-			break;
-		  case TCPS_FIN_WAIT_2:
-			value->v.integer = 7;
-			break;
-		  case TCPS_TIME_WAIT:
-			value->v.integer = 11;
-			break;
-		  default:
-			value->v.integer = 0;
-			break;
-		}
+		value->v.integer = tcp_cur->oids[i].state;
 		break;
 
 	  case LEAF_tcpConnLocalAddress:
-		value->v.ipaddress[0] = tcpoids[i].index.subs[0];
-		value->v.ipaddress[1] = tcpoids[i].index.subs[1];
-		value->v.ipaddress[2] = tcpoids[i].index.subs[2];
-		value->v.ipaddress[3] = tcpoids[i].index.subs[3];
+		value->v.ipaddress[0] = subs[0];
+		value->v.ipaddress[1] = subs[1];
+		value->v.ipaddress[2] = subs[2];
+		value->v.ipaddress[3] = subs[3];
 		break;
 
 	  case LEAF_tcpConnLocalPort:
-		value->v.integer = tcpoids[i].index.subs[4];
+		value->v.integer = subs[4];
 		break;
 
 	  case LEAF_tcpConnRemAddress:
-		value->v.ipaddress[0] = tcpoids[i].index.subs[5];
-		value->v.ipaddress[1] = tcpoids[i].index.subs[6];
-		value->v.ipaddress[2] = tcpoids[i].index.subs[7];
-		value->v.ipaddress[3] = tcpoids[i].index.subs[8];
+		value->v.ipaddress[0] = subs[5];
+		value->v.ipaddress[1] = subs[6];
+		value->v.ipaddress[2] = subs[7];
+		value->v.ipaddress[3] = subs[8];
 		break;
 
 	  case LEAF_tcpConnRemPort:
-		value->v.integer = tcpoids[i].index.subs[9];
+		value->v.integer = subs[9];
 		break;
 	}
 	return (SNMP_ERR_NOERROR);
@@ -32,121 +32,282 @@
  */
 #include "mibII.h"
 #include "mibII_oid.h"
+#if !defined(__linux__)
 #include <sys/socketvar.h>
 #include <netinet/in_pcb.h>
 #include <netinet/udp.h>
 #include <netinet/ip_var.h>
 #include <netinet/udp_var.h>
+#endif
+
+/* default maximum age of the data in ticks */
+#define	UDP_MAXAGE	100
 
 struct udp_index {
-	struct asn_oid	index;
-	struct xinpcb	*inp;
+	struct asn_coid	index;
+};
+
+struct udp_snap {
+	uint32_t	stat[LEAF_udpOutDatagrams + 1];	/* by leaf */
+#if !defined(__linux__)
+	struct xinpgen	*xinpgen;
+	size_t		xinpgen_len;
+#endif
+	u_int		total;		/* valid entries in oids */
+	u_int		oidnum;		/* allocated entries in oids */
+	struct udp_index *oids;
 };
 
-static uint64_t udp_tick;
-static struct udpstat udpstat;
-static struct xinpgen *xinpgen;
-static size_t xinpgen_len;
-static u_int udp_total;
+/* the operations read udp_cur while fetch_udp fills udp_next */
+static struct udp_snap udp_snap[2];
+static struct udp_snap *udp_cur = &udp_snap[0];
+static struct udp_snap *udp_next = &udp_snap[1];
 
-static u_int oidnum;
-static struct udp_index *udpoids;
+static struct snmp_refresh *udp_refresh;
 
 static int
 udp_compare(const void *p1, const void *p2)
 {
 	const struct udp_index *t1 = p1;
 	const struct udp_index *t2 = p2;
+	struct asn_oid idx;
+
+	asn_coid_get(&idx, &t2->index);
+	return (asn_compare_coid(&t1->index, &idx));
+}
+
+/*
+ * Binary search the sorted index array. Return the first entry whose index
+ * is greater than (next) or not less than (!next) the index part of var.
+ */
+static u_int
+udp_find(const struct asn_oid *var, u_int sub, int next)
+{
+	struct asn_oid key;
+	u_int lo, hi, mid;
+	int c;
+
+	key.len = var->len - sub;
+	memcpy(key.subs, &var->subs[sub], key.len * sizeof(key.subs[0]));
+
+	lo = 0;
+	hi = udp_cur->total;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = -asn_compare_coid(&udp_cur->oids[mid].index, &key);
+		if (c > 0 || (next && c == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Set the index of a listener from the address and port in host byte
+ * order.
+ */
+static void
+udp_index_set(struct udp_index *oid, in_addr_t laddr, u_int lport)
+{
+	struct asn_oid idx;
+
+	idx.len = 5;
+	idx.subs[0] = (laddr >> 24) & 0xff;
+	idx.subs[1] = (laddr >> 16) & 0xff;
+	idx.subs[2] = (laddr >>  8) & 0xff;
+	idx.subs[3] = (laddr >>  0) & 0xff;
+	idx.subs[4] = lport;
 
-	return (asn_compare_oid(&t1->index, &t2->index));
+	/* always fits inline, so this cannot fail */
+	(void)asn_coid_set(&oid->index, &idx);
 }
 
+#if defined(__linux__)
+
+/* the names of the counters in /proc/net/snmp */
+static const char *const udp_names[LEAF_udpOutDatagrams + 1] = {
+	[LEAF_udpInDatagrams] =		"InDatagrams",
+	[LEAF_udpNoPorts] =		"NoPorts",
+	[LEAF_udpInErrors] =		"InErrors",
+	[LEAF_udpOutDatagrams] =	"OutDatagrams",
+};
+
+/*
+ * /proc/net/udp has the same format as /proc/net/tcp.
+ */
 static int
-fetch_udp(void)
+fetch_udp(void *arg __unused)
 {
+	struct udp_snap *s = udp_next;
+	FILE *fp;
+	char line[256];
+	u_int laddr, lport, n;
+	struct udp_index *oid;
+
+	if (mib_proc_snmp("Udp", udp_names, LEAF_udpOutDatagrams + 1,
+	    s->stat) == -1)
+		return (-1);
+
+	if ((fp = fopen("/proc/net/udp", "r")) == NULL) {
+		syslog(LOG_ERR, "/proc/net/udp: %m");
+		return (-1);
+	}
+	s->total = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%*u: %x:%x", &laddr, &lport) != 2)
+			continue;
+		if (s->total == s->oidnum) {
+			n = (s->oidnum == 0) ? 64 : 2 * s->oidnum;
+			if ((oid = realloc(s->oids,
+			    n * sizeof(s->oids[0]))) == NULL) {
+				syslog(LOG_ERR, "%m");
+				(void)fclose(fp);
+				return (-1);
+			}
+			/* asn_coid_set needs zeroed entries */
+			memset(&oid[s->oidnum], 0,
+			    (n - s->oidnum) * sizeof(oid[0]));
+			s->oids = oid;
+			s->oidnum = n;
+		}
+		udp_index_set(&s->oids[s->total++], ntohl(laddr), lport);
+	}
+	(void)fclose(fp);
+
+	qsort(s->oids, s->total, sizeof(s->oids[0]), udp_compare);
+
+	return (0);
+}
+
+#else /* !__linux__ */
+
+static int
+fetch_udp(void *arg __unused)
+{
+	struct udp_snap *s = udp_next;
+	struct udpstat udps;
 	size_t len;
 	struct xinpgen *ptr;
 	struct xinpcb *inp;
 	struct udp_index *oid;
-	in_addr_t inaddr;
 
-	len = sizeof(udpstat);
-	if (sysctlbyname("net.inet.udp.stats", &udpstat, &len, NULL, 0) == -1) {
+	len = sizeof(udps);
+	if (sysctlbyname("net.inet.udp.stats", &udps, &len, NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.udp.stats: %m");
 		return (-1);
 	}
-	if (len != sizeof(udpstat)) {
+	if (len != sizeof(udps)) {
 		syslog(LOG_ERR, "net.inet.udp.stats: wrong size");
 		return (-1);
 	}
 
-	udp_tick = get_ticks();
+	s->stat[LEAF_udpInDatagrams] = udps.udps_ipackets;
+	s->stat[LEAF_udpNoPorts] = udps.udps_noport +
+	    udps.udps_noportbcast +
+	    udps.udps_noportmcast;
+	s->stat[LEAF_udpInErrors] = udps.udps_hdrops +
+	    udps.udps_badsum +
+	    udps.udps_badlen +
+	    udps.udps_fullsock;
+	s->stat[LEAF_udpOutDatagrams] = udps.udps_opackets;
 
 	len = 0;
 	if (sysctlbyname("net.inet.udp.pcblist", NULL, &len, NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.udp.pcblist: %m");
 		return (-1);
 	}
-	if (len > xinpgen_len) {
-		if ((ptr = realloc(xinpgen, len)) == NULL) {
+	if (len > s->xinpgen_len) {
+		if ((ptr = realloc(s->xinpgen, len)) == NULL) {
 			syslog(LOG_ERR, "%zu: %m", len);
 			return (-1);
 		}
-		xinpgen = ptr;
-		xinpgen_len = len;
+		s->xinpgen = ptr;
+		s->xinpgen_len = len;
 	}
-	if (sysctlbyname("net.inet.udp.pcblist", xinpgen, &len, NULL, 0) == -1) {
+	if (sysctlbyname("net.inet.udp.pcblist", s->xinpgen, &len,
+	    NULL, 0) == -1) {
 		syslog(LOG_ERR, "net.inet.udp.pcblist: %m");
 		return (-1);
 	}
 
-	udp_total = 0;
-	for (ptr = (struct xinpgen *)(void *)((char *)xinpgen + xinpgen->xig_len);
+	s->total = 0;
+	for (ptr = (struct xinpgen *)(void *)((char *)s->xinpgen +
+	    s->xinpgen->xig_len);
 	     ptr->xig_len > sizeof(struct xinpgen);
              ptr = (struct xinpgen *)(void *)((char *)ptr + ptr->xig_len)) {
 		inp = (struct xinpcb *)ptr;
-		if (inp->xi_inp.inp_gencnt > xinpgen->xig_gen ||
+		if (inp->xi_inp.inp_gencnt > s->xinpgen->xig_gen ||
 		    (inp->xi_inp.inp_vflag & INP_IPV4) == 0)
 			continue;
 
-		udp_total++;
+		s->total++;
 	}
 
-	if (oidnum < udp_total) {
-		oid = realloc(udpoids, udp_total * sizeof(udpoids[0]));
+	if (s->oidnum < s->total) {
+		oid = realloc(s->oids, s->total * sizeof(s->oids[0]));
 		if (oid == NULL) {
-			free(udpoids);
-			oidnum = 0;
+			free(s->oids);
+			s->oids = NULL;
+			s->oidnum = 0;
+			s->total = 0;
 			return (0);
 		}
-		udpoids = oid;
-		oidnum = udp_total;
+		/* asn_coid_set needs zeroed entries */
+		memset(&oid[s->oidnum], 0,
+		    (s->total - s->oidnum) * sizeof(oid[0]));
+		s->oids = oid;
+		s->oidnum = s->total;
 	}
 
-	oid = udpoids;
-	for (ptr = (struct xinpgen *)(void *)((char *)xinpgen + xinpgen->xig_len);
+	oid = s->oids;
+	for (ptr = (struct xinpgen *)(void *)((char *)s->xinpgen +
+	    s->xinpgen->xig_len);
 	     ptr->xig_len > sizeof(struct xinpgen);
              ptr = (struct xinpgen *)(void *)((char *)ptr + ptr->xig_len)) {
 		inp = (struct xinpcb *)ptr;
-		if (inp->xi_inp.inp_gencnt > xinpgen->xig_gen ||
+		if (inp->xi_inp.inp_gencnt > s->xinpgen->xig_gen ||
 		    (inp->xi_inp.inp_vflag & INP_IPV4) == 0)
 			continue;
-		oid->inp = inp;
-		oid->index.len = 5;
-		inaddr = ntohl(inp->xi_inp.inp_laddr.s_addr);
-		oid->index.subs[0] = (inaddr >> 24) & 0xff;
-		oid->index.subs[1] = (inaddr >> 16) & 0xff;
-		oid->index.subs[2] = (inaddr >>  8) & 0xff;
-		oid->index.subs[3] = (inaddr >>  0) & 0xff;
-		oid->index.subs[4] = ntohs(inp->xi_inp.inp_lport);
+		udp_index_set(oid, ntohl(inp->xi_inp.inp_laddr.s_addr),
+		    ntohs(inp->xi_inp.inp_lport));
 		oid++;
 	}
 
-	qsort(udpoids, udp_total, sizeof(udpoids[0]), udp_compare);
+	qsort(s->oids, s->total, sizeof(s->oids[0]), udp_compare);
 
 	return (0);
 }
 
+#endif /* !__linux__ */
+
+static void
+swap_udp(void *arg __unused)
+{
+	struct udp_snap *s = udp_cur;
+
+	udp_cur = udp_next;
+	udp_next = s;
+}
+
+/*
+ * Register the refresh cache for the statistics and the listener table.
+ */
+int
+mib_udp_init(struct lmodule *mod)
+{
+	udp_refresh = refresh_register_bg("mibII.udp", UDP_MAXAGE, fetch_udp,
+	    swap_udp, NULL, mod);
+	return (udp_refresh == NULL ? -1 : 0);
+}
+
+void
+mib_udp_fini(void)
+{
+	refresh_unregister(udp_refresh);
+	udp_refresh = NULL;
+}
+
 int
 op_udp(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int iidx __unused, enum snmp_op op)
@@ -167,33 +328,10 @@ op_udp(struct snmp_context *ctx __unused, struct snmp_value *value,
 		abort();
 	}
 
-	if (udp_tick < this_tick)
-		if (fetch_udp() == -1)
-			return (SNMP_ERR_GENERR);
-
-	switch (value->var.subs[sub - 1]) {
-
-	  case LEAF_udpInDatagrams:
-		value->v.uint32 = udpstat.udps_ipackets;
-		break;
+	if (refresh_check(udp_refresh) == -1)
+		return (SNMP_ERR_GENERR);
 
-	  case LEAF_udpNoPorts:
-		value->v.uint32 = udpstat.udps_noport +
-		    udpstat.udps_noportbcast +
-		    udpstat.udps_noportmcast;
-		break;
-
-	  case LEAF_udpInErrors:
-		value->v.uint32 = udpstat.udps_hdrops +
-		    udpstat.udps_badsum +
-		    udpstat.udps_badlen +
-		    udpstat.udps_fullsock;
-		break;
-
-	  case LEAF_udpOutDatagrams:
-		value->v.uint32 = udpstat.udps_opackets;
-		break;
-	}
+	value->v.uint32 = udp_cur->stat[value->var.subs[sub - 1]];
 	return (SNMP_ERR_NOERROR);
 }
 
@@ -202,27 +340,26 @@ op_udptable(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int iidx __unused, enum snmp_op op)
 {
 	u_int i;
+	struct asn_oid idx;
+	const asn_subid_t *subs;
 
-	if (udp_tick < this_tick)
-		if (fetch_udp() == -1)
-			return (SNMP_ERR_GENERR);
+	if (refresh_check(udp_refresh) == -1)
+		return (SNMP_ERR_GENERR);
 
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
-		for (i = 0; i < udp_total; i++)
-			if (index_compare(&value->var, sub, &udpoids[i].index) < 0)
-				break;
-		if (i == udp_total)
+		if ((i = udp_find(&value->var, sub, 1)) == udp_cur->total)
 			return (SNMP_ERR_NOSUCHNAME);
-		index_append(&value->var, sub, &udpoids[i].index);
+		asn_coid_get(&idx, &udp_cur->oids[i].index);
+		index_append(&value->var, sub, &idx);
 		break;
 
 	  case SNMP_OP_GET:
-		for (i = 0; i < udp_total; i++)
-			if (index_compare(&value->var, sub, &udpoids[i].index) == 0)
-				break;
-		if (i == udp_total)
+		if ((i = udp_find(&value->var, sub, 0)) == udp_cur->total)
+			return (SNMP_ERR_NOSUCHNAME);
+		asn_coid_get(&idx, &udp_cur->oids[i].index);
+		if (index_compare(&value->var, sub, &idx) != 0)
 			return (SNMP_ERR_NOSUCHNAME);
 		break;
 
@@ -234,18 +371,19 @@ op_udptable(struct snmp_context *ctx __unused, struct snmp_value *value,
 	  default:
 		abort();
 	}
+	subs = asn_coid_subs(&udp_cur->oids[i].index);
 
 	switch (value->var.subs[sub - 1]) {
 
 	  case LEAF_udpLocalAddress:
-		value->v.ipaddress[0] = udpoids[i].index.subs[0];
-		value->v.ipaddress[1] = udpoids[i].index.subs[1];
-		value->v.ipaddress[2] = udpoids[i].index.subs[2];
-		value->v.ipaddress[3] = udpoids[i].index.subs[3];
+		value->v.ipaddress[0] = subs[0];
+		value->v.ipaddress[1] = subs[1];
+		value->v.ipaddress[2] = subs[2];
+		value->v.ipaddress[3] = subs[3];
 		break;
 
 	  case LEAF_udpLocalPort:
-		value->v.integer = udpoids[i].index.subs[4];
+		value->v.integer = subs[4];
 		break;
 
 	}
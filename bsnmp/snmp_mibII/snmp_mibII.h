@@ -36,6 +36,42 @@
 /* forward declaration */
 struct mibif;
 
+#if defined(__linux__)
+/*
+ * Linux has no interface MIB in the kernel. The rtnetlink code fills in
+ * this subset of the BSD structures, so that the tables work unchanged.
+ */
+struct if_data {
+	u_char		ifi_type;	/* IANA ifType */
+	u_char		ifi_link_state;
+	u_long		ifi_mtu;
+	u_long		ifi_baudrate;
+	u_long		ifi_ipackets;
+	u_long		ifi_ierrors;
+	u_long		ifi_opackets;
+	u_long		ifi_oerrors;
+	u_long		ifi_ibytes;
+	u_long		ifi_obytes;
+	u_long		ifi_imcasts;
+	u_long		ifi_omcasts;
+	u_long		ifi_iqdrops;
+	u_long		ifi_noproto;
+	struct timeval	ifi_lastchange;
+};
+
+struct ifmibdata {
+	char		ifmd_name[IFNAMSIZ];
+	int		ifmd_flags;
+	int		ifmd_snd_len;
+	int		ifmd_snd_drops;
+	struct if_data	ifmd_data;
+};
+
+#define	LINK_STATE_UNKNOWN	0
+#define	LINK_STATE_DOWN		1
+#define	LINK_STATE_UP		2
+#endif
+
 enum mibif_notify {
 	MIBIF_NOTIFY_DESTROY
 };
@@ -35,7 +35,6 @@
 #include <sys/queue.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <ctype.h>
 #include <errno.h>
@@ -83,8 +82,8 @@ static const struct asn_oid oid_ntpMIB = OIDX_ntpMIB;
 /* the Object Resource registration index */
 static u_int reg_index;
 
-/* last time we've fetch the system variables */
-static uint64_t sysinfo_tick;
+/* refresh cache of the system variables */
+static struct snmp_refresh *sysinfo_refresh;
 
 /* cached system variables */
 static int32_t	sys_leap;
@@ -111,8 +110,8 @@ static double	sys_jitter;
 static int	sysb_stability;
 static double	sys_stability;
 
-/* last time we've fetch the peer list */
-static uint64_t peers_tick;
+/* refresh cache of the peer and filter lists */
+static struct snmp_refresh *peers_refresh;
 
 /* request sequence number generator */
 static uint16_t	seqno;
@@ -121,11 +120,50 @@ static uint16_t	seqno;
 static int ntpd_sock;
 static void *ntpd_fd;
 
-struct peer {
-	/* required entries for macros */
-	uint32_t	index;
-	TAILQ_ENTRY(peer) link;
+/* a query to ntpd */
+struct ntpd_query {
+	TAILQ_ENTRY(ntpd_query) link;
+	u_int		op;
+	u_int		associd;
+	const char	*vars;
+	uint16_t	seqno;		/* of the request on the wire */
+	void		*timer;
+	u_char		*data;		/* response fragments so far */
+	size_t		datalen;
+	void		(*done)(u_int, u_char *, size_t);
+};
+TAILQ_HEAD(ntpd_query_list, ntpd_query);
+
+/*
+ * Queries to ntpd. Up to NTPC_WINDOW of them are on the wire at the same
+ * time, the others wait until one of these has completed.
+ */
+#define	NTPC_WINDOW	64
+static struct ntpd_query_list ntpd_sent = TAILQ_HEAD_INITIALIZER(ntpd_sent);
+static struct ntpd_query_list ntpd_waiting =
+    TAILQ_HEAD_INITIALIZER(ntpd_waiting);
+static u_int ntpd_nsent;
+
+/* peer variables still to be fetched and whether one has failed */
+static u_int peers_waiting;
+static int peers_failed;
+
+/*
+ * ntpd reports most values as text. Those that the MIB exports as
+ * strings are kept in the peer as they came.
+ */
+#define	NTP_VALLEN	24
+#define	NTP_FILTMAX	8	/* NTP_SHIFT in ntpd */
+
+/* one register of the clock filter */
+struct filt {
+	char		offset[NTP_VALLEN];
+	char		delay[NTP_VALLEN];
+	char		dispersion[NTP_VALLEN];
+};
 
+/* the variables of one association */
+struct peer_vars {
 	int32_t		config;		/* config bit */
 	u_char		srcadr[4];	/* PeerAddress */
 	uint32_t	srcport;	/* PeerPort */
@@ -137,38 +175,34 @@ struct peer {
 	int32_t		ppoll;		/* PeerPoll */
 	int32_t		hpoll;		/* HostPoll */
 	int32_t		precision;	/* Precision */
-	char		*rootdelay;	/* RootDelay */
-	char		*rootdispersion;/* RootDispersion */
-	char		*refid;		/* RefId */
+	char		rootdelay[NTP_VALLEN];		/* RootDelay */
+	char		rootdispersion[NTP_VALLEN];	/* RootDispersion */
+	char		refid[NTP_VALLEN];		/* RefId */
 	u_char		reftime[8];	/* RefTime */
 	u_char		orgtime[8];	/* OrgTime */
 	u_char		rcvtime[8];	/* ReceiveTime */
 	u_char		xmttime[8];	/* TransmitTime */
 	u_int32_t	reach;		/* Reach */
 	int32_t		timer;		/* Timer */
-	char		*offset;	/* Offset */
-	char		*delay;		/* Delay */
-	char		*dispersion;	/* Dispersion */
+	char		offset[NTP_VALLEN];		/* Offset */
+	char		delay[NTP_VALLEN];		/* Delay */
+	char		dispersion[NTP_VALLEN];		/* Dispersion */
 	int32_t		filt_entries;
+	struct filt	filt[NTP_FILTMAX];
 };
-TAILQ_HEAD(peer_list, peer);
 
-/* list of peers */
-static struct peer_list peers = TAILQ_HEAD_INITIALIZER(peers);
-
-struct filt {
-	/* required fields */
-	struct asn_oid	index;
-	TAILQ_ENTRY(filt) link;
+struct peer {
+	/* required entries for macros */
+	uint32_t	index;
+	TAILQ_ENTRY(peer) link;
 
-	char		*offset;
-	char		*delay;
-	char		*dispersion;
+	int		seen;		/* in the last association list */
+	struct peer_vars v;
 };
-TAILQ_HEAD(filt_list, filt);
+TAILQ_HEAD(peer_list, peer);
 
-/* list of filters */
-static struct filt_list filts = TAILQ_HEAD_INITIALIZER(filts);
+/* list of peers */
+static struct peer_list peers = TAILQ_HEAD_INITIALIZER(peers);
 
 /* configuration */
 static u_char *ntp_host;
@@ -176,7 +210,11 @@ static u_char *ntp_port;
 static uint32_t ntp_timeout;
 
 static void ntpd_input(int, void *);
+static void ntpd_timeout(void *);
+static void ntpd_flush(void);
 static int open_socket(void);
+static int fetch_sysinfo(void *);
+static int fetch_peers(void *);
 
 /* the initialization function */
 static int
@@ -194,6 +232,18 @@ ntp_init(struct lmodule *mod, int argc, char *argv[] __unused)
 	ntp_port = strdup("ntp");
 	ntp_timeout = 50;		/* 0.5sec */
 
+	/* each fetch costs round trips to ntpd, which are done
+	 * asynchronously. The peer list can be kept longer by setting
+	 * begemotSnmpdRefreshMaxAge."ntp.peers". */
+	if ((sysinfo_refresh = refresh_register("ntp.sysinfo", 100,
+	    fetch_sysinfo, NULL, module)) == NULL)
+		return (ENOMEM);
+	if ((peers_refresh = refresh_register("ntp.peers", 100,
+	    fetch_peers, NULL, module)) == NULL) {
+		refresh_unregister(sysinfo_refresh);
+		return (ENOMEM);
+	}
+
 	return (0);
 }
 
@@ -223,6 +273,9 @@ ntp_fini(void)
 
 	or_unregister(reg_index);
 	fd_deselect(ntpd_fd);
+	ntpd_flush();
+	refresh_unregister(peers_refresh);
+	refresh_unregister(sysinfo_refresh);
 
 	return (0);
 }
@@ -301,20 +354,16 @@ dump_packet(const u_char *pkt, size_t ret)
 }
 
 /*
- * Execute an NTP request.
+ * Send an NTP request. The sequence number used is left in seqno.
  */
 static int
 ntpd_request(u_int op, u_int associd, const char *vars)
 {
-	u_char	*rpkt;
+	u_char	rpkt[NTPC_MAX];
 	u_char	*ptr;
 	size_t	vlen;
 	ssize_t	ret;
 
-	if ((rpkt = malloc(NTPC_MAX)) == NULL) {
-		syslog(LOG_ERR, "%m");
-		return (-1);
-	}
 	memset(rpkt, 0, NTPC_MAX);
 
 	ptr = rpkt;
@@ -339,7 +388,6 @@ ntpd_request(u_int op, u_int associd, const char *vars)
 		vlen = strlen(vars);
 		if (vlen > NTPC_DMAX) {
 			syslog(LOG_ERR, "NTP request too long (%zu)", vlen);
-			free(rpkt);
 			return (-1);
 		}
 		*ptr++ = vlen >> 8;
@@ -362,203 +410,269 @@ ntpd_request(u_int op, u_int associd, const char *vars)
 	ret = send(ntpd_sock, rpkt, ptr - rpkt, 0);
 	if (ret == -1) {
 		syslog(LOG_ERR, "cannot send to ntpd: %m");
-		free(rpkt);
 		return (-1);
 	}
 	return (0);
 }
 
 /*
- * Callback if packet arrived from NTPD
+ * Put a query on the wire
  */
 static int
-ntpd_read(uint16_t *op, uint16_t *associd, u_char **data, size_t *datalen)
+ntpd_send(struct ntpd_query *q)
 {
-	u_char	pkt[NTPC_MAX + 1];
-	u_char	*ptr, *nptr;
-	u_int	n;
-	ssize_t	ret;
-	size_t	z;
-	u_int	offset;		/* current offset */
-	int	more;		/* more flag */
-	int	sel;
-	struct timeval inc, end, rem;
-	fd_set	iset;
-
-	*datalen = 0;
-	*data = NULL;
-	offset = 0;
-
-	inc.tv_sec = ntp_timeout / 100;
-	inc.tv_usec = (ntp_timeout % 100) * 1000;
-
-	(void)gettimeofday(&end, NULL);
-	timeradd(&end, &inc, &end);
-
-  next:
-	/* compute remaining time */
-	(void)gettimeofday(&rem, NULL);
-	if (timercmp(&rem, &end, >=)) {
-		/* do a poll */
-		rem.tv_sec = 0;
-		rem.tv_usec = 0;
-	} else {
-		timersub(&end, &rem, &rem);
-	}
+	if (ntpd_request(q->op, q->associd, q->vars) == -1)
+		return (-1);
+	q->seqno = seqno;
+	q->timer = timer_start(ntp_timeout, ntpd_timeout, q, module);
+	TAILQ_INSERT_TAIL(&ntpd_sent, q, link);
+	ntpd_nsent++;
+	return (0);
+}
+
+/*
+ * Queue a query to ntpd. The query is sent at once unless there are
+ * already NTPC_WINDOW queries on the wire. The done function gets the
+ * response data or NULL if the query failed. If the query cannot be sent
+ * right away, -1 is returned and done is not called.
+ */
+static int
+ntpd_query(u_int op, u_int associd, const char *vars,
+    void (*done)(u_int, u_char *, size_t))
+{
+	struct ntpd_query *q;
 
-	/* select */
-	FD_ZERO(&iset);
-	FD_SET(ntpd_sock, &iset);
-	sel = select(ntpd_sock + 1, &iset, NULL, NULL, &rem);
-	if (sel == -1) {
-		if (errno == EINTR)
-			goto next;
-		syslog(LOG_ERR, "select ntpd_sock: %m");
-		free(*data);
+	if ((q = malloc(sizeof(*q))) == NULL) {
+		syslog(LOG_ERR, "%m");
 		return (-1);
 	}
-	if (sel == 0) {
-		syslog(LOG_ERR, "timeout on NTP connection");
-		free(*data);
+	memset(q, 0, sizeof(*q));
+	q->op = op;
+	q->associd = associd;
+	q->vars = vars;
+	q->done = done;
+
+	if (ntpd_nsent >= NTPC_WINDOW || !TAILQ_EMPTY(&ntpd_waiting)) {
+		TAILQ_INSERT_TAIL(&ntpd_waiting, q, link);
+		return (0);
+	}
+	if (ntpd_send(q) == -1) {
+		free(q);
 		return (-1);
 	}
+	return (0);
+}
 
-	/* now read it */
-	ret = recv(ntpd_sock, pkt, sizeof(pkt), 0);
-	if (ret == -1) {
-		syslog(LOG_ERR, "error reading from ntpd: %m");
-		free(*data);
-		return (-1);
+/*
+ * Fill the window with waiting queries. Queries that cannot be sent fail.
+ */
+static void
+ntpd_next(void)
+{
+	struct ntpd_query *q;
+
+	while (ntpd_nsent < NTPC_WINDOW &&
+	    (q = TAILQ_FIRST(&ntpd_waiting)) != NULL) {
+		TAILQ_REMOVE(&ntpd_waiting, q, link);
+		if (ntpd_send(q) == -1) {
+			(*q->done)(q->associd, NULL, 0);
+			free(q);
+		}
 	}
+}
 
-	if (ntp_debug & DBG_DUMP_PKTS) {
-		syslog(LOG_INFO, "got %zd bytes", ret);
-		dump_packet(pkt, (size_t)ret);
+/*
+ * Take a query off the wire and report the result
+ */
+static void
+ntpd_finish(struct ntpd_query *q, u_char *data, size_t datalen)
+{
+	TAILQ_REMOVE(&ntpd_sent, q, link);
+	ntpd_nsent--;
+	if (q->timer != NULL)
+		timer_stop(q->timer);
+	(*q->done)(q->associd, data, datalen);
+	free(q->data);
+	free(q);
+
+	ntpd_next();
+}
+
+/*
+ * ntpd did not answer a query in time
+ */
+static void
+ntpd_timeout(void *arg)
+{
+	struct ntpd_query *q = arg;
+
+	q->timer = NULL;
+	syslog(LOG_ERR, "timeout on NTP connection");
+	ntpd_finish(q, NULL, 0);
+}
+
+/*
+ * Drop all queries, e.g. when the module is unloaded
+ */
+static void
+ntpd_flush(void)
+{
+	struct ntpd_query *q;
+
+	while ((q = TAILQ_FIRST(&ntpd_sent)) != NULL) {
+		TAILQ_REMOVE(&ntpd_sent, q, link);
+		if (q->timer != NULL)
+			timer_stop(q->timer);
+		free(q->data);
+		free(q);
+	}
+	ntpd_nsent = 0;
+	while ((q = TAILQ_FIRST(&ntpd_waiting)) != NULL) {
+		TAILQ_REMOVE(&ntpd_waiting, q, link);
+		free(q);
+	}
+}
+
+/*
+ * Process one response packet. The query is found by the sequence number
+ * and the fragments are collected until the last one has arrived.
+ */
+static void
+ntpd_packet(const u_char *pkt, size_t pktlen)
+{
+	const u_char *ptr;
+	struct ntpd_query *q;
+	u_char	*nptr;
+	u_int	n, op, associd, offset;
+	int	more;
+	size_t	z;
+
+	if (pktlen < 12) {
+		syslog(LOG_ERR, "packet too short");
+		return;
 	}
 
 	ptr = pkt;
 	if ((*ptr & 0x3f) != ((NTPC_VERSION << 3) | NTPC_MODE)) {
 		syslog(LOG_ERR, "unexpected packet version 0x%x", *ptr);
-		free(*data);
-		return (-1);
+		return;
 	}
 	ptr++;
 
 	if (!(*ptr & NTPC_BIT_RESP)) {
 		syslog(LOG_ERR, "not a response packet");
-		return (-1);
+		return;
+	}
+
+	/* seqno */
+	n = ptr[1] << 8;
+	n |= ptr[2];
+
+	TAILQ_FOREACH(q, &ntpd_sent, link)
+		if (q->seqno == n)
+			break;
+	if (q == NULL) {
+		/* a late response to a query that has timed out */
+		if (ntp_debug & DBG_DUMP_PKTS)
+			syslog(LOG_INFO, "dropping response for seqno %u", n);
+		return;
 	}
+
 	if (*ptr & NTPC_BIT_ERROR) {
-		z = *datalen - 12;
+		z = pktlen - 12;
 		if (z > NTPC_DMAX)
 			z = NTPC_DMAX;
 		syslog(LOG_ERR, "error response: %.*s", (int)z, pkt + 12);
-		free(*data);
-		return (-1);
+		ntpd_finish(q, NULL, 0);
+		return;
 	}
 	more = (*ptr & NTPC_BIT_MORE);
 
-	*op = *ptr++ & NTPC_OPMASK;
-
-	/* seqno */
-	n = *ptr++ << 8;
-	n |= *ptr++;
-
-	if (n != seqno) {
-		syslog(LOG_ERR, "expecting seqno %u, got %u", seqno, n);
-		free(*data);
-		return (-1);
+	op = *ptr++ & NTPC_OPMASK;
+	if (op != q->op) {
+		syslog(LOG_ERR, "bad response op 0x%x", op);
+		ntpd_finish(q, NULL, 0);
+		return;
 	}
 
-	/* status */
-	n = *ptr++ << 8;
-	n |= *ptr++;
+	/* skip seqno and status */
+	ptr += 4;
 
 	/* associd */
-	*associd = *ptr++ << 8;
-	*associd |= *ptr++;
+	associd = *ptr++ << 8;
+	associd |= *ptr++;
+
+	if (associd != q->associd) {
+		syslog(LOG_ERR, "response for wrong associd");
+		ntpd_finish(q, NULL, 0);
+		return;
+	}
 
 	/* offset */
-	n = *ptr++ << 8;
-	n |= *ptr++;
+	offset = *ptr++ << 8;
+	offset |= *ptr++;
 
-	if (n != offset) {
-		syslog(LOG_ERR, "offset: expecting %u, got %u", offset, n);
-		free(*data);
-		return (-1);
+	if (offset != q->datalen) {
+		syslog(LOG_ERR, "offset: expecting %zu, got %u",
+		    q->datalen, offset);
+		ntpd_finish(q, NULL, 0);
+		return;
 	}
 
 	/* count */
 	n = *ptr++ << 8;
 	n |= *ptr++;
 
-	if ((size_t)ret < 12 + n) {
+	if (pktlen < 12 + n) {
 		syslog(LOG_ERR, "packet too short");
-		return (-1);
+		ntpd_finish(q, NULL, 0);
+		return;
 	}
 
-	nptr = realloc(*data, *datalen + n);
+	/*
+	 * Leave room for ntpd_parse() to terminate the last value. This
+	 * also makes sure that an empty response (no associations) is
+	 * reported with a non-NULL buffer - NULL means failure.
+	 */
+	nptr = realloc(q->data, q->datalen + n + 1);
 	if (nptr == NULL) {
 		syslog(LOG_ERR, "cannot allocate memory: %m");
-		free(*data);
-		return (-1);
+		ntpd_finish(q, NULL, 0);
+		return;
 	}
-	*data = nptr;
-
-	memcpy(*data + offset, ptr, n);
-	*datalen += n;
+	q->data = nptr;
+	memcpy(q->data + q->datalen, ptr, n);
+	q->datalen += n;
 
 	if (!more)
-		return (0);
-
-	offset += n;
-	goto next;
-}
-
-/*
- * Send a request and wait for the response
- */
-static int
-ntpd_dialog(u_int op, u_int associd, const char *vars, u_char **data,
-    size_t *datalen)
-{
-	uint16_t rassocid;
-	uint16_t rop;
-
-	if (ntpd_request(op, associd, vars) == -1)
-		return (-1);
-	if (ntpd_read(&rop, &rassocid, data, datalen) == -1)
-		return (-1);
-
-	if (rop != op) {
-		syslog(LOG_ERR, "bad response op 0x%x", rop);
-		free(data);
-		return (-1);
-	}
-
-	if (associd != rassocid) {
-		syslog(LOG_ERR, "response for wrong associd");
-		free(data);
-		return (-1);
-	}
-	return (0);
+		ntpd_finish(q, q->data, q->datalen);
 }
 
 /*
- * Callback if packet arrived from NTPD
+ * Callback if packets arrived from NTPD
  */
 static void
 ntpd_input(int fd __unused, void *arg __unused)
 {
-	uint16_t associd;
-	uint16_t op;
-	u_char	*data;
-	size_t	datalen;
+	u_char	pkt[NTPC_MAX + 1];
+	ssize_t	ret;
 
-	if (ntpd_read(&op, &associd, &data, &datalen) == -1)
-		return;
+	for (;;) {
+		ret = recv(ntpd_sock, pkt, sizeof(pkt), MSG_DONTWAIT);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				syslog(LOG_ERR, "error reading from ntpd: %m");
+			return;
+		}
 
-	free(data);
+		if (ntp_debug & DBG_DUMP_PKTS) {
+			syslog(LOG_INFO, "got %zd bytes", ret);
+			dump_packet(pkt, (size_t)ret);
+		}
+		ntpd_packet(pkt, (size_t)ret);
+	}
 }
 
 /*
@@ -730,7 +844,7 @@ val_parse_ip(const char *val, u_char ip[4])
 
 	r = sscanf(val, "%hhd.%hhd.%hhd.%hhd%n",
 	    &ip[0], &ip[1], &ip[2], &ip[3], &n);
-	if (n == 4 && (size_t)n == strlen(val))
+	if (r == 4 && (size_t)n == strlen(val))
 		return (0);
 
 	memset(ip, 0, 4);
@@ -760,22 +874,35 @@ val_parse_ip(const char *val, u_char ip[4])
 }
 
 /*
- * Fetch system info
+ * Copy a string value into a fixed size field
  */
 static int
-fetch_sysinfo(void)
+val_parse_str(const char *val, char buf[NTP_VALLEN])
+{
+	size_t len;
+
+	if ((len = strlen(val)) >= NTP_VALLEN) {
+		buf[0] = '\0';
+		return (0);
+	}
+	memcpy(buf, val, len + 1);
+	return (1);
+}
+
+/*
+ * The system info has arrived
+ */
+static void
+sysinfo_done(u_int associd __unused, u_char *data, size_t datalen)
 {
-	u_char *data;
 	u_char *ptr;
-	size_t datalen;
 	char *name;
 	char *val;
 
-	if (ntpd_dialog(NTPC_OP_READVAR, 0,
-	    "leap,stratum,precision,rootdelay,rootdispersion,refid,reftime,"
-	    "poll,peer,clock,system,processor,jitter,stability",
-	    &data, &datalen))
-		return (-1);
+	if (data == NULL) {
+		refresh_complete(sysinfo_refresh, -1);
+		return;
+	}
 
 	/* clear info */
 	sysb_leap = 0;
@@ -865,12 +992,28 @@ fetch_sysinfo(void)
 		}
 	}
 
-	free(data);
-	return (0);
+	refresh_complete(sysinfo_refresh, 0);
 }
 
+/*
+ * Fetch system info
+ */
 static int
-parse_filt(char *val, uint16_t associd, int which)
+fetch_sysinfo(void *arg __unused)
+{
+	if (ntpd_query(NTPC_OP_READVAR, 0,
+	    "leap,stratum,precision,rootdelay,rootdispersion,refid,reftime,"
+	    "poll,peer,clock,system,processor,jitter,stability",
+	    sysinfo_done) == -1)
+		return (-1);
+	return (REFRESH_PENDING);
+}
+
+/*
+ * Parse one column of the clock filter registers
+ */
+static int
+parse_filt(char *val, struct peer_vars *v, int which)
 {
 	char *w;
 	int cnt;
@@ -878,32 +1021,22 @@ parse_filt(char *val, uint16_t associd, int which)
 
 	cnt = 0;
 	for (w = strtok(val, " \t"); w != NULL; w = strtok(NULL, " \t")) {
-		TAILQ_FOREACH(f, &filts, link)
-			if (f->index.subs[0] == associd &&
-			    f->index.subs[1] == (asn_subid_t)(cnt + 1))
-				break;
-		if (f == NULL) {
-			f = malloc(sizeof(*f));
-			memset(f, 0, sizeof(*f));
-			f->index.len = 2;
-			f->index.subs[0] = associd;
-			f->index.subs[1] = cnt + 1;
-
-			INSERT_OBJECT_OID(f, &filts);
-		}
+		if (cnt == NTP_FILTMAX)
+			break;
+		f = &v->filt[cnt];
 
 		switch (which) {
 
 		  case 0:
-			f->offset = strdup(w);
+			val_parse_str(w, f->offset);
 			break;
 
 		  case 1:
-			f->delay = strdup(w);
+			val_parse_str(w, f->delay);
 			break;
 
 		  case 2:
-			f->dispersion = strdup(w);
+			val_parse_str(w, f->dispersion);
 			break;
 
 		  default:
@@ -915,190 +1048,257 @@ parse_filt(char *val, uint16_t associd, int which)
 }
 
 /*
- * Fetch the complete peer list
+ * Find a peer by its association id
  */
-static int
-fetch_peers(void)
+static struct peer *
+peer_find(u_int associd)
 {
-	u_char *data, *pdata, *ptr;
-	size_t datalen, pdatalen;
-	int i;
 	struct peer *p;
-	struct filt *f;
-	uint16_t associd;
+
+	TAILQ_FOREACH(p, &peers, link)
+		if (p->index == associd)
+			return (p);
+	return (NULL);
+}
+
+/*
+ * The variables of one association have arrived. When this was the last
+ * one, the peer list is complete.
+ */
+static void
+peer_done(u_int associd, u_char *data, size_t datalen)
+{
+	u_char *ptr;
+	struct peer *p;
+	struct peer_vars *v;
 	char *name, *val;
 
-	/* free the old list */
-	while ((p = TAILQ_FIRST(&peers)) != NULL) {
-		TAILQ_REMOVE(&peers, p, link);
-		free(p->rootdelay);
-		free(p->rootdispersion);
-		free(p->refid);
-		free(p->offset);
-		free(p->delay);
-		free(p->dispersion);
-		free(p);
+	if (data == NULL) {
+		peers_failed = 1;
+		goto out;
 	}
-	while ((f = TAILQ_FIRST(&filts)) != NULL) {
-		TAILQ_REMOVE(&filts, f, link);
-		free(f->offset);
-		free(f->delay);
-		free(f->dispersion);
-		free(f);
+	if ((p = peer_find(associd)) == NULL)
+		goto out;
+
+	/* parse the data over the old values */
+	v = &p->v;
+	memset(v, 0, sizeof(*v));
+
+	ptr = data;
+	while (ntpd_parse(&ptr, &datalen, &name, &val)) {
+		if (ntp_debug & DBG_DUMP_VARS)
+			syslog(LOG_DEBUG, "%s: '%s'='%s'",
+			    __func__, name, val);
+		if (strcmp(name, "config") == 0 ||
+		    strcmp(name, "peer.config") == 0) {
+			val_parse_int32(val, &v->config, 0, 1, 0);
+
+		} else if (strcmp(name, "srcadr") == 0 ||
+		    strcmp(name, "peer.srcadr") == 0) {
+			val_parse_ip(val, v->srcadr);
+
+		} else if (strcmp(name, "srcport") == 0 ||
+		    strcmp(name, "peer.srcport") == 0) {
+			val_parse_uint32(val, &v->srcport,
+			    1, 65535, 0);
+
+		} else if (strcmp(name, "dstadr") == 0 ||
+		    strcmp(name, "peer.dstadr") == 0) {
+			val_parse_ip(val, v->dstadr);
+
+		} else if (strcmp(name, "dstport") == 0 ||
+		    strcmp(name, "peer.dstport") == 0) {
+			val_parse_uint32(val, &v->dstport,
+			    1, 65535, 0);
+
+		} else if (strcmp(name, "leap") == 0 ||
+		    strcmp(name, "peer.leap") == 0) {
+			val_parse_int32(val, &v->leap, 0, 3, 2);
+
+		} else if (strcmp(name, "hmode") == 0 ||
+		    strcmp(name, "peer.hmode") == 0) {
+			val_parse_int32(val, &v->hmode, 0, 7, 0);
+
+		} else if (strcmp(name, "stratum") == 0 ||
+		    strcmp(name, "peer.stratum") == 0) {
+			val_parse_int32(val, &v->stratum, 0, 255, 0);
+
+		} else if (strcmp(name, "ppoll") == 0 ||
+		    strcmp(name, "peer.ppoll") == 0) {
+			val_parse_int32(val, &v->ppoll,
+			    INT32_MIN, INT32_MAX, 0);
+
+		} else if (strcmp(name, "hpoll") == 0 ||
+		    strcmp(name, "peer.hpoll") == 0) {
+			val_parse_int32(val, &v->hpoll,
+			    INT32_MIN, INT32_MAX, 0);
+
+		} else if (strcmp(name, "precision") == 0 ||
+		    strcmp(name, "peer.precision") == 0) {
+			val_parse_int32(val, &v->precision,
+			    INT32_MIN, INT32_MAX, 0);
+
+		} else if (strcmp(name, "rootdelay") == 0 ||
+		    strcmp(name, "peer.rootdelay") == 0) {
+			val_parse_str(val, v->rootdelay);
+
+		} else if (strcmp(name, "rootdispersion") == 0 ||
+		    strcmp(name, "peer.rootdispersion") == 0) {
+			val_parse_str(val, v->rootdispersion);
+
+		} else if (strcmp(name, "refid") == 0 ||
+		    strcmp(name, "peer.refid") == 0) {
+			val_parse_str(val, v->refid);
+
+		} else if (strcmp(name, "reftime") == 0 ||
+		    strcmp(name, "sys.reftime") == 0) {
+			val_parse_ts(val, v->reftime);
+
+		} else if (strcmp(name, "org") == 0 ||
+		    strcmp(name, "sys.org") == 0) {
+			val_parse_ts(val, v->orgtime);
+
+		} else if (strcmp(name, "rec") == 0 ||
+		    strcmp(name, "sys.rec") == 0) {
+			val_parse_ts(val, v->rcvtime);
+
+		} else if (strcmp(name, "xmt") == 0 ||
+		    strcmp(name, "sys.xmt") == 0) {
+			val_parse_ts(val, v->xmttime);
+
+		} else if (strcmp(name, "reach") == 0 ||
+		    strcmp(name, "peer.reach") == 0) {
+			val_parse_uint32(val, &v->reach,
+			    0, 65535, 0);
+
+		} else if (strcmp(name, "timer") == 0 ||
+		    strcmp(name, "peer.timer") == 0) {
+			val_parse_int32(val, &v->timer,
+			    INT32_MIN, INT32_MAX, 0);
+
+		} else if (strcmp(name, "offset") == 0 ||
+		    strcmp(name, "peer.offset") == 0) {
+			val_parse_str(val, v->offset);
+
+		} else if (strcmp(name, "delay") == 0 ||
+		    strcmp(name, "peer.delay") == 0) {
+			val_parse_str(val, v->delay);
+
+		} else if (strcmp(name, "dispersion") == 0 ||
+		    strcmp(name, "peer.dispersion") == 0) {
+			val_parse_str(val, v->dispersion);
+
+		} else if (strcmp(name, "filtdelay") == 0 ||
+		    strcmp(name, "peer.filtdelay") == 0) {
+			v->filt_entries = parse_filt(val, v, 1);
+
+		} else if (strcmp(name, "filtoffset") == 0 ||
+		    strcmp(name, "peer.filtoffset") == 0) {
+			v->filt_entries = parse_filt(val, v, 0);
+
+		} else if (strcmp(name, "filtdisp") == 0 ||
+		    strcmp(name, "peer.filtdisp") == 0) {
+			v->filt_entries = parse_filt(val, v, 2);
+		}
 	}
 
-	/* fetch the list of associations */
-	if (ntpd_dialog(NTPC_OP_READSTAT, 0, NULL, &data, &datalen))
-		return (-1);
+  out:
+	if (--peers_waiting == 0)
+		refresh_complete(peers_refresh, peers_failed ? -1 : 0);
+}
+
+/*
+ * The list of associations has arrived. Peers that have gone away are
+ * dropped, the others are kept and their variables are all asked for
+ * at once. The responses are matched to the requests in ntpd_packet().
+ */
+static void
+peers_list_done(u_int id __unused, u_char *data, size_t datalen)
+{
+	u_int i;
+	uint16_t associd;
+	struct peer *p, *p1;
 
-	for (i = 0; i < (int)(datalen / 4); i++) {
+	if (data == NULL) {
+		refresh_complete(peers_refresh, -1);
+		return;
+	}
+
+	TAILQ_FOREACH(p, &peers, link)
+		p->seen = 0;
+	for (i = 0; i < datalen / 4; i++) {
 		associd  = data[4 * i + 0] << 8;
 		associd |= data[4 * i + 1] << 0;
 
-		/* ask for the association variables */
-		if (ntpd_dialog(NTPC_OP_READVAR, associd,
+		if ((p = peer_find(associd)) == NULL) {
+			if ((p = malloc(sizeof(*p))) == NULL) {
+				syslog(LOG_ERR, "%m");
+				refresh_complete(peers_refresh, -1);
+				return;
+			}
+			memset(p, 0, sizeof(*p));
+			p->index = associd;
+			INSERT_OBJECT_INT(p, &peers);
+		}
+		p->seen = 1;
+	}
+	p = TAILQ_FIRST(&peers);
+	while (p != NULL) {
+		p1 = TAILQ_NEXT(p, link);
+		if (!p->seen) {
+			TAILQ_REMOVE(&peers, p, link);
+			free(p);
+		}
+		p = p1;
+	}
+
+	peers_waiting = 0;
+	peers_failed = 0;
+	TAILQ_FOREACH(p, &peers, link) {
+		if (ntpd_query(NTPC_OP_READVAR, p->index,
 		    "config,srcadr,srcport,dstadr,dstport,leap,hmode,stratum,"
 		    "hpoll,ppoll,precision,rootdelay,rootdispersion,refid,"
 		    "reftime,org,rec,xmt,reach,timer,offset,delay,dispersion,"
-		    "filtdelay,filtoffset,filtdisp",
-		    &pdata, &pdatalen)) {
-			free(data);
-			return (-1);
-		}
-
-		/* now save and parse the data */
-		p = malloc(sizeof(*p));
-		if (p == NULL) {
-			free(data);
-			syslog(LOG_ERR, "%m");
-			return (-1);
-		}
-		memset(p, 0, sizeof(*p));
-		p->index = associd;
-		INSERT_OBJECT_INT(p, &peers);
-
-		ptr = pdata;
-		while (ntpd_parse(&ptr, &pdatalen, &name, &val)) {
-			if (ntp_debug & DBG_DUMP_VARS)
-				syslog(LOG_DEBUG, "%s: '%s'='%s'",
-				    __func__, name, val);
-			if (strcmp(name, "config") == 0 ||
-			    strcmp(name, "peer.config") == 0) {
-				val_parse_int32(val, &p->config, 0, 1, 0);
-
-			} else if (strcmp(name, "srcadr") == 0 ||
-			    strcmp(name, "peer.srcadr") == 0) {
-				val_parse_ip(val, p->srcadr);
-
-			} else if (strcmp(name, "srcport") == 0 ||
-			    strcmp(name, "peer.srcport") == 0) {
-				val_parse_uint32(val, &p->srcport,
-				    1, 65535, 0);
-
-			} else if (strcmp(name, "dstadr") == 0 ||
-			    strcmp(name, "peer.dstadr") == 0) {
-				val_parse_ip(val, p->dstadr);
-
-			} else if (strcmp(name, "dstport") == 0 ||
-			    strcmp(name, "peer.dstport") == 0) {
-				val_parse_uint32(val, &p->dstport,
-				    1, 65535, 0);
-
-			} else if (strcmp(name, "leap") == 0 ||
-			    strcmp(name, "peer.leap") == 0) {
-				val_parse_int32(val, &p->leap, 0, 3, 2);
-
-			} else if (strcmp(name, "hmode") == 0 ||
-			    strcmp(name, "peer.hmode") == 0) {
-				val_parse_int32(val, &p->hmode, 0, 7, 0);
-
-			} else if (strcmp(name, "stratum") == 0 ||
-			    strcmp(name, "peer.stratum") == 0) {
-				val_parse_int32(val, &p->stratum, 0, 255, 0);
-
-			} else if (strcmp(name, "ppoll") == 0 ||
-			    strcmp(name, "peer.ppoll") == 0) {
-				val_parse_int32(val, &p->ppoll,
-				    INT32_MIN, INT32_MAX, 0);
-
-			} else if (strcmp(name, "hpoll") == 0 ||
-			    strcmp(name, "peer.hpoll") == 0) {
-				val_parse_int32(val, &p->hpoll,
-				    INT32_MIN, INT32_MAX, 0);
-
-			} else if (strcmp(name, "precision") == 0 ||
-			    strcmp(name, "peer.precision") == 0) {
-				val_parse_int32(val, &p->hpoll,
-				    INT32_MIN, INT32_MAX, 0);
-
-			} else if (strcmp(name, "rootdelay") == 0 ||
-			    strcmp(name, "peer.rootdelay") == 0) {
-				p->rootdelay = strdup(val);
-
-			} else if (strcmp(name, "rootdispersion") == 0 ||
-			    strcmp(name, "peer.rootdispersion") == 0) {
-				p->rootdispersion = strdup(val);
-
-			} else if (strcmp(name, "refid") == 0 ||
-			    strcmp(name, "peer.refid") == 0) {
-				p->refid = strdup(val);
-
-			} else if (strcmp(name, "reftime") == 0 ||
-			    strcmp(name, "sys.reftime") == 0) {
-				val_parse_ts(val, p->reftime);
-
-			} else if (strcmp(name, "org") == 0 ||
-			    strcmp(name, "sys.org") == 0) {
-				val_parse_ts(val, p->orgtime);
-
-			} else if (strcmp(name, "rec") == 0 ||
-			    strcmp(name, "sys.rec") == 0) {
-				val_parse_ts(val, p->rcvtime);
-
-			} else if (strcmp(name, "xmt") == 0 ||
-			    strcmp(name, "sys.xmt") == 0) {
-				val_parse_ts(val, p->xmttime);
-
-			} else if (strcmp(name, "reach") == 0 ||
-			    strcmp(name, "peer.reach") == 0) {
-				val_parse_uint32(val, &p->reach,
-				    0, 65535, 0);
-
-			} else if (strcmp(name, "timer") == 0 ||
-			    strcmp(name, "peer.timer") == 0) {
-				val_parse_int32(val, &p->timer,
-				    INT32_MIN, INT32_MAX, 0);
-
-			} else if (strcmp(name, "offset") == 0 ||
-			    strcmp(name, "peer.offset") == 0) {
-				p->offset = strdup(val);
-
-			} else if (strcmp(name, "delay") == 0 ||
-			    strcmp(name, "peer.delay") == 0) {
-				p->delay = strdup(val);
-
-			} else if (strcmp(name, "dispersion") == 0 ||
-			    strcmp(name, "peer.dispersion") == 0) {
-				p->dispersion = strdup(val);
-
-			} else if (strcmp(name, "filtdelay") == 0 ||
-			    strcmp(name, "peer.filtdelay") == 0) {
-				p->filt_entries = parse_filt(val, associd, 0);
-
-			} else if (strcmp(name, "filtoffset") == 0 ||
-			    strcmp(name, "peer.filtoffset") == 0) {
-				p->filt_entries = parse_filt(val, associd, 1);
-
-			} else if (strcmp(name, "filtdisp") == 0 ||
-			    strcmp(name, "peer.filtdisp") == 0) {
-				p->filt_entries = parse_filt(val, associd, 2);
-			}
+		    "filtdelay,filtoffset,filtdisp", peer_done) == -1) {
+			peers_failed = 1;
+			break;
 		}
-		free(pdata);
+		peers_waiting++;
 	}
+	if (peers_waiting == 0)
+		refresh_complete(peers_refresh, peers_failed ? -1 : 0);
+}
 
-	free(data);
-	return (0);
+/*
+ * Fetch the peer list. The peers are updated in place when the
+ * responses arrive.
+ */
+static int
+fetch_peers(void *arg __unused)
+{
+
+	/* fetch the list of associations */
+	if (ntpd_query(NTPC_OP_READSTAT, 0, NULL, peers_list_done) == -1)
+		return (-1);
+	return (REFRESH_PENDING);
+}
+
+/*
+ * Make sure the cached data is current. If a query to ntpd had to be
+ * started, the request waits for it.
+ */
+static int
+ntp_check(struct snmp_refresh *r)
+{
+	switch (refresh_check(r)) {
+
+	  case -1:
+		return (SNMP_ERR_GENERR);
+
+	  case REFRESH_PENDING:
+		return (SNMP_ERR_PENDING);
+	}
+	return (SNMP_ERR_NOERROR);
 }
 
 /*
@@ -1109,6 +1309,7 @@ op_ntpSystem(struct snmp_context *ctx __unused, struct snmp_value *value,
     u_int sub, u_int iidx __unused, enum snmp_op op)
 {
 	asn_subid_t which = value->var.subs[sub - 1];
+	int ret;
 
 	switch (op) {
 
@@ -1116,11 +1317,8 @@ op_ntpSystem(struct snmp_context *ctx __unused, struct snmp_value *value,
 		abort();
 
 	  case SNMP_OP_GET:
-		if (this_tick > sysinfo_tick) {
-			if (fetch_sysinfo() == -1)
-				return (SNMP_ERR_GENERR);
-			sysinfo_tick = this_tick;
-		}
+		if ((ret = ntp_check(sysinfo_refresh)) != SNMP_ERR_NOERROR)
+			return (ret);
 
 		switch (which) {
 
@@ -1211,12 +1409,10 @@ op_ntpPeersVarTable(struct snmp_context *ctx __unused, struct snmp_value *value,
 	asn_subid_t which = value->var.subs[sub - 1];
 	uint32_t peer;
 	struct peer *t;
+	int ret;
 
-	if (this_tick > peers_tick) {
-		if (fetch_peers() == -1)
-			return (SNMP_ERR_GENERR);
-		peers_tick = this_tick;
-	}
+	if ((ret = ntp_check(peers_refresh)) != SNMP_ERR_NOERROR)
+		return (ret);
 
 	switch (op) {
 
@@ -1254,84 +1450,84 @@ op_ntpPeersVarTable(struct snmp_context *ctx __unused, struct snmp_value *value,
 	switch (which) {
 
 	  case LEAF_ntpPeersConfigured:
-		value->v.integer = t->config;
+		value->v.integer = t->v.config;
 		break;
 
 	  case LEAF_ntpPeersPeerAddress:
-		return (ip_get(value, t->srcadr));
+		return (ip_get(value, t->v.srcadr));
 
 	  case LEAF_ntpPeersPeerPort:
-		value->v.uint32 = t->srcport;
+		value->v.uint32 = t->v.srcport;
 		break;
 
 	  case LEAF_ntpPeersHostAddress:
-		return (ip_get(value, t->dstadr));
+		return (ip_get(value, t->v.dstadr));
 
 	  case LEAF_ntpPeersHostPort:
-		value->v.uint32 = t->dstport;
+		value->v.uint32 = t->v.dstport;
 		break;
 
 	  case LEAF_ntpPeersLeap:
-		value->v.integer = t->leap;
+		value->v.integer = t->v.leap;
 		break;
 
 	  case LEAF_ntpPeersMode:
-		value->v.integer = t->hmode;
+		value->v.integer = t->v.hmode;
 		break;
 
 	  case LEAF_ntpPeersStratum:
-		value->v.integer = t->stratum;
+		value->v.integer = t->v.stratum;
 		break;
 
 	  case LEAF_ntpPeersPeerPoll:
-		value->v.integer = t->ppoll;
+		value->v.integer = t->v.ppoll;
 		break;
 
 	  case LEAF_ntpPeersHostPoll:
-		value->v.integer = t->hpoll;
+		value->v.integer = t->v.hpoll;
 		break;
 
 	  case LEAF_ntpPeersPrecision:
-		value->v.integer = t->precision;
+		value->v.integer = t->v.precision;
 		break;
 
 	  case LEAF_ntpPeersRootDelay:
-		return (string_get(value, t->rootdelay, -1));
+		return (string_get(value, t->v.rootdelay, -1));
 
 	  case LEAF_ntpPeersRootDispersion:
-		return (string_get(value, t->rootdispersion, -1));
+		return (string_get(value, t->v.rootdispersion, -1));
 
 	  case LEAF_ntpPeersRefId:
-		return (string_get(value, t->refid, -1));
+		return (string_get(value, t->v.refid, -1));
 
 	  case LEAF_ntpPeersRefTime:
-		return (string_get(value, t->reftime, 8));
+		return (string_get(value, t->v.reftime, 8));
 
 	  case LEAF_ntpPeersOrgTime:
-		return (string_get(value, t->orgtime, 8));
+		return (string_get(value, t->v.orgtime, 8));
 
 	  case LEAF_ntpPeersReceiveTime:
-		return (string_get(value, t->rcvtime, 8));
+		return (string_get(value, t->v.rcvtime, 8));
 
 	  case LEAF_ntpPeersTransmitTime:
-		return (string_get(value, t->xmttime, 8));
+		return (string_get(value, t->v.xmttime, 8));
 
 	  case LEAF_ntpPeersReach:
-		value->v.uint32 = t->reach;
+		value->v.uint32 = t->v.reach;
 		break;
 
 	  case LEAF_ntpPeersTimer:
-		value->v.uint32 = t->timer;
+		value->v.uint32 = t->v.timer;
 		break;
 
 	  case LEAF_ntpPeersOffset:
-		return (string_get(value, t->offset, -1));
+		return (string_get(value, t->v.offset, -1));
 
 	  case LEAF_ntpPeersDelay:
-		return (string_get(value, t->delay, -1));
+		return (string_get(value, t->v.delay, -1));
 
 	  case LEAF_ntpPeersDispersion:
-		return (string_get(value, t->dispersion, -1));
+		return (string_get(value, t->v.dispersion, -1));
 
 	  default:
 		abort();
@@ -1347,12 +1543,10 @@ op_ntpFilterPeersVarTable(struct snmp_context *ctx __unused,
 	asn_subid_t which = value->var.subs[sub - 1];
 	uint32_t peer;
 	struct peer *t;
+	int ret;
 
-	if (this_tick > peers_tick) {
-		if (fetch_peers() == -1)
-			return (SNMP_ERR_GENERR);
-		peers_tick = this_tick;
-	}
+	if ((ret = ntp_check(peers_refresh)) != SNMP_ERR_NOERROR)
+		return (ret);
 
 	switch (op) {
 
@@ -1390,7 +1584,7 @@ op_ntpFilterPeersVarTable(struct snmp_context *ctx __unused,
 	switch (which) {
 
 	  case LEAF_ntpFilterValidEntries:
-		value->v.integer = t->filt_entries;
+		value->v.integer = t->v.filt_entries;
 		break;
 
 	  default:
@@ -1399,6 +1593,54 @@ op_ntpFilterPeersVarTable(struct snmp_context *ctx __unused,
 	return (SNMP_ERR_NOERROR);
 }
 
+/*
+ * Find a filter register. The table is indexed by the association id
+ * and the register number which runs from 1 to the number of entries
+ * of the peer.
+ */
+static struct peer *
+filt_find(const struct asn_oid *oid, u_int sub, u_int *reg)
+{
+	struct peer *p;
+
+	if (oid->len != sub + 2)
+		return (NULL);
+	if ((p = peer_find(oid->subs[sub])) == NULL)
+		return (NULL);
+	if (oid->subs[sub + 1] == 0 ||
+	    oid->subs[sub + 1] > (asn_subid_t)p->v.filt_entries)
+		return (NULL);
+	*reg = oid->subs[sub + 1];
+	return (p);
+}
+
+/*
+ * Find the filter register following the given index
+ */
+static struct peer *
+filt_next(const struct asn_oid *oid, u_int sub, u_int *reg)
+{
+	struct peer *p;
+	asn_subid_t associd, n;
+
+	associd = (oid->len > sub) ? oid->subs[sub] : 0;
+	n = (oid->len > sub + 1) ? oid->subs[sub + 1] : 0;
+
+	TAILQ_FOREACH(p, &peers, link) {
+		if (p->index < associd || p->v.filt_entries == 0)
+			continue;
+		if (p->index == associd && oid->len > sub) {
+			if (n >= (asn_subid_t)p->v.filt_entries)
+				continue;
+			*reg = n + 1;
+			return (p);
+		}
+		*reg = 1;
+		return (p);
+	}
+	return (NULL);
+}
+
 int
 op_ntpFilterRegisterTable(struct snmp_context *ctx __unused, struct snmp_value *value __unused,
     u_int sub __unused, u_int iidx __unused, enum snmp_op op __unused)
@@ -1406,25 +1648,26 @@ op_ntpFilterRegisterTable(struct snmp_context *ctx __unused, struct snmp_value *
 	asn_subid_t which = value->var.subs[sub - 1];
 	uint32_t peer;
 	uint32_t filt;
-	struct filt *t;
+	struct peer *t;
+	u_int reg;
+	int ret;
 
-	if (this_tick > peers_tick) {
-		if (fetch_peers() == -1)
-			return (SNMP_ERR_GENERR);
-		peers_tick = this_tick;
-	}
+	if ((ret = ntp_check(peers_refresh)) != SNMP_ERR_NOERROR)
+		return (ret);
 
 	switch (op) {
 
 	  case SNMP_OP_GETNEXT:
-		t = NEXT_OBJECT_OID(&filts, &value->var, sub);
+		t = filt_next(&value->var, sub, &reg);
 		if (t == NULL)
 			return (SNMP_ERR_NOSUCHNAME);
-		index_append(&value->var, sub, &t->index);
+		value->var.len = sub + 2;
+		value->var.subs[sub] = t->index;
+		value->var.subs[sub + 1] = reg;
 		break;
 
 	  case SNMP_OP_GET:
-		t = FIND_OBJECT_OID(&filts, &value->var, sub);
+		t = filt_find(&value->var, sub, &reg);
 		if (t == NULL)
 			return (SNMP_ERR_NOSUCHNAME);
 		break;
@@ -1432,7 +1675,7 @@ op_ntpFilterRegisterTable(struct snmp_context *ctx __unused, struct snmp_value *
 	  case SNMP_OP_SET:
 		if (index_decode(&value->var, sub, iidx, &peer, &filt))
 			return (SNMP_ERR_NO_CREATION);
-		t = FIND_OBJECT_OID(&filts, &value->var, sub);
+		t = filt_find(&value->var, sub, &reg);
 		if (t != NULL)
 			return (SNMP_ERR_NOT_WRITEABLE);
 		return (SNMP_ERR_NO_CREATION);
@@ -1449,13 +1692,13 @@ op_ntpFilterRegisterTable(struct snmp_context *ctx __unused, struct snmp_value *
 	switch (which) {
 
 	  case LEAF_ntpFilterPeersOffset:
-		return (string_get(value, t->offset, -1));
+		return (string_get(value, t->v.filt[reg - 1].offset, -1));
 
 	  case LEAF_ntpFilterPeersDelay:
-		return (string_get(value, t->delay, -1));
+		return (string_get(value, t->v.filt[reg - 1].delay, -1));
 
 	  case LEAF_ntpFilterPeersDispersion:
-		return (string_get(value, t->dispersion, -1));
+		return (string_get(value, t->v.filt[reg - 1].dispersion, -1));
 
 	  default:
 		abort();
@@ -1496,22 +1739,18 @@ op_begemot_ntp(struct snmp_context *ctx __unused, struct snmp_value *value,
 			return (SNMP_ERR_NOERROR);
 
 		  case LEAF_begemotNtpJitter:
-			if (this_tick > sysinfo_tick) {
-				if (fetch_sysinfo() == -1)
-					return (SNMP_ERR_GENERR);
-				sysinfo_tick = this_tick;
-			}
+			if ((ret = ntp_check(sysinfo_refresh)) !=
+			    SNMP_ERR_NOERROR)
+				return (ret);
 			if (!sysb_jitter)
 				return (SNMP_ERR_NOSUCHNAME);
 			value->v.counter64 = sys_jitter / 1000 * (1ULL << 32);
 			return (SNMP_ERR_NOERROR);
 
 		  case LEAF_begemotNtpStability:
-			if (this_tick > sysinfo_tick) {
-				if (fetch_sysinfo() == -1)
-					return (SNMP_ERR_GENERR);
-				sysinfo_tick = this_tick;
-			}
+			if ((ret = ntp_check(sysinfo_refresh)) !=
+			    SNMP_ERR_NOERROR)
+				return (ret);
 			if (!sysb_stability)
 				return (SNMP_ERR_NOSUCHNAME);
 			value->v.counter64 = sys_stability * (1ULL << 32);
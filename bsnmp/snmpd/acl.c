@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Source address access control.
+ *
+ * The entries of begemotSnmpdAclTable are compiled into one binary prefix
+ * trie per address family whenever the table changes. Checking a peer
+ * walks at most 32 (or 128) nodes; the longest matching prefix decides.
+ * Peers that match no entry are permitted.
+ *
+ * If the daemon is built with TCP wrappers, hosts_access(3) is consulted
+ * for addresses that the table permits. Its verdict is cached per address
+ * until the configuration is re-read.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <netinet/in.h>
+#if defined(USE_TCPWRAPPERS)
+#include <arpa/inet.h>
+#include <tcpd.h>
+#endif
+
+#include "snmpmod.h"
+#include "snmpd.h"
+#include "tree.h"
+#include "oid.h"
+
+static const struct asn_oid
+	oid_begemotSnmpdAclTable = OIDX_begemotSnmpdAclTable;
+
+#define	ACL_PERMIT	1
+#define	ACL_DENY	2
+
+/* maximum number of cached hosts_access(3) verdicts */
+#define	ACL_WRAP_CACHE	1024
+
+struct acl_entry {
+	TAILQ_ENTRY(acl_entry) link;
+	struct asn_oid	index;
+	u_char		addr[16];
+	u_int		alen;		/* 4 or 16 */
+	u_int		plen;		/* prefix length in bits */
+	int		action;
+};
+static TAILQ_HEAD(, acl_entry) acl_list = TAILQ_HEAD_INITIALIZER(acl_list);
+
+struct acl_node {
+	struct acl_node	*child[2];
+	int		action;		/* 0 if no entry ends here */
+};
+
+/* compiled tries for IPv4 and IPv6 */
+static struct acl_node *acl_trie4;
+static struct acl_node *acl_trie6;
+
+#if defined(USE_TCPWRAPPERS)
+/* hosts_access(3) request */
+static struct request_info req;
+
+/* cached verdicts of hosts_access(3) */
+static struct acl_node *wrap_trie4;
+static struct acl_node *wrap_trie6;
+static u_int wrap_cached;
+#endif
+
+/*
+ * Free a trie
+ */
+static void
+acl_trie_free(struct acl_node *n)
+{
+
+	if (n != NULL) {
+		acl_trie_free(n->child[0]);
+		acl_trie_free(n->child[1]);
+		free(n);
+	}
+}
+
+/*
+ * Insert a prefix into a trie. Returns -1 if out of memory.
+ */
+static int
+acl_trie_insert(struct acl_node **rootp, const u_char *addr, u_int plen,
+    int action)
+{
+	struct acl_node **np = rootp;
+	u_int i;
+
+	for (i = 0; ; i++) {
+		if (*np == NULL) {
+			if ((*np = calloc(1, sizeof(**np))) == NULL)
+				return (-1);
+		}
+		if (i == plen)
+			break;
+		np = &(*np)->child[(addr[i / 8] >> (7 - i % 8)) & 1];
+	}
+	(*np)->action = action;
+	return (0);
+}
+
+/*
+ * Find the action of the longest matching prefix. Returns 0 if there is
+ * no match.
+ */
+static int
+acl_trie_lookup(const struct acl_node *n, const u_char *addr, u_int bits)
+{
+	int action = 0;
+	u_int i;
+
+	for (i = 0; n != NULL; i++) {
+		if (n->action != 0)
+			action = n->action;
+		if (i == bits)
+			break;
+		n = n->child[(addr[i / 8] >> (7 - i % 8)) & 1];
+	}
+	return (action);
+}
+
+/*
+ * Rebuild the tries from the table.
+ */
+static void
+acl_compile(void)
+{
+	struct acl_node *t4 = NULL, *t6 = NULL;
+	struct acl_entry *e;
+
+	TAILQ_FOREACH(e, &acl_list, link)
+		if (acl_trie_insert(e->alen == 4 ? &t4 : &t6, e->addr,
+		    e->plen, e->action) == -1) {
+			syslog(LOG_ERR, "acl: %m - keeping old access list");
+			acl_trie_free(t4);
+			acl_trie_free(t6);
+			return;
+		}
+
+	acl_trie_free(acl_trie4);
+	acl_trie_free(acl_trie6);
+	acl_trie4 = t4;
+	acl_trie6 = t6;
+}
+
+#if defined(USE_TCPWRAPPERS)
+/*
+ * Ask hosts_access(3) about an address we have no verdict for yet.
+ */
+static int
+acl_wrap_check(int family, const u_char *addr)
+{
+	struct acl_node **rootp;
+	char client[INET6_ADDRSTRLEN];
+	u_int bits;
+	int action;
+
+	rootp = (family == AF_INET) ? &wrap_trie4 : &wrap_trie6;
+	bits = (family == AF_INET) ? 32 : 128;
+
+	if ((action = acl_trie_lookup(*rootp, addr, bits)) != 0)
+		return (action);
+
+	if (inet_ntop(family, addr, client, sizeof(client)) == NULL) {
+		syslog(LOG_ERR, "inet_ntop(): %m");
+		return (ACL_PERMIT);
+	}
+	request_set(&req, RQ_CLIENT_ADDR, client, 0);
+	if (hosts_access(&req) == 0) {
+		syslog(LOG_ERR, "refused connection from %.500s",
+		    eval_client(&req));
+		action = ACL_DENY;
+	} else
+		action = ACL_PERMIT;
+
+	if (wrap_cached == ACL_WRAP_CACHE)
+		acl_flush();
+	if (acl_trie_insert(rootp, addr, bits, action) == 0)
+		wrap_cached++;
+
+	return (action);
+}
+#endif
+
+/*
+ * Check whether a peer may talk to us. Returns 0 if so, -1 otherwise.
+ */
+int
+acl_check(const struct sockaddr *sa)
+{
+	const u_char *addr;
+	int action;
+
+	switch (sa->sa_family) {
+
+	  case AF_INET:
+		addr = (const u_char *)
+		    &((const struct sockaddr_in *)(const void *)sa)->sin_addr;
+		action = acl_trie_lookup(acl_trie4, addr, 32);
+		break;
+
+	  case AF_INET6:
+		addr = (const u_char *)
+		    &((const struct sockaddr_in6 *)(const void *)sa)->sin6_addr;
+		action = acl_trie_lookup(acl_trie6, addr, 128);
+		break;
+
+	  default:
+		return (0);
+	}
+
+#if defined(USE_TCPWRAPPERS)
+	if (action != ACL_DENY)
+		action = acl_wrap_check(sa->sa_family, addr);
+#endif
+
+	return (action == ACL_DENY ? -1 : 0);
+}
+
+/*
+ * Forget all cached verdicts. This is called when the configuration is
+ * re-read.
+ */
+void
+acl_flush(void)
+{
+#if defined(USE_TCPWRAPPERS)
+	acl_trie_free(wrap_trie4);
+	acl_trie_free(wrap_trie6);
+	wrap_trie4 = wrap_trie6 = NULL;
+	wrap_cached = 0;
+#endif
+}
+
+void
+acl_init(void)
+{
+#if defined(USE_TCPWRAPPERS)
+	/*
+	 * Initialize hosts_access(3) handler.
+	 */
+	request_init(&req, RQ_DAEMON, "snmpd", 0);
+	sock_methods(&req);
+#endif
+}
+
+/*
+ * Dependency to create, modify or delete an entry
+ */
+struct acl_dep {
+	struct snmp_dependency dep;
+
+	/* index */
+	u_char		*addr;
+	size_t		alen;
+	u_int32_t	plen;
+
+	struct acl_entry *entry;
+
+	/* which of the fields are set */
+	u_int		set;
+
+	int		action;
+	int		status;
+	int		old_action;
+};
+#define	AD_ACTION	0x01
+#define	AD_STATUS	0x02
+#define	AD_CREATE	0x04	/* rollback create */
+#define	AD_DELETE	0x08	/* delete in finish */
+#define	AD_MODIFY	0x10	/* rollback modify */
+
+/*
+ * Create a table entry
+ */
+static int
+acl_create(struct acl_dep *ad)
+{
+	struct acl_entry *e;
+	u_int i;
+
+	if ((ad->alen != 4 && ad->alen != 16) || ad->plen > ad->alen * 8)
+		return (SNMP_ERR_INCONS_NAME);
+
+	if ((e = malloc(sizeof(*e))) == NULL)
+		return (SNMP_ERR_RES_UNAVAIL);
+	memset(e, 0, sizeof(*e));
+
+	memcpy(e->addr, ad->addr, ad->alen);
+	e->alen = ad->alen;
+	e->plen = ad->plen;
+	e->action = (ad->set & AD_ACTION) ? ad->action : ACL_PERMIT;
+
+	e->index.len = e->alen + 2;
+	e->index.subs[0] = e->alen;
+	for (i = 0; i < e->alen; i++)
+		e->index.subs[i + 1] = e->addr[i];
+	e->index.subs[i + 1] = e->plen;
+
+	INSERT_OBJECT_OID(e, &acl_list);
+	ad->entry = e;
+
+	return (SNMP_ERR_NOERROR);
+}
+
+static void
+acl_remove(struct acl_entry *e)
+{
+
+	TAILQ_REMOVE(&acl_list, e, link);
+	free(e);
+}
+
+/*
+ * Dependency handler for the access list
+ */
+static int
+acl_func(struct snmp_context *ctx, struct snmp_dependency *dep,
+    enum snmp_depop op)
+{
+	struct acl_dep *ad = (struct acl_dep *)(void *)dep;
+	int err = SNMP_ERR_NOERROR;
+
+	switch (op) {
+
+	  case SNMP_DEPOP_COMMIT:
+		if (ad->entry == NULL) {
+			if (!(ad->set & AD_STATUS) || !ad->status)
+				err = SNMP_ERR_INCONS_NAME;
+			else if ((err = acl_create(ad)) == SNMP_ERR_NOERROR)
+				ad->set |= AD_CREATE;
+
+		} else if ((ad->set & AD_STATUS) && !ad->status) {
+			/* delete - defer to finalizer */
+			ad->set |= AD_DELETE;
+
+		} else if (ad->set & AD_ACTION) {
+			ad->old_action = ad->entry->action;
+			ad->entry->action = ad->action;
+			ad->set |= AD_MODIFY;
+		}
+		return (err);
+
+	  case SNMP_DEPOP_ROLLBACK:
+		if (ad->set & AD_CREATE)
+			acl_remove(ad->entry);
+		else if (ad->set & AD_MODIFY)
+			ad->entry->action = ad->old_action;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_DEPOP_FINISH:
+		if (ctx->code == SNMP_RET_OK) {
+			if (ad->set & AD_DELETE)
+				acl_remove(ad->entry);
+			if (ad->set & (AD_CREATE | AD_DELETE | AD_MODIFY))
+				acl_compile();
+		}
+		free(ad->addr);
+		return (SNMP_ERR_NOERROR);
+	}
+	abort();
+}
+
+/*
+ * Access list table
+ */
+int
+op_acl(struct snmp_context *ctx, struct snmp_value *value,
+    u_int sub, u_int iidx, enum snmp_op op)
+{
+	asn_subid_t which = value->var.subs[sub - 1];
+	struct acl_entry *e;
+	struct acl_dep *ad;
+	struct asn_oid didx;
+	u_char *addr;
+	size_t alen;
+	u_int32_t plen;
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		if ((e = NEXT_OBJECT_OID(&acl_list, &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		index_append(&value->var, sub, &e->index);
+		break;
+
+	  case SNMP_OP_GET:
+		if ((e = FIND_OBJECT_OID(&acl_list, &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		break;
+
+	  case SNMP_OP_SET:
+		e = FIND_OBJECT_OID(&acl_list, &value->var, sub);
+
+		if (index_decode(&value->var, sub, iidx, &addr, &alen, &plen))
+			return (SNMP_ERR_NO_CREATION);
+
+		asn_slice_oid(&didx, &value->var, sub, value->var.len);
+		if ((ad = (struct acl_dep *)(void *)snmp_dep_lookup(ctx,
+		    &oid_begemotSnmpdAclTable, &didx, sizeof(*ad),
+		    acl_func)) == NULL) {
+			free(addr);
+			return (SNMP_ERR_GENERR);
+		}
+
+		if (ad->addr == NULL) {
+			ad->addr = addr;
+			ad->alen = alen;
+			ad->plen = plen;
+		} else
+			free(addr);
+		ad->entry = e;
+
+		switch (which) {
+
+		  case LEAF_begemotSnmpdAclAction:
+			if (ad->set & AD_ACTION)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (value->v.integer != ACL_PERMIT &&
+			    value->v.integer != ACL_DENY)
+				return (SNMP_ERR_WRONG_VALUE);
+			ad->action = value->v.integer;
+			ad->set |= AD_ACTION;
+			break;
+
+		  case LEAF_begemotSnmpdAclStatus:
+			if (ad->set & AD_STATUS)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (!TRUTH_OK(value->v.integer))
+				return (SNMP_ERR_WRONG_VALUE);
+			ad->status = TRUTH_GET(value->v.integer);
+			ad->set |= AD_STATUS;
+			break;
+
+		  default:
+			abort();
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_ROLLBACK:
+	  case SNMP_OP_COMMIT:
+		return (SNMP_ERR_NOERROR);
+
+	  default:
+		abort();
+	}
+
+	/*
+	 * Come here to fetch the value
+	 */
+	switch (which) {
+
+	  case LEAF_begemotSnmpdAclAction:
+		value->v.integer = e->action;
+		break;
+
+	  case LEAF_begemotSnmpdAclStatus:
+		value->v.integer = 1;
+		break;
+
+	  default:
+		abort();
+	}
+
+	return (SNMP_ERR_NOERROR);
+}
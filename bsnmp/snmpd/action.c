@@ -228,18 +228,18 @@ op_system_group(struct snmp_context *ctx, struct snmp_value *value,
 	switch (which) {
 
 	  case LEAF_sysDescr:
-		return (string_get(value, systemg.descr, -1));
+		return (string_get_ref(value, systemg.descr, -1));
 	  case LEAF_sysObjectId:
 		return (oid_get(value, &systemg.object_id));
 	  case LEAF_sysUpTime:
 		value->v.uint32 = get_ticks() - start_tick;
 		break;
 	  case LEAF_sysContact:
-		return (string_get(value, systemg.contact, -1));
+		return (string_get_ref(value, systemg.contact, -1));
 	  case LEAF_sysName:
-		return (string_get(value, systemg.name, -1));
+		return (string_get_ref(value, systemg.name, -1));
 	  case LEAF_sysLocation:
-		return (string_get(value, systemg.location, -1));
+		return (string_get_ref(value, systemg.location, -1));
 	  case LEAF_sysServices:
 		value->v.integer = systemg.services;
 		break;
@@ -390,7 +390,7 @@ op_or_table(struct snmp_context *ctx __unused, struct snmp_value *value,
 		break;
 
 	  case LEAF_sysORDescr:
-		return (string_get(value, objres->descr, -1));
+		return (string_get_ref(value, objres->descr, -1));
 
 	  case LEAF_sysORUpTime:
 		value->v.uint32 = objres->uptime;
@@ -511,6 +511,18 @@ op_snmpd_stats(struct snmp_context *ctx __unused, struct snmp_value *value,
 			value->v.uint32 = snmpd_stats.inBadPduTypes;
 			break;
 
+		  case LEAF_begemotSnmpdStatsInAclDrops:
+			value->v.uint32 = snmpd_stats.inAclDrops;
+			break;
+
+		  case LEAF_begemotSnmpdStatsPendingRequests:
+			value->v.uint32 = snmpd_stats.pendingRequests;
+			break;
+
+		  case LEAF_begemotSnmpdStatsPendingTimeouts:
+			value->v.uint32 = snmpd_stats.pendingTimeouts;
+			break;
+
 		  default:
 			return (SNMP_ERR_NOSUCHNAME);
 		}
@@ -556,6 +568,21 @@ op_snmpd_config(struct snmp_context *ctx, struct snmp_value *value,
 		  case LEAF_begemotSnmpdVersionEnable:
 			value->v.uint32 = snmpd.version_enable;
 			break;
+		  case LEAF_begemotSnmpdStreamBuffer:
+			value->v.integer = snmpd.streambuf;
+			break;
+		  case LEAF_begemotSnmpdInputBatch:
+			value->v.integer = snmpd.input_batch;
+			break;
+		  case LEAF_begemotSnmpdUdpFilter:
+			value->v.integer = snmpd.udp_filter;
+			break;
+		  case LEAF_begemotSnmpdTrapQueue:
+			value->v.integer = snmpd.trap_queue;
+			break;
+		  case LEAF_begemotSnmpdPendingTimeout:
+			value->v.integer = snmpd.pending_timeout;
+			break;
 		  default:
 			return (SNMP_ERR_NOSUCHNAME);
 		}
@@ -604,6 +631,42 @@ op_snmpd_config(struct snmp_context *ctx, struct snmp_value *value,
 				return (SNMP_ERR_WRONG_VALUE);
 			snmpd.version_enable = value->v.uint32;
 			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotSnmpdStreamBuffer:
+			ctx->scratch->int1 = snmpd.streambuf;
+			if (value->v.integer < 0 || (value->v.integer != 0 &&
+			    value->v.integer < 484))
+				return (SNMP_ERR_WRONG_VALUE);
+			snmpd.streambuf = value->v.integer;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotSnmpdInputBatch:
+			ctx->scratch->int1 = snmpd.input_batch;
+			if (value->v.integer < 1 || value->v.integer > 1024)
+				return (SNMP_ERR_WRONG_VALUE);
+			snmpd.input_batch = value->v.integer;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotSnmpdUdpFilter:
+			ctx->scratch->int1 = snmpd.udp_filter;
+			if (value->v.integer < 0 || value->v.integer > 2)
+				return (SNMP_ERR_WRONG_VALUE);
+			snmpd.udp_filter = value->v.integer;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotSnmpdTrapQueue:
+			ctx->scratch->int1 = snmpd.trap_queue;
+			if (value->v.integer < 1 || value->v.integer > 65535)
+				return (SNMP_ERR_WRONG_VALUE);
+			snmpd.trap_queue = value->v.integer;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotSnmpdPendingTimeout:
+			ctx->scratch->int1 = snmpd.pending_timeout;
+			if (value->v.integer < 1 || value->v.integer > 6000)
+				return (SNMP_ERR_WRONG_VALUE);
+			snmpd.pending_timeout = value->v.integer;
+			return (SNMP_ERR_NOERROR);
 		}
 		abort();
 
@@ -625,6 +688,21 @@ op_snmpd_config(struct snmp_context *ctx, struct snmp_value *value,
 		  case LEAF_begemotSnmpdVersionEnable:
 			snmpd.version_enable = ctx->scratch->int1;
 			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdStreamBuffer:
+			snmpd.streambuf = ctx->scratch->int1;
+			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdInputBatch:
+			snmpd.input_batch = ctx->scratch->int1;
+			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdUdpFilter:
+			snmpd.udp_filter = ctx->scratch->int1;
+			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdTrapQueue:
+			snmpd.trap_queue = ctx->scratch->int1;
+			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdPendingTimeout:
+			snmpd.pending_timeout = ctx->scratch->int1;
+			return (SNMP_ERR_NOERROR);
 		}
 		abort();
 
@@ -638,7 +716,15 @@ op_snmpd_config(struct snmp_context *ctx, struct snmp_value *value,
 		  case LEAF_begemotSnmpdTrap1Addr:
 			ip_commit(ctx);
 			return (SNMP_ERR_NOERROR);
+		  case LEAF_begemotSnmpdStreamBuffer:
+		  case LEAF_begemotSnmpdInputBatch:
+		  case LEAF_begemotSnmpdTrapQueue:
+		  case LEAF_begemotSnmpdPendingTimeout:
+			return (SNMP_ERR_NOERROR);
 		  case LEAF_begemotSnmpdVersionEnable:
+		  case LEAF_begemotSnmpdUdpFilter:
+			/* the filter checks the version */
+			udp_filter_update();
 			return (SNMP_ERR_NOERROR);
 		}
 		abort();
@@ -695,8 +781,10 @@ op_community(struct snmp_context *ctx, struct snmp_value *value,
 			if ((c = FIND_OBJECT_OID(&community_list, &value->var,
 			    sub)) == NULL)
 				string_free(ctx);
-			else
+			else {
 				string_commit(ctx);
+				udp_filter_update();
+			}
 			return (SNMP_ERR_NOERROR);
 		}
 		abort();
@@ -708,10 +796,10 @@ op_community(struct snmp_context *ctx, struct snmp_value *value,
 	switch (which) {
 
 	  case LEAF_begemotSnmpdCommunityString:
-		return (string_get(value, c->string, -1));
+		return (string_get_ref(value, c->string, -1));
 
 	  case LEAF_begemotSnmpdCommunityDescr:
-		return (string_get(value, c->descr, -1));
+		return (string_get_ref(value, c->descr, -1));
 	}
 	abort();
 }
@@ -899,10 +987,10 @@ op_modules(struct snmp_context *ctx, struct snmp_value *value,
 	switch (which) {
 
 	  case LEAF_begemotSnmpdModulePath:
-		return (string_get(value, m->path, -1));
+		return (string_get_ref(value, m->path, -1));
 
 	  case LEAF_begemotSnmpdModuleComment:
-		return (string_get(value, m->config->comment, -1));
+		return (string_get_ref(value, m->config->comment, -1));
 	}
 	abort();
 }
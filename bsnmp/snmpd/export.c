@@ -144,6 +144,36 @@ string_get_max(struct snmp_value *value, const u_char *ptr, ssize_t len,
 	return (SNMP_ERR_NOERROR);
 }
 
+/*
+ * Get a string value for a response packet without copying it. The
+ * string is referenced from the value and encoded directly into the
+ * output buffer, so it must not change until the response is sent.
+ */
+int
+string_get_ref(struct snmp_value *value, const u_char *ptr, ssize_t len)
+{
+	return (string_get_max_ref(value, ptr, len, (size_t)-1));
+}
+
+int
+string_get_max_ref(struct snmp_value *value, const u_char *ptr, ssize_t len,
+    size_t maxlen)
+{
+	if (ptr == NULL) {
+		value->v.octetstring.len = 0;
+		value->v.octetstring.octets = NULL;
+		return (SNMP_ERR_NOERROR);
+	}
+	if (len == -1)
+		len = strlen(ptr);
+	if ((size_t)len > maxlen)
+		len = maxlen;
+	value->v.octetstring.len = (u_long)len;
+	value->v.octetstring.octets = (u_char *)(uintptr_t)ptr;
+	value->v.octetstring.borrowed = 1;
+	return (SNMP_ERR_NOERROR);
+}
+
 /*
  * Support for IPADDRESS
  *
@@ -47,11 +47,6 @@
 #include <dlfcn.h>
 #include <inttypes.h>
 
-#if defined(USE_TCPWRAPPERS)
-#include <arpa/inet.h>
-#include <tcpd.h>
-#endif
-
 #include "support.h"
 #include "snmpmod.h"
 #include "snmpd.h"
@@ -84,6 +79,11 @@ struct snmpd snmpd = {
 	0,		/* auth_traps */
 	{0, 0, 0, 0},	/* trap1addr */
 	VERS_ENABLE_ALL,/* version_enable */
+	0,		/* streambuf */
+	16,		/* input_batch */
+	0,		/* udp_filter */
+	256,		/* trap_queue */
+	300,		/* pending_timeout */
 };
 struct snmpd_stats snmpd_stats;
 
@@ -157,6 +157,9 @@ const struct asn_oid oid_zeroDotZero = { 2, { 0, 0 }};
 /* request id generator for traps */
 u_int trap_reqid;
 
+/* request id generator for INFORMs */
+u_int inform_reqid;
+
 /* help text */
 static const char usgtxt[] = "\
 Begemot simple SNMP daemon. Copyright (c) 2001-2002 Fraunhofer Institute for\n\
@@ -174,14 +177,11 @@ options:\n\
   -p file	specify pid file\n\
 ";
 
-/* hosts_access(3) request */
-#if defined(USE_TCPWRAPPERS)
-static struct request_info req;
-#endif
-
 /* transports */
 extern const struct transport_def udp_trans;
 extern const struct transport_def lsock_trans;
+extern const struct transport_def shm_trans;
+extern const struct transport_def tcp_trans;
 
 struct transport_list transport_list = TAILQ_HEAD_INITIALIZER(transport_list);
 
@@ -269,7 +269,9 @@ snmp_input_start(const u_char *buf, size_t len, const char *source,
 	}
 	b.asn_len = *pdulen = (size_t)sret;
 
-	code = snmp_pdu_decode(&b, pdu, ip);
+	/* the values of GET requests are not needed unless we dump them */
+	code = snmp_pdu_decode_flags(&b, pdu, ip,
+	    debug.dump_pdus ? 0 : SNMP_DECODE_NOVALUES);
 
 	snmpd_stats.inPkts++;
 
@@ -349,19 +351,25 @@ snmp_input_start(const u_char *buf, size_t len, const char *source,
 }
 
 /*
- * Will return only _OK or _FAILED
+ * Execute the PDU and encode the response into a send buffer of the
+ * given size. Will return only _OK or _FAILED, and _PENDING if the
+ * request may be parked and waits for a module. The response is returned
+ * as up to SNMP_RESP_IOV fragments of the send buffer, so that the
+ * bindings need not be moved when the lengths are fixed.
  */
-enum snmpd_input_err
-snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
-    u_char *sndbuf, size_t *sndlen, const char *source,
-    enum snmpd_input_err ierr, int32_t ivar, void *data)
+static enum snmpd_input_err
+input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
+    u_char *sndbuf, size_t sndsize, struct iovec *iov, u_int *iovcnt,
+    size_t *sndlen, const char *source, enum snmpd_input_err ierr,
+    int32_t ivar, void *data, int may_park)
 {
 	struct snmp_pdu resp;
 	struct asn_buf resp_b, pdu_b;
 	enum snmp_ret ret;
+	enum snmp_code code;
 
 	resp_b.asn_ptr = sndbuf;
-	resp_b.asn_len = snmpd.txbuf;
+	resp_b.asn_len = sndsize;
 
 	pdu_b.asn_cptr = rcvbuf;
 	pdu_b.asn_len = rcvlen;
@@ -390,6 +398,9 @@ snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
 			snmp_pdu_dump(pdu);
 		}
 		*sndlen = (size_t)(resp_b.asn_ptr - sndbuf);
+		iov[0].iov_base = sndbuf;
+		iov[0].iov_len = *sndlen;
+		*iovcnt = 1;
 		return (SNMPD_INPUT_OK);
 	}
 
@@ -420,12 +431,19 @@ snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
 
 	  case SNMP_RET_OK:
 		/* normal return - send a response */
-		if (debug.dump_pdus) {
+		code = snmp_fix_encoding_iov(&resp_b, &resp, iov);
+		if (code == SNMP_CODE_OK && debug.dump_pdus) {
 			snmp_printf("%s <- ", source);
 			snmp_pdu_dump(&resp);
 		}
-		*sndlen = (size_t)(resp_b.asn_ptr - sndbuf);
 		snmp_pdu_free(&resp);
+		if (code != SNMP_CODE_OK) {
+			syslog(LOG_WARNING, "could not encode response");
+			snmpd_stats.silentDrops++;
+			return (SNMPD_INPUT_FAILED);
+		}
+		*iovcnt = SNMP_RESP_IOV;
+		*sndlen = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 		return (SNMPD_INPUT_OK);
 
 	  case SNMP_RET_IGN:
@@ -433,11 +451,18 @@ snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
 		snmpd_stats.silentDrops++;
 		return (SNMPD_INPUT_FAILED);
 
+	  case SNMP_RET_PENDING:
+		/* some bindings wait for a module. If the request cannot
+		 * wait, the pending bindings are a genErr. */
+		if (may_park)
+			return (SNMPD_INPUT_PENDING);
+		/* FALLTHROUGH */
+
 	  case SNMP_RET_ERR:
 		/* error - send error response. The snmp routine has
 		 * changed the error fields in the original message. */
 		resp_b.asn_ptr = sndbuf;
-		resp_b.asn_len = snmpd.txbuf;
+		resp_b.asn_len = sndsize;
 		if (snmp_make_errresp(pdu, &pdu_b, &resp_b) == SNMP_RET_IGN) {
 			syslog(LOG_WARNING, "could not encode error response");
 			snmpd_stats.silentDrops++;
@@ -448,12 +473,40 @@ snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
 				snmp_pdu_dump(pdu);
 			}
 			*sndlen = (size_t)(resp_b.asn_ptr - sndbuf);
+			iov[0].iov_base = sndbuf;
+			iov[0].iov_len = *sndlen;
+			*iovcnt = 1;
 			return (SNMPD_INPUT_OK);
 		}
 	}
 	abort();
 }
 
+/*
+ * Will return only _OK or _FAILED. The response is put together at the
+ * start of the send buffer.
+ */
+enum snmpd_input_err
+snmp_input_finish(struct snmp_pdu *pdu, const u_char *rcvbuf, size_t rcvlen,
+    u_char *sndbuf, size_t *sndlen, const char *source,
+    enum snmpd_input_err ierr, int32_t ivar, void *data)
+{
+	struct iovec iov[SNMP_RESP_IOV];
+	u_int iovcnt, i;
+	enum snmpd_input_err ferr;
+
+	ferr = input_finish(pdu, rcvbuf, rcvlen, sndbuf, snmpd.txbuf, iov,
+	    &iovcnt, sndlen, source, ierr, ivar, data, 0);
+	if (ferr != SNMPD_INPUT_OK)
+		return (ferr);
+
+	for (*sndlen = 0, i = 0; i < iovcnt; i++) {
+		memmove(sndbuf + *sndlen, iov[i].iov_base, iov[i].iov_len);
+		*sndlen += iov[i].iov_len;
+	}
+	return (SNMPD_INPUT_OK);
+}
+
 /*
  * Insert a port into the right place in the transport's table of ports
  */
@@ -624,7 +677,8 @@ fd_resume(void *p)
 #if defined(USE_LIBBEGEMOT)
 	if (f->id >= 0)
 		return (0);
-	if ((f->id = poll_register(f->fd, input, f, POLL_IN)) < 0) {
+	if ((f->id = poll_register(f->fd, input, f,
+	    f->out ? POLL_OUT : POLL_IN)) < 0) {
 		err = errno;
 		syslog(LOG_ERR, "select fd %d: %m", f->fd);
 		errno = err;
@@ -633,7 +687,8 @@ fd_resume(void *p)
 #else
 	if (evTestID(f->id))
 		return (0);
-	if (evSelectFD(evctx, f->fd, EV_READ, input, f, &f->id)) {
+	if (evSelectFD(evctx, f->fd, f->out ? EV_WRITE : EV_READ, input, f,
+	    &f->id)) {
 		err = errno;
 		syslog(LOG_ERR, "select fd %d: %m", f->fd);
 		errno = err;
@@ -643,8 +698,9 @@ fd_resume(void *p)
 	return (0);
 }
 
-void *
-fd_select(int fd, void (*func)(int, void *), void *udata, struct lmodule *mod)
+static void *
+fd_select1(int fd, void (*func)(int, void *), void *udata, struct lmodule *mod,
+    int out)
 {
 	struct fdesc *f;
 	int err;
@@ -658,6 +714,7 @@ fd_select(int fd, void (*func)(int, void *), void *udata, struct lmodule *mod)
 	f->fd = fd;
 	f->func = func;
 	f->udata = udata;
+	f->out = out;
 	f->owner = mod;
 #if defined(USE_LIBBEGEMOT)
 	f->id = -1;
@@ -677,6 +734,23 @@ fd_select(int fd, void (*func)(int, void *), void *udata, struct lmodule *mod)
 	return (f);
 }
 
+void *
+fd_select(int fd, void (*func)(int, void *), void *udata, struct lmodule *mod)
+{
+	return (fd_select1(fd, func, udata, mod, 0));
+}
+
+/*
+ * Call the function when the file descriptor can be written. Transports
+ * use this to write out responses that did not fit into the socket.
+ */
+void *
+fd_select_out(int fd, void (*func)(int, void *), void *udata,
+    struct lmodule *mod)
+{
+	return (fd_select1(fd, func, udata, mod, 1));
+}
+
 void
 fd_deselect(void *p)
 {
@@ -712,13 +786,12 @@ snmp_input_consume(struct port_input *pi)
 		pi->length = 0;
 		return;
 	}
-	if (pi->consumed >= pi->length) {
+	pi->start += pi->consumed;
+	if (pi->start >= pi->length) {
 		/* all bytes consumed */
+		pi->start = 0;
 		pi->length = 0;
-		return;
 	}
-	memmove(pi->buf, pi->buf + pi->consumed, pi->length - pi->consumed);
-	pi->length -= pi->consumed;
 }
 
 struct credmsg {
@@ -733,8 +806,6 @@ check_priv(struct port_input *pi, struct msghdr *msg)
 	struct xucred ucred;
 	socklen_t ucredlen;
 
-	pi->priv = 0;
-
 	if (msg->msg_controllen == sizeof(*cmsg)) {
 		/* process explicitly sends credentials */
 
@@ -743,12 +814,47 @@ check_priv(struct port_input *pi, struct msghdr *msg)
 		return;
 	}
 
-	/* ok, obtain the accept time credentials */
-	ucredlen = sizeof(ucred);
+	/* ok, obtain the accept time credentials. They cannot change
+	 * for a connection, so fetch them only once for streams. */
+	if (!pi->stream || !pi->peercred) {
+		pi->peerpriv = 0;
+		ucredlen = sizeof(ucred);
 
-	if (getsockopt(pi->fd, 0, LOCAL_PEERCRED, &ucred, &ucredlen) == 0 &&
-	    ucredlen >= sizeof(ucred) && ucred.cr_version == XUCRED_VERSION)
-		pi->priv = (ucred.cr_uid == 0);
+		if (getsockopt(pi->fd, 0, LOCAL_PEERCRED, &ucred,
+		    &ucredlen) == 0 && ucredlen >= sizeof(ucred) &&
+		    ucred.cr_version == XUCRED_VERSION)
+			pi->peerpriv = (ucred.cr_uid == 0);
+		pi->peercred = 1;
+	}
+	pi->priv = pi->peerpriv;
+}
+
+/*
+ * The receive buffer of a stream connection is full, but does not yet
+ * contain a complete message. If large messages are enabled, grow the
+ * buffer up to the configured maximum.
+ */
+static int
+stream_grow(struct port_input *pi)
+{
+	size_t newlen;
+	u_char *newbuf;
+
+	if (snmpd.streambuf <= pi->buflen)
+		return (-1);
+
+	newlen = pi->buflen * 2;
+	if (newlen > snmpd.streambuf)
+		newlen = snmpd.streambuf;
+
+	if ((newbuf = realloc(pi->buf, newlen)) == NULL) {
+		syslog(LOG_CRIT, "cannot grow receive buffer to %zu", newlen);
+		snmpd_stats.noRxbuf++;
+		return (-1);
+	}
+	pi->buf = newbuf;
+	pi->buflen = newlen;
+	return (0);
 }
 
 /*
@@ -771,9 +877,18 @@ recv_stream(struct port_input *pi)
 		}
 		pi->buflen = buf_size(0);
 		pi->consumed = 0;
+		pi->start = 0;
 		pi->length = 0;
 	}
 
+	if (pi->length == pi->buflen && pi->start > 0) {
+		/* no space left at the end - move the partial message
+		 * to the front of the buffer */
+		memmove(pi->buf, pi->buf + pi->start, pi->length - pi->start);
+		pi->length -= pi->start;
+		pi->start = 0;
+	}
+
 	/* try to get a message */
 	msg.msg_name = pi->peer;
 	msg.msg_namelen = pi->peerlen;
@@ -797,6 +912,9 @@ recv_stream(struct port_input *pi)
 
 	len = recvmsg(pi->fd, &msg, 0);
 
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		/* nothing there on a non-blocking socket */
+		return (1);
 	if (len == -1 || len == 0)
 		/* receive error */
 		return (-1);
@@ -828,7 +946,7 @@ recv_dgram(struct port_input *pi)
 			/* ups - could not get buffer. Read away input
 			 * and drop it */
 			(void)recvfrom(pi->fd, embuf, sizeof(embuf),
-			    0, NULL, NULL);
+			    MSG_DONTWAIT, NULL, NULL);
 			/* return error */
 			return (-1);
 		}
@@ -856,7 +974,8 @@ recv_dgram(struct port_input *pi)
 	iov[0].iov_base = pi->buf;
 	iov[0].iov_len = pi->buflen;
 
-	len = recvmsg(pi->fd, &msg, 0);
+	/* don't block when a batch has drained the socket */
+	len = recvmsg(pi->fd, &msg, MSG_DONTWAIT);
 
 	if (len == -1 || len == 0)
 		/* receive error */
@@ -878,64 +997,286 @@ recv_dgram(struct port_input *pi)
 }
 
 /*
- * Input from a socket
+ * Requests that wait for asynchronous fetches of modules. A parked
+ * request is executed again each time a module reports that a fetch
+ * has finished, until it can be answered or the timeout fires. All
+ * executions use the time the request was received, so that data
+ * fetched after that time is fresh enough for the request.
  */
-int
-snmpd_input(struct port_input *pi, struct tport *tport)
+#define	PENDING_MAX	64
+
+struct pending {
+	TAILQ_ENTRY(pending) link;
+	struct port_input *pi;		/* input the request came from */
+	struct sockaddr_storage peer;	/* where to send it */
+	socklen_t	peerlen;
+	u_int		community;	/* community of the request */
+	uint64_t	tick;		/* time the request was received */
+	void		*timer;		/* timeout */
+	u_char		*buf;		/* the encoded request */
+	size_t		len;
+};
+static TAILQ_HEAD(, pending) pending_list =
+    TAILQ_HEAD_INITIALIZER(pending_list);
+static u_int pending_count;
+static int pending_busy;	/* executing parked requests */
+static int pending_again;	/* fetch finished while doing this */
+
+static void pending_timeout(void *);
+
+/*
+ * Get a buffer for the response to a request from the given input.
+ * Stream connections may get large responses.
+ */
+static u_char *
+input_sndbuf(struct port_input *pi, size_t *sndsize)
 {
 	u_char *sndbuf;
-	size_t sndlen;
-	struct snmp_pdu pdu;
-	enum snmpd_input_err ierr, ferr;
-	enum snmpd_proxy_err perr;
-	int32_t vi;
-	int ret;
-	ssize_t slen;
-#if defined(USE_TCPWRAPPERS)
-	char client[16];
-#endif
 
-	/* get input depending on the transport */
-	if (pi->stream) {
-		ret = recv_stream(pi);
+	if (pi->stream && snmpd.streambuf > snmpd.txbuf) {
+		*sndsize = snmpd.streambuf;
+		if ((sndbuf = malloc(*sndsize)) == NULL) {
+			syslog(LOG_CRIT, "cannot allocate buffer");
+			snmpd_stats.noTxbuf++;
+		}
 	} else {
-		ret = recv_dgram(pi);
+		*sndsize = snmpd.txbuf;
+		sndbuf = buf_alloc(1);
 	}
+	if (pi->maxmsg != 0 && *sndsize > pi->maxmsg)
+		*sndsize = pi->maxmsg;
+	return (sndbuf);
+}
 
-	if (ret == -1)
+/*
+ * Send a response on the input the request came from. Inputs that
+ * belong to a connection have their own output function, the others
+ * send to the peer address.
+ */
+static ssize_t
+input_respond(struct port_input *pi, const struct sockaddr *peer,
+    socklen_t peerlen, const struct iovec *iov, u_int iovcnt, size_t len)
+{
+	struct msghdr msg;
+	ssize_t slen;
+
+	if (pi->output != NULL)
+		slen = (*pi->output)(pi, iov, iovcnt);
+	else {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = (void *)(uintptr_t)peer;
+		msg.msg_namelen = peerlen;
+		msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+		msg.msg_iovlen = iovcnt;
+		slen = sendmsg(pi->fd, &msg, 0);
+	}
+	if (slen == -1)
+		syslog(LOG_ERR, "sendmsg: %m");
+	else if ((size_t)slen != len)
+		syslog(LOG_ERR, "sendmsg: short write %zu/%zu",
+		    len, (size_t)slen);
+	return (slen);
+}
+
+/*
+ * Park the request that is at the start of the input buffer
+ */
+static int
+pending_park(struct port_input *pi)
+{
+	struct pending *p;
+
+	if (pending_count >= PENDING_MAX || pi->peerlen > sizeof(p->peer))
 		return (-1);
 
-#if defined(USE_TCPWRAPPERS)
-	/*
-	 * In case of AF_INET{6} peer, do hosts_access(5) check.
-	 */
-	if (inet_ntop(pi->peer->sa_family,
-	    &((const struct sockaddr_in *)(const void *)pi->peer)->sin_addr,
-	    client, sizeof(client)) != NULL) {
-		request_set(&req, RQ_CLIENT_ADDR, client, 0);
-		if (hosts_access(&req) == 0) {
-			syslog(LOG_ERR, "refused connection from %.500s",
-			    eval_client(&req));
-			return (-1);
+	if ((p = malloc(sizeof(*p))) == NULL) {
+		syslog(LOG_ERR, "%s: %m", __func__);
+		return (-1);
+	}
+	if ((p->buf = malloc(pi->consumed)) == NULL) {
+		syslog(LOG_ERR, "%s: %m", __func__);
+		free(p);
+		return (-1);
+	}
+	memcpy(p->buf, pi->buf + pi->start, pi->consumed);
+	p->len = pi->consumed;
+
+	p->pi = pi;
+	memcpy(&p->peer, pi->peer, pi->peerlen);
+	p->peerlen = pi->peerlen;
+	p->community = community;
+	p->tick = this_tick;
+	p->timer = timer_start(snmpd.pending_timeout, pending_timeout, p,
+	    NULL);
+
+	TAILQ_INSERT_TAIL(&pending_list, p, link);
+	pending_count++;
+	snmpd_stats.pendingRequests++;
+
+	return (0);
+}
+
+/*
+ * Forget a parked request
+ */
+static void
+pending_free(struct pending *p)
+{
+	TAILQ_REMOVE(&pending_list, p, link);
+	pending_count--;
+	if (p->timer != NULL)
+		timer_stop(p->timer);
+	free(p->buf);
+	free(p);
+}
+
+/*
+ * Execute a parked request again. If it can be answered (or must be
+ * dropped) return 0, if it still waits for a module return 1. With
+ * 'final' set, all bindings still waiting are a genErr.
+ */
+static int
+pending_run(struct pending *p, int final)
+{
+	struct snmp_pdu pdu;
+	struct asn_buf b;
+	int32_t ivar;
+	u_char *sndbuf;
+	size_t sndsize, sndlen;
+	struct iovec iov[SNMP_RESP_IOV];
+	u_int iovcnt;
+	enum snmpd_input_err ferr;
+	uint64_t now;
+	u_int saved_comm;
+
+	b.asn_cptr = p->buf;
+	b.asn_len = p->len;
+	if (snmp_pdu_decode_flags(&b, &pdu, &ivar,
+	    SNMP_DECODE_NOVALUES) != SNMP_CODE_OK) {
+		snmpd_stats.silentDrops++;
+		return (0);
+	}
+
+	if ((sndbuf = input_sndbuf(p->pi, &sndsize)) == NULL) {
+		snmpd_stats.silentDrops++;
+		snmp_pdu_free(&pdu);
+		return (0);
+	}
+
+	now = this_tick;
+	saved_comm = community;
+	this_tick = p->tick;
+	community = p->community;
+
+	ferr = input_finish(&pdu, p->buf, p->len, sndbuf, sndsize, iov,
+	    &iovcnt, &sndlen, "SNMP", SNMPD_INPUT_OK, 0, NULL, !final);
+
+	this_tick = now;
+	community = saved_comm;
+	snmp_pdu_free(&pdu);
+
+	if (ferr == SNMPD_INPUT_PENDING) {
+		free(sndbuf);
+		return (1);
+	}
+
+	/* the input is still there - pending_flush() drops the request
+	 * when it is closed */
+	if (ferr == SNMPD_INPUT_OK)
+		(void)input_respond(p->pi, (struct sockaddr *)&p->peer,
+		    p->peerlen, iov, iovcnt, sndlen);
+	free(sndbuf);
+	return (0);
+}
+
+/*
+ * The request has waited too long. Answer it with what we have.
+ */
+static void
+pending_timeout(void *arg)
+{
+	struct pending *p = arg;
+
+	p->timer = NULL;
+	snmpd_stats.pendingTimeouts++;
+	(void)pending_run(p, 1);
+	pending_free(p);
+}
+
+/*
+ * A module has finished an asynchronous fetch. Execute all parked
+ * requests again. If a fetch finishes while we are doing this, just
+ * remember to do another round.
+ */
+void
+snmp_resume_pending(void)
+{
+	struct pending *p, *n;
+
+	pending_again = 1;
+	if (pending_busy)
+		return;
+
+	pending_busy = 1;
+	while (pending_again) {
+		pending_again = 0;
+		for (p = TAILQ_FIRST(&pending_list); p != NULL; p = n) {
+			n = TAILQ_NEXT(p, link);
+			if (pending_run(p, 0) == 0)
+				pending_free(p);
 		}
-	} else
-		syslog(LOG_ERR, "inet_ntop(): %m");
-#endif
+	}
+	pending_busy = 0;
+}
+
+/*
+ * An input is closed. Drop all requests that came from it.
+ */
+static void
+pending_flush(struct port_input *pi)
+{
+	struct pending *p, *n;
+
+	for (p = TAILQ_FIRST(&pending_list); p != NULL; p = n) {
+		n = TAILQ_NEXT(p, link);
+		if (p->pi == pi)
+			pending_free(p);
+	}
+}
+
+/*
+ * Process the next PDU in the input buffer. Returns -1 if the input
+ * is bad, 1 if a stream connection needs more bytes and 0 otherwise.
+ */
+static int
+input_pdu(struct port_input *pi, struct tport *tport)
+{
+	u_char *sndbuf;
+	size_t sndlen, sndsize;
+	struct iovec iov[SNMP_RESP_IOV];
+	u_int iovcnt;
+	struct snmp_pdu pdu;
+	enum snmpd_input_err ierr, ferr;
+	enum snmpd_proxy_err perr;
+	int32_t vi;
+	int32_t estat, eidx;
+	ssize_t slen;
 
 	/*
-	 * Handle input
+	 * Decode the PDU
 	 */
-	ierr = snmp_input_start(pi->buf, pi->length, "SNMP", &pdu, &vi,
-	    &pi->consumed);
+	ierr = snmp_input_start(pi->buf + pi->start, pi->length - pi->start,
+	    "SNMP", &pdu, &vi, &pi->consumed);
 	if (ierr == SNMPD_INPUT_TRUNC) {
 		/* need more bytes. This is ok only for streaming transports.
 		 * but only if we have not reached bufsiz yet. */
 		if (pi->stream) {
-			if (pi->length == buf_size(0)) {
+			if (pi->length - pi->start == pi->buflen &&
+			    stream_grow(pi) == -1) {
 				snmpd_stats.silentDrops++;
 				return (-1);
 			}
-			return (0);
+			return (1);
 		}
 		snmpd_stats.silentDrops++;
 		return (-1);
@@ -1029,32 +1370,96 @@ snmpd_input(struct port_input *pi, struct tport *tport)
 	}
 
 	/*
-	 * Execute it.
+	 * Execute it
 	 */
-	if ((sndbuf = buf_alloc(1)) == NULL) {
+	if ((sndbuf = input_sndbuf(pi, &sndsize)) == NULL) {
 		snmpd_stats.silentDrops++;
 		snmp_pdu_free(&pdu);
 		snmp_input_consume(pi);
 		return (0);
 	}
-	ferr = snmp_input_finish(&pdu, pi->buf, pi->length,
-	    sndbuf, &sndlen, "SNMP", ierr, vi, NULL);
+	/* GETBULK parameters are overwritten when the request is pending */
+	estat = pdu.error_status;
+	eidx = pdu.error_index;
 
-	if (ferr == SNMPD_INPUT_OK) {
-		slen = sendto(pi->fd, sndbuf, sndlen, 0, pi->peer, pi->peerlen);
-		if (slen == -1)
-			syslog(LOG_ERR, "sendto: %m");
-		else if ((size_t)slen != sndlen)
-			syslog(LOG_ERR, "sendto: short write %zu/%zu",
-			    sndlen, (size_t)slen);
+	ferr = input_finish(&pdu, pi->buf + pi->start, pi->length - pi->start,
+	    sndbuf, sndsize, iov, &iovcnt, &sndlen, "SNMP", ierr, vi, NULL, 1);
+
+	if (ferr == SNMPD_INPUT_PENDING) {
+		if (pending_park(pi) == 0) {
+			snmp_pdu_free(&pdu);
+			free(sndbuf);
+			snmp_input_consume(pi);
+			return (0);
+		}
+		/* cannot wait - execute it again and fail what is pending */
+		pdu.error_status = estat;
+		pdu.error_index = eidx;
+		ferr = input_finish(&pdu, pi->buf + pi->start,
+		    pi->length - pi->start, sndbuf, sndsize, iov, &iovcnt,
+		    &sndlen, "SNMP", ierr, vi, NULL, 0);
 	}
+
+	if (ferr == SNMPD_INPUT_OK)
+		slen = input_respond(pi, pi->peer, pi->peerlen, iov, iovcnt,
+		    sndlen);
 	snmp_pdu_free(&pdu);
 	free(sndbuf);
 	snmp_input_consume(pi);
 
+	/* a stream that did not take its whole response is given up */
+	if (ferr == SNMPD_INPUT_OK && pi->stream && (size_t)slen != sndlen)
+		return (-1);
+
 	return (0);
 }
 
+/*
+ * Input from a socket
+ */
+int
+snmpd_input(struct port_input *pi, struct tport *tport)
+{
+	int ret;
+
+	/* get input depending on the transport */
+	if (pi->stream) {
+		ret = recv_stream(pi);
+	} else {
+		ret = recv_dgram(pi);
+	}
+
+	if (ret == -1)
+		return (-1);
+	if (ret == 1)
+		return (0);
+
+	if (acl_check(pi->peer) == -1) {
+		snmpd_stats.inAclDrops++;
+		/* a datagram port can continue with the next datagram */
+		return (pi->stream ? -1 : 0);
+	}
+
+	return (snmpd_input_process(pi, tport));
+}
+
+/*
+ * Handle the input that is in the buffer of a port. A stream connection
+ * may have received several PDUs at once. Execute all complete ones now.
+ * This is also used by transports that fill the buffer themselves.
+ */
+int
+snmpd_input_process(struct port_input *pi, struct tport *tport)
+{
+	int ret;
+
+	do
+		ret = input_pdu(pi, tport);
+	while (ret == 0 && pi->stream && pi->length > 0);
+
+	return (ret == -1 ? -1 : 0);
+}
+
 /*
  * Send a PDU to a given port
  */
@@ -1067,6 +1472,7 @@ snmp_send_port(void *targ, const struct asn_oid *port, struct snmp_pdu *pdu,
 	u_char *sndbuf;
 	size_t sndlen;
 	ssize_t len;
+	struct iovec iov;
 
 	TAILQ_FOREACH(tp, &trans->table, link)
 		if (asn_compare_oid(port, &tp->index) == 0)
@@ -1079,7 +1485,12 @@ snmp_send_port(void *targ, const struct asn_oid *port, struct snmp_pdu *pdu,
 
 	snmp_output(pdu, sndbuf, &sndlen, "SNMP PROXY");
 
-	len = trans->vtab->send(tp, sndbuf, sndlen, addr, addrlen);
+	if (trans->vtab->sendv != NULL) {
+		iov.iov_base = sndbuf;
+		iov.iov_len = sndlen;
+		len = trans->vtab->sendv(tp, &iov, 1, addr, addrlen);
+	} else
+		len = trans->vtab->send(tp, sndbuf, sndlen, addr, addrlen);
 
 	if (len == -1)
 		syslog(LOG_ERR, "sendto: %m");
@@ -1097,6 +1508,7 @@ snmp_send_port(void *targ, const struct asn_oid *port, struct snmp_pdu *pdu,
 void
 snmpd_input_close(struct port_input *pi)
 {
+	pending_flush(pi);
 	if (pi->id != NULL)
 		fd_deselect(pi->id);
 	if (pi->fd >= 0)
@@ -1156,10 +1568,12 @@ config_func(evContext ctx __unused, void *uap __unused,
 {
 	struct lmodule *m;
 
+	acl_flush();
 	if (read_config(config_file, NULL)) {
 		syslog(LOG_ERR, "error reading config file '%s'", config_file);
 		return;
 	}
+	udp_filter_update();
 	TAILQ_FOREACH(m, &lmodules, link)
 		if (m->config->config)
 			(*m->config->config)();
@@ -1355,6 +1769,9 @@ main(int argc, char *argv[])
 	snmp_debug = snmp_debug_func;
 	asn_error = asn_error_func;
 
+	/* responses are sent in fragments, see input_finish() */
+	snmp_resp_iov = 1;
+
 	while ((opt = getopt(argc, argv, "c:dD:hI:l:m:p:")) != EOF)
 		switch (opt) {
 
@@ -1440,13 +1857,7 @@ main(int argc, char *argv[])
 
 	snmp_serial_no = random();
 
-#if defined(USE_TCPWRAPPERS)
-	/*
-	 * Initialize hosts_access(3) handler.
-	 */
-	request_init(&req, RQ_DAEMON, "snmpd", 0);
-	sock_methods(&req);
-#endif
+	acl_init();
 
 	/*
 	 * Initialize the tree.
@@ -1466,6 +1877,7 @@ main(int argc, char *argv[])
 	community = COMM_INITIALIZE;
 
 	trap_reqid = reqid_allocate(512, NULL);
+	inform_reqid = reqid_allocate(16384, NULL);
 
 	if (config_file[0] == '\0')
 		snprintf(config_file, sizeof(config_file), PATH_CONFIG, prefix);
@@ -1484,6 +1896,10 @@ main(int argc, char *argv[])
 		syslog(LOG_WARNING, "cannot start UDP transport");
 	if (lsock_trans.start() != SNMP_ERR_NOERROR)
 		syslog(LOG_WARNING, "cannot start LSOCK transport");
+	if (shm_trans.start() != SNMP_ERR_NOERROR)
+		syslog(LOG_WARNING, "cannot start SHM transport");
+	if (tcp_trans.start() != SNMP_ERR_NOERROR)
+		syslog(LOG_WARNING, "cannot start TCP transport");
 
 #if defined(USE_LIBBEGEMOT)
 	if (debug.evdebug > 0)
@@ -1961,6 +2377,7 @@ comm_flush(struct lmodule *mod)
 		}
 		p = p1;
 	}
+	udp_filter_update();
 }
 
 /*
@@ -2309,6 +2726,7 @@ lm_unload(struct lmodule *m)
 	reqid_flush(m);
 	timer_flush(m);
 	fd_flush(m);
+	refresh_flush(m);
 
 	dlclose(m->handle);
 	free(m->path);
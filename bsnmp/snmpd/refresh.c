@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Refresh caches.
+ *
+ * Modules register one entry for each set of data they load from the
+ * system. refresh_check() calls the fetch function only when the data is
+ * older than the maximum age of the entry, so that the PDUs of one walk
+ * are answered from the same snapshot. The maximum age can be changed
+ * through begemotSnmpdRefreshTable. Entries written before the owning
+ * module has registered them are kept and applied on registration.
+ *
+ * Entries registered with refresh_register_bg() are fetched on a worker
+ * thread once they have data. The fetch function fills a buffer that
+ * only it uses; when it has finished, the main thread calls the swap
+ * function to publish the new buffer. Until then requests are answered
+ * from the previous snapshot. The worker takes one job at a time, so
+ * the fetch functions need not be reentrant, but they must not touch
+ * anything the main thread uses.
+ *
+ * A fetch function that only sends a query returns REFRESH_PENDING. The
+ * ops then return SNMP_ERR_PENDING and the daemon parks the request
+ * until the module calls refresh_complete() with the answer. A failed
+ * asynchronous fetch is not retried for requests that were received
+ * before it failed; otherwise they would wait for the next attempt.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "snmpmod.h"
+#include "snmpd.h"
+#include "tree.h"
+#include "oid.h"
+
+#define	REFRESH_REGISTERED	1
+#define	REFRESH_UNREGISTERED	2
+
+#define	REFRESH_INLINE		1
+#define	REFRESH_BACKGROUND	2
+
+/* state of a background job */
+enum refresh_job {
+	JOB_IDLE,
+	JOB_QUEUED,		/* on refresh_jobs */
+	JOB_RUNNING,		/* worker is in the fetch function */
+	JOB_DONE,		/* on refresh_done */
+};
+
+struct snmp_refresh {
+	TAILQ_ENTRY(snmp_refresh) link;
+	struct asn_oid	index;
+	char		name[REFRESH_NAMELEN + 1];
+	u_int		maxage;		/* in 1/100 seconds */
+	int		configured;	/* maxage was set by the manager */
+
+	int		(*fetch)(void *);
+	void		(*swap)(void *);
+	void		*arg;
+	struct lmodule	*owner;		/* NULL if not registered */
+	int		background;	/* fetch on the worker thread */
+	int		published;	/* swap has been called */
+	int		inflight;	/* asynchronous fetch running */
+	uint64_t	failed;		/* last asynchronous failure */
+
+	uint64_t	last;		/* tick of the last fetch, 0 if none */
+	uint32_t	fetches;
+	uint32_t	hits;
+	uint32_t	failures;
+
+	/* background job - protected by refresh_mtx */
+	TAILQ_ENTRY(snmp_refresh) qlink;
+	enum refresh_job job;
+	int		result;
+	uint64_t	started;	/* this_tick when the job was queued */
+};
+TAILQ_HEAD(refresh_queue, snmp_refresh);
+
+static struct refresh_queue refresh_list =
+    TAILQ_HEAD_INITIALIZER(refresh_list);
+
+/* the worker thread */
+static int refresh_thread_up;
+static pthread_t refresh_thread;
+static pthread_mutex_t refresh_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refresh_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t refresh_idle = PTHREAD_COND_INITIALIZER;
+static struct refresh_queue refresh_jobs =
+    TAILQ_HEAD_INITIALIZER(refresh_jobs);
+static struct refresh_queue refresh_done =
+    TAILQ_HEAD_INITIALIZER(refresh_done);
+
+/* the worker writes a byte for each finished job */
+static int refresh_pipe[2] = { -1, -1 };
+static void *refresh_fd;
+
+/*
+ * Check a name. Allow the characters that make sensible module and
+ * table names.
+ */
+static int
+refresh_name_ok(const u_char *name, size_t len)
+{
+	const u_char *ptr;
+
+	if (len == 0 || len > REFRESH_NAMELEN)
+		return (0);
+	for (ptr = name; ptr < name + len; ptr++)
+		if (!isascii(*ptr) || (!isalnum(*ptr) && *ptr != '.' &&
+		    *ptr != '-' && *ptr != '_'))
+			return (0);
+	return (1);
+}
+
+static struct snmp_refresh *
+refresh_find(const char *name)
+{
+	struct snmp_refresh *r;
+
+	TAILQ_FOREACH(r, &refresh_list, link)
+		if (strcmp(r->name, name) == 0)
+			return (r);
+	return (NULL);
+}
+
+static struct snmp_refresh *
+refresh_create(const u_char *name, size_t len)
+{
+	struct snmp_refresh *r;
+	u_int i;
+
+	if ((r = malloc(sizeof(*r))) == NULL) {
+		syslog(LOG_ERR, "%s: %m", __func__);
+		return (NULL);
+	}
+	memset(r, 0, sizeof(*r));
+	memcpy(r->name, name, len);
+	r->name[len] = '\0';
+
+	r->index.len = len + 1;
+	r->index.subs[0] = len;
+	for (i = 0; i < len; i++)
+		r->index.subs[i + 1] = name[i];
+
+	INSERT_OBJECT_OID(r, &refresh_list);
+	return (r);
+}
+
+static void
+refresh_destroy(struct snmp_refresh *r)
+{
+	TAILQ_REMOVE(&refresh_list, r, link);
+	free(r);
+}
+
+/*
+ * Worker thread. Run the queued fetch functions one after the other.
+ */
+static void *
+refresh_worker(void *arg __unused)
+{
+	struct snmp_refresh *r;
+	int ret;
+
+	(void)pthread_mutex_lock(&refresh_mtx);
+	for (;;) {
+		while ((r = TAILQ_FIRST(&refresh_jobs)) == NULL)
+			(void)pthread_cond_wait(&refresh_work, &refresh_mtx);
+		TAILQ_REMOVE(&refresh_jobs, r, qlink);
+		r->job = JOB_RUNNING;
+		(void)pthread_mutex_unlock(&refresh_mtx);
+
+		ret = (*r->fetch)(r->arg);
+
+		(void)pthread_mutex_lock(&refresh_mtx);
+		r->result = ret;
+		r->job = JOB_DONE;
+		TAILQ_INSERT_TAIL(&refresh_done, r, qlink);
+		(void)pthread_cond_broadcast(&refresh_idle);
+
+		/* if the pipe is full, the main thread has not read it yet */
+		(void)write(refresh_pipe[1], "", 1);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/*
+ * Publish the result of a fetch.
+ */
+static void
+refresh_publish(struct snmp_refresh *r, int result, uint64_t when)
+{
+	if (result == -1) {
+		r->failures++;
+		return;
+	}
+	if (r->swap != NULL) {
+		(*r->swap)(r->arg);
+		r->published = 1;
+	}
+	r->fetches++;
+	r->last = when;
+}
+
+/*
+ * Called in the main thread when the worker has finished jobs.
+ */
+static void
+refresh_input(int fd, void *arg __unused)
+{
+	char buf[64];
+	struct snmp_refresh *r;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	(void)pthread_mutex_lock(&refresh_mtx);
+	while ((r = TAILQ_FIRST(&refresh_done)) != NULL) {
+		TAILQ_REMOVE(&refresh_done, r, qlink);
+		r->job = JOB_IDLE;
+
+		/* the worker does not touch the entry while it is idle */
+		(void)pthread_mutex_unlock(&refresh_mtx);
+		refresh_publish(r, r->result, r->started);
+		(void)pthread_mutex_lock(&refresh_mtx);
+	}
+	(void)pthread_mutex_unlock(&refresh_mtx);
+}
+
+/*
+ * Start the worker thread. Signals are left to the main thread.
+ */
+static int
+refresh_start_thread(void)
+{
+	sigset_t all, old;
+	int err;
+
+	if (pipe(refresh_pipe) == -1) {
+		syslog(LOG_ERR, "%s: pipe: %m", __func__);
+		return (-1);
+	}
+	if (fcntl(refresh_pipe[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(refresh_pipe[1], F_SETFL, O_NONBLOCK) == -1) {
+		syslog(LOG_ERR, "%s: fcntl: %m", __func__);
+		goto err;
+	}
+	if ((refresh_fd = fd_select(refresh_pipe[0], refresh_input, NULL,
+	    NULL)) == NULL)
+		goto err;
+
+	(void)sigfillset(&all);
+	(void)pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&refresh_thread, NULL, refresh_worker, NULL);
+	(void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		syslog(LOG_ERR, "%s: pthread_create: %s", __func__,
+		    strerror(err));
+		fd_deselect(refresh_fd);
+		refresh_fd = NULL;
+		goto err;
+	}
+	refresh_thread_up = 1;
+	return (0);
+
+  err:
+	(void)close(refresh_pipe[0]);
+	(void)close(refresh_pipe[1]);
+	refresh_pipe[0] = refresh_pipe[1] = -1;
+	return (-1);
+}
+
+/*
+ * Wait until the worker is done with an entry and take it off the queues.
+ * The result of a finished job is dropped.
+ */
+static void
+refresh_cancel(struct snmp_refresh *r)
+{
+	(void)pthread_mutex_lock(&refresh_mtx);
+	while (r->job == JOB_RUNNING)
+		(void)pthread_cond_wait(&refresh_idle, &refresh_mtx);
+	if (r->job == JOB_QUEUED)
+		TAILQ_REMOVE(&refresh_jobs, r, qlink);
+	else if (r->job == JOB_DONE)
+		TAILQ_REMOVE(&refresh_done, r, qlink);
+	r->job = JOB_IDLE;
+	(void)pthread_mutex_unlock(&refresh_mtx);
+}
+
+static struct snmp_refresh *
+refresh_add(const char *name, u_int maxage, int (*fetch)(void *),
+    void (*swap)(void *), void *arg, struct lmodule *mod)
+{
+	struct snmp_refresh *r;
+
+	if (!refresh_name_ok((const u_char *)name, strlen(name))) {
+		syslog(LOG_ERR, "%s: bad name '%s'", __func__, name);
+		return (NULL);
+	}
+	if ((r = refresh_find(name)) != NULL) {
+		if (r->owner != NULL) {
+			syslog(LOG_ERR, "%s: '%s' already registered",
+			    __func__, name);
+			return (NULL);
+		}
+	} else if ((r = refresh_create((const u_char *)name,
+	    strlen(name))) == NULL)
+		return (NULL);
+
+	if (!r->configured)
+		r->maxage = maxage;
+	r->fetch = fetch;
+	r->swap = swap;
+	r->arg = arg;
+	r->owner = mod;
+	r->background = 0;
+	r->published = 0;
+	r->inflight = 0;
+	r->failed = 0;
+	r->last = 0;
+	return (r);
+}
+
+/*
+ * Register a fetch function. If the manager has already configured a
+ * maximum age for this name, it overrides the module's default.
+ */
+struct snmp_refresh *
+refresh_register(const char *name, u_int maxage, int (*fetch)(void *),
+    void *arg, struct lmodule *mod)
+{
+	return (refresh_add(name, maxage, fetch, NULL, arg, mod));
+}
+
+/*
+ * Register a fetch function that runs on the worker thread and a swap
+ * function that publishes its result. The first fetch is done inline,
+ * because there is nothing to answer from before. If the thread cannot
+ * be started, all fetches are done inline.
+ */
+struct snmp_refresh *
+refresh_register_bg(const char *name, u_int maxage, int (*fetch)(void *),
+    void (*swap)(void *), void *arg, struct lmodule *mod)
+{
+	struct snmp_refresh *r;
+
+	if ((r = refresh_add(name, maxage, fetch, swap, arg, mod)) == NULL)
+		return (NULL);
+	if (!refresh_thread_up)
+		(void)refresh_start_thread();
+	r->background = refresh_thread_up;
+	return (r);
+}
+
+/*
+ * Unregister. A configured maximum age is kept for the next registration.
+ */
+void
+refresh_unregister(struct snmp_refresh *r)
+{
+	if (r == NULL)
+		return;
+	if (r->background)
+		refresh_cancel(r);
+	if (!r->configured) {
+		refresh_destroy(r);
+		return;
+	}
+	r->fetch = NULL;
+	r->swap = NULL;
+	r->arg = NULL;
+	r->owner = NULL;
+	r->background = 0;
+	r->published = 0;
+	r->inflight = 0;
+	r->failed = 0;
+	r->last = 0;
+}
+
+/*
+ * Make sure the data is not older than the maximum age. With a maximum
+ * age of 0 this fetches once per PDU. A background entry with old data
+ * only queues a job and answers from the old data. Returns
+ * REFRESH_PENDING while an asynchronous fetch is running.
+ */
+int
+refresh_check(struct snmp_refresh *r)
+{
+	int ret;
+
+	if (r->last != 0 && r->last + r->maxage >= this_tick) {
+		r->hits++;
+		return (0);
+	}
+	if (r->inflight)
+		return (REFRESH_PENDING);
+	if (r->failed != 0 && r->failed >= this_tick)
+		return (-1);
+
+	if (!r->background || !r->published) {
+		ret = (*r->fetch)(r->arg);
+		if (ret == REFRESH_PENDING) {
+			r->inflight = 1;
+			return (REFRESH_PENDING);
+		}
+		refresh_publish(r, ret, this_tick);
+		return (ret == -1 ? -1 : 0);
+	}
+
+	(void)pthread_mutex_lock(&refresh_mtx);
+	if (r->job == JOB_IDLE) {
+		r->job = JOB_QUEUED;
+		r->started = this_tick;
+		TAILQ_INSERT_TAIL(&refresh_jobs, r, qlink);
+		(void)pthread_cond_signal(&refresh_work);
+	}
+	(void)pthread_mutex_unlock(&refresh_mtx);
+	r->hits++;
+	return (0);
+}
+
+/*
+ * An asynchronous fetch has finished. The data counts as fetched now,
+ * which is not before any of the requests waiting for it. These are
+ * executed again.
+ */
+void
+refresh_complete(struct snmp_refresh *r, int result)
+{
+	uint64_t now;
+
+	if (!r->inflight)
+		return;
+	r->inflight = 0;
+
+	now = get_ticks();
+	if (result == -1)
+		r->failed = now;
+	refresh_publish(r, result, now);
+
+	snmp_resume_pending();
+}
+
+/*
+ * Force a fetch on the next check, e.g. because the module learned that
+ * its data has changed.
+ */
+void
+refresh_invalidate(struct snmp_refresh *r)
+{
+	r->last = 0;
+}
+
+/*
+ * Unregister all entries of a module that is being unloaded.
+ */
+void
+refresh_flush(struct lmodule *mod)
+{
+	struct snmp_refresh *r, *r1;
+
+	r = TAILQ_FIRST(&refresh_list);
+	while (r != NULL) {
+		r1 = TAILQ_NEXT(r, link);
+		if (r->owner == mod)
+			refresh_unregister(r);
+		r = r1;
+	}
+}
+
+int
+op_refresh(struct snmp_context *ctx, struct snmp_value *value,
+    u_int sub, u_int iidx, enum snmp_op op)
+{
+	asn_subid_t which = value->var.subs[sub - 1];
+	struct snmp_refresh *r;
+	u_char *name;
+	size_t namelen;
+	uint64_t now;
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		if ((r = NEXT_OBJECT_OID(&refresh_list, &value->var, sub))
+		    == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		index_append(&value->var, sub, &r->index);
+		break;
+
+	  case SNMP_OP_GET:
+		if ((r = FIND_OBJECT_OID(&refresh_list, &value->var, sub))
+		    == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		break;
+
+	  case SNMP_OP_SET:
+		r = FIND_OBJECT_OID(&refresh_list, &value->var, sub);
+		if (which != LEAF_begemotSnmpdRefreshMaxAge) {
+			if (r == NULL)
+				return (SNMP_ERR_NO_CREATION);
+			return (SNMP_ERR_NOT_WRITEABLE);
+		}
+		ctx->scratch->ptr1 = NULL;
+		if (r == NULL) {
+			if (index_decode(&value->var, sub, iidx,
+			    &name, &namelen))
+				return (SNMP_ERR_NO_CREATION);
+			if (!refresh_name_ok(name, namelen)) {
+				free(name);
+				return (SNMP_ERR_NO_CREATION);
+			}
+			r = refresh_create(name, namelen);
+			free(name);
+			if (r == NULL)
+				return (SNMP_ERR_RES_UNAVAIL);
+			/* remember to destroy it on rollback */
+			ctx->scratch->ptr1 = r;
+		}
+		ctx->scratch->int1 = r->maxage;
+		ctx->scratch->int2 = r->configured;
+		r->maxage = value->v.uint32;
+		r->configured = 1;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_ROLLBACK:
+		if ((r = ctx->scratch->ptr1) != NULL) {
+			refresh_destroy(r);
+			return (SNMP_ERR_NOERROR);
+		}
+		r = FIND_OBJECT_OID(&refresh_list, &value->var, sub);
+		r->maxage = ctx->scratch->int1;
+		r->configured = ctx->scratch->int2;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_COMMIT:
+		return (SNMP_ERR_NOERROR);
+
+	  default:
+		abort();
+	}
+
+	switch (which) {
+
+	  case LEAF_begemotSnmpdRefreshMaxAge:
+		value->v.uint32 = r->maxage;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshAge:
+		now = get_ticks();
+		if (r->last == 0 || r->last > now)
+			value->v.uint32 = 0;
+		else
+			value->v.uint32 = now - r->last;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshStatus:
+		value->v.integer = r->owner != NULL ?
+		    REFRESH_REGISTERED : REFRESH_UNREGISTERED;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshFetches:
+		value->v.uint32 = r->fetches;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshHits:
+		value->v.uint32 = r->hits;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshFailures:
+		value->v.uint32 = r->failures;
+		break;
+
+	  case LEAF_begemotSnmpdRefreshMode:
+		value->v.integer = r->background ?
+		    REFRESH_BACKGROUND : REFRESH_INLINE;
+		break;
+	}
+	return (SNMP_ERR_NOERROR);
+}
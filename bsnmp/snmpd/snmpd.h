@@ -83,6 +83,9 @@ extern u_int next_idrange;
 /* request id generator for traps */
 extern u_int trap_reqid;
 
+/* request id generator for INFORMs */
+extern u_int inform_reqid;
+
 /*************************************************************
  *
  * Timers
@@ -108,6 +111,7 @@ struct fdesc {
 	void	(*func)(int, void *);/* user function */
 	void	*udata;		/* user data */
 	evFileID id;		/* file id */
+	int	out;		/* wait until it can be written */
 	struct lmodule *owner;	/* owner module of the file */
 	LIST_ENTRY(fdesc) link;
 };
@@ -145,6 +149,8 @@ void lm_start(struct lmodule *);
  *
  * SNMP ports
  */
+struct iovec;
+
 /*
  * Common input stuff
  */
@@ -158,11 +164,18 @@ struct port_input {
 	struct sockaddr	*peer;		/* last received packet */
 	socklen_t	peerlen;
 	int		priv : 1;	/* peer is privileged */
+	int		peercred : 1;	/* peerpriv is valid */
+	int		peerpriv : 1;	/* accept time credentials */
 
 	u_char		*buf;		/* receive buffer */
 	size_t		buflen;		/* buffer length */
 	size_t		length;		/* received length */
 	size_t		consumed;	/* how many bytes used */
+	size_t		start;		/* start of unprocessed bytes */
+
+	/* deliver a response, NULL to send it on fd */
+	ssize_t		(*output)(struct port_input *, const struct iovec *, u_int);
+	size_t		maxmsg;		/* largest response, 0 for any */
 };
 
 struct tport {
@@ -172,9 +185,29 @@ struct tport {
 };
 TAILQ_HEAD(tport_list, tport);
 
+void *fd_select_out(int, void (*)(int, void *), void *, struct lmodule *);
+
 int snmpd_input(struct port_input *, struct tport *);
+int snmpd_input_process(struct port_input *, struct tport *);
 void snmpd_input_close(struct port_input *);
 
+/*
+ * Source address access control
+ */
+void acl_init(void);
+int acl_check(const struct sockaddr *);
+void acl_flush(void);
+
+/*
+ * Refresh caches
+ */
+void refresh_flush(struct lmodule *);
+
+/*
+ * UDP transport
+ */
+void udp_filter_update(void);
+
 
 /*
  * Transport domain
@@ -193,6 +226,10 @@ struct transport_def {
 
 	ssize_t		(*send)(struct tport *, const u_char *, size_t,
 			    const struct sockaddr *, size_t);
+
+	/* optional vectored send */
+	ssize_t		(*sendv)(struct tport *, const struct iovec *, u_int,
+			    const struct sockaddr *, size_t);
 };
 struct transport {
 	struct asn_oid	index;		/* transport table index */
@@ -242,6 +279,21 @@ struct snmpd {
 
 	/* version enable flags */
 	uint32_t	version_enable;
+
+	/* maximum message size for stream transports (0 - off) */
+	u_int32_t	streambuf;
+
+	/* datagrams to process per input event */
+	u_int32_t	input_batch;
+
+	/* socket filter on UDP ports (0 - off) */
+	u_int32_t	udp_filter;
+
+	/* maximum number of queued traps per trap sink */
+	u_int32_t	trap_queue;
+
+	/* ticks a request may wait for asynchronous fetches */
+	u_int32_t	pending_timeout;
 };
 extern struct snmpd snmpd;
 
@@ -276,6 +328,9 @@ struct snmpd_stats {
 	u_int32_t	inTooLong;
 	u_int32_t	noTxbuf;
 	u_int32_t	noRxbuf;
+	u_int32_t	inAclDrops;	/* refused by access control */
+	u_int32_t	pendingRequests; /* waited for a module */
+	u_int32_t	pendingTimeouts; /* ... and were given up */
 };
 extern struct snmpd_stats snmpd_stats;
 
@@ -296,6 +351,34 @@ extern struct objres_list objres_list;
 /*
  * Trap Sink Table
  */
+struct trapbuf {
+	u_int		refs;		/* messages using this buffer */
+	u_char		*buf;		/* encoded message */
+	size_t		len;
+};
+
+/* room for the headers up to and including the request id */
+#define	TRAP_HDRLEN	(SNMP_COMMUNITY_MAXLEN + 32)
+
+struct trapsink;
+
+struct trapmsg {
+	STAILQ_ENTRY(trapmsg) link;
+	struct trapbuf	*body;		/* shared encoding */
+	size_t		off;		/* start of our part of the body */
+	size_t		hdrlen;		/* length of private header */
+	u_char		hdr[TRAP_HDRLEN];
+
+	/* INFORM state */
+	int		inform;		/* wait for a response */
+	int32_t		reqid;
+	struct trapsink	*sink;
+	uint64_t	due;		/* retransmission time in ticks */
+	u_int		retries;
+	u_int		heapidx;	/* position in the retransmission heap */
+};
+STAILQ_HEAD(trapmsg_list, trapmsg);
+
 struct trapsink {
 	TAILQ_ENTRY(trapsink) link;
 	struct asn_oid	index;
@@ -303,6 +386,20 @@ struct trapsink {
 	int		socket;
 	u_char		comm[SNMP_COMMUNITY_MAXLEN];
 	int		version;
+
+	struct trapmsg_list queue;	/* messages not yet sent */
+	u_int32_t	qlen;		/* length of queue */
+	u_int32_t	drops;		/* dropped on queue overflow */
+
+	void		*fdid;		/* selected for responses */
+	struct trapmsg_list pending;	/* INFORMs waiting for a response */
+	u_int32_t	npending;
+	u_int32_t	inform_window;	/* maximum outstanding INFORMs */
+	u_int32_t	inform_timeout;	/* retransmission timeout in ticks */
+	u_int32_t	inform_retries;	/* retransmissions before dropping */
+	u_int32_t	inform_acked;
+	u_int32_t	inform_retried;
+	u_int32_t	inform_dropped;
 };
 enum {
 	TRAPSINK_ACTIVE		= 1,
@@ -312,6 +409,7 @@ enum {
 
 	TRAPSINK_V1		= 1,
 	TRAPSINK_V2		= 2,
+	TRAPSINK_INFORM		= 3,
 };
 TAILQ_HEAD(trapsink_list, trapsink);
 extern struct trapsink_list trapsink_list;
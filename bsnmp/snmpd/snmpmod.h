@@ -256,6 +256,8 @@ enum snmpd_input_err {
 	SNMPD_INPUT_TRUNC,
 	/* unknown community */
 	SNMPD_INPUT_BAD_COMM,
+	/* request waits for an asynchronous fetch */
+	SNMPD_INPUT_PENDING,
 };
 
 /*
@@ -371,6 +373,42 @@ int fd_resume(void *);
 u_int or_register(const struct asn_oid *, const char *, struct lmodule *);
 void or_unregister(u_int);
 
+/*
+ * Refresh caches
+ *
+ * A module registers a fetch function for data it loads from the system
+ * together with a default maximum age in 1/100 seconds. refresh_check
+ * calls the fetch function only if the data is older than that. The
+ * maximum age can be changed with begemotSnmpdRefreshMaxAge.
+ *
+ * With refresh_register_bg the fetch function runs on a worker thread and
+ * fills a buffer of its own; the swap function is called in the main
+ * thread to make that buffer the current one.
+ *
+ * A fetch function may also start an asynchronous fetch and return
+ * REFRESH_PENDING. refresh_check then returns REFRESH_PENDING until the
+ * module calls refresh_complete with the result.
+ */
+#define	REFRESH_NAMELEN	32
+#define	REFRESH_PENDING	1
+
+struct snmp_refresh;
+struct snmp_refresh *refresh_register(const char *, u_int,
+    int (*)(void *), void *, struct lmodule *);
+struct snmp_refresh *refresh_register_bg(const char *, u_int,
+    int (*)(void *), void (*)(void *), void *, struct lmodule *);
+void refresh_unregister(struct snmp_refresh *);
+int refresh_check(struct snmp_refresh *);
+void refresh_invalidate(struct snmp_refresh *);
+void refresh_complete(struct snmp_refresh *, int);
+
+/*
+ * Asynchronous fetches. A GET or GETNEXT op that must wait for data
+ * returns SNMP_ERR_PENDING. The request is parked and executed again
+ * each time a module calls snmp_resume_pending.
+ */
+void snmp_resume_pending(void);
+
 /*
  * Buffers
  */
@@ -401,6 +439,8 @@ void string_commit(struct snmp_context *);
 void string_rollback(struct snmp_context *, u_char **);
 int string_get(struct snmp_value *, const u_char *, ssize_t);
 int string_get_max(struct snmp_value *, const u_char *, ssize_t, size_t);
+int string_get_ref(struct snmp_value *, const u_char *, ssize_t);
+int string_get_max_ref(struct snmp_value *, const u_char *, ssize_t, size_t);
 void string_free(struct snmp_context *);
 
 int ip_save(struct snmp_value *, struct snmp_context *, u_char *);
@@ -31,6 +31,7 @@
  * Local domain socket transport
  */
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 
@@ -57,6 +58,8 @@ static void lsock_close_port(struct tport *);
 static int lsock_init_port(struct tport *);
 static ssize_t lsock_send(struct tport *, const u_char *, size_t,
     const struct sockaddr *, size_t);
+static ssize_t lsock_sendv(struct tport *, const struct iovec *, u_int,
+    const struct sockaddr *, size_t);
 
 /* exported */
 const struct transport_def lsock_trans = {
@@ -66,7 +69,8 @@ const struct transport_def lsock_trans = {
 	lsock_stop,
 	lsock_close_port,
 	lsock_init_port,
-	lsock_send
+	lsock_send,
+	lsock_sendv
 };
 static struct transport *my_trans;
 
@@ -233,18 +237,25 @@ lsock_close_port(struct tport *tp)
 }
 
 /*
- * Input on a local socket (either datagram or stream)
+ * Input on a local socket (either datagram or stream). Datagram sockets
+ * are drained of up to input_batch messages.
  */
 static void
 lsock_input(int fd __unused, void *udata)
 {
 	struct lsock_peer *peer = udata;
 	struct lsock_port *p = peer->port;
-
-	peer->input.peerlen = sizeof(peer->peer);
-	if (snmpd_input(&peer->input, &p->tport) == -1 && peer->input.stream)
-		/* framing or other input error */
-		lsock_peer_close(peer);
+	u_int n = 0;
+
+	do {
+		peer->input.peerlen = sizeof(peer->peer);
+		if (snmpd_input(&peer->input, &p->tport) == -1) {
+			if (peer->input.stream)
+				/* framing or other input error */
+				lsock_peer_close(peer);
+			return;
+		}
+	} while (!peer->input.stream && ++n < snmpd.input_batch);
 }
 
 /*
@@ -383,6 +394,27 @@ lsock_init_port(struct tport *tp)
 	return (SNMP_ERR_NOERROR);
 }
 
+/*
+ * Find the peer to send to
+ */
+static struct lsock_peer *
+lsock_peer_find(struct lsock_port *p, const struct sockaddr *addr,
+    size_t addrlen)
+{
+	struct lsock_peer *peer;
+
+	if (p->type == LOCP_DGRAM_PRIV || p->type == LOCP_DGRAM_UNPRIV)
+		return (LIST_FIRST(&p->peers));
+
+	/* search for the peer */
+	LIST_FOREACH(peer, &p->peers, link)
+		if (peer->input.peerlen == addrlen &&
+		    memcmp(peer->input.peer, addr, addrlen) == 0)
+			return (peer);
+	errno = ENOTCONN;
+	return (NULL);
+}
+
 /*
  * Send something
  */
@@ -390,27 +422,38 @@ static ssize_t
 lsock_send(struct tport *tp, const u_char *buf, size_t len,
     const struct sockaddr *addr, size_t addrlen)
 {
-	struct lsock_port *p = (struct lsock_port *)tp;
 	struct lsock_peer *peer;
 
-	if (p->type == LOCP_DGRAM_PRIV || p->type == LOCP_DGRAM_UNPRIV) {
-		peer = LIST_FIRST(&p->peers);
+	if ((peer = lsock_peer_find((struct lsock_port *)tp, addr,
+	    addrlen)) == NULL)
+		return (-1);
 
-	} else {
-		/* search for the peer */
-		LIST_FOREACH(peer, &p->peers, link)
-			if (peer->input.peerlen == addrlen &&
-			    memcmp(peer->input.peer, addr, addrlen) == 0)
-				break;
-		if (peer == NULL) {
-			errno = ENOTCONN;
-			return (-1);
-		}
-	}
-	
 	return (sendto(peer->input.fd, buf, len, 0, addr, addrlen));
 }
 
+/*
+ * Send a message that is scattered over several buffers
+ */
+static ssize_t
+lsock_sendv(struct tport *tp, const struct iovec *iov, u_int iovcnt,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct lsock_peer *peer;
+	struct msghdr msg;
+
+	if ((peer = lsock_peer_find((struct lsock_port *)tp, addr,
+	    addrlen)) == NULL)
+		return (-1);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)(uintptr_t)addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+	msg.msg_iovlen = iovcnt;
+
+	return (sendmsg(peer->input.fd, &msg, 0));
+}
+
 /*
  * Dependency to create a lsock port
  */
@@ -0,0 +1,805 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Shared memory transport for local clients. See snmpshm.h for the
+ * layout of the shared memory.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/ucred.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <syslog.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "snmpmod.h"
+#include "snmpd.h"
+#include "snmpshm.h"
+#include "trans_shm.h"
+#include "tree.h"
+#include "oid.h"
+
+static const struct asn_oid
+	oid_begemotSnmpdShmPortTable = OIDX_begemotSnmpdShmPortTable;
+
+/* responses held back for a client that does not read its ring */
+#define	SHM_OUTQ_MAX	64
+
+/*
+ * A client that can resize the shared memory object makes the agent
+ * fault on its next access to the rings. Where the size can be sealed
+ * anybody may connect, otherwise only root.
+ */
+#if defined(F_ADD_SEALS)
+#define	SHM_SOCK_MODE	0666
+#else
+#define	SHM_SOCK_MODE	0600
+#endif
+
+static int shm_start(void);
+static int shm_stop(int);
+static void shm_close_port(struct tport *);
+static int shm_init_port(struct tport *);
+static ssize_t shm_send(struct tport *, const u_char *, size_t,
+    const struct sockaddr *, size_t);
+static ssize_t shm_sendv(struct tport *, const struct iovec *, u_int,
+    const struct sockaddr *, size_t);
+
+/* exported */
+const struct transport_def shm_trans = {
+	"shm",
+	OIDX_begemotSnmpdTransShm,
+	shm_start,
+	shm_stop,
+	shm_close_port,
+	shm_init_port,
+	shm_send,
+	shm_sendv
+};
+static struct transport *my_trans;
+
+static int
+shm_remove(struct tport *tp, intptr_t arg __unused)
+{
+	struct shm_port *port = (struct shm_port *)tp;
+
+	(void)remove(port->name);
+
+	return (-1);
+}
+
+static int
+shm_stop(int force)
+{
+
+	if (my_trans != NULL) {
+		if (!force && trans_first_port(my_trans) != NULL)
+			return (SNMP_ERR_GENERR);
+		trans_iter_port(my_trans, shm_remove, 0);
+		return (trans_unregister(my_trans));
+	}
+	return (SNMP_ERR_NOERROR);
+}
+
+static int
+shm_start(void)
+{
+	return (trans_register(&shm_trans, &my_trans));
+}
+
+/*
+ * Open a shared memory port.
+ */
+static int
+shm_open_port(u_char *name, size_t namelen, struct shm_port **pp)
+{
+	struct shm_port *port;
+	size_t u;
+	int err;
+	struct sockaddr_un sa;
+
+	if (namelen == 0 || namelen + 1 > sizeof(sa.sun_path))
+		return (SNMP_ERR_BADVALUE);
+
+	if ((port = malloc(sizeof(*port))) == NULL)
+		return (SNMP_ERR_GENERR);
+	memset(port, 0, sizeof(*port));
+
+	if ((port->name = malloc(namelen + 1)) == NULL) {
+		free(port);
+		return (SNMP_ERR_GENERR);
+	}
+	strncpy(port->name, name, namelen);
+	port->name[namelen] = '\0';
+
+	port->sock = -1;
+	LIST_INIT(&port->peers);
+
+	port->tport.index.len = namelen + 1;
+	port->tport.index.subs[0] = namelen;
+	for (u = 0; u < namelen; u++)
+		port->tport.index.subs[u + 1] = name[u];
+
+	trans_insert_port(my_trans, &port->tport);
+
+	if (community != COMM_INITIALIZE &&
+	    (err = shm_init_port(&port->tport)) != SNMP_ERR_NOERROR) {
+		shm_close_port(&port->tport);
+		return (err);
+	}
+
+	*pp = port;
+
+	return (SNMP_ERR_NOERROR);
+}
+
+/*
+ * Close a peer and unmap its rings
+ */
+static void
+shm_peer_close(struct shm_peer *peer)
+{
+	struct shm_msg *m;
+
+	LIST_REMOVE(peer, link);
+	snmpd_input_close(&peer->input);
+	while ((m = STAILQ_FIRST(&peer->outq)) != NULL) {
+		STAILQ_REMOVE_HEAD(&peer->outq, link);
+		free(m);
+	}
+	if (peer->shm != NULL)
+		(void)munmap(peer->shm, sizeof(*peer->shm));
+	free(peer);
+}
+
+/*
+ * Close a shared memory port
+ */
+static void
+shm_close_port(struct tport *tp)
+{
+	struct shm_port *port = (struct shm_port *)tp;
+	struct shm_peer *peer;
+
+	if (port->id != NULL)
+		fd_deselect(port->id);
+	if (port->sock >= 0)
+		(void)close(port->sock);
+	(void)remove(port->name);
+
+	trans_remove_port(tp);
+
+	while ((peer = LIST_FIRST(&port->peers)) != NULL)
+		shm_peer_close(peer);
+
+	free(port->name);
+	free(port);
+}
+
+/*
+ * Wake up the client if there are new responses in the ring and it
+ * sleeps. While the requests of the client are processed this is done
+ * once at the end.
+ */
+static void
+shm_doorbell(struct shm_peer *peer)
+{
+	if (peer->ring && !peer->busy) {
+		peer->ring = 0;
+		if (snmp_shm_notify(&peer->shm->resp))
+			(void)send(peer->input.fd, "", 1, MSG_DONTWAIT);
+	}
+}
+
+/*
+ * Move held back responses into the ring as far as they fit. Return
+ * 0 if all of them were moved.
+ */
+static int
+shm_flush(struct shm_peer *peer)
+{
+	struct shm_msg *m;
+
+	while ((m = STAILQ_FIRST(&peer->outq)) != NULL) {
+		if (snmp_shm_put(&peer->shm->resp, m->data, m->len) == -1)
+			return (-1);
+		STAILQ_REMOVE_HEAD(&peer->outq, link);
+		peer->outqlen--;
+		free(m);
+		peer->ring = 1;
+	}
+	return (0);
+}
+
+/*
+ * Check whether the response ring can take the response to another
+ * request. If not, ask the client to wake us up when it has read some.
+ */
+static int
+shm_can_respond(struct shm_peer *peer)
+{
+	struct snmp_shm_ring *r = &peer->shm->resp;
+
+	if (shm_flush(peer) == 0 && snmp_shm_space(r) >= SNMP_SHM_RESERVE)
+		return (1);
+	snmp_shm_wait(r);
+	return (shm_flush(peer) == 0 && snmp_shm_space(r) >= SNMP_SHM_RESERVE);
+}
+
+/*
+ * Put a response into the response ring of the peer. Responses are
+ * never larger than SNMP_SHM_MSGSIZE. If the ring is full, because the
+ * response was delayed and the client has not read the earlier ones
+ * yet, the response is held back until the client has made space.
+ */
+static ssize_t
+shm_output(struct port_input *pi, const struct iovec *iov, u_int iovcnt)
+{
+	struct shm_peer *peer = (struct shm_peer *)pi;
+	struct shm_msg *m;
+	size_t len;
+	u_int i;
+
+	for (len = 0, i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len > SNMP_SHM_MSGSIZE) {
+		errno = EMSGSIZE;
+		return (-1);
+	}
+	if (STAILQ_EMPTY(&peer->outq) &&
+	    snmp_shm_putv(&peer->shm->resp, iov, iovcnt) == 0) {
+		peer->ring = 1;
+		shm_doorbell(peer);
+		return ((ssize_t)len);
+	}
+
+	if (peer->outqlen >= SHM_OUTQ_MAX ||
+	    (m = malloc(sizeof(*m) + len)) == NULL) {
+		errno = ENOBUFS;
+		return (-1);
+	}
+	for (m->len = 0, i = 0; i < iovcnt; i++) {
+		memcpy(m->data + m->len, iov[i].iov_base, iov[i].iov_len);
+		m->len += iov[i].iov_len;
+	}
+	STAILQ_INSERT_TAIL(&peer->outq, m, link);
+	peer->outqlen++;
+
+	/* the client may have made space in the meantime */
+	(void)shm_can_respond(peer);
+	shm_doorbell(peer);
+	return ((ssize_t)len);
+}
+
+/*
+ * The client has rung the doorbell. Process the requests in the ring
+ * as long as there is space for their responses. The client rings
+ * again when it has read responses and we wait for space. When the
+ * ring is empty, tell the client to ring for the next request and look
+ * once more, because it may have put one in before it saw the flag.
+ */
+static void
+shm_input(int fd, void *udata)
+{
+	struct shm_peer *peer = udata;
+	struct shm_port *p = peer->port;
+	u_char bell[64];
+	ssize_t len;
+	int asleep = 0;
+
+	len = recv(fd, bell, sizeof(bell), MSG_DONTWAIT);
+	if (len == 0 || (len == -1 && errno != EAGAIN)) {
+		shm_peer_close(peer);
+		return;
+	}
+
+	peer->busy = 1;
+	while (shm_can_respond(peer)) {
+		len = snmp_shm_get(&peer->shm->req, peer->input.buf,
+		    peer->input.buflen);
+		if (len == 0) {
+			if (asleep)
+				break;
+			snmp_shm_sleep(&peer->shm->req);
+			asleep = 1;
+			continue;
+		}
+		if (asleep) {
+			snmp_shm_awake(&peer->shm->req);
+			asleep = 0;
+		}
+		if (len == -1) {
+			syslog(LOG_WARNING, "%s: bad request ring", p->name);
+			shm_peer_close(peer);
+			return;
+		}
+		peer->input.start = 0;
+		peer->input.length = (size_t)len;
+		if (snmpd_input_process(&peer->input, &p->tport) == -1) {
+			shm_peer_close(peer);
+			return;
+		}
+		/* each message must contain exactly one PDU */
+		peer->input.start = 0;
+		peer->input.length = 0;
+	}
+	peer->busy = 0;
+
+	shm_doorbell(peer);
+}
+
+/*
+ * Check whether the peer is root
+ */
+static int
+shm_peer_priv(int fd)
+{
+	struct xucred ucred;
+	socklen_t ucredlen;
+
+	ucredlen = sizeof(ucred);
+	return (getsockopt(fd, 0, LOCAL_PEERCRED, &ucred, &ucredlen) == 0 &&
+	    ucredlen >= sizeof(ucred) && ucred.cr_version == XUCRED_VERSION &&
+	    ucred.cr_uid == 0);
+}
+
+/*
+ * Create an anonymous shared memory object for the rings and map it.
+ * Return the descriptor of the object. If the system supports it, the
+ * size of the object is sealed, so that the client cannot shrink it.
+ */
+static int
+shm_segment(struct snmp_shm **shmp)
+{
+	char name[64];
+	void *ptr;
+	int fd;
+
+#if defined(F_ADD_SEALS)
+	strcpy(name, "bsnmpd");
+	if ((fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) {
+		syslog(LOG_ERR, "memfd_create: %m");
+		return (-1);
+	}
+#else
+	static u_int serial;
+
+	snprintf(name, sizeof(name), "/bsnmpd.%ld.%u", (long)getpid(),
+	    serial++);
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1) {
+		syslog(LOG_ERR, "shm_open(%s): %m", name);
+		return (-1);
+	}
+	(void)shm_unlink(name);
+#endif
+
+	if (ftruncate(fd, sizeof(struct snmp_shm)) == -1) {
+		syslog(LOG_ERR, "ftruncate(%s): %m", name);
+		(void)close(fd);
+		return (-1);
+	}
+#if defined(F_ADD_SEALS)
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+	    F_SEAL_SEAL) == -1) {
+		syslog(LOG_ERR, "F_ADD_SEALS(%s): %m", name);
+		(void)close(fd);
+		return (-1);
+	}
+#endif
+	ptr = mmap(NULL, sizeof(struct snmp_shm), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		syslog(LOG_ERR, "mmap(%s): %m", name);
+		(void)close(fd);
+		return (-1);
+	}
+	/* the client must ring for its first request */
+	((struct snmp_shm *)ptr)->req.sleeping = 1;
+	*shmp = ptr;
+	return (fd);
+}
+
+/*
+ * Send the descriptor of the shared memory to the client
+ */
+static int
+shm_pass_fd(int sock, int fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		struct cmsghdr	hdr;
+		u_char		buf[CMSG_SPACE(sizeof(int))];
+	} cmsg;
+	u_char byte = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsg, 0, sizeof(cmsg));
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &cmsg;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int));
+
+	cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg.hdr.cmsg_level = SOL_SOCKET;
+	cmsg.hdr.cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(&cmsg.hdr), &fd, sizeof(int));
+
+	return (sendmsg(sock, &msg, 0) == 1 ? 0 : -1);
+}
+
+/*
+ * A client connects. Create its rings and hand them over.
+ */
+static void
+shm_listen_input(int fd, void *udata)
+{
+	struct shm_port *p = udata;
+	struct shm_peer *peer;
+	int shmfd;
+
+	if ((peer = malloc(sizeof(*peer))) == NULL) {
+		syslog(LOG_WARNING, "%s: peer malloc failed", p->name);
+		(void)close(accept(fd, NULL, NULL));
+		return;
+	}
+	memset(peer, 0, sizeof(*peer));
+
+	peer->port = p;
+	STAILQ_INIT(&peer->outq);
+
+	peer->input.stream = 1;
+	peer->input.cred = 1;
+	peer->input.peerlen = sizeof(peer->peer);
+	peer->input.peer = (struct sockaddr *)&peer->peer;
+	peer->input.output = shm_output;
+	peer->input.maxmsg = SNMP_SHM_MSGSIZE;
+
+	peer->input.fd = accept(fd, peer->input.peer, &peer->input.peerlen);
+	if (peer->input.fd == -1) {
+		syslog(LOG_WARNING, "%s: accept failed: %m", p->name);
+		free(peer);
+		return;
+	}
+	peer->input.priv = shm_peer_priv(peer->input.fd);
+	peer->input.peerpriv = peer->input.priv;
+	peer->input.peercred = 1;
+
+	peer->input.buflen = SNMP_SHM_MSGSIZE;
+	if ((peer->input.buf = malloc(peer->input.buflen)) == NULL) {
+		syslog(LOG_WARNING, "%s: buffer malloc failed", p->name);
+		(void)close(peer->input.fd);
+		free(peer);
+		return;
+	}
+
+	if ((shmfd = shm_segment(&peer->shm)) == -1) {
+		snmpd_input_close(&peer->input);
+		free(peer);
+		return;
+	}
+	if (shm_pass_fd(peer->input.fd, shmfd) == -1) {
+		syslog(LOG_WARNING, "%s: cannot pass descriptor: %m", p->name);
+		(void)close(shmfd);
+		(void)munmap(peer->shm, sizeof(*peer->shm));
+		snmpd_input_close(&peer->input);
+		free(peer);
+		return;
+	}
+	(void)close(shmfd);
+
+	if ((peer->input.id = fd_select(peer->input.fd, shm_input,
+	    peer, NULL)) == NULL) {
+		(void)munmap(peer->shm, sizeof(*peer->shm));
+		snmpd_input_close(&peer->input);
+		free(peer);
+		return;
+	}
+
+	LIST_INSERT_HEAD(&p->peers, peer, link);
+}
+
+/*
+ * Create the listening socket
+ */
+static int
+shm_init_port(struct tport *tp)
+{
+	struct shm_port *p = (struct shm_port *)tp;
+	struct sockaddr_un sa;
+
+	if ((p->sock = socket(PF_LOCAL, SOCK_STREAM, 0)) < 0) {
+		syslog(LOG_ERR, "creating local socket: %m");
+		return (SNMP_ERR_RES_UNAVAIL);
+	}
+
+	strcpy(sa.sun_path, p->name);
+	sa.sun_family = AF_LOCAL;
+	sa.sun_len = strlen(p->name) +
+	    offsetof(struct sockaddr_un, sun_path);
+
+	(void)remove(p->name);
+
+	if (bind(p->sock, (struct sockaddr *)&sa, sizeof(sa))) {
+		if (errno == EADDRNOTAVAIL) {
+			close(p->sock);
+			p->sock = -1;
+			return (SNMP_ERR_INCONS_NAME);
+		}
+		syslog(LOG_ERR, "bind: %s %m", p->name);
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	if (chmod(p->name, SHM_SOCK_MODE) == -1)
+		syslog(LOG_WARNING, "chmod(%s,%o): %m", p->name,
+		    SHM_SOCK_MODE);
+
+	if (listen(p->sock, 10) == -1) {
+		syslog(LOG_ERR, "listen: %s %m", p->name);
+		(void)remove(p->name);
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+
+	p->id = fd_select(p->sock, shm_listen_input, p, NULL);
+	if (p->id == NULL) {
+		(void)remove(p->name);
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	return (SNMP_ERR_NOERROR);
+}
+
+/*
+ * Find a peer by its address. Clients that have not bound their socket
+ * to a name all have the same address and cannot be told apart, so they
+ * cannot be reached this way.
+ */
+static struct shm_peer *
+shm_peer_find(struct shm_port *p, const struct sockaddr *addr,
+    size_t addrlen)
+{
+	struct shm_peer *peer;
+	const struct sockaddr_un *sun = (const struct sockaddr_un *)addr;
+
+	if (addrlen <= offsetof(struct sockaddr_un, sun_path) ||
+	    sun->sun_path[0] == '\0') {
+		errno = EDESTADDRREQ;
+		return (NULL);
+	}
+	LIST_FOREACH(peer, &p->peers, link)
+		if (peer->input.peerlen == addrlen &&
+		    memcmp(peer->input.peer, addr, addrlen) == 0)
+			return (peer);
+	errno = ENOTCONN;
+	return (NULL);
+}
+
+/*
+ * Send something to a peer
+ */
+static ssize_t
+shm_send(struct tport *tp, const u_char *buf, size_t len,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)(uintptr_t)buf;
+	iov.iov_len = len;
+	return (shm_sendv(tp, &iov, 1, addr, addrlen));
+}
+
+/*
+ * Send a message that is scattered over several buffers
+ */
+static ssize_t
+shm_sendv(struct tport *tp, const struct iovec *iov, u_int iovcnt,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct shm_peer *peer;
+
+	if ((peer = shm_peer_find((struct shm_port *)tp, addr,
+	    addrlen)) == NULL)
+		return (-1);
+	return (shm_output(&peer->input, iov, iovcnt));
+}
+
+/*
+ * Dependency to create a shared memory port
+ */
+struct shm_dep {
+	struct snmp_dependency dep;
+
+	/* index (path name) */
+	u_char *path;
+	size_t pathlen;
+
+	/* the port */
+	struct shm_port *port;
+
+	/* which of the fields are set */
+	u_int set;
+
+	/* status */
+	int status;
+};
+#define	SD_STATUS	0x01
+#define	SD_CREATE	0x02	/* rollback create */
+#define	SD_DELETE	0x04	/* rollback delete */
+
+/*
+ * dependency handler for shared memory ports
+ */
+static int
+shm_func(struct snmp_context *ctx, struct snmp_dependency *dep,
+    enum snmp_depop op)
+{
+	struct shm_dep *sd = (struct shm_dep *)(void *)dep;
+	int err = SNMP_ERR_NOERROR;
+
+	switch (op) {
+
+	  case SNMP_DEPOP_COMMIT:
+		if (!(sd->set & SD_STATUS))
+			err = SNMP_ERR_BADVALUE;
+		else if (sd->port == NULL) {
+			if (!sd->status)
+				err = SNMP_ERR_BADVALUE;
+
+			else {
+				/* create */
+				err = shm_open_port(sd->path, sd->pathlen,
+				    &sd->port);
+				if (err == SNMP_ERR_NOERROR)
+					sd->set |= SD_CREATE;
+			}
+		} else if (!sd->status) {
+			/* delete - hard to roll back so defer to finalizer */
+			sd->set |= SD_DELETE;
+		}
+		return (err);
+
+	  case SNMP_DEPOP_ROLLBACK:
+		if (sd->set & SD_CREATE) {
+			/* was create */
+			shm_close_port(&sd->port->tport);
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_DEPOP_FINISH:
+		if ((sd->set & SD_DELETE) && ctx->code == SNMP_RET_OK)
+			shm_close_port(&sd->port->tport);
+		free(sd->path);
+		return (SNMP_ERR_NOERROR);
+	}
+	abort();
+}
+
+/*
+ * Shared memory port table
+ */
+int
+op_shm_port(struct snmp_context *ctx, struct snmp_value *value,
+    u_int sub, u_int iidx, enum snmp_op op)
+{
+	asn_subid_t which = value->var.subs[sub-1];
+	struct shm_port *p;
+	u_char *name;
+	size_t namelen;
+	struct shm_dep *sd;
+	struct asn_oid didx;
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		if ((p = (struct shm_port *)trans_next_port(my_trans,
+		    &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		index_append(&value->var, sub, &p->tport.index);
+		break;
+
+	  case SNMP_OP_GET:
+		if ((p = (struct shm_port *)trans_find_port(my_trans,
+		    &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		break;
+
+	  case SNMP_OP_SET:
+		p = (struct shm_port *)trans_find_port(my_trans,
+		    &value->var, sub);
+
+		if (index_decode(&value->var, sub, iidx, &name, &namelen))
+			return (SNMP_ERR_NO_CREATION);
+
+		asn_slice_oid(&didx, &value->var, sub, value->var.len);
+		if ((sd = (struct shm_dep *)(void *)snmp_dep_lookup(ctx,
+		    &oid_begemotSnmpdShmPortTable, &didx, sizeof(*sd),
+		    shm_func)) == NULL) {
+			free(name);
+			return (SNMP_ERR_GENERR);
+		}
+
+		if (sd->path == NULL) {
+			sd->path = name;
+			sd->pathlen = namelen;
+		} else {
+			free(name);
+		}
+		sd->port = p;
+
+		switch (which) {
+
+		  case LEAF_begemotSnmpdShmPortStatus:
+			if (sd->set & SD_STATUS)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (!TRUTH_OK(value->v.integer))
+				return (SNMP_ERR_WRONG_VALUE);
+
+			sd->status = TRUTH_GET(value->v.integer);
+			sd->set |= SD_STATUS;
+			break;
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_ROLLBACK:
+	  case SNMP_OP_COMMIT:
+		return (SNMP_ERR_NOERROR);
+
+	  default:
+		abort();
+	}
+
+	/*
+	 * Come here to fetch the value
+	 */
+	switch (which) {
+
+	  case LEAF_begemotSnmpdShmPortStatus:
+		value->v.integer = 1;
+		break;
+
+	  default:
+		abort();
+	}
+
+	return (SNMP_ERR_NOERROR);
+}
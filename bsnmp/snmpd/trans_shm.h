@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * Shared memory transport
+ */
+
+/* a response that did not fit into the ring */
+struct shm_msg {
+	STAILQ_ENTRY(shm_msg) link;
+	size_t		len;
+	u_char		data[];
+};
+
+struct shm_peer {
+	struct port_input input;	/* must begin with this */
+	LIST_ENTRY(shm_peer) link;
+	struct sockaddr_un peer;
+	struct shm_port	*port;		/* parent port */
+	struct snmp_shm	*shm;		/* mapped rings */
+	int		ring;		/* need to wake up client */
+	int		busy;		/* in shm_input */
+	STAILQ_HEAD(, shm_msg) outq;	/* waiting for ring space */
+	u_int		outqlen;
+};
+
+struct shm_port {
+	struct tport	tport;		/* must begin with this */
+
+	char		*name;		/* unix path name */
+
+	int		sock;		/* listening socket */
+	void		*id;		/* select handle */
+
+	LIST_HEAD(, shm_peer) peers;
+};
+
+extern const struct transport_def shm_trans;
@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * TCP transport (RFC 3430)
+ *
+ * Each accepted connection gets its own peer with a stream input buffer.
+ * Connections are persistent and a client may have several requests
+ * outstanding; they are executed and answered in the order received.
+ *
+ * The sockets are non-blocking. Responses the socket does not take are
+ * queued and written when the socket becomes writable; until then no
+ * more requests are read from the connection. A client that lets the
+ * queue grow beyond TCP_OUTQ_MAX or makes no progress for TCP_IDLE is
+ * disconnected. At most TCP_MAXCONN connections are accepted per port.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <syslog.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "snmpmod.h"
+#include "snmpd.h"
+#include "trans_tcp.h"
+#include "tree.h"
+#include "oid.h"
+
+#define	TCP_MAXCONN	64		/* connections per port */
+#define	TCP_OUTQ_MAX	(256 * 1024)	/* queued response bytes */
+#define	TCP_IDLE	(300 * 100)	/* idle timeout in ticks */
+#define	TCP_IDLE_CHECK	(10 * 100)	/* check interval */
+
+static int tcp_start(void);
+static int tcp_stop(int);
+static void tcp_close_port(struct tport *);
+static int tcp_init_port(struct tport *);
+static ssize_t tcp_send(struct tport *, const u_char *, size_t,
+    const struct sockaddr *, size_t);
+static ssize_t tcp_sendv(struct tport *, const struct iovec *, u_int,
+    const struct sockaddr *, size_t);
+
+/* exported */
+const struct transport_def tcp_trans = {
+	"tcp",
+	OIDX_begemotSnmpdTransTcp,
+	tcp_start,
+	tcp_stop,
+	tcp_close_port,
+	tcp_init_port,
+	tcp_send,
+	tcp_sendv
+};
+static struct transport *my_trans;
+
+static int
+tcp_start(void)
+{
+	return (trans_register(&tcp_trans, &my_trans));
+}
+
+static int
+tcp_stop(int force)
+{
+
+	if (my_trans != NULL) {
+		if (!force && trans_first_port(my_trans) != NULL)
+			return (SNMP_ERR_GENERR);
+		return (trans_unregister(my_trans));
+	}
+	return (SNMP_ERR_NOERROR);
+}
+
+/*
+ * Close a connection
+ */
+static void
+tcp_peer_close(struct tcp_peer *peer)
+{
+	struct tcp_port *p = peer->port;
+
+	LIST_REMOVE(peer, link);
+	if (p->npeers-- == TCP_MAXCONN)
+		p->full = 0;
+	if (peer->oid != NULL)
+		fd_deselect(peer->oid);
+	snmpd_input_close(&peer->input);
+	free(peer->obuf);
+	free(peer);
+}
+
+/*
+ * The socket of a connection with queued responses is writable
+ */
+static void
+tcp_output_ready(int fd, void *udata)
+{
+	struct tcp_peer *peer = udata;
+	ssize_t n;
+
+	n = send(fd, peer->obuf, peer->olen, MSG_NOSIGNAL);
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		tcp_peer_close(peer);
+		return;
+	}
+	peer->last = get_ticks();
+	peer->olen -= n;
+	memmove(peer->obuf, peer->obuf + n, peer->olen);
+	if (peer->olen > 0)
+		return;
+
+	/* all written - read requests again */
+	fd_deselect(peer->oid);
+	peer->oid = NULL;
+	if (fd_resume(peer->input.id) == -1)
+		tcp_peer_close(peer);
+}
+
+/*
+ * Write a response to a connection. The socket is connected, so don't
+ * give an address to the kernel. What the socket does not take is
+ * queued; the caller sees the response as written.
+ */
+static ssize_t
+tcp_output(struct port_input *pi, const struct iovec *iov, u_int iovcnt)
+{
+	struct tcp_peer *peer = (struct tcp_peer *)pi;
+	struct msghdr msg;
+	size_t len, done, skip;
+	ssize_t n;
+	u_char *obuf;
+	u_int i;
+
+	for (len = 0, i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	done = 0;
+	if (peer->olen == 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+		msg.msg_iovlen = iovcnt;
+
+		n = sendmsg(pi->fd, &msg, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno != EAGAIN && errno != EINTR)
+				return (-1);
+			n = 0;
+		}
+		if ((size_t)n == len)
+			return ((ssize_t)len);
+		done = n;
+	}
+
+	if (peer->olen + len - done > TCP_OUTQ_MAX) {
+		errno = ENOBUFS;
+		return (done > 0 ? (ssize_t)done : -1);
+	}
+	if ((obuf = realloc(peer->obuf, peer->olen + len - done)) == NULL)
+		return (done > 0 ? (ssize_t)done : -1);
+	peer->obuf = obuf;
+	for (skip = done, i = 0; i < iovcnt; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		memcpy(peer->obuf + peer->olen,
+		    (const u_char *)iov[i].iov_base + skip,
+		    iov[i].iov_len - skip);
+		peer->olen += iov[i].iov_len - skip;
+		skip = 0;
+	}
+
+	if (peer->oid == NULL) {
+		if ((peer->oid = fd_select_out(pi->fd, tcp_output_ready,
+		    peer, NULL)) == NULL) {
+			peer->olen -= len - done;
+			return (done > 0 ? (ssize_t)done : -1);
+		}
+		/* don't take more requests until the client reads */
+		fd_suspend(pi->id);
+	}
+	return ((ssize_t)len);
+}
+
+/*
+ * Input on a connection. All complete messages in the buffer are
+ * executed by snmpd_input.
+ */
+static void
+tcp_input(int fd __unused, void *udata)
+{
+	struct tcp_peer *peer = udata;
+
+	peer->last = get_ticks();
+	if (snmpd_input(&peer->input, &peer->port->tport) == -1)
+		/* connection closed, framing or other input error */
+		tcp_peer_close(peer);
+}
+
+/*
+ * Close connections that have neither sent a request nor read a
+ * response for some time.
+ */
+static void
+tcp_idle_check(void *arg)
+{
+	struct tcp_port *p = arg;
+	struct tcp_peer *peer, *peer1;
+	uint64_t now = get_ticks();
+
+	for (peer = LIST_FIRST(&p->peers); peer != NULL; peer = peer1) {
+		peer1 = LIST_NEXT(peer, link);
+		if (now - peer->last >= TCP_IDLE)
+			tcp_peer_close(peer);
+	}
+}
+
+/*
+ * The listening socket is ready. Accept the new connection.
+ */
+static void
+tcp_listen_input(int fd, void *udata)
+{
+	struct tcp_port *p = udata;
+	struct tcp_peer *peer;
+	int on, s;
+
+	if (p->npeers >= TCP_MAXCONN) {
+		/* take it off the queue, otherwise we are called again */
+		if ((s = accept(fd, NULL, NULL)) != -1)
+			(void)close(s);
+		if (!p->full)
+			syslog(LOG_WARNING, "tcp: %u connections on port %u, "
+			    "rejecting new ones", p->npeers, p->port);
+		p->full = 1;
+		return;
+	}
+
+	if ((peer = malloc(sizeof(*peer))) == NULL) {
+		syslog(LOG_WARNING, "tcp: peer malloc failed");
+		(void)close(accept(fd, NULL, NULL));
+		return;
+	}
+	memset(peer, 0, sizeof(*peer));
+
+	peer->port = p;
+
+	peer->input.stream = 1;
+	peer->input.cred = 0;
+	peer->input.output = tcp_output;
+	peer->input.peerlen = sizeof(peer->peer);
+	peer->input.peer = (struct sockaddr *)&peer->peer;
+
+	peer->input.fd = accept(fd, peer->input.peer, &peer->input.peerlen);
+	if (peer->input.fd == -1) {
+		syslog(LOG_WARNING, "tcp: accept failed: %m");
+		free(peer);
+		return;
+	}
+
+	/* responses are written in one piece - don't delay them */
+	on = 1;
+	if (setsockopt(peer->input.fd, IPPROTO_TCP, TCP_NODELAY,
+	    &on, sizeof(on)) == -1)
+		syslog(LOG_WARNING, "setsockopt(TCP_NODELAY): %m");
+
+	/* a peer that does not read must never block the daemon */
+	if (fcntl(peer->input.fd, F_SETFL, O_NONBLOCK) == -1) {
+		syslog(LOG_WARNING, "tcp: fcntl(O_NONBLOCK): %m");
+		close(peer->input.fd);
+		free(peer);
+		return;
+	}
+
+	if ((peer->input.id = fd_select(peer->input.fd, tcp_input,
+	    peer, NULL)) == NULL) {
+		close(peer->input.fd);
+		free(peer);
+		return;
+	}
+
+	peer->last = get_ticks();
+	LIST_INSERT_HEAD(&p->peers, peer, link);
+	p->npeers++;
+}
+
+/*
+ * Create a TCP socket, bind it to the given port and listen on it
+ */
+static int
+tcp_init_port(struct tport *tp)
+{
+	struct tcp_port *p = (struct tcp_port *)tp;
+	struct sockaddr_in addr;
+	u_int32_t ip;
+	int on;
+
+	if ((p->sock = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+		syslog(LOG_ERR, "creating TCP socket: %m");
+		return (SNMP_ERR_RES_UNAVAIL);
+	}
+	on = 1;
+	if (setsockopt(p->sock, SOL_SOCKET, SO_REUSEADDR,
+	    &on, sizeof(on)) == -1)
+		syslog(LOG_WARNING, "setsockopt(SO_REUSEADDR): %m");
+
+	ip = (p->addr[0] << 24) | (p->addr[1] << 16) | (p->addr[2] << 8) |
+	    p->addr[3];
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_addr.s_addr = htonl(ip);
+	addr.sin_port = htons(p->port);
+	addr.sin_family = AF_INET;
+	addr.sin_len = sizeof(addr);
+	if (bind(p->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		if (errno == EADDRNOTAVAIL) {
+			close(p->sock);
+			p->sock = -1;
+			return (SNMP_ERR_INCONS_NAME);
+		}
+		syslog(LOG_ERR, "bind: %s:%u %m", inet_ntoa(addr.sin_addr),
+		    p->port);
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	if (listen(p->sock, SOMAXCONN) == -1) {
+		syslog(LOG_ERR, "listen: %s:%u %m", inet_ntoa(addr.sin_addr),
+		    p->port);
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	if ((p->id = fd_select(p->sock, tcp_listen_input, p, NULL)) == NULL) {
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	if ((p->idle = timer_start_repeat(TCP_IDLE_CHECK, TCP_IDLE_CHECK,
+	    tcp_idle_check, p, NULL)) == NULL) {
+		fd_deselect(p->id);
+		p->id = NULL;
+		close(p->sock);
+		p->sock = -1;
+		return (SNMP_ERR_GENERR);
+	}
+	return (SNMP_ERR_NOERROR);
+}
+
+/*
+ * Create a new TCP port object and start it, if we are not
+ * in initialization mode. The arguments are in host byte order.
+ */
+static int
+tcp_open_port(u_int8_t *addr, u_int32_t tcp_port, struct tcp_port **pp)
+{
+	struct tcp_port *port;
+	int err;
+
+	if (tcp_port > 0xffff)
+		return (SNMP_ERR_NO_CREATION);
+	if ((port = malloc(sizeof(*port))) == NULL)
+		return (SNMP_ERR_GENERR);
+	memset(port, 0, sizeof(*port));
+
+	/* initialize common part */
+	port->tport.index.len = 5;
+	port->tport.index.subs[0] = addr[0];
+	port->tport.index.subs[1] = addr[1];
+	port->tport.index.subs[2] = addr[2];
+	port->tport.index.subs[3] = addr[3];
+	port->tport.index.subs[4] = tcp_port;
+
+	port->addr[0] = addr[0];
+	port->addr[1] = addr[1];
+	port->addr[2] = addr[2];
+	port->addr[3] = addr[3];
+	port->port = tcp_port;
+
+	port->sock = -1;
+	LIST_INIT(&port->peers);
+
+	trans_insert_port(my_trans, &port->tport);
+
+	if (community != COMM_INITIALIZE &&
+	    (err = tcp_init_port(&port->tport)) != SNMP_ERR_NOERROR) {
+		tcp_close_port(&port->tport);
+		return (err);
+	}
+	*pp = port;
+	return (SNMP_ERR_NOERROR);
+}
+
+/*
+ * Close a TCP port and all its connections
+ */
+static void
+tcp_close_port(struct tport *tp)
+{
+	struct tcp_port *port = (struct tcp_port *)tp;
+	struct tcp_peer *peer;
+
+	if (port->idle != NULL)
+		timer_stop(port->idle);
+	if (port->id != NULL)
+		fd_deselect(port->id);
+	if (port->sock >= 0)
+		(void)close(port->sock);
+
+	trans_remove_port(tp);
+
+	while ((peer = LIST_FIRST(&port->peers)) != NULL)
+		tcp_peer_close(peer);
+
+	free(port);
+}
+
+/*
+ * Find the connection to send to
+ */
+static struct tcp_peer *
+tcp_peer_find(struct tcp_port *p, const struct sockaddr *addr, size_t addrlen)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+	struct tcp_peer *peer;
+
+	if (addrlen >= sizeof(*sin))
+		LIST_FOREACH(peer, &p->peers, link)
+			if (peer->peer.sin_addr.s_addr ==
+			    sin->sin_addr.s_addr &&
+			    peer->peer.sin_port == sin->sin_port)
+				return (peer);
+	errno = ENOTCONN;
+	return (NULL);
+}
+
+/*
+ * Send something
+ */
+static ssize_t
+tcp_send(struct tport *tp, const u_char *buf, size_t len,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)(uintptr_t)buf;
+	iov.iov_len = len;
+	return (tcp_sendv(tp, &iov, 1, addr, addrlen));
+}
+
+/*
+ * Send a message that is scattered over several buffers
+ */
+static ssize_t
+tcp_sendv(struct tport *tp, const struct iovec *iov, u_int iovcnt,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct tcp_peer *peer;
+
+	if ((peer = tcp_peer_find((struct tcp_port *)tp, addr,
+	    addrlen)) == NULL)
+		return (-1);
+
+	return (tcp_output(&peer->input, iov, iovcnt));
+}
+
+/*
+ * TCP port table
+ */
+int
+op_tcp_port(struct snmp_context *ctx, struct snmp_value *value,
+    u_int sub, u_int iidx, enum snmp_op op)
+{
+	asn_subid_t which = value->var.subs[sub-1];
+	struct tcp_port *p;
+	u_int8_t addr[4];
+	u_int32_t port;
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		if ((p = (struct tcp_port *)trans_next_port(my_trans,
+		    &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		index_append(&value->var, sub, &p->tport.index);
+		break;
+
+	  case SNMP_OP_GET:
+		if ((p = (struct tcp_port *)trans_find_port(my_trans,
+		    &value->var, sub)) == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		break;
+
+	  case SNMP_OP_SET:
+		p = (struct tcp_port *)trans_find_port(my_trans,
+		    &value->var, sub);
+		ctx->scratch->int1 = (p != NULL);
+
+		if (which != LEAF_begemotSnmpdTcpPortStatus)
+			abort();
+		if (!TRUTH_OK(value->v.integer))
+			return (SNMP_ERR_WRONG_VALUE);
+
+		ctx->scratch->int2 = TRUTH_GET(value->v.integer);
+
+		if (ctx->scratch->int2) {
+			/* open a TCP port */
+			if (p != NULL)
+				/* already open - do nothing */
+				return (SNMP_ERR_NOERROR);
+
+			if (index_decode(&value->var, sub, iidx, addr, &port))
+				return (SNMP_ERR_NO_CREATION);
+			return (tcp_open_port(addr, port, &p));
+
+		} else {
+			/* close TCP port - do in commit */
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_ROLLBACK:
+		p = (struct tcp_port *)trans_find_port(my_trans,
+		    &value->var, sub);
+		if (ctx->scratch->int1 == 0) {
+			/* did not exist */
+			if (ctx->scratch->int2 == 1) {
+				/* created */
+				if (p != NULL)
+					tcp_close_port(&p->tport);
+			}
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_COMMIT:
+		p = (struct tcp_port *)trans_find_port(my_trans,
+		    &value->var, sub);
+		if (ctx->scratch->int1 == 1) {
+			/* did exist */
+			if (ctx->scratch->int2 == 0) {
+				/* delete */
+				if (p != NULL)
+					tcp_close_port(&p->tport);
+			}
+		}
+		return (SNMP_ERR_NOERROR);
+
+	  default:
+		abort();
+	}
+
+	/*
+	 * Come here to fetch the value
+	 */
+	switch (which) {
+
+	  case LEAF_begemotSnmpdTcpPortStatus:
+		value->v.integer = 1;
+		break;
+
+	  default:
+		abort();
+	}
+
+	return (SNMP_ERR_NOERROR);
+}
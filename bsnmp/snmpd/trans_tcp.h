@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Begemot$
+ *
+ * TCP transport (RFC 3430)
+ */
+
+struct tcp_peer {
+	struct port_input input;	/* must begin with this */
+	LIST_ENTRY(tcp_peer) link;
+	struct sockaddr_in peer;
+	struct tcp_port	*port;		/* parent port */
+	uint64_t	last;		/* time of last progress */
+
+	/* responses the socket did not take yet */
+	u_char		*obuf;
+	size_t		olen;
+	void		*oid;		/* select handle for writing */
+};
+
+struct tcp_port {
+	struct tport	tport;		/* must begin with this */
+
+	uint8_t		addr[4];	/* host byteorder */
+	uint16_t	port;		/* host byteorder */
+
+	int		sock;		/* listening socket */
+	void		*id;		/* select handle */
+	void		*idle;		/* idle check timer */
+
+	LIST_HEAD(, tcp_peer) peers;
+	u_int		npeers;
+	int		full;		/* rejecting connections */
+};
+
+extern const struct transport_def tcp_trans;
@@ -31,6 +31,8 @@
  * UDP transport
  */
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <stdlib.h>
 #include <syslog.h>
@@ -40,6 +42,9 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
 
 #include "snmpmod.h"
 #include "snmpd.h"
@@ -53,6 +58,8 @@ static void udp_close_port(struct tport *);
 static int udp_init_port(struct tport *);
 static ssize_t udp_send(struct tport *, const u_char *, size_t,
     const struct sockaddr *, size_t);
+static ssize_t udp_sendv(struct tport *, const struct iovec *, u_int,
+    const struct sockaddr *, size_t);
 
 /* exported */
 const struct transport_def udp_trans = {
@@ -62,10 +69,196 @@ const struct transport_def udp_trans = {
 	udp_stop,
 	udp_close_port,
 	udp_init_port,
-	udp_send
+	udp_send,
+	udp_sendv
 };
 static struct transport *my_trans;
 
+#if defined(SO_ATTACH_FILTER)
+/*
+ * Socket filter for the UDP ports. The filter sees the UDP header
+ * in front of the message.
+ */
+#define	UF_MSG		8
+
+static struct sock_filter *uf_prog;
+static u_int uf_len;
+
+#define	UF_STMT(C, K) do {						\
+	struct sock_filter _i = BPF_STMT((C), (K));			\
+	prog[n++] = _i;							\
+    } while (0)
+#define	UF_JUMP(C, K, T, F) do {					\
+	struct sock_filter _i = BPF_JUMP((C), (K), (T), (F));		\
+	prog[n++] = _i;							\
+    } while (0)
+
+/*
+ * Emit the comparison of a community string with the one in the packet.
+ * The index register points to the version field. Returns the number
+ * of instructions.
+ */
+static u_int
+udp_filter_comm(struct sock_filter *prog, const u_char *str, u_int len)
+{
+	u_int n = 0, off, skip;
+
+	/* instructions after the length check */
+	skip = 2 * (len / 4) + 2 * ((len % 4) / 2) + 2 * (len % 2) + 1;
+
+	UF_STMT(BPF_LD | BPF_B | BPF_IND, 4);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, len, 0, skip);
+	for (off = 0; off + 4 <= len; off += 4) {
+		skip -= 2;
+		UF_STMT(BPF_LD | BPF_W | BPF_IND, 5 + off);
+		UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		    ((u_int32_t)str[off] << 24) | (str[off + 1] << 16) |
+		    (str[off + 2] << 8) | str[off + 3], 0, skip);
+	}
+	if (len - off >= 2) {
+		skip -= 2;
+		UF_STMT(BPF_LD | BPF_H | BPF_IND, 5 + off);
+		UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		    (str[off] << 8) | str[off + 1], 0, skip);
+		off += 2;
+	}
+	if (off < len) {
+		skip -= 2;
+		UF_STMT(BPF_LD | BPF_B | BPF_IND, 5 + off);
+		UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, str[off], 0, skip);
+	}
+	UF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+	return (n);
+}
+
+/*
+ * Build the filter program. Mode 1 accepts only BER encoded SNMP
+ * messages with an enabled version, mode 2 also checks the community.
+ */
+static int
+udp_filter_build(u_int mode)
+{
+	struct sock_filter *prog;
+	struct community *c;
+	u_int n, ncomm, len;
+
+	free(uf_prog);
+	uf_prog = NULL;
+	uf_len = 0;
+	if (mode == 0)
+		return (0);
+
+	ncomm = 0;
+	if (mode == 2)
+		TAILQ_FOREACH(c, &community_list, link) {
+			if (c->string == NULL)
+				continue;
+			if (strlen((const char *)c->string) >= 0x80) {
+				/* needs a long length - don't check */
+				mode = 1;
+				break;
+			}
+			ncomm++;
+		}
+
+	if ((prog = malloc((ncomm * 72 + 24) * sizeof(*prog))) == NULL)
+		return (-1);
+	n = 0;
+
+	/* SEQUENCE */
+	UF_STMT(BPF_LD | BPF_B | BPF_ABS, UF_MSG);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x30, 0, 14);
+	/* length - let X point to the version */
+	UF_STMT(BPF_LD | BPF_B | BPF_ABS, UF_MSG + 1);
+	UF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x80, 2, 0);
+	UF_STMT(BPF_LDX | BPF_W | BPF_IMM, UF_MSG + 2);
+	UF_JUMP(BPF_JMP | BPF_JA, 5, 0, 0);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x81, 0, 2);
+	UF_STMT(BPF_LDX | BPF_W | BPF_IMM, UF_MSG + 3);
+	UF_JUMP(BPF_JMP | BPF_JA, 2, 0, 0);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x82, 0, 6);
+	UF_STMT(BPF_LDX | BPF_W | BPF_IMM, UF_MSG + 4);
+	/* INTEGER version */
+	UF_STMT(BPF_LD | BPF_H | BPF_IND, 0);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0201, 0, 3);
+	UF_STMT(BPF_LD | BPF_B | BPF_IND, 2);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0,
+	    (snmpd.version_enable & VERS_ENABLE_V1) ? 2 : 1, 0);
+	UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1,
+	    (snmpd.version_enable & VERS_ENABLE_V2C) ? 1 : 0, 0);
+	UF_STMT(BPF_RET | BPF_K, 0);
+
+	if (mode == 1)
+		UF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	else {
+		/* OCTET STRING community */
+		UF_STMT(BPF_LD | BPF_B | BPF_IND, 3);
+		UF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x04, 1, 0);
+		UF_STMT(BPF_RET | BPF_K, 0);
+		TAILQ_FOREACH(c, &community_list, link)
+			if (c->string != NULL) {
+				len = strlen((const char *)c->string);
+				n += udp_filter_comm(prog + n, c->string, len);
+			}
+		UF_STMT(BPF_RET | BPF_K, 0);
+	}
+
+	uf_prog = prog;
+	uf_len = n;
+	return (0);
+}
+
+/*
+ * Attach the current filter to a port or remove the filter
+ */
+static int
+udp_filter_attach(struct tport *tp, intptr_t arg __unused)
+{
+	struct udp_port *p = (struct udp_port *)tp;
+	struct sock_fprog fprog;
+	int dummy = 0;
+
+	if (p->input.fd < 0)
+		return (-1);
+	if (uf_prog == NULL) {
+		(void)setsockopt(p->input.fd, SOL_SOCKET, SO_DETACH_FILTER,
+		    &dummy, sizeof(dummy));
+		return (-1);
+	}
+	fprog.len = uf_len;
+	fprog.filter = uf_prog;
+	if (setsockopt(p->input.fd, SOL_SOCKET, SO_ATTACH_FILTER,
+	    &fprog, sizeof(fprog)) == -1) {
+		/* don't leave an outdated filter in place */
+		syslog(LOG_WARNING, "SO_ATTACH_FILTER: %m");
+		(void)setsockopt(p->input.fd, SOL_SOCKET, SO_DETACH_FILTER,
+		    &dummy, sizeof(dummy));
+	}
+	return (-1);
+}
+#endif
+
+/*
+ * The filter settings, the enabled versions or the communities have
+ * changed. Rebuild the socket filter and attach it to all open ports.
+ * If the filter cannot be built the ports are left without a filter,
+ * because the old one may drop messages that are now acceptable.
+ */
+void
+udp_filter_update(void)
+{
+#if defined(SO_ATTACH_FILTER)
+	if (udp_filter_build(snmpd.udp_filter) == -1)
+		syslog(LOG_ERR, "udp filter: %m - filter removed");
+	if (my_trans != NULL)
+		(void)trans_iter_port(my_trans, udp_filter_attach, 0);
+#else
+	if (snmpd.udp_filter != 0)
+		syslog(LOG_WARNING, "socket filters not supported");
+#endif
+}
+
 static int
 udp_start(void)
 {
@@ -82,15 +275,24 @@ udp_stop(int force __unused)
 }
 
 /*
- * A UDP port is ready
+ * A UDP port is ready. Process up to input_batch datagrams that are
+ * already queued on the socket before returning to the event loop.
+ * The event loops (libbegemot's poll and eventlib) only report
+ * readiness and have no way to wait on a completion queue, so an
+ * io_uring style receive path would need its own loop. Draining the
+ * socket per wakeup is what can be done within them.
  */
 static void
 udp_input(int fd __unused, void *udata)
 {
 	struct udp_port *p = udata;
+	u_int n;
 
-	p->input.peerlen = sizeof(p->ret);
-	snmpd_input(&p->input, &p->tport);
+	for (n = 0; n < snmpd.input_batch; n++) {
+		p->input.peerlen = sizeof(p->ret);
+		if (snmpd_input(&p->input, &p->tport) == -1)
+			break;
+	}
 }
 
 /*
@@ -126,6 +328,10 @@ udp_init_port(struct tport *tp)
 		p->input.fd = -1;
 		return (SNMP_ERR_GENERR);
 	}
+#if defined(SO_ATTACH_FILTER)
+	if (uf_prog != NULL)
+		(void)udp_filter_attach(tp, 0);
+#endif
 	if ((p->input.id = fd_select(p->input.fd, udp_input,
 	    p, NULL)) == NULL) {
 		close(p->input.fd);
@@ -208,6 +414,25 @@ udp_send(struct tport *tp, const u_char *buf, size_t len,
 	return (sendto(p->input.fd, buf, len, 0, addr, addrlen));
 }
 
+/*
+ * Send a message that is scattered over several buffers
+ */
+static ssize_t
+udp_sendv(struct tport *tp, const struct iovec *iov, u_int iovcnt,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct udp_port *p = (struct udp_port *)tp;
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)(uintptr_t)addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+	msg.msg_iovlen = iovcnt;
+
+	return (sendmsg(p->input.fd, &msg, 0));
+}
+
 /*
  * Port table
  */
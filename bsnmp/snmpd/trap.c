@@ -32,6 +32,8 @@
  */
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +41,8 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -56,21 +60,49 @@ static const struct asn_oid oid_begemotTrapSinkTable =
 static const struct asn_oid oid_sysUpTime = OIDX_sysUpTime;
 static const struct asn_oid oid_snmpTrapOID = OIDX_snmpTrapOID;
 
+/* maximum number of messages sent to one sink per drain */
+#define	TRAP_BATCH	32
+
+/* drain timer, NULL if not running */
+static void *trap_timer;
+
+/* outstanding INFORMs ordered by retransmission time */
+static struct trapmsg **inform_heap;
+static u_int inform_heap_len;
+static u_int inform_heap_size;
+
+/* retransmission timer and its expiry */
+static void *inform_timer;
+static uint64_t inform_timer_due;
+
+static void trap_drain(void *);
+static void inform_input(int, void *);
+static void inform_timeout(void *);
+
 struct trapsink_dep {
 	struct snmp_dependency dep;
 	u_int	set;
 	u_int	status;
 	u_char	comm[SNMP_COMMUNITY_MAXLEN + 1];
 	u_int	version;
+	u_int	window;
+	u_int	timeout;
+	u_int	retries;
 	u_int	rb;
 	u_int	rb_status;
 	u_int	rb_version;
 	u_char	rb_comm[SNMP_COMMUNITY_MAXLEN + 1];
+	u_int	rb_window;
+	u_int	rb_timeout;
+	u_int	rb_retries;
 };
 enum {
 	TDEP_STATUS	= 0x0001,
 	TDEP_COMM	= 0x0002,
 	TDEP_VERSION	= 0x0004,
+	TDEP_WINDOW	= 0x0008,
+	TDEP_TIMEOUT	= 0x0010,
+	TDEP_RETRIES	= 0x0020,
 
 	TDEP_CREATE	= 0x0001,
 	TDEP_MODIFY	= 0x0002,
@@ -90,13 +122,27 @@ trapsink_create(struct trapsink_dep *tdep)
 	t->status = TRAPSINK_NOT_READY;
 	t->comm[0] = '\0';
 	t->version = TRAPSINK_V2;
+	STAILQ_INIT(&t->queue);
+	t->qlen = 0;
+	t->drops = 0;
+	STAILQ_INIT(&t->pending);
+	t->npending = 0;
+	t->inform_window = 8;
+	t->inform_timeout = 150;
+	t->inform_retries = 3;
+	t->inform_acked = 0;
+	t->inform_retried = 0;
+	t->inform_dropped = 0;
 
 	if ((t->socket = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
 		syslog(LOG_ERR, "socket(UDP): %m");
 		free(t);
 		return (SNMP_ERR_RES_UNAVAIL);
 	}
-	(void)shutdown(t->socket, SHUT_RD);
+
+	/* the queue is drained from the event loop - never block there */
+	if (fcntl(t->socket, F_SETFL, O_NONBLOCK) == -1)
+		syslog(LOG_WARNING, "fcntl(O_NONBLOCK): %m");
 
 	sa.sin_len = sizeof(sa);
 	sa.sin_family = AF_INET;
@@ -113,10 +159,23 @@ trapsink_create(struct trapsink_dep *tdep)
 		return (SNMP_ERR_GENERR);
 	}
 
+	/* responses to INFORMs; anything else is read away */
+	if ((t->fdid = fd_select(t->socket, inform_input, t, NULL)) == NULL) {
+		(void)close(t->socket);
+		free(t);
+		return (SNMP_ERR_GENERR);
+	}
+
 	if (tdep->set & TDEP_VERSION)
 		t->version = tdep->version;
 	if (tdep->set & TDEP_COMM)
 		strcpy(t->comm, tdep->comm);
+	if (tdep->set & TDEP_WINDOW)
+		t->inform_window = tdep->window;
+	if (tdep->set & TDEP_TIMEOUT)
+		t->inform_timeout = tdep->timeout;
+	if (tdep->set & TDEP_RETRIES)
+		t->inform_retries = tdep->retries;
 
 	if (t->comm[0] != '\0')
 		t->status = TRAPSINK_NOT_IN_SERVICE;
@@ -124,6 +183,7 @@ trapsink_create(struct trapsink_dep *tdep)
 	/* look whether we should activate */
 	if (tdep->status == 4) {
 		if (t->status == TRAPSINK_NOT_READY) {
+			fd_deselect(t->fdid);
 			if (t->socket != -1)
 				(void)close(t->socket);
 			free(t);
@@ -139,10 +199,153 @@ trapsink_create(struct trapsink_dep *tdep)
 	return (SNMP_ERR_NOERROR);
 }
 
+static void
+trapbuf_release(struct trapbuf *b)
+{
+	if (--b->refs == 0) {
+		free(b->buf);
+		free(b);
+	}
+}
+
+/*
+ * Remove the first n messages from the queue of a sink.
+ */
+static void
+trapsink_dequeue(struct trapsink *t, u_int n)
+{
+	struct trapmsg *m;
+
+	while (n-- > 0 && (m = STAILQ_FIRST(&t->queue)) != NULL) {
+		STAILQ_REMOVE_HEAD(&t->queue, link);
+		t->qlen--;
+		trapbuf_release(m->body);
+		free(m);
+	}
+}
+
+/*
+ * Retransmission heap. The earliest retransmission is at index 0.
+ */
+static void
+inform_heap_set(u_int i, struct trapmsg *m)
+{
+	inform_heap[i] = m;
+	m->heapidx = i;
+}
+
+static void
+inform_heap_up(u_int i)
+{
+	struct trapmsg *m = inform_heap[i];
+
+	while (i > 0 && inform_heap[(i - 1) / 2]->due > m->due) {
+		inform_heap_set(i, inform_heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	inform_heap_set(i, m);
+}
+
+static void
+inform_heap_down(u_int i)
+{
+	struct trapmsg *m = inform_heap[i];
+	u_int c;
+
+	while ((c = 2 * i + 1) < inform_heap_len) {
+		if (c + 1 < inform_heap_len &&
+		    inform_heap[c + 1]->due < inform_heap[c]->due)
+			c++;
+		if (inform_heap[c]->due >= m->due)
+			break;
+		inform_heap_set(i, inform_heap[c]);
+		i = c;
+	}
+	inform_heap_set(i, m);
+}
+
+static int
+inform_heap_insert(struct trapmsg *m)
+{
+	struct trapmsg **h;
+	u_int size;
+
+	if (inform_heap_len == inform_heap_size) {
+		size = inform_heap_size == 0 ? 64 : 2 * inform_heap_size;
+		if ((h = realloc(inform_heap, size * sizeof(*h))) == NULL) {
+			syslog(LOG_ERR, "inform heap: %m");
+			return (-1);
+		}
+		inform_heap = h;
+		inform_heap_size = size;
+	}
+	inform_heap_set(inform_heap_len++, m);
+	inform_heap_up(m->heapidx);
+	return (0);
+}
+
+static void
+inform_heap_remove(struct trapmsg *m)
+{
+	u_int i = m->heapidx;
+
+	if (i == --inform_heap_len)
+		return;
+	inform_heap_set(i, inform_heap[inform_heap_len]);
+	inform_heap_up(i);
+	inform_heap_down(inform_heap[i]->heapidx);
+}
+
+/*
+ * Set the retransmission timer to the earliest retransmission.
+ */
+static void
+inform_arm(void)
+{
+	uint64_t now;
+
+	if (inform_heap_len == 0) {
+		if (inform_timer != NULL) {
+			timer_stop(inform_timer);
+			inform_timer = NULL;
+		}
+		return;
+	}
+	if (inform_timer != NULL) {
+		if (inform_timer_due == inform_heap[0]->due)
+			return;
+		timer_stop(inform_timer);
+	}
+	inform_timer_due = inform_heap[0]->due;
+	now = get_ticks();
+	inform_timer = timer_start(inform_timer_due > now ?
+	    inform_timer_due - now : 0, inform_timeout, NULL, NULL);
+}
+
+/*
+ * Forget an outstanding INFORM.
+ */
+static void
+inform_free(struct trapmsg *m)
+{
+	struct trapsink *t = m->sink;
+
+	inform_heap_remove(m);
+	STAILQ_REMOVE(&t->pending, m, trapmsg, link);
+	t->npending--;
+	trapbuf_release(m->body);
+	free(m);
+}
+
 static void
 trapsink_free(struct trapsink *t)
 {
 	TAILQ_REMOVE(&trapsink_list, t, link);
+	trapsink_dequeue(t, t->qlen);
+	while (!STAILQ_EMPTY(&t->pending))
+		inform_free(STAILQ_FIRST(&t->pending));
+	inform_arm();
+	fd_deselect(t->fdid);
 	if (t->socket != -1)
 		(void)close(t->socket);
 	free(t);
@@ -154,6 +357,9 @@ trapsink_modify(struct trapsink *t, struct trapsink_dep *tdep)
 	tdep->rb_status = t->status;
 	tdep->rb_version = t->version;
 	strcpy(tdep->rb_comm, t->comm);
+	tdep->rb_window = t->inform_window;
+	tdep->rb_timeout = t->inform_timeout;
+	tdep->rb_retries = t->inform_retries;
 
 	if (tdep->set & TDEP_STATUS) {
 		/* if we are active and should move to not_in_service do
@@ -168,6 +374,14 @@ trapsink_modify(struct trapsink *t, struct trapsink_dep *tdep)
 		t->version = tdep->version;
 	if (tdep->set & TDEP_COMM)
 		strcpy(t->comm, tdep->comm);
+	if (tdep->set & TDEP_WINDOW)
+		t->inform_window = tdep->window;
+	if (tdep->set & TDEP_TIMEOUT)
+		t->inform_timeout = tdep->timeout;
+	if (tdep->set & TDEP_RETRIES)
+		t->inform_retries = tdep->retries;
+	if (tdep->set & ~TDEP_STATUS)
+		tdep->rb |= TDEP_MODIFY;
 
 	if (tdep->set & TDEP_STATUS) {
 		/* if we were inactive and should go active - do this now */
@@ -176,6 +390,9 @@ trapsink_modify(struct trapsink *t, struct trapsink_dep *tdep)
 				t->status = tdep->rb_status;
 				t->version = tdep->rb_version;
 				strcpy(t->comm, tdep->rb_comm);
+				t->inform_window = tdep->rb_window;
+				t->inform_timeout = tdep->rb_timeout;
+				t->inform_retries = tdep->rb_retries;
 				return (SNMP_ERR_INCONS_VALUE);
 			}
 			t->status = TRAPSINK_ACTIVE;
@@ -194,6 +411,12 @@ trapsink_unmodify(struct trapsink *t, struct trapsink_dep *tdep)
 		t->version = tdep->rb_version;
 	if (tdep->set & TDEP_COMM)
 		strcpy(t->comm, tdep->rb_comm);
+	if (tdep->set & TDEP_WINDOW)
+		t->inform_window = tdep->rb_window;
+	if (tdep->set & TDEP_TIMEOUT)
+		t->inform_timeout = tdep->rb_timeout;
+	if (tdep->set & TDEP_RETRIES)
+		t->inform_retries = tdep->rb_retries;
 	
 	return (SNMP_ERR_NOERROR);
 }
@@ -363,11 +586,39 @@ op_trapsink(struct snmp_context *ctx, struct snmp_value *value,
 			if (tdep->set & TDEP_VERSION)
 				return (SNMP_ERR_INCONS_VALUE);
 			if (value->v.integer != TRAPSINK_V1 &&
-			    value->v.integer != TRAPSINK_V2)
+			    value->v.integer != TRAPSINK_V2 &&
+			    value->v.integer != TRAPSINK_INFORM)
 				return (SNMP_ERR_WRONG_VALUE);
 			tdep->version = value->v.integer;
 			tdep->set |= TDEP_VERSION;
 			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotTrapSinkInformWindow:
+			if (tdep->set & TDEP_WINDOW)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (value->v.integer < 1 || value->v.integer > 64)
+				return (SNMP_ERR_WRONG_VALUE);
+			tdep->window = value->v.integer;
+			tdep->set |= TDEP_WINDOW;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotTrapSinkInformTimeout:
+			if (tdep->set & TDEP_TIMEOUT)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (value->v.integer < 1 || value->v.integer > 6000)
+				return (SNMP_ERR_WRONG_VALUE);
+			tdep->timeout = value->v.integer;
+			tdep->set |= TDEP_TIMEOUT;
+			return (SNMP_ERR_NOERROR);
+
+		  case LEAF_begemotTrapSinkInformRetries:
+			if (tdep->set & TDEP_RETRIES)
+				return (SNMP_ERR_INCONS_VALUE);
+			if (value->v.integer < 0 || value->v.integer > 20)
+				return (SNMP_ERR_WRONG_VALUE);
+			tdep->retries = value->v.integer;
+			tdep->set |= TDEP_RETRIES;
+			return (SNMP_ERR_NOERROR);
 		}
 		if (t == NULL)
 			return (SNMP_ERR_INCONS_NAME);
@@ -393,24 +644,515 @@ op_trapsink(struct snmp_context *ctx, struct snmp_value *value,
 		value->v.integer = t->version;
 		break;
 
+	  case LEAF_begemotTrapSinkQueueLen:
+		value->v.uint32 = t->qlen;
+		break;
+
+	  case LEAF_begemotTrapSinkDrops:
+		value->v.uint32 = t->drops;
+		break;
+
+	  case LEAF_begemotTrapSinkInformWindow:
+		value->v.integer = t->inform_window;
+		break;
+
+	  case LEAF_begemotTrapSinkInformTimeout:
+		value->v.integer = t->inform_timeout;
+		break;
+
+	  case LEAF_begemotTrapSinkInformRetries:
+		value->v.integer = t->inform_retries;
+		break;
+
+	  case LEAF_begemotTrapSinkInformAcked:
+		value->v.uint32 = t->inform_acked;
+		break;
+
+	  case LEAF_begemotTrapSinkInformRetried:
+		value->v.uint32 = t->inform_retried;
+		break;
+
+	  case LEAF_begemotTrapSinkInformDropped:
+		value->v.uint32 = t->inform_dropped;
+		break;
 	}
 	return (SNMP_ERR_NOERROR);
 }
 
-void
-snmp_send_trap(const struct asn_oid *trap_oid, ...)
+/*
+ * Build the iovec for a queued message: the private header followed by
+ * the shared part of the body. Return the number of elements used.
+ */
+static int
+trapmsg_iov(struct trapmsg *m, struct iovec *iov, size_t *len)
+{
+	int n = 0;
+
+	if (m->hdrlen != 0) {
+		iov[n].iov_base = m->hdr;
+		iov[n].iov_len = m->hdrlen;
+		n++;
+	}
+	iov[n].iov_base = m->body->buf + m->off;
+	iov[n].iov_len = m->body->len - m->off;
+	*len = m->hdrlen + iov[n].iov_len;
+	return (n + 1);
+}
+
+/*
+ * Take the first n messages off the queue of a sink after they have been
+ * sent. INFORMs are kept until they are acknowledged or time out.
+ */
+static void
+trapsink_sent(struct trapsink *t, u_int n)
+{
+	struct trapmsg *m;
+	uint64_t now;
+
+	now = get_ticks();
+	while (n-- > 0 && (m = STAILQ_FIRST(&t->queue)) != NULL) {
+		if (!m->inform) {
+			trapsink_dequeue(t, 1);
+			continue;
+		}
+		STAILQ_REMOVE_HEAD(&t->queue, link);
+		t->qlen--;
+		m->sink = t;
+		m->retries = 0;
+		m->due = now + t->inform_timeout;
+		if (inform_heap_insert(m) == -1) {
+			t->inform_dropped++;
+			trapbuf_release(m->body);
+			free(m);
+			continue;
+		}
+		STAILQ_INSERT_TAIL(&t->pending, m, link);
+		t->npending++;
+	}
+	inform_arm();
+}
+
+/*
+ * Number of messages that may be sent to a sink now. For INFORM sinks
+ * this is limited by the outstanding window.
+ */
+static u_int
+trapsink_room(const struct trapsink *t)
+{
+	u_int room = TRAP_BATCH;
+
+	if (t->version == TRAPSINK_INFORM) {
+		if (t->npending >= t->inform_window)
+			return (0);
+		if (room > t->inform_window - t->npending)
+			room = t->inform_window - t->npending;
+	}
+	if (room > t->qlen)
+		room = t->qlen;
+	return (room);
+}
+
+/*
+ * Send up to TRAP_BATCH queued messages to a sink. Return the number of
+ * messages sent or dropped because of an error. Return -1 if the socket
+ * cannot take more messages now.
+ */
+static int
+trapsink_send(struct trapsink *t)
+{
+	struct trapmsg *m;
+	struct iovec iov[2 * TRAP_BATCH];
+	size_t len[TRAP_BATCH];
+	u_int room;
+	int n;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[TRAP_BATCH];
+	int cnt;
+
+	if ((room = trapsink_room(t)) == 0)
+		return (0);
+	n = 0;
+	STAILQ_FOREACH(m, &t->queue, link) {
+		if (n == (int)room)
+			break;
+		memset(&msgs[n], 0, sizeof(msgs[n]));
+		msgs[n].msg_hdr.msg_iov = &iov[2 * n];
+		msgs[n].msg_hdr.msg_iovlen = trapmsg_iov(m, &iov[2 * n],
+		    &len[n]);
+		n++;
+	}
+	if ((cnt = sendmmsg(t->socket, msgs, n, 0)) >= 0) {
+		for (n = 0; n < cnt; n++)
+			if (msgs[n].msg_len != len[n])
+				syslog(LOG_ERR, "send: short write %zu/%zu",
+				    len[n], (size_t)msgs[n].msg_len);
+		trapsink_sent(t, cnt);
+		return (cnt);
+	}
+#else
+	struct msghdr msg;
+	ssize_t sent;
+
+	if ((room = trapsink_room(t)) == 0)
+		return (0);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	for (n = 0; n < (int)room &&
+	    (m = STAILQ_FIRST(&t->queue)) != NULL; n++) {
+		msg.msg_iovlen = trapmsg_iov(m, iov, &len[0]);
+		if ((sent = sendmsg(t->socket, &msg, 0)) == -1)
+			break;
+		if ((size_t)sent != len[0])
+			syslog(LOG_ERR, "send: short write %zu/%zu",
+			    len[0], (size_t)sent);
+		trapsink_sent(t, 1);
+	}
+	if (n != 0)
+		return (n);
+#endif
+	if (errno == EAGAIN || errno == ENOBUFS)
+		return (-1);
+
+	/* don't retry a trap that the socket refused, INFORMs time out */
+	syslog(LOG_ERR, "send: %m");
+	trapsink_sent(t, 1);
+	return (1);
+}
+
+/*
+ * Send queued traps from the event loop. Each sink gets at most TRAP_BATCH
+ * messages per call so that request processing can go on between batches.
+ */
+static void
+trap_drain(void *arg __unused)
 {
-	struct snmp_pdu pdu;
 	struct trapsink *t;
-	const struct snmp_value *v;
-	va_list ap;
-	u_char *sndbuf;
-	size_t sndlen;
+	int more, blocked;
+
+	trap_timer = NULL;
+	more = blocked = 0;
+
+	TAILQ_FOREACH(t, &trapsink_list, link) {
+		if (t->qlen == 0)
+			continue;
+		if (trapsink_send(t) == -1)
+			blocked = 1;
+		else if (trapsink_room(t) != 0)
+			more = 1;
+	}
+
+	/* if only full sockets are left wait a tick before retrying */
+	if (more)
+		trap_timer = timer_start(0, trap_drain, NULL, NULL);
+	else if (blocked)
+		trap_timer = timer_start(1, trap_drain, NULL, NULL);
+}
+
+/*
+ * Append a message to the queue of a sink. The message consists of the
+ * given header (may be empty) and the body starting at off. The message
+ * takes a reference to the body.
+ */
+static void
+trapsink_enqueue(struct trapsink *t, struct trapbuf *body, size_t off,
+    const u_char *hdr, size_t hdrlen, int32_t reqid)
+{
+	struct trapmsg *m;
+
+	if (t->qlen >= snmpd.trap_queue) {
+		t->drops++;
+		return;
+	}
+	if ((m = malloc(sizeof(*m))) == NULL) {
+		syslog(LOG_ERR, "trap queue: %m");
+		t->drops++;
+		return;
+	}
+	m->body = body;
+	m->off = off;
+	m->hdrlen = hdrlen;
+	if (hdrlen != 0)
+		memcpy(m->hdr, hdr, hdrlen);
+	m->inform = (t->version == TRAPSINK_INFORM);
+	m->reqid = reqid;
+	body->refs++;
+	STAILQ_INSERT_TAIL(&t->queue, m, link);
+	t->qlen++;
+
+	if (trap_timer == NULL)
+		trap_timer = timer_start(0, trap_drain, NULL, NULL);
+}
+
+/*
+ * Retransmit INFORMs whose timeout expired. Drop those that have been
+ * retransmitted often enough.
+ */
+static void
+inform_timeout(void *arg __unused)
+{
+	struct trapmsg *m;
+	struct trapsink *t;
+	struct msghdr msg;
+	struct iovec iov[2];
+	size_t len;
+	uint64_t now;
+	int drain = 0;
+
+	inform_timer = NULL;
+	now = get_ticks();
+
+	while (inform_heap_len > 0 && (m = inform_heap[0])->due <= now) {
+		t = m->sink;
+		if (m->retries >= t->inform_retries) {
+			t->inform_dropped++;
+			inform_free(m);
+			drain |= (t->qlen != 0);
+			continue;
+		}
+		m->retries++;
+		t->inform_retried++;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = trapmsg_iov(m, iov, &len);
+		(void)sendmsg(t->socket, &msg, 0);
+
+		m->due = now + t->inform_timeout;
+		inform_heap_down(0);
+	}
+	inform_arm();
+
+	if (drain && trap_timer == NULL)
+		trap_timer = timer_start(0, trap_drain, NULL, NULL);
+}
+
+/*
+ * Input on a trap sink socket. Match responses against the outstanding
+ * INFORMs of the sink.
+ */
+static void
+inform_input(int fd, void *udata)
+{
+	struct trapsink *t = udata;
+	struct trapmsg *m;
+	struct snmp_pdu pdu;
+	struct asn_buf b;
+	u_char *buf;
 	ssize_t len;
+	int32_t ip;
+	int acked = 0;
+
+	if ((buf = buf_alloc(0)) == NULL) {
+		(void)recv(fd, &ip, sizeof(ip), MSG_DONTWAIT);
+		return;
+	}
+	while ((len = recv(fd, buf, buf_size(0), MSG_DONTWAIT)) != -1) {
+		if (t->npending == 0)
+			continue;
+		b.asn_cptr = buf;
+		b.asn_len = len;
+		memset(&pdu, 0, sizeof(pdu));
+		if (snmp_pdu_decode(&b, &pdu, &ip) != SNMP_CODE_OK)
+			continue;
+		if (pdu.type == SNMP_PDU_RESPONSE &&
+		    reqid_istype(pdu.request_id, inform_reqid)) {
+			STAILQ_FOREACH(m, &t->pending, link)
+				if (m->reqid == pdu.request_id)
+					break;
+			if (m != NULL) {
+				t->inform_acked++;
+				inform_free(m);
+				acked = 1;
+			}
+		}
+		snmp_pdu_free(&pdu);
+	}
+	free(buf);
+
+	if (acked) {
+		inform_arm();
+		if (t->qlen != 0 && trap_timer == NULL)
+			trap_timer = timer_start(0, trap_drain, NULL, NULL);
+	}
+}
+
+/*
+ * Skip one TLV in an encoded message.
+ */
+static int
+trap_skip(struct asn_buf *b)
+{
+	u_char type;
+	asn_len_t len;
+
+	if (asn_get_header(b, &type, &len) != ASN_ERR_OK || b->asn_len < len)
+		return (-1);
+	b->asn_ptr += len;
+	b->asn_len -= len;
+	return (0);
+}
+
+/*
+ * Find the version and community and the part behind the request id
+ * in an encoded TRAP2 or INFORM.
+ */
+static int
+trap_split(const struct trapbuf *body, size_t *vcoff, size_t *vclen,
+    size_t *tailoff)
+{
+	struct asn_buf b;
+	asn_len_t len;
+	u_char type;
+
+	b.asn_cptr = body->buf;
+	b.asn_len = body->len;
+
+	if (asn_get_sequence(&b, &len) != ASN_ERR_OK)
+		return (-1);
+	*vcoff = b.asn_cptr - body->buf;
+	if (trap_skip(&b) == -1 || trap_skip(&b) == -1)
+		return (-1);
+	*vclen = (b.asn_cptr - body->buf) - *vcoff;
+	if (asn_get_header(&b, &type, &len) != ASN_ERR_OK ||
+	    trap_skip(&b) == -1)
+		return (-1);
+	*tailoff = b.asn_cptr - body->buf;
+	return (0);
+}
+
+/*
+ * Build the headers of a TRAP2 or INFORM up to and including the request
+ * id for a body whose request id part has been split off.
+ */
+static size_t
+trap_header(u_char *hdr, const struct trapbuf *body, size_t vcoff,
+    size_t vclen, size_t tailoff, u_int type, int32_t reqid)
+{
+	struct asn_buf b;
+	u_char pdu[16];
+	size_t pdulen, idlen, taillen;
+
+	taillen = body->len - tailoff;
+
+	/* request id followed by the PDU header in front of it */
+	b.asn_ptr = pdu + 8;
+	b.asn_len = sizeof(pdu) - 8;
+	if (asn_put_integer(&b, reqid) != ASN_ERR_OK)
+		abort();
+	idlen = b.asn_ptr - (pdu + 8);
+
+	b.asn_ptr = pdu;
+	b.asn_len = 8;
+	if (asn_put_header(&b, ASN_TYPE_CONSTRUCTED | ASN_CLASS_CONTEXT |
+	    type, idlen + taillen) != ASN_ERR_OK)
+		abort();
+	pdulen = b.asn_ptr - pdu;
+
+	b.asn_ptr = hdr;
+	b.asn_len = TRAP_HDRLEN;
+	if (asn_put_header(&b, ASN_TYPE_SEQUENCE | ASN_TYPE_CONSTRUCTED,
+	    vclen + pdulen + idlen + taillen) != ASN_ERR_OK ||
+	    b.asn_len < vclen + pdulen + idlen)
+		abort();
+	memcpy(b.asn_ptr, body->buf + vcoff, vclen);
+	b.asn_ptr += vclen;
+	memcpy(b.asn_ptr, pdu, pdulen);
+	b.asn_ptr += pdulen;
+	memcpy(b.asn_ptr, pdu + 8, idlen);
+	b.asn_ptr += idlen;
+
+	return (b.asn_ptr - hdr);
+}
+
+/*
+ * Encode a trap for one (version, community) group of sinks and queue it
+ * to all active sinks of that group. V1 sinks get identical messages.
+ * TRAP2 and INFORM messages differ only in the request id: the first
+ * sink gets the encoded message, all others get a freshly built header
+ * up to the request id and share the rest.
+ */
+static void
+trap_fanout(struct trapsink *first, struct snmp_pdu *pdu)
+{
+	struct trapsink *t;
+	struct trapbuf *body;
+	size_t vcoff, vclen, tailoff, hdrlen;
+	u_char hdr[TRAP_HDRLEN];
+	int split;
+
+	if ((body = malloc(sizeof(*body))) == NULL) {
+		syslog(LOG_ERR, "trap send buffer: %m");
+		return;
+	}
+	if ((body->buf = buf_alloc(1)) == NULL) {
+		syslog(LOG_ERR, "trap send buffer: %m");
+		free(body);
+		return;
+	}
+	body->refs = 1;
+
+	snmp_output(pdu, body->buf, &body->len, "TRAP");
+	trapsink_enqueue(first, body, 0, NULL, 0, pdu->request_id);
+
+	split = -1;
+	for (t = TAILQ_NEXT(first, link); t != NULL;
+	    t = TAILQ_NEXT(t, link)) {
+		if (t->status != TRAPSINK_ACTIVE ||
+		    t->version != first->version ||
+		    strcmp(t->comm, first->comm) != 0)
+			continue;
+
+		if (pdu->version == SNMP_V1) {
+			trapsink_enqueue(t, body, 0, NULL, 0, 0);
+			continue;
+		}
+		if (split == -1 && (split = trap_split(body, &vcoff, &vclen,
+		    &tailoff)) == -1) {
+			syslog(LOG_ERR, "cannot split trap encoding");
+			break;
+		}
+		pdu->request_id = reqid_next(pdu->type == SNMP_PDU_INFORM ?
+		    inform_reqid : trap_reqid);
+		hdrlen = trap_header(hdr, body, vcoff, vclen, tailoff,
+		    pdu->type, pdu->request_id);
+		if (debug.dump_pdus) {
+			snmp_printf("TRAP <- ");
+			snmp_pdu_dump(pdu);
+		}
+		trapsink_enqueue(t, body, tailoff, hdr, hdrlen,
+		    pdu->request_id);
+	}
+	trapbuf_release(body);
+}
+
+/*
+ * Send a trap with the given bindings to all active sinks.
+ */
+static void
+trap_send(const struct asn_oid *trap_oid, const struct snmp_value **vars,
+    u_int nvars)
+{
+	struct snmp_pdu pdu;
+	struct trapsink *t, *t1;
+	u_int i;
+	uint32_t ticks;
+
+	ticks = get_ticks() - start_tick;
 
 	TAILQ_FOREACH(t, &trapsink_list, link) {
 		if (t->status != TRAPSINK_ACTIVE)
 			continue;
+
+		/* the first active sink of each group encodes */
+		for (t1 = TAILQ_FIRST(&trapsink_list); t1 != t;
+		    t1 = TAILQ_NEXT(t1, link))
+			if (t1->status == TRAPSINK_ACTIVE &&
+			    t1->version == t->version &&
+			    strcmp(t1->comm, t->comm) == 0)
+				break;
+		if (t1 != t)
+			continue;
+
 		memset(&pdu, 0, sizeof(pdu));
 		strcpy(pdu.community, t->comm);
 		if (t->version == TRAPSINK_V1) {
@@ -420,20 +1162,26 @@ snmp_send_trap(const struct asn_oid *trap_oid, ...)
 			memcpy(pdu.agent_addr, snmpd.trap1addr, 4);
 			pdu.generic_trap = trap_oid->subs[trap_oid->len - 1] - 1;
 			pdu.specific_trap = 0;
-			pdu.time_stamp = get_ticks() - start_tick;
+			pdu.time_stamp = ticks;
 
 			pdu.nbindings = 0;
+		} else if (t->version == TRAPSINK_INFORM) {
+			pdu.version = SNMP_V2c;
+			pdu.type = SNMP_PDU_INFORM;
+			pdu.request_id = reqid_next(inform_reqid);
 		} else {
 			pdu.version = SNMP_V2c;
 			pdu.type = SNMP_PDU_TRAP2;
 			pdu.request_id = reqid_next(trap_reqid);
+		}
+		if (pdu.version == SNMP_V2c) {
 			pdu.error_index = 0;
 			pdu.error_status = SNMP_ERR_NOERROR;
 
 			pdu.bindings[0].var = oid_sysUpTime;
 			pdu.bindings[0].var.subs[pdu.bindings[0].var.len++] = 0;
 			pdu.bindings[0].syntax = SNMP_SYNTAX_TIMETICKS;
-			pdu.bindings[0].v.uint32 = get_ticks() - start_tick;
+			pdu.bindings[0].v.uint32 = ticks;
 
 			pdu.bindings[1].var = oid_snmpTrapOID;
 			pdu.bindings[1].var.subs[pdu.bindings[1].var.len++] = 0;
@@ -443,24 +1191,387 @@ snmp_send_trap(const struct asn_oid *trap_oid, ...)
 			pdu.nbindings = 2;
 		}
 
-		va_start(ap, trap_oid);
-		while ((v = va_arg(ap, const struct snmp_value *)) != NULL)
-			pdu.bindings[pdu.nbindings++] = *v;
-		va_end(ap);
+		for (i = 0; i < nvars; i++)
+			pdu.bindings[pdu.nbindings++] = *vars[i];
 
-		if ((sndbuf = buf_alloc(1)) == NULL) {
-			syslog(LOG_ERR, "trap send buffer: %m");
-			return;
+		trap_fanout(t, &pdu);
+	}
+}
+
+/*
+ * Notification damping.
+ *
+ * Each (trap OID, first binding name) pair has a penalty. Every trap adds
+ * TRAPDAMP_PENALTY, and the penalty halves every halflife seconds. When
+ * it reaches the suppress limit, further traps for the pair are only
+ * counted. Once it has decayed below the reuse limit, the last suppressed
+ * trap is sent with an additional begemotTrapDampCount binding that
+ * carries the number of traps it stands for.
+ */
+#define	TRAPDAMP_PENALTY	1000
+#define	TRAPDAMP_MAX		4096
+#define	TRAPDAMP_HASH		256
+
+struct trapdamp {
+	TAILQ_ENTRY(trapdamp) link;	/* ordered by index */
+	LIST_ENTRY(trapdamp) hlink;	/* hash chain */
+	u_int32_t	index;
+	struct asn_oid	trap;
+	struct asn_oid	key;
+	u_int		penalty;
+	uint64_t	last;		/* ticks of the last penalty update */
+	int		suppressed;
+	u_int32_t	count;		/* traps suppressed since last send */
+	u_int32_t	events;		/* all traps */
+	struct snmp_value *saved;
+	u_int		nsaved;		/* bindings of last suppressed trap */
+};
+static TAILQ_HEAD(, trapdamp) trapdamp_list =
+    TAILQ_HEAD_INITIALIZER(trapdamp_list);
+static LIST_HEAD(, trapdamp) trapdamp_hash[TRAPDAMP_HASH];
+static u_int trapdamp_cnt;
+static u_int32_t trapdamp_next = 1;
+static void *trapdamp_timer;
+
+static struct {
+	u_int	halflife;	/* seconds, 0 - off */
+	u_int	suppress;
+	u_int	reuse;
+	u_int	ceiling;
+} trapdamp_cfg = { 0, 2000, 750, 12000 };
+
+static const struct asn_oid oid_begemotTrapDampCount =
+    OIDX_begemotTrapDampCount;
+
+static u_int
+trapdamp_hashval(const struct asn_oid *trap, const struct asn_oid *key)
+{
+	u_int h = 0, i;
+
+	for (i = 0; i < trap->len; i++)
+		h = h * 31 + trap->subs[i];
+	for (i = 0; i < key->len; i++)
+		h = h * 31 + key->subs[i];
+	return (h % TRAPDAMP_HASH);
+}
+
+/*
+ * Bring the penalty up to date. Between two halvings the decay is
+ * approximated linearly.
+ */
+static void
+trapdamp_decay(struct trapdamp *d, uint64_t now)
+{
+	uint64_t hl, dt;
+
+	if (now <= d->last)
+		return;
+	hl = (uint64_t)trapdamp_cfg.halflife * 100;
+	dt = now - d->last;
+	if (dt / hl >= 32)
+		d->penalty = 0;
+	else {
+		d->penalty >>= dt / hl;
+		d->penalty -= (uint64_t)d->penalty * (dt % hl) / (2 * hl);
+	}
+	d->last = now;
+}
+
+static void
+trapdamp_unsave(struct trapdamp *d)
+{
+	while (d->nsaved > 0)
+		snmp_value_free(&d->saved[--d->nsaved]);
+	free(d->saved);
+	d->saved = NULL;
+}
+
+/*
+ * Send the summary of a suppressed trap.
+ */
+static void
+trapdamp_release(struct trapdamp *d)
+{
+	const struct snmp_value *vars[SNMP_MAX_BINDINGS];
+	struct snmp_value cnt;
+	u_int i;
+
+	d->suppressed = 0;
+	if (d->count == 0)
+		return;
+
+	for (i = 0; i < d->nsaved; i++)
+		vars[i] = &d->saved[i];
+	cnt.var = oid_begemotTrapDampCount;
+	cnt.var.subs[cnt.var.len++] = d->index;
+	cnt.syntax = SNMP_SYNTAX_COUNTER;
+	cnt.v.uint32 = d->count;
+	vars[i++] = &cnt;
+
+	trap_send(&d->trap, vars, i);
+
+	d->count = 0;
+	trapdamp_unsave(d);
+}
+
+static void
+trapdamp_free(struct trapdamp *d)
+{
+	TAILQ_REMOVE(&trapdamp_list, d, link);
+	LIST_REMOVE(d, hlink);
+	trapdamp_cnt--;
+	trapdamp_unsave(d);
+	free(d);
+}
+
+/*
+ * Once a second: release entries whose penalty has decayed and forget
+ * those that are quiet.
+ */
+static void
+trapdamp_tick(void *arg __unused)
+{
+	struct trapdamp *d, *d1;
+	uint64_t now;
+
+	now = get_ticks();
+	for (d = TAILQ_FIRST(&trapdamp_list); d != NULL; d = d1) {
+		d1 = TAILQ_NEXT(d, link);
+		trapdamp_decay(d, now);
+		if (d->suppressed) {
+			if (d->penalty < trapdamp_cfg.reuse)
+				trapdamp_release(d);
+		} else if (d->penalty < trapdamp_cfg.reuse / 2)
+			trapdamp_free(d);
+	}
+	if (trapdamp_cnt == 0) {
+		timer_stop(trapdamp_timer);
+		trapdamp_timer = NULL;
+	}
+}
+
+/*
+ * Send all pending summaries and drop the damping state.
+ */
+static void
+trapdamp_flush(void)
+{
+	struct trapdamp *d;
+
+	while ((d = TAILQ_FIRST(&trapdamp_list)) != NULL) {
+		if (d->suppressed)
+			trapdamp_release(d);
+		trapdamp_free(d);
+	}
+	if (trapdamp_timer != NULL) {
+		timer_stop(trapdamp_timer);
+		trapdamp_timer = NULL;
+	}
+}
+
+/*
+ * Account a trap. Return true if it is to be suppressed.
+ */
+static int
+trapdamp_event(const struct asn_oid *trap_oid,
+    const struct snmp_value **vars, u_int nvars)
+{
+	static const struct asn_oid nokey;
+	const struct asn_oid *key;
+	struct trapdamp *d;
+	uint64_t now;
+	u_int h, i;
+
+	key = (nvars > 0) ? &vars[0]->var : &nokey;
+	h = trapdamp_hashval(trap_oid, key);
+	now = get_ticks();
+
+	LIST_FOREACH(d, &trapdamp_hash[h], hlink)
+		if (asn_compare_oid(&d->trap, trap_oid) == 0 &&
+		    asn_compare_oid(&d->key, key) == 0)
+			break;
+
+	if (d == NULL) {
+		if (trapdamp_cnt >= TRAPDAMP_MAX ||
+		    (d = malloc(sizeof(*d))) == NULL)
+			return (0);
+		memset(d, 0, sizeof(*d));
+		d->index = trapdamp_next++;
+		d->trap = *trap_oid;
+		d->key = *key;
+		d->last = now;
+		TAILQ_INSERT_TAIL(&trapdamp_list, d, link);
+		LIST_INSERT_HEAD(&trapdamp_hash[h], d, hlink);
+		trapdamp_cnt++;
+		if (trapdamp_timer == NULL)
+			trapdamp_timer = timer_start_repeat(100, 100,
+			    trapdamp_tick, NULL, NULL);
+	}
+
+	trapdamp_decay(d, now);
+	d->penalty += TRAPDAMP_PENALTY;
+	if (d->penalty > trapdamp_cfg.ceiling)
+		d->penalty = trapdamp_cfg.ceiling;
+	d->events++;
+
+	if (!d->suppressed && d->penalty < trapdamp_cfg.suppress)
+		return (0);
+
+	/* keep the last suppressed trap for the summary */
+	d->suppressed = 1;
+	d->count++;
+	trapdamp_unsave(d);
+	if (nvars > SNMP_MAX_BINDINGS - 1)
+		nvars = SNMP_MAX_BINDINGS - 1;
+	if (nvars > 0 &&
+	    (d->saved = malloc(nvars * sizeof(d->saved[0]))) != NULL)
+		for (i = 0; i < nvars; i++) {
+			if (snmp_value_copy(&d->saved[i], vars[i]) != 0)
+				break;
+			d->nsaved++;
 		}
+	return (1);
+}
+
+void
+snmp_send_trap(const struct asn_oid *trap_oid, ...)
+{
+	const struct snmp_value *v;
+	const struct snmp_value *vars[SNMP_MAX_BINDINGS];
+	u_int nvars;
+	va_list ap;
 
-		snmp_output(&pdu, sndbuf, &sndlen, "TRAP");
+	nvars = 0;
+	va_start(ap, trap_oid);
+	while ((v = va_arg(ap, const struct snmp_value *)) != NULL)
+		vars[nvars++] = v;
+	va_end(ap);
 
-		if ((len = send(t->socket, sndbuf, sndlen, 0)) == -1)
-			syslog(LOG_ERR, "send: %m");
-		else if ((size_t)len != sndlen)
-			syslog(LOG_ERR, "send: short write %zu/%zu",
-			    sndlen, (size_t)len);
+	if (trapdamp_cfg.halflife != 0 &&
+	    trapdamp_event(trap_oid, vars, nvars))
+		return;
+
+	trap_send(trap_oid, vars, nvars);
+}
+
+int
+op_trapdamp(struct snmp_context *ctx, struct snmp_value *value,
+    u_int sub, u_int iidx __unused, enum snmp_op op)
+{
+	asn_subid_t which = value->var.subs[sub - 1];
+	u_int *p;
+
+	switch (which) {
 
-		free(sndbuf);
+	  case LEAF_begemotTrapDampHalfLife:
+		p = &trapdamp_cfg.halflife;
+		break;
+	  case LEAF_begemotTrapDampSuppressLimit:
+		p = &trapdamp_cfg.suppress;
+		break;
+	  case LEAF_begemotTrapDampReuseLimit:
+		p = &trapdamp_cfg.reuse;
+		break;
+	  case LEAF_begemotTrapDampCeiling:
+		p = &trapdamp_cfg.ceiling;
+		break;
+	  default:
+		abort();
 	}
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		abort();
+
+	  case SNMP_OP_GET:
+		value->v.integer = *p;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_SET:
+		ctx->scratch->int1 = *p;
+		if (which == LEAF_begemotTrapDampHalfLife) {
+			if (value->v.integer < 0 || value->v.integer > 3600)
+				return (SNMP_ERR_WRONG_VALUE);
+		} else if (value->v.integer < 1 || value->v.integer > 1000000)
+			return (SNMP_ERR_WRONG_VALUE);
+		*p = value->v.integer;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_ROLLBACK:
+		*p = ctx->scratch->int1;
+		return (SNMP_ERR_NOERROR);
+
+	  case SNMP_OP_COMMIT:
+		/* penalties were computed with the old half-life */
+		if (which == LEAF_begemotTrapDampHalfLife &&
+		    (u_int)ctx->scratch->int1 != *p)
+			trapdamp_flush();
+		return (SNMP_ERR_NOERROR);
+	}
+	abort();
+}
+
+int
+op_trapdamp_table(struct snmp_context *ctx __unused, struct snmp_value *value,
+    u_int sub, u_int iidx __unused, enum snmp_op op)
+{
+	struct trapdamp *d;
+
+	switch (op) {
+
+	  case SNMP_OP_GETNEXT:
+		if ((d = NEXT_OBJECT_INT(&trapdamp_list, &value->var, sub))
+		    == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		value->var.len = sub + 1;
+		value->var.subs[sub] = d->index;
+		break;
+
+	  case SNMP_OP_GET:
+		if ((d = FIND_OBJECT_INT(&trapdamp_list, &value->var, sub))
+		    == NULL)
+			return (SNMP_ERR_NOSUCHNAME);
+		break;
+
+	  case SNMP_OP_SET:
+		if ((d = FIND_OBJECT_INT(&trapdamp_list, &value->var, sub))
+		    == NULL)
+			return (SNMP_ERR_NO_CREATION);
+		return (SNMP_ERR_NOT_WRITEABLE);
+
+	  case SNMP_OP_ROLLBACK:
+	  case SNMP_OP_COMMIT:
+	  default:
+		abort();
+	}
+
+	switch (value->var.subs[sub - 1]) {
+
+	  case LEAF_begemotTrapDampTrap:
+		value->v.oid = d->trap;
+		break;
+
+	  case LEAF_begemotTrapDampKey:
+		value->v.oid = d->key;
+		break;
+
+	  case LEAF_begemotTrapDampPenalty:
+		trapdamp_decay(d, get_ticks());
+		value->v.uint32 = d->penalty;
+		break;
+
+	  case LEAF_begemotTrapDampState:
+		value->v.integer = d->suppressed ? 2 : 1;
+		break;
+
+	  case LEAF_begemotTrapDampCount:
+		value->v.uint32 = d->count;
+		break;
+
+	  case LEAF_begemotTrapDampEvents:
+		value->v.uint32 = d->events;
+		break;
+	}
+	return (SNMP_ERR_NOERROR);
 }
@@ -510,6 +510,7 @@ parse_server(struct snmp_client *client, char opt, char *opt_arg)
 		return (-1);
 
 	if (client->trans > SNMP_TRANS_UDP &&
+		client->trans != SNMP_TRANS_TCP &&
 		client->chost == NULL) {
 		if ((client->chost = snmp_malloc(strlen(SNMP_DEFAULT_LOCAL + 1))) == NULL) {
 			return (-1);